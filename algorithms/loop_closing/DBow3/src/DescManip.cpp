@@ -76,8 +76,8 @@ void DescManip::meanValue(const std::vector<cv::Mat> &descriptors,
     else{
         assert(descriptors[0].type()==CV_32F );//ensure it is float
 
-        mean.create(1, descriptors[0].cols,descriptors[0].type());
-        mean.setTo(cv::Scalar::all(0));
+        // new buffer, mean may share its data with one of the descriptors
+        mean = cv::Mat::zeros(1, descriptors[0].cols,descriptors[0].type());
         float inv_s =1./double( descriptors.size());
         for(size_t i=0;i<descriptors.size();i++)
             mean +=  descriptors[i] * inv_s;
@@ -0,0 +1,91 @@
+/**
+ * File: FeatureExtractor.h
+ * Description: ORB extraction with reusable detectors
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_FEATURE_EXTRACTOR__
+#define __D_T_FEATURE_EXTRACTOR__
+
+#include <mutex>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+#include "../src/exports.h"
+
+namespace DBoW3 {
+
+/**
+ * Extracts ORB keypoints and descriptors with detectors configured once.
+ * Detectors are kept in a pool and each thread extracting borrows one, so
+ * an extractor can be shared by threads and none is built per image.
+ */
+class DBOW_API FeatureExtractor
+{
+public:
+
+  /**
+   * Parameters of the ORB detectors, the defaults are those of
+   * cv::ORB::create
+   */
+  FeatureExtractor(int nfeatures = 500, float scale_factor = 1.2f,
+    int nlevels = 8, int edge_threshold = 31, int first_level = 0,
+    int wta_k = 2, int score_type = cv::ORB::HARRIS_SCORE,
+    int patch_size = 31, int fast_threshold = 20);
+
+  /**
+   * Extracts the features of an image
+   * @param image
+   * @param keypoints
+   * @param descriptors
+   * @param mask optional mask of the region to search
+   */
+  void extract(const cv::Mat &image, std::vector<cv::KeyPoint> &keypoints,
+    cv::Mat &descriptors, const cv::Mat &mask = cv::Mat()) const;
+
+  /**
+   * Extracts the features of several images in parallel
+   * @param images
+   * @param keypoints keypoints of each image
+   * @param descriptors descriptors of each image
+   */
+  void extract(const std::vector<cv::Mat> &images,
+    std::vector<std::vector<cv::KeyPoint> > &keypoints,
+    std::vector<cv::Mat> &descriptors) const;
+
+  /// Number of detectors built so far, at most the number of threads
+  /// that extracted at the same time
+  size_t detectors() const;
+
+protected:
+
+  /// Takes a detector from the pool, or builds one if all are in use
+  cv::Ptr<cv::ORB> acquire() const;
+
+  /// Gives a detector back to the pool
+  void release(const cv::Ptr<cv::ORB> &orb) const;
+
+  class ExtractRange;
+
+protected:
+
+  int m_nfeatures;
+  float m_scale_factor;
+  int m_nlevels;
+  int m_edge_threshold;
+  int m_first_level;
+  int m_wta_k;
+  int m_score_type;
+  int m_patch_size;
+  int m_fast_threshold;
+
+  mutable std::mutex m_mutex;
+  /// Detectors not in use
+  mutable std::vector<cv::Ptr<cv::ORB> > m_pool;
+  mutable size_t m_created;
+};
+
+} // namespace DBoW3
+
+#endif
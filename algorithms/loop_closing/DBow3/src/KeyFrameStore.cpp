@@ -0,0 +1,374 @@
+/**
+ * File: KeyFrameStore.cpp
+ * Description: append-only file of the keyframes of a database
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <cstring>
+#include <iostream>
+#include "../src/KeyFrameStore.h"
+#include "../src/Vocabulary.h"
+#include "../src/MappedFile.h"
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace DBoW3 {
+
+// --------------------------------------------------------------------------
+// File layout: a StoreHeader, then one RecordHeader and its payload per
+// entry. The payload holds, each section padded to 8 bytes:
+//   n_words StoredWord, n_nodes StoredNode followed by the n_node_features
+//   feature indexes of the nodes, n_keypoints StoredKeyPoint, and the
+//   descriptor rows
+
+static const char kStoreMagic[8] = {'D','B','O','W','3','K','F','S'};
+static const uint32_t kStoreVersion = 1;
+static const uint32_t kRecordMagic = 0x3152464b; // "KFR1"
+
+struct StoreHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t voc_signature;
+  uint32_t voc_words;
+  uint32_t reserved[9];
+};
+
+struct RecordHeader
+{
+  uint32_t magic;
+  uint32_t entry_id;
+  uint64_t payload_size;
+  uint64_t checksum;
+  uint32_t n_words;
+  uint32_t n_nodes;
+  uint32_t n_node_features;
+  uint32_t n_keypoints;
+  int32_t desc_rows;
+  int32_t desc_cols;
+  int32_t desc_type;
+  uint32_t reserved;
+};
+
+struct StoredWord
+{
+  uint32_t id;
+  uint32_t reserved;
+  double value;
+};
+
+struct StoredNode
+{
+  uint32_t id;
+  uint32_t n_features;
+};
+
+struct StoredKeyPoint
+{
+  float x, y, size, angle, response;
+  int32_t octave, class_id;
+  uint32_t reserved;
+};
+
+static inline uint64_t pad8(uint64_t bytes)
+{
+  return (bytes + 7) / 8 * 8;
+}
+
+/// Payload bytes of a record, 0 if the descriptor sizes are invalid
+static uint64_t payloadSize(const RecordHeader &h)
+{
+  if(h.desc_rows < 0 || h.desc_cols < 0 || h.desc_type < 0) return 0;
+  const uint64_t desc_bytes = (uint64_t)h.desc_rows * (uint64_t)h.desc_cols *
+    CV_ELEM_SIZE(h.desc_type);
+  return (uint64_t)h.n_words * sizeof(StoredWord) +
+    (uint64_t)h.n_nodes * sizeof(StoredNode) +
+    pad8((uint64_t)h.n_node_features * sizeof(uint32_t)) +
+    (uint64_t)h.n_keypoints * sizeof(StoredKeyPoint) +
+    pad8(desc_bytes);
+}
+
+/// Cuts the file after its last valid record
+static bool truncateFile(const std::string &filename, uint64_t size)
+{
+#ifndef _WIN32
+  return truncate(filename.c_str(), (off_t)size) == 0;
+#else
+  std::vector<char> prefix((size_t)size);
+  {
+    std::ifstream in(filename, std::ios::binary);
+    if(!in.read(prefix.data(), prefix.size())) return false;
+  }
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  out.write(prefix.data(), prefix.size());
+  return (bool)out;
+#endif
+}
+
+// --------------------------------------------------------------------------
+
+
+KeyFrameStore::KeyFrameStore(): m_size(0)
+{
+}
+
+// --------------------------------------------------------------------------
+
+
+KeyFrameStore::~KeyFrameStore()
+{
+  close();
+}
+
+// --------------------------------------------------------------------------
+
+
+uint64_t KeyFrameStore::vocabularySignature(const Vocabulary &voc)
+{
+  std::vector<uchar> buf;
+  auto put = [&buf](const void *p, size_t n){
+    buf.insert(buf.end(), (const uchar*)p, (const uchar*)p + n);
+  };
+  const int32_t params[] = { (int32_t)voc.size(), voc.getBranchingFactor(),
+    voc.getDepthLevels(), (int32_t)voc.getWeightingType(),
+    (int32_t)voc.getScoringType(), voc.getDescritorSize(),
+    voc.getDescritorType() };
+  put(params, sizeof(params));
+
+  // a few words tell apart vocabularies of the same shape
+  if(!voc.empty())
+  {
+    const WordId wids[] = { 0, (WordId)(voc.size() / 2), (WordId)(voc.size() - 1) };
+    for(WordId wid: wids)
+    {
+      cv::Mat w = voc.getWord(wid);
+      if(w.isContinuous()) put(w.data, w.total() * w.elemSize());
+      const double weight = voc.getWordWeight(wid);
+      put(&weight, sizeof(weight));
+    }
+  }
+  return checksum64(buf.data(), buf.size());
+}
+
+// --------------------------------------------------------------------------
+
+
+bool KeyFrameStore::create(const std::string &filename, const Vocabulary &voc)
+{
+  close();
+
+  StoreHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, kStoreMagic, sizeof(h.magic));
+  h.version = kStoreVersion;
+  h.header_size = sizeof(StoreHeader);
+  h.voc_signature = vocabularySignature(voc);
+  h.voc_words = voc.size();
+
+  m_file.open(filename, std::ios::binary | std::ios::trunc);
+  if(!m_file.is_open()) return false;
+  m_file.write((const char*)&h, sizeof(h));
+  m_file.flush();
+  if(!m_file)
+  {
+    close();
+    return false;
+  }
+
+  m_filename = filename;
+  m_size = 0;
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+
+int KeyFrameStore::open(const std::string &filename, const Vocabulary &voc,
+  const std::function<void(StoredFrame&)> &reader)
+{
+  close();
+
+  uint64_t valid_size = 0;
+  unsigned int n = 0;
+  bool torn = false;
+  {
+    size_t size = 0;
+    std::shared_ptr<const uchar> mapping = mapFile(filename, size);
+    if(!mapping || size < sizeof(StoreHeader)) return -1;
+
+    StoreHeader h;
+    memcpy(&h, mapping.get(), sizeof(h));
+    if(memcmp(h.magic, kStoreMagic, sizeof(h.magic)) != 0 ||
+       h.version != kStoreVersion || h.header_size != sizeof(StoreHeader) ||
+       h.voc_words != voc.size() || h.voc_signature != vocabularySignature(voc))
+      return -1;
+
+    StoredFrame frame;
+    uint64_t offset = sizeof(StoreHeader);
+    while(offset + sizeof(RecordHeader) <= size)
+    {
+      RecordHeader r;
+      memcpy(&r, mapping.get() + offset, sizeof(r));
+      const uint64_t payload = offset + sizeof(RecordHeader);
+      if(r.magic != kRecordMagic || r.entry_id != n ||
+         r.payload_size != payloadSize(r) || r.payload_size > size - payload ||
+         checksum64(mapping.get() + payload, r.payload_size) != r.checksum)
+        break;
+
+      const uchar *p = mapping.get() + payload;
+      frame.id = r.entry_id;
+
+      frame.bow.clear();
+      const StoredWord *words = (const StoredWord*)p;
+      for(uint32_t i = 0; i < r.n_words; i++)
+        frame.bow.emplace_hint(frame.bow.end(), words[i].id, words[i].value);
+      p += (size_t)r.n_words * sizeof(StoredWord);
+
+      frame.fv.clear();
+      const StoredNode *nodes = (const StoredNode*)p;
+      const uint32_t *features = (const uint32_t*)(nodes + r.n_nodes);
+      uint64_t nfeatures = 0;
+      for(uint32_t i = 0; i < r.n_nodes; i++)
+      {
+        if(nfeatures + nodes[i].n_features > r.n_node_features) break;
+        frame.fv.emplace_hint(frame.fv.end(), nodes[i].id,
+          std::vector<unsigned int>(features + nfeatures,
+            features + nfeatures + nodes[i].n_features));
+        nfeatures += nodes[i].n_features;
+      }
+      p += (size_t)r.n_nodes * sizeof(StoredNode) +
+        pad8((uint64_t)r.n_node_features * sizeof(uint32_t));
+
+      frame.keypoints.resize(r.n_keypoints);
+      const StoredKeyPoint *kps = (const StoredKeyPoint*)p;
+      for(uint32_t i = 0; i < r.n_keypoints; i++)
+      {
+        cv::KeyPoint &kp = frame.keypoints[i];
+        kp.pt.x = kps[i].x;
+        kp.pt.y = kps[i].y;
+        kp.size = kps[i].size;
+        kp.angle = kps[i].angle;
+        kp.response = kps[i].response;
+        kp.octave = kps[i].octave;
+        kp.class_id = kps[i].class_id;
+      }
+      p += (size_t)r.n_keypoints * sizeof(StoredKeyPoint);
+
+      if(r.desc_rows > 0 && r.desc_cols > 0)
+        frame.descriptors = cv::Mat(r.desc_rows, r.desc_cols, r.desc_type,
+          (void*)p);
+      else
+        frame.descriptors = cv::Mat();
+
+      reader(frame);
+
+      offset = payload + r.payload_size;
+      n++;
+    }
+    valid_size = offset;
+    torn = offset != size;
+  } // mapping released
+
+  if(torn)
+  {
+    std::cerr << "KeyFrameStore: dropping an incomplete record at the end of "
+      << filename << std::endl;
+    if(!truncateFile(filename, valid_size)) return -1;
+  }
+
+  m_file.open(filename, std::ios::binary | std::ios::app);
+  if(!m_file.is_open()) return -1;
+  m_filename = filename;
+  m_size = n;
+  return (int)n;
+}
+
+// --------------------------------------------------------------------------
+
+
+bool KeyFrameStore::append(const BowVector &bow, const FeatureVector &fv,
+  const std::vector<cv::KeyPoint> &keypoints, const cv::Mat &descriptors)
+{
+  if(!m_file.is_open()) return false;
+
+  RecordHeader r;
+  memset(&r, 0, sizeof(r));
+  r.magic = kRecordMagic;
+  r.entry_id = m_size;
+  r.n_words = bow.size();
+  r.n_nodes = fv.size();
+  for(auto fit = fv.begin(); fit != fv.end(); ++fit)
+    r.n_node_features += fit->second.size();
+  r.n_keypoints = keypoints.size();
+  r.desc_rows = descriptors.rows;
+  r.desc_cols = descriptors.cols;
+  r.desc_type = descriptors.empty() ? 0 : descriptors.type();
+  r.payload_size = payloadSize(r);
+
+  std::vector<uchar> payload((size_t)r.payload_size, 0);
+  uchar *p = payload.data();
+
+  StoredWord *words = (StoredWord*)p;
+  for(auto vit = bow.begin(); vit != bow.end(); ++vit, ++words)
+  {
+    words->id = vit->first;
+    words->value = vit->second;
+  }
+  p += (size_t)r.n_words * sizeof(StoredWord);
+
+  StoredNode *nodes = (StoredNode*)p;
+  uint32_t *features = (uint32_t*)(nodes + r.n_nodes);
+  for(auto fit = fv.begin(); fit != fv.end(); ++fit, ++nodes)
+  {
+    nodes->id = fit->first;
+    nodes->n_features = fit->second.size();
+    for(size_t i = 0; i < fit->second.size(); i++) *features++ = fit->second[i];
+  }
+  p += (size_t)r.n_nodes * sizeof(StoredNode) +
+    pad8((uint64_t)r.n_node_features * sizeof(uint32_t));
+
+  StoredKeyPoint *kps = (StoredKeyPoint*)p;
+  for(size_t i = 0; i < keypoints.size(); i++)
+  {
+    const cv::KeyPoint &kp = keypoints[i];
+    kps[i].x = kp.pt.x;
+    kps[i].y = kp.pt.y;
+    kps[i].size = kp.size;
+    kps[i].angle = kp.angle;
+    kps[i].response = kp.response;
+    kps[i].octave = kp.octave;
+    kps[i].class_id = kp.class_id;
+  }
+  p += (size_t)r.n_keypoints * sizeof(StoredKeyPoint);
+
+  const size_t row_bytes = descriptors.cols * descriptors.elemSize();
+  for(int i = 0; i < descriptors.rows; i++, p += row_bytes)
+    memcpy(p, descriptors.ptr<uchar>(i), row_bytes);
+
+  r.checksum = checksum64(payload.data(), payload.size());
+
+  m_file.write((const char*)&r, sizeof(r));
+  m_file.write((const char*)payload.data(), payload.size());
+  m_file.flush();
+  if(!m_file) return false;
+
+  m_size++;
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+
+void KeyFrameStore::close()
+{
+  if(m_file.is_open()) m_file.close();
+  m_file.clear();
+  m_size = 0;
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW3
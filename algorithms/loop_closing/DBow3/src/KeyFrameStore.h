@@ -0,0 +1,106 @@
+/**
+ * File: KeyFrameStore.h
+ * Description: append-only file of the keyframes of a database
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_KEYFRAME_STORE__
+#define __D_T_KEYFRAME_STORE__
+
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "../src/exports.h"
+#include "../src/BowVector.h"
+#include "../src/FeatureVector.h"
+#include "../src/QueryResults.h"
+
+namespace DBoW3 {
+
+class Vocabulary;
+
+/**
+ * Append-only file with one record per database entry: its bow vector,
+ * its feature vector (only used with a direct index), and the keypoints and
+ * descriptors of the frame. The postings of the inverted file are the bow
+ * records in entry order, so a database is reopened by appending them to
+ * the rows, without transforming any descriptor.
+ *
+ * Records are 8 byte aligned and checksummed. A record cut short by a crash
+ * while appending is dropped when the file is opened again.
+ */
+class DBOW_API KeyFrameStore
+{
+public:
+
+  /// Content of a record, as given to the reader of open
+  struct StoredFrame
+  {
+    EntryId id;
+    BowVector bow;
+    FeatureVector fv;
+    std::vector<cv::KeyPoint> keypoints;
+    /// Points into the file mapping, only valid while the reader runs
+    cv::Mat descriptors;
+  };
+
+  KeyFrameStore();
+  ~KeyFrameStore();
+
+  /**
+   * Creates an empty store for the given vocabulary, replacing the file
+   * @param filename
+   * @param voc
+   * @return true on success
+   */
+  bool create(const std::string &filename, const Vocabulary &voc);
+
+  /**
+   * Opens a store for appending and gives every record to the reader, in
+   * entry order
+   * @param filename
+   * @param voc vocabulary the store must have been created with
+   * @param reader
+   * @return number of records, -1 if the file does not exist, is not a
+   *   keyframe store or was created with another vocabulary
+   */
+  int open(const std::string &filename, const Vocabulary &voc,
+    const std::function<void(StoredFrame&)> &reader);
+
+  /**
+   * Appends the next entry and flushes it to the file
+   * @return true on success
+   */
+  bool append(const BowVector &bow, const FeatureVector &fv,
+    const std::vector<cv::KeyPoint> &keypoints, const cv::Mat &descriptors);
+
+  /**
+   * Closes the file, the records stay in it
+   */
+  void close();
+
+  inline bool isOpen() const { return m_file.is_open(); }
+
+  /// Number of records in the file
+  inline unsigned int size() const { return m_size; }
+
+  inline const std::string& getFilename() const { return m_filename; }
+
+  /**
+   * Fingerprint of a vocabulary stored in the file header
+   */
+  static uint64_t vocabularySignature(const Vocabulary &voc);
+
+protected:
+
+  std::ofstream m_file;
+  std::string m_filename;
+  unsigned int m_size;
+};
+
+} // namespace DBoW3
+
+#endif
@@ -0,0 +1,74 @@
+/**
+ * File: MappedFile.cpp
+ * Description: read only file mappings and checksums of the binary
+ *   formats that are used in place (mapped vocabulary, keyframe store)
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <cstring>
+#include <fstream>
+#include "../src/MappedFile.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace DBoW3 {
+
+// --------------------------------------------------------------------------
+
+uint64_t checksum64(const uchar *data, size_t size)
+{
+  uint64_t h = 14695981039346656037ULL;
+  const size_t n = size / sizeof(uint64_t);
+  for(size_t i = 0; i < n; i++)
+  {
+    uint64_t w;
+    memcpy(&w, data + i * sizeof(uint64_t), sizeof(w));
+    h = (h ^ w) * 1099511628211ULL;
+  }
+  for(size_t i = n * sizeof(uint64_t); i < size; i++)
+    h = (h ^ data[i]) * 1099511628211ULL;
+  return h;
+}
+
+// --------------------------------------------------------------------------
+
+std::shared_ptr<const uchar> mapFile(const std::string &filename,
+  size_t &size)
+{
+#ifndef _WIN32
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd < 0) return std::shared_ptr<const uchar>();
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    close(fd);
+    return std::shared_ptr<const uchar>();
+  }
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) return std::shared_ptr<const uchar>();
+
+  size = st.st_size;
+  const size_t length = size;
+  return std::shared_ptr<const uchar>((const uchar*)data,
+    [length](const uchar *p){ munmap((void*)p, length); });
+#else
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  if(!file) return std::shared_ptr<const uchar>();
+  size = (size_t)file.tellg();
+  std::shared_ptr<uchar> buffer(new uchar[size], std::default_delete<uchar[]>());
+  file.seekg(0, std::ios::beg);
+  file.read((char*)buffer.get(), size);
+  if(!file) return std::shared_ptr<const uchar>();
+  return buffer;
+#endif
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW3
@@ -0,0 +1,263 @@
+/**
+ * File: ShardedDatabase.cpp
+ * Description: database of keyframes partitioned by time and position
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include "../src/ShardedDatabase.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace DBoW3 {
+
+// --------------------------------------------------------------------------
+
+
+ShardedDatabase::ShardedDatabase(unsigned int window_size, double cell_size):
+  m_db(false, 0), m_window_size(std::max(1u, window_size)),
+  m_cell_size(cell_size)
+{
+}
+
+// --------------------------------------------------------------------------
+
+
+ShardedDatabase::ShardedDatabase(const Vocabulary &voc, bool use_di,
+  int di_levels, unsigned int window_size, double cell_size):
+  m_db(voc, use_di, di_levels), m_window_size(std::max(1u, window_size)),
+  m_cell_size(cell_size)
+{
+}
+
+// --------------------------------------------------------------------------
+
+
+ShardedDatabase::ShardedDatabase(const std::shared_ptr<const Vocabulary> &voc,
+  bool use_di, int di_levels, unsigned int window_size, double cell_size):
+  m_db(voc, use_di, di_levels), m_window_size(std::max(1u, window_size)),
+  m_cell_size(cell_size)
+{
+}
+
+// --------------------------------------------------------------------------
+
+
+EntryId ShardedDatabase::add(const BowVector &vec, const FeatureVector &fvec)
+{
+  return addToShard(vec, fvec, false, 0, 0);
+}
+
+// --------------------------------------------------------------------------
+
+
+EntryId ShardedDatabase::add(const BowVector &vec, const FeatureVector &fvec,
+  const cv::Point2d &position)
+{
+  int cell_x = 0, cell_y = 0;
+  if(m_cell_size > 0)
+  {
+    cell_x = (int)std::floor(position.x / m_cell_size);
+    cell_y = (int)std::floor(position.y / m_cell_size);
+  }
+  return addToShard(vec, fvec, true, cell_x, cell_y);
+}
+
+// --------------------------------------------------------------------------
+
+
+EntryId ShardedDatabase::addToShard(const BowVector &vec,
+  const FeatureVector &fvec, bool located, int cell_x, int cell_y)
+{
+  const EntryId id = m_db.add(vec, fvec);
+  const unsigned int window = id / m_window_size;
+
+  // the shards of previous windows are complete
+  if(!m_shards.empty() && m_shards.back().window != window)
+    m_window_shards.clear();
+
+  auto key = std::make_tuple(located, cell_x, cell_y);
+  auto sit = m_window_shards.find(key);
+  if(sit == m_window_shards.end())
+  {
+    Shard shard;
+    shard.window = window;
+    shard.located = located;
+    shard.cell_x = cell_x;
+    shard.cell_y = cell_y;
+    shard.size = 0;
+    sit = m_window_shards.insert(std::make_pair(key,
+      (unsigned int)m_shards.size())).first;
+    m_shards.push_back(shard);
+  }
+
+  Shard &shard = m_shards[sit->second];
+  if(!shard.ranges.empty() && shard.ranges.back().second == id)
+    shard.ranges.back().second++;
+  else
+    shard.ranges.push_back(EntryRange(id, id + 1));
+  shard.size++;
+
+  return id;
+}
+
+// --------------------------------------------------------------------------
+
+
+double ShardedDatabase::distance(const Shard &shard,
+  const cv::Point2d &position) const
+{
+  if(!shard.located) return std::numeric_limits<double>::infinity();
+  if(m_cell_size <= 0) return 0;
+
+  const double x0 = shard.cell_x * m_cell_size;
+  const double y0 = shard.cell_y * m_cell_size;
+  const double dx = std::max(0., std::max(x0 - position.x,
+    position.x - (x0 + m_cell_size)));
+  const double dy = std::max(0., std::max(y0 - position.y,
+    position.y - (y0 + m_cell_size)));
+  return std::sqrt(dx * dx + dy * dy);
+}
+
+// --------------------------------------------------------------------------
+
+
+void ShardedDatabase::selectShards(const ShardQuery &q,
+  std::vector<unsigned int> &shards) const
+{
+  shards.clear();
+  if(q.max_id < -1) return;
+
+  // (distance, shard), without position all the distances are 0
+  std::vector<std::pair<double, unsigned int> > ranked;
+  ranked.reserve(m_shards.size());
+  for(unsigned int i = 0; i < m_shards.size(); i++)
+  {
+    const Shard &shard = m_shards[i];
+    if(q.max_id >= 0 && shard.ranges.front().first >= (EntryId)q.max_id)
+      continue;
+
+    double d = 0;
+    if(q.use_position)
+    {
+      d = distance(shard, q.position);
+      if(q.radius > 0 && shard.located && d > q.radius) continue;
+    }
+    ranked.push_back(std::make_pair(d, i));
+  }
+
+  // nearest first, then newest first
+  std::sort(ranked.begin(), ranked.end(),
+    [this](const std::pair<double, unsigned int> &a,
+      const std::pair<double, unsigned int> &b)
+    {
+      if(a.first != b.first) return a.first < b.first;
+      return m_shards[a.second].window > m_shards[b.second].window ||
+        (m_shards[a.second].window == m_shards[b.second].window &&
+         a.second < b.second);
+    });
+
+  if(q.max_shards > 0 && (int)ranked.size() > q.max_shards)
+    ranked.resize(q.max_shards);
+
+  shards.reserve(ranked.size());
+  for(const auto &r: ranked) shards.push_back(r.second);
+}
+
+// --------------------------------------------------------------------------
+
+
+void ShardedDatabase::selectEntries(const ShardQuery &q,
+  std::vector<EntryRange> &ranges) const
+{
+  std::vector<unsigned int> shards;
+  selectShards(q, shards);
+
+  ranges.clear();
+  for(unsigned int i: shards)
+  {
+    for(const EntryRange &r: m_shards[i].ranges)
+    {
+      EntryRange clipped = r;
+      if(q.max_id >= 0)
+        clipped.second = std::min(clipped.second, (EntryId)q.max_id);
+      if(clipped.first < clipped.second) ranges.push_back(clipped);
+    }
+  }
+
+  // join the runs of neighbouring shards
+  std::sort(ranges.begin(), ranges.end());
+  size_t n = 0;
+  for(size_t i = 0; i < ranges.size(); i++)
+  {
+    if(n > 0 && ranges[n-1].second == ranges[i].first)
+      ranges[n-1].second = ranges[i].second;
+    else
+      ranges[n++] = ranges[i];
+  }
+  ranges.resize(n);
+}
+
+// --------------------------------------------------------------------------
+
+
+void ShardedDatabase::query(const BowVector &vec, QueryResults &ret,
+  int max_results, const ShardQuery &q) const
+{
+  std::vector<EntryRange> ranges;
+  selectEntries(q, ranges);
+  m_db.query(vec, ret, max_results, ranges, q.parallel);
+}
+
+// --------------------------------------------------------------------------
+
+
+void ShardedDatabase::query(const std::vector<BowVector> &vecs,
+  std::vector<QueryResults> &rets, int max_results, const ShardQuery &q) const
+{
+  std::vector<EntryRange> ranges;
+  selectEntries(q, ranges);
+  m_db.query(vecs, rets, max_results, ranges, q.parallel);
+}
+
+// --------------------------------------------------------------------------
+
+
+void ShardedDatabase::load(const std::string &filename)
+{
+  m_db.load(filename);
+
+  // the entries are only partitioned by time
+  m_shards.clear();
+  m_window_shards.clear();
+  for(EntryId id = 0; id < m_db.size(); id += m_window_size)
+  {
+    Shard shard;
+    shard.window = id / m_window_size;
+    shard.located = false;
+    shard.cell_x = 0;
+    shard.cell_y = 0;
+    shard.ranges.push_back(EntryRange(id,
+      std::min(id + m_window_size, m_db.size())));
+    shard.size = shard.ranges.back().second - id;
+    m_shards.push_back(shard);
+  }
+  if(!m_shards.empty())
+    m_window_shards[std::make_tuple(false, 0, 0)] = m_shards.size() - 1;
+}
+
+// --------------------------------------------------------------------------
+
+
+void ShardedDatabase::clear()
+{
+  m_db.clear();
+  m_shards.clear();
+  m_window_shards.clear();
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW3
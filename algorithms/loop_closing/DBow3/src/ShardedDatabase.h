@@ -0,0 +1,218 @@
+/**
+ * File: ShardedDatabase.h
+ * Description: database of keyframes partitioned by time and position
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_SHARDED_DATABASE__
+#define __D_T_SHARDED_DATABASE__
+
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "../src/Database.h"
+#include "../src/exports.h"
+
+namespace DBoW3 {
+
+/// Entries of a ShardedDatabase added in the same time window to the same
+/// cell of positions
+struct DBOW_API Shard
+{
+  /// Time window, entry id / window size
+  unsigned int window;
+  /// The entries were added with a position
+  bool located;
+  /// Cell of the positions, (0, 0) if not located or with no cells
+  int cell_x;
+  int cell_y;
+  /// Runs of consecutive entry ids, in ascending order
+  std::vector<EntryRange> ranges;
+  /// Number of entries
+  unsigned int size;
+};
+
+/// Selects the shards scored by a query of a ShardedDatabase
+struct DBOW_API ShardQuery
+{
+  ShardQuery(): max_id(-1), use_position(false), radius(0), max_shards(0),
+    parallel(false) {}
+
+  /// Only entries with id < max_id are scored. -1 means all
+  int max_id;
+  /// Rank the shards by the distance of their cell to position
+  bool use_position;
+  cv::Point2d position;
+  /// With use_position, shards with a cell farther than radius are not
+  /// scored. Those without position always are. <= 0 means no limit
+  double radius;
+  /// Number of shards scored at most: the nearest ones, or the newest ones
+  /// without use_position. <= 0 means all
+  int max_shards;
+  /// Score the entries in different threads
+  bool parallel;
+};
+
+/**
+ * Database whose entries are partitioned in shards by time window and, if
+ * they are added with a position, by cell of a grid of positions. Queries
+ * only score the entries of the shards they select, so their cost does not
+ * grow with the entries far from the query or out of its time limit.
+ * Entry ids are those of a Database with the same entries.
+ */
+class DBOW_API ShardedDatabase
+{
+public:
+
+  /**
+   * Creates an empty database without vocabulary
+   * @param window_size entries of a time window
+   * @param cell_size side of the cells of positions. <= 0 means all the
+   *   positions are in the same cell
+   */
+  explicit ShardedDatabase(unsigned int window_size = 200,
+    double cell_size = 0);
+
+  /**
+   * Creates a database with the given vocabulary
+   * @param voc vocabulary
+   * @param use_di a direct index is used to store feature indexes
+   * @param di_levels levels to go up the vocabulary tree to select the
+   *   node id to store in the direct index when adding images
+   * @param window_size entries of a time window
+   * @param cell_size side of the cells of positions. <= 0 means all the
+   *   positions are in the same cell
+   */
+  explicit ShardedDatabase(const Vocabulary &voc, bool use_di = false,
+    int di_levels = 0, unsigned int window_size = 200, double cell_size = 0);
+
+  /**
+   * Creates a database that uses the given vocabulary without copying it
+   * (e.g. one of VocabularyRegistry)
+   * @param voc vocabulary
+   * @param use_di a direct index is used to store feature indexes
+   * @param di_levels levels to go up the vocabulary tree to select the
+   *   node id to store in the direct index when adding images
+   * @param window_size entries of a time window
+   * @param cell_size side of the cells of positions. <= 0 means all the
+   *   positions are in the same cell
+   */
+  explicit ShardedDatabase(const std::shared_ptr<const Vocabulary> &voc,
+    bool use_di = false, int di_levels = 0, unsigned int window_size = 200,
+    double cell_size = 0);
+
+  /**
+   * Adds an entry without position and returns its id
+   * @param vec bow vector
+   * @param fvec feature vector, only used with the direct index
+   */
+  EntryId add(const BowVector &vec, const FeatureVector &fvec = FeatureVector());
+
+  /**
+   * Adds an entry with a position and returns its id
+   * @param vec bow vector
+   * @param fvec feature vector, only used with the direct index
+   * @param position position of the entry, in the units of the cell size
+   */
+  EntryId add(const BowVector &vec, const FeatureVector &fvec,
+    const cv::Point2d &position);
+
+  /**
+   * Queries the entries of the shards selected by q
+   * @param vec bow vector already normalized
+   * @param ret results, with the ids of the entries
+   * @param max_results number of results to return. <= 0 means all
+   * @param q shards to score
+   */
+  void query(const BowVector &vec, QueryResults &ret, int max_results,
+    const ShardQuery &q) const;
+
+  /**
+   * Queries the entries of the shards selected by q with several vectors
+   * at once
+   * @param vecs bow vectors already normalized
+   * @param rets results of each vector
+   * @param max_results number of results to return per vector. <= 0 means all
+   * @param q shards to score
+   */
+  void query(const std::vector<BowVector> &vecs,
+    std::vector<QueryResults> &rets, int max_results,
+    const ShardQuery &q) const;
+
+  /**
+   * Returns the shards selected by q, in order of rank
+   * @param q
+   * @param shards indexes of the shards
+   */
+  void selectShards(const ShardQuery &q, std::vector<unsigned int> &shards) const;
+
+  /**
+   * Returns the entries scored by q, as ranges of ids in ascending order
+   * @param q
+   * @param ranges
+   */
+  void selectEntries(const ShardQuery &q, std::vector<EntryRange> &ranges) const;
+
+  /**
+   * Loads a Database saved whole. Its entries have no position
+   * @param filename
+   */
+  void load(const std::string &filename);
+
+  /// Empties the database
+  void clear();
+
+  /// Number of entries
+  unsigned int size() const { return m_db.size(); }
+
+  inline const std::vector<Shard>& getShards() const { return m_shards; }
+
+  /// The database of all the entries
+  inline const Database& getDatabase() const { return m_db; }
+
+  bool usingDirectIndex() const { return m_db.usingDirectIndex(); }
+
+  int getDirectIndexLevels() const { return m_db.getDirectIndexLevels(); }
+
+  /**
+   * Returns the features of an entry, with the direct index
+   * @param id entry id
+   */
+  const FeatureVector& retrieveFeatures(EntryId id) const
+  {
+    return m_db.retrieveFeatures(id);
+  }
+
+protected:
+
+  /// Adds the entry to the shard of its window and cell
+  EntryId addToShard(const BowVector &vec, const FeatureVector &fvec,
+    bool located, int cell_x, int cell_y);
+
+  /// Distance from a position to the cell of a shard
+  double distance(const Shard &shard, const cv::Point2d &position) const;
+
+protected:
+
+  /// All the entries
+  Database m_db;
+
+  /// Entries of a time window
+  unsigned int m_window_size;
+
+  /// Side of the cells of positions
+  double m_cell_size;
+
+  std::vector<Shard> m_shards;
+
+  /// Shards of the current window by (located, cell_x, cell_y)
+  std::map<std::tuple<bool, int, int>, unsigned int> m_window_shards;
+};
+
+} // namespace DBoW3
+
+#endif
@@ -18,6 +18,7 @@
 #include <iostream>
 #include <string>
 #include <algorithm>
+#include <memory>
 #include <opencv2/core/core.hpp>
 #include "../src/exports.h"
 #include "../src/FeatureVector.h"
@@ -29,6 +30,7 @@ namespace DBoW3 {
 class DBOW_API Vocabulary
 {		
 friend class FastSearch;
+friend class ParallelQuantizer;
 public:
   
   /**
@@ -118,14 +120,17 @@ public:
    * Returns the number of words in the vocabulary
    * @return number of words
    */
-  virtual inline unsigned int size() const{  return (unsigned int)m_words.size();}
+  virtual inline unsigned int size() const
+  {
+    return m_mapping ? m_flat_nwords : (unsigned int)m_words.size();
+  }
 
   
   /**
    * Returns whether the vocabulary is empty (i.e. it has not been trained)
    * @return true iff the vocabulary is empty
    */
-  virtual inline bool empty() const{ return m_words.empty();}
+  virtual inline bool empty() const{ return size() == 0;}
 
   /** Clears the vocabulary object
    */
@@ -154,12 +159,63 @@ public:
   virtual void transform(const std::vector<cv::Mat>& features,
     BowVector &v, FeatureVector &fv, int levelsup) const;
 
+  /**
+   * Transform a set of descriptors into a bow vector and a feature vector
+   * @param features, one per row
+   * @param v (out) bow vector
+   * @param fv (out) feature vector of nodes and feature indexes
+   * @param levelsup levels to go up the vocabulary tree to get the node index
+   */
+  virtual void transform(const cv::Mat& features,
+    BowVector &v, FeatureVector &fv, int levelsup) const;
+
   /**
    * Transforms a single feature into a word (without weight)
    * @param feature
    * @return word id
    */
   virtual WordId transform(const cv::Mat& feature) const;
+
+  /**
+   * Quantizes all the rows of a descriptor matrix at once, descending the
+   * flat tree with one distance kernel per block of siblings
+   * @param features, one per row
+   * @param words (out) word id of each row
+   * @param weights (out) weight of the word of each row
+   * @param nids (out) if given, id of the node "levelsup" levels up of each row
+   * @param levelsup
+   */
+  void quantize(const cv::Mat &features, std::vector<WordId> &words,
+    std::vector<WordValue> &weights, std::vector<NodeId> *nids = NULL,
+    int levelsup = 0) const;
+
+  /**
+   * Splits the rows of batched transforms over several threads
+   * (cv::parallel_for_) when there are at least min_rows of them
+   * @param parallel
+   * @param min_rows
+   */
+  void setParallelTransform(bool parallel, int min_rows = 256)
+  {
+    m_parallel_transform = parallel;
+    m_parallel_min_rows = min_rows;
+  }
+
+  /**
+   * Selects the training algorithm of create. The parallel one packs the
+   * features in one contiguous matrix, builds sibling subtrees as parallel
+   * tasks (cv::parallel_for_) and computes binary means by bit-majority
+   * voting. Every node draws its k-means++ seeds from its own generator,
+   * derived from the seed and its path in the tree, so the same features
+   * and seed give the same vocabulary whatever the number of threads
+   * @param parallel
+   * @param seed
+   */
+  void setParallelTraining(bool parallel, uint64_t seed = 0)
+  {
+    m_parallel_training = parallel;
+    m_training_seed = seed;
+  }
   
   /**
    * Returns the score of two vectors
@@ -261,6 +317,29 @@ public:
    */
   bool load(std::istream &stream);
 
+  /**
+   * Saves the vocabulary in a format that loadMapped can use in place:
+   * the flat tree, the word weights and the padded descriptors, followed
+   * by a checksum. load(filename) recognizes these files too
+   * @param filename
+   */
+  void saveMapped(const std::string &filename) const;
+
+  /**
+   * Maps a file created with saveMapped. The nodes, descriptors and weights
+   * are read from the mapped pages, which are shared by all the processes
+   * and all the copies of this vocabulary that use the same file.
+   * Modifying the vocabulary (stopWords, create) copies it to memory first
+   * @param filename
+   * @param verify_checksum checks the whole file before using it
+   */
+  void loadMapped(const std::string &filename, bool verify_checksum = true);
+
+  /**
+   * Returns whether the vocabulary is used in place from a mapped file
+   */
+  inline bool isMapped() const { return (bool)m_mapping; }
+
   /** 
    * Saves the vocabulary to a file storage structure
    * @param fn node in file storage
@@ -411,11 +490,66 @@ protected:
    */
   void initiateClustersKMpp(const std::vector<cv::Mat> &descriptors,
     std::vector<cv::Mat> &clusters) const;
+
+  /**
+   * Creates the whole tree under the root with the parallel trainer, see
+   * setParallelTraining. Produces the same node layout as HKmeansStep
+   * @param descriptors all the training descriptors
+   */
+  void HKmeansParallel(const std::vector<cv::Mat> &descriptors);
   
   /**
    * Create the words of the vocabulary once the tree has been built
    */
   void createWords();
+
+  /**
+   * Builds the flat copy of the tree used by the transforms: nodes in
+   * breadth-first order with the children of a node stored contiguously,
+   * and all the node descriptors packed in one matrix. Must be called
+   * whenever m_nodes changes
+   */
+  void buildFlatTree();
+
+  /**
+   * Quantizes n descriptors through the flat tree
+   * @param rows pointers to the descriptors
+   * @param n number of descriptors
+   * @param words (out) word id of each descriptor
+   * @param nids (out) if not NULL, node id "levelsup" levels up
+   * @param levelsup
+   */
+  void quantizeFlat(const uchar * const *rows, int n, WordId *words,
+    NodeId *nids, int levelsup) const;
+
+  /**
+   * Returns whether a feature can be quantized with the flat tree
+   */
+  inline bool flatCompatible(const cv::Mat &feature) const
+  {
+    return m_flat_size > 0 && feature.type() == m_flat_type &&
+      feature.cols == m_flat_cols && (feature.rows == 1 || feature.isContinuous());
+  }
+
+  /**
+   * Returns the weight of a word, from m_words or from the mapped file
+   */
+  inline WordValue wordWeight(WordId wid) const
+  {
+    return m_mapping ? m_flat_weights[wid] : m_words[wid]->weight;
+  }
+
+  /**
+   * Rebuilds m_nodes and m_words from the mapped file and releases it,
+   * so that the vocabulary can be modified
+   */
+  void unmap();
+
+  /**
+   * Throws if a feature cannot be quantized by a mapped vocabulary, which
+   * has no m_nodes to fall back on
+   */
+  void checkMappedFeature(const cv::Mat &feature) const;
   
   /**
    * Sets the weights of the nodes of tree according to the given features.
@@ -460,6 +594,58 @@ protected:
   /// Words of the vocabulary (tree leaves)
   /// this condition holds: m_words[wid]->word_id == wid
   std::vector<Node*> m_words;
+
+  /// Node of the flat tree, see buildFlatTree. Also the on-disk layout
+  /// of the mapped format
+  struct FlatNode
+  {
+    /// Position of the first child in the flat arrays
+    uint32_t first_child;
+    /// Number of children, 0 for words
+    uint32_t n_children;
+    /// Position of the parent in the flat arrays (0 for the root)
+    uint32_t parent;
+    /// Id of the node in m_nodes
+    NodeId node_id;
+    /// Word id if the node is a word
+    WordId word_id;
+  };
+
+  /// Tree nodes in breadth-first order, the root is the first one.
+  /// Points to m_flat_storage or into the mapped file
+  const FlatNode *m_flat_nodes = NULL;
+  uint32_t m_flat_size = 0;
+  std::vector<FlatNode> m_flat_storage;
+
+  /// Descriptors of m_flat_nodes, one zero padded row each
+  cv::Mat m_flat_descriptors;
+
+  /// Only set for mapped vocabularies, which have no m_nodes: number of
+  /// words, weight and flat position of each word, and flat position of
+  /// each node id (UINT32_MAX if unused)
+  uint32_t m_flat_nwords = 0;
+  const WordValue *m_flat_weights = NULL;
+  const uint32_t *m_flat_word_pos = NULL;
+  const uint32_t *m_flat_node_pos = NULL;
+  uint32_t m_flat_nnode_ids = 0;
+
+  /// Mapped file, shared by the copies of this vocabulary
+  std::shared_ptr<const uchar> m_mapping;
+
+  /// Type and number of columns of the descriptors in the flat tree
+  int m_flat_type = -1;
+  int m_flat_cols = 0;
+
+  /// Largest number of children of a node
+  uint32_t m_flat_max_children = 0;
+
+  /// Batched transform options
+  bool m_parallel_transform = false;
+  int m_parallel_min_rows = 256;
+
+  /// Training options
+  bool m_parallel_training = false;
+  uint64_t m_training_seed = 0;
 public:
   //for debug (REMOVE)
   inline Node* getNodeWord(uint32_t idx){return m_words[idx];}
@@ -0,0 +1,83 @@
+/**
+ * File: VocabularyRegistry.cpp
+ * Description: vocabularies loaded once per process and shared
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include "../src/VocabularyRegistry.h"
+
+#include <climits>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+
+namespace DBoW3 {
+
+// --------------------------------------------------------------------------
+
+// vocabularies by canonical path, only weak references: the registry does
+// not keep alive a vocabulary nobody uses
+static std::mutex s_mutex;
+static std::map<std::string, std::weak_ptr<const Vocabulary> > s_vocabularies;
+
+// --------------------------------------------------------------------------
+
+
+static std::string canonicalPath(const std::string &filename)
+{
+#ifdef _WIN32
+  char path[_MAX_PATH];
+  if(_fullpath(path, filename.c_str(), _MAX_PATH)) return path;
+#else
+  char path[PATH_MAX];
+  if(realpath(filename.c_str(), path)) return path;
+#endif
+  return filename;
+}
+
+// --------------------------------------------------------------------------
+
+
+std::shared_ptr<const Vocabulary> VocabularyRegistry::get(
+  const std::string &filename)
+{
+  const std::string key = canonicalPath(filename);
+
+  // loads are serialized, so that a file requested by several threads at
+  // once is loaded only once
+  std::lock_guard<std::mutex> lock(s_mutex);
+  std::shared_ptr<const Vocabulary> voc = s_vocabularies[key].lock();
+  if(!voc)
+  {
+    std::shared_ptr<Vocabulary> loaded = std::make_shared<Vocabulary>();
+    loaded->load(filename);
+    voc = loaded;
+    s_vocabularies[key] = voc;
+  }
+  return voc;
+}
+
+// --------------------------------------------------------------------------
+
+
+size_t VocabularyRegistry::size()
+{
+  std::lock_guard<std::mutex> lock(s_mutex);
+  size_t n = 0;
+  for(auto it = s_vocabularies.begin(); it != s_vocabularies.end(); )
+  {
+    if(it->second.expired())
+      it = s_vocabularies.erase(it);
+    else
+    {
+      n++;
+      ++it;
+    }
+  }
+  return n;
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW3
@@ -0,0 +1,41 @@
+/**
+ * File: VocabularyRegistry.h
+ * Description: vocabularies loaded once per process and shared
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_VOCABULARY_REGISTRY__
+#define __D_T_VOCABULARY_REGISTRY__
+
+#include <memory>
+#include <string>
+#include "../src/Vocabulary.h"
+#include "../src/exports.h"
+
+namespace DBoW3 {
+
+/**
+ * Process-wide registry of vocabularies loaded from files. Every request of
+ * the same file returns the same immutable vocabulary, which is loaded the
+ * first time and released when nobody holds it any more. Databases created
+ * with it point at it instead of copying it.
+ */
+class DBOW_API VocabularyRegistry
+{
+public:
+
+  /**
+   * Returns the vocabulary of a file, loading it if it is not held already.
+   * Throws as Vocabulary::load if it cannot be loaded
+   * @param filename vocabulary file, in any format Vocabulary::load reads
+   */
+  static std::shared_ptr<const Vocabulary> get(const std::string &filename);
+
+  /// Number of vocabularies held at the moment
+  static size_t size();
+};
+
+} // namespace DBoW3
+
+#endif
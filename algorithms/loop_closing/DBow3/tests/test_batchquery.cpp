@@ -0,0 +1,76 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+
+// DBoW3
+#include "DBoW3.h"
+#include "test_utils.h"
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+using namespace DBoW3;
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+int main(int argc,char **argv)
+{
+
+    try{
+        if (argc<2){
+            cerr<<"Usage:  voc.dbow3 [nentries] [nqueries]"<<endl;
+            return -1;
+        }
+        Vocabulary voc(argv[1]);
+        if(voc.empty()) throw std::runtime_error("could not load vocabulary "+string(argv[1]));
+        int nentries = argc>2 ? atoi(argv[2]) : 10000;
+        int nqueries = argc>3 ? atoi(argv[3]) : 8;
+
+        std::mt19937 rng(0);
+        Database db(voc, false, 0);
+        for(int i=0; i<nentries; i++){
+            BowVector v;
+            voc.transform(randomDescriptors(rng, 200), v);
+            db.add(v);
+        }
+        vector<BowVector> queries(nqueries);
+        for(auto &q: queries) voc.transform(randomDescriptors(rng, 500), q);
+
+        int errors = 0;
+        int max_results[] = {0, 1, 10};
+        int max_ids[] = {-1, nentries / 3, -2};
+        for(int mr: max_results) for(int mi: max_ids){
+            auto start = std::chrono::high_resolution_clock::now();
+            vector<QueryResults> single(queries.size());
+            for(size_t q=0; q<queries.size(); q++) db.query(queries[q], single[q], mr, mi);
+            double t_single = msSince(start);
+
+            start = std::chrono::high_resolution_clock::now();
+            vector<QueryResults> batch;
+            db.query(queries, batch, mr, mi);
+            double t_batch = msSince(start);
+
+            start = std::chrono::high_resolution_clock::now();
+            vector<QueryResults> parallel;
+            db.query(queries, parallel, mr, mi, true);
+            double t_parallel = msSince(start);
+
+            cout<<"max_results "<<mr<<" max_id "<<mi<<": single "<<t_single<<" ms, batch "
+                <<t_batch<<" ms, parallel "<<t_parallel<<" ms"<<endl;
+            for(size_t q=0; q<queries.size(); q++){
+                if(!sameResults(single[q], batch[q]) || !sameResults(single[q], parallel[q])){
+                    cerr<<"query "<<q<<" differs"<<endl;
+                    errors++;
+                }
+            }
+        }
+
+        cout<<(errors==0 ? "OK" : "FAILED")<<endl;
+        return errors==0 ? 0 : 1;
+
+    }catch(std::exception &ex){
+        cerr<<ex.what()<<endl;
+        return 1;
+    }
+}
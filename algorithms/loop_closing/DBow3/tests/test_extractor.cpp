@@ -0,0 +1,80 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstring>
+
+// DBoW3
+#include "FeatureExtractor.h"
+#include "test_utils.h"
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/features2d/features2d.hpp>
+using namespace DBoW3;
+using namespace std;
+
+bool sameFeatures(const vector<cv::KeyPoint> &ka, const cv::Mat &da, const vector<cv::KeyPoint> &kb, const cv::Mat &db){
+    if(ka.size() != kb.size() || da.rows != db.rows || da.cols != db.cols) return false;
+    for(size_t i=0; i<ka.size(); i++)
+        if(ka[i].pt.x != kb[i].pt.x || ka[i].pt.y != kb[i].pt.y || ka[i].octave != kb[i].octave) return false;
+    for(int r=0; r<da.rows; r++)
+        if(memcmp(da.ptr<uchar>(r), db.ptr<uchar>(r), da.cols * da.elemSize()) != 0) return false;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+
+int main(int argc,char **argv)
+{
+
+    try{
+        if (argc<2){
+            cerr<<"Usage:  image1 image2 ..."<<endl;
+            return -1;
+        }
+        vector<cv::Mat> images;
+        for(int i=1; i<argc; i++){
+            images.push_back(cv::imread(argv[i], 0));
+            if(images.back().empty()) throw std::runtime_error("could not open image "+string(argv[i]));
+        }
+
+        // a detector built for every image, as LoopClosingManager used to
+        auto start = std::chrono::high_resolution_clock::now();
+        vector<vector<cv::KeyPoint> > keypoints(images.size());
+        vector<cv::Mat> descriptors(images.size());
+        for(size_t i=0; i<images.size(); i++)
+            cv::ORB::create()->detectAndCompute(images[i], cv::Mat(), keypoints[i], descriptors[i]);
+        cout<<"new detector per image: "<<msSince(start)<<" ms"<<endl;
+
+        FeatureExtractor extractor;
+        start = std::chrono::high_resolution_clock::now();
+        vector<vector<cv::KeyPoint> > keypoints1(images.size());
+        vector<cv::Mat> descriptors1(images.size());
+        for(size_t i=0; i<images.size(); i++)
+            extractor.extract(images[i], keypoints1[i], descriptors1[i]);
+        cout<<"reused detector: "<<msSince(start)<<" ms"<<endl;
+
+        start = std::chrono::high_resolution_clock::now();
+        vector<vector<cv::KeyPoint> > keypoints2;
+        vector<cv::Mat> descriptors2;
+        extractor.extract(images, keypoints2, descriptors2);
+        cout<<"batch: "<<msSince(start)<<" ms, "<<extractor.detectors()<<" detectors"<<endl;
+
+        int errors = 0;
+        for(size_t i=0; i<images.size(); i++){
+            if(!sameFeatures(keypoints[i], descriptors[i], keypoints1[i], descriptors1[i]) ||
+               !sameFeatures(keypoints[i], descriptors[i], keypoints2[i], descriptors2[i])){
+                cerr<<"image "<<i<<" differs"<<endl;
+                errors++;
+            }
+        }
+
+        cout<<(errors==0 ? "OK" : "FAILED")<<endl;
+        return errors==0 ? 0 : 1;
+
+    }catch(std::exception &ex){
+        cerr<<ex.what()<<endl;
+        return 1;
+    }
+}
@@ -0,0 +1,102 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <limits>
+#include <random>
+
+// DBoW3
+#include "DBoW3.h"
+#include "DescManip.h"
+#include "test_utils.h"
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+using namespace DBoW3;
+using namespace std;
+
+//command line parser
+class CmdLineParser{int argc; char **argv; public: CmdLineParser(int _argc,char **_argv):argc(_argc),argv(_argv){}  bool operator[] ( string param ) {int idx=-1;  for ( int i=0; i<argc && idx==-1; i++ ) if ( string ( argv[i] ) ==param ) idx=i;    return ( idx!=-1 ) ;    } string operator()(string param,string defvalue="-1"){int idx=-1;    for ( int i=0; i<argc && idx==-1; i++ ) if ( string ( argv[i] ) ==param ) idx=i; if ( idx==-1 ) return defvalue;   else  return ( argv[  idx+1] ); }};
+
+// per-node descent over m_nodes, as done before the flat tree existed
+class ReferenceVocabulary: public Vocabulary{
+public:
+    // mapped vocabularies have no m_nodes until they are unmapped
+    void loadNodes(const string &filename){
+        load(filename);
+        unmap();
+    }
+
+    void quantizeReference(const cv::Mat &feature, WordId &word_id, NodeId &nid, int levelsup) const{
+        const int nid_level = m_L - levelsup;
+        NodeId final_id = 0;
+        nid = 0;
+        int current_level = 0;
+        do{
+            ++current_level;
+            double best_d = std::numeric_limits<double>::max();
+            for(NodeId id: m_nodes[final_id].children){
+                double d = DescManip::distance(feature, m_nodes[id].descriptor);
+                if(d < best_d){ best_d = d; final_id = id; }
+            }
+            if(current_level == nid_level) nid = final_id;
+        }while(!m_nodes[final_id].isLeaf());
+        if(current_level < nid_level) nid = final_id;
+        word_id = m_nodes[final_id].word_id;
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+int main(int argc,char **argv)
+{
+
+    try{
+        CmdLineParser cml(argc,argv);
+        if (cml["-h"] || argc<2){
+            cerr<<"Usage:  voc.dbow [-n features] [-parallel]"<<endl;
+            return -1;
+        }
+        ReferenceVocabulary voc;
+        voc.loadNodes(argv[1]);
+        cout<<"loaded "<<voc<<endl;
+        voc.setParallelTransform(cml["-parallel"]);
+
+        int n = stoi(cml("-n","10000"));
+        std::mt19937 rng(0);
+        cv::Mat features = randomDescriptors(rng, n, voc.getDescritorSize(), voc.getDescritorType());
+
+        int errors = 0;
+        for(int levelsup=0; levelsup<=voc.getDepthLevels(); levelsup++){
+            vector<WordId> words;
+            vector<WordValue> weights;
+            vector<NodeId> nids;
+            voc.quantize(features, words, weights, &nids, levelsup);
+            for(int r=0; r<n; r++){
+                WordId wid;
+                NodeId nid;
+                voc.quantizeReference(features.row(r), wid, nid, levelsup);
+                if(wid!=words[r] || nid!=nids[r]) errors++;
+            }
+        }
+        cout<<"mismatches: "<<errors<<endl;
+
+        auto t0 = std::chrono::high_resolution_clock::now();
+        for(int r=0; r<n; r++){
+            WordId wid;
+            NodeId nid;
+            voc.quantizeReference(features.row(r), wid, nid, 0);
+        }
+        auto t1 = std::chrono::high_resolution_clock::now();
+        vector<WordId> words;
+        vector<WordValue> weights;
+        voc.quantize(features, words, weights);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        cout<<"per-node: "<<std::chrono::duration<double,std::milli>(t1-t0).count()<<" ms, "
+            <<"flat: "<<std::chrono::duration<double,std::milli>(t2-t1).count()<<" ms"<<endl;
+        return errors==0 ? 0 : 1;
+    }catch(std::exception &ex){
+        cerr<<ex.what()<<endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstdio>
+
+// DBoW3
+#include "DBoW3.h"
+#include "KeyFrameStore.h"
+#include "test_utils.h"
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+using namespace DBoW3;
+using namespace std;
+
+//command line parser
+class CmdLineParser{int argc; char **argv; public: CmdLineParser(int _argc,char **_argv):argc(_argc),argv(_argv){}  bool operator[] ( string param ) {int idx=-1;  for ( int i=0; i<argc && idx==-1; i++ ) if ( string ( argv[i] ) ==param ) idx=i;    return ( idx!=-1 ) ;    } string operator()(string param,string defvalue="-1"){int idx=-1;    for ( int i=0; i<argc && idx==-1; i++ ) if ( string ( argv[i] ) ==param ) idx=i; if ( idx==-1 ) return defvalue;   else  return ( argv[  idx+1] ); }};
+
+struct Frame{
+    vector<cv::KeyPoint> keypoints;
+    cv::Mat descriptors;
+};
+
+Frame randomFrame(int n, int cols, int type, std::mt19937 &rng){
+    Frame f;
+    f.descriptors.create(n, cols, type);
+    f.keypoints.resize(n);
+    for(int r=0; r<n; r++){
+        for(int c=0; c<cols; c++){
+            if(type==CV_8U) f.descriptors.at<uchar>(r,c) = rng() & 0xff;
+            else f.descriptors.at<float>(r,c) = (rng() % 10000) / 10000.f;
+        }
+        f.keypoints[r].pt.x = rng() % 640;
+        f.keypoints[r].pt.y = rng() % 480;
+        f.keypoints[r].octave = rng() % 8;
+        f.keypoints[r].angle = (rng() % 3600) / 10.f;
+    }
+    return f;
+}
+
+// ----------------------------------------------------------------------------
+
+int main(int argc,char **argv)
+{
+
+    try{
+        CmdLineParser cml(argc,argv);
+        if (cml["-h"] || argc<2){
+            cerr<<"Usage:  voc.dbow [-frames n] [-features n] [-o store.kfdb]"<<endl;
+            return -1;
+        }
+        Vocabulary voc(argv[1]);
+        cout<<"loaded "<<voc<<endl;
+        const int nframes = stoi(cml("-frames","500"));
+        const int nfeatures = stoi(cml("-features","500"));
+        const string filename = cml("-o","keyframes.kfdb");
+
+        std::mt19937 rng(0);
+        vector<Frame> frames;
+        for(int i=0; i<nframes; i++)
+            frames.push_back(randomFrame(nfeatures, voc.getDescritorSize(), voc.getDescritorType(), rng));
+
+        // build the database, appending every frame to the store
+        auto start = std::chrono::high_resolution_clock::now();
+        Database db(voc, false, 0);
+        KeyFrameStore store;
+        if(!store.create(filename, voc)) throw std::runtime_error("could not create "+filename);
+        for(const Frame &f: frames){
+            BowVector bow;
+            db.add(f.descriptors, &bow);
+            store.append(bow, FeatureVector(), f.keypoints, f.descriptors);
+        }
+        store.close();
+        cout<<"built "<<db.size()<<" entries: "<<msSince(start)<<" ms"<<endl;
+
+        // reopen it
+        start = std::chrono::high_resolution_clock::now();
+        Database db2(voc, false, 0);
+        vector<Frame> frames2;
+        int n = store.open(filename, voc, [&](KeyFrameStore::StoredFrame &sf){
+            db2.add(sf.bow, sf.fv);
+            Frame f;
+            f.keypoints.swap(sf.keypoints);
+            f.descriptors = sf.descriptors.clone();
+            frames2.push_back(f);
+        });
+        cout<<"reopened "<<n<<" entries: "<<msSince(start)<<" ms"<<endl;
+
+        int errors = 0;
+        if(n != nframes){ cerr<<"expected "<<nframes<<" entries"<<endl; errors++; }
+        for(int i=0; i<n && i<nframes; i++){
+            const Frame &a = frames[i], &b = frames2[i];
+            bool same = a.keypoints.size()==b.keypoints.size() &&
+                    memcmp(a.descriptors.data, b.descriptors.data, a.descriptors.total()*a.descriptors.elemSize())==0;
+            for(size_t k=0; same && k<a.keypoints.size(); k++)
+                same = a.keypoints[k].pt.x==b.keypoints[k].pt.x && a.keypoints[k].pt.y==b.keypoints[k].pt.y &&
+                        a.keypoints[k].octave==b.keypoints[k].octave && a.keypoints[k].angle==b.keypoints[k].angle;
+            if(!same){ cerr<<"frame "<<i<<" differs"<<endl; errors++; }
+        }
+        for(int q=0; q<20; q++){
+            Frame f = randomFrame(nfeatures, voc.getDescritorSize(), voc.getDescritorType(), rng);
+            QueryResults r1, r2;
+            db.query(f.descriptors, r1, 4);
+            db2.query(f.descriptors, r2, 4);
+            if(!sameResults(r1, r2, 1e-9)){ cerr<<"query "<<q<<" differs"<<endl; errors++; }
+        }
+
+        // appending goes on after the last record
+        BowVector bow;
+        db2.add(frames[0].descriptors, &bow);
+        store.append(bow, FeatureVector(), frames[0].keypoints, frames[0].descriptors);
+        store.close();
+
+        // a record cut short is dropped
+        {
+            std::ifstream in(filename, std::ios::binary | std::ios::ate);
+            long size = in.tellg();
+            in.close();
+            std::vector<char> data(size);
+            std::ifstream(filename, std::ios::binary).read(data.data(), size);
+            std::ofstream(filename, std::ios::binary | std::ios::trunc).write(data.data(), size - 100);
+        }
+        n = store.open(filename, voc, [](KeyFrameStore::StoredFrame &){});
+        cout<<"after cutting the last record: "<<n<<" entries"<<endl;
+        if(n != nframes){ cerr<<"expected "<<nframes<<" entries"<<endl; errors++; }
+        store.close();
+
+        // another vocabulary is refused
+        Vocabulary other(voc.getBranchingFactor(), voc.getDepthLevels());
+        vector<cv::Mat> training;
+        for(int i=0; i<5; i++) training.push_back(frames[i].descriptors);
+        other.create(training);
+        n = store.open(filename, other, [](KeyFrameStore::StoredFrame &){});
+        if(n != -1){ cerr<<"opened with another vocabulary"<<endl; errors++; }
+
+        std::remove(filename.c_str());
+        cout<<(errors==0 ? "OK" : "FAILED")<<endl;
+        return errors==0 ? 0 : 1;
+
+    }catch(std::exception &ex){
+        cerr<<ex.what()<<endl;
+        return 1;
+    }
+}
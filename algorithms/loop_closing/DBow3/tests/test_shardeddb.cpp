@@ -0,0 +1,124 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cmath>
+
+// DBoW3
+#include "DBoW3.h"
+#include "ShardedDatabase.h"
+#include "test_utils.h"
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+using namespace DBoW3;
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+int main(int argc,char **argv)
+{
+
+    try{
+        if (argc<2){
+            cerr<<"Usage:  voc.dbow3 [nentries]"<<endl;
+            return -1;
+        }
+        Vocabulary voc(argv[1]);
+        if(voc.empty()) throw std::runtime_error("could not load vocabulary "+string(argv[1]));
+        int nentries = argc>2 ? atoi(argv[2]) : 10000;
+
+        //a trajectory going back and forth along a 1km line, 100 entries per window, 50m cells
+        std::mt19937 rng(0);
+        Database db(voc, false, 0);
+        ShardedDatabase sdb(voc, false, 0, 100, 50);
+        vector<cv::Point2d> positions;
+        for(int i=0; i<nentries; i++){
+            BowVector v;
+            voc.transform(randomDescriptors(rng, 200), v);
+            double t = std::fmod(i * 0.5, 2000.);
+            cv::Point2d p(t < 1000 ? t : 2000 - t, 0);
+            positions.push_back(p);
+            db.add(v);
+            if(i < 1000) sdb.add(v);//no position until the first fix
+            else sdb.add(v, FeatureVector(), p);
+        }
+        cout<<sdb.size()<<" entries in "<<sdb.getShards().size()<<" shards"<<endl;
+
+        BowVector query;
+        voc.transform(randomDescriptors(rng, 500), query);
+        int errors = 0;
+
+        //no restriction: same as the database
+        for(int max_id: {-1, nentries / 2, -2}){
+            QueryResults r1, r2;
+            db.query(query, r1, 10, max_id);
+            ShardQuery q;
+            q.max_id = max_id;
+            sdb.query(query, r2, 10, q);
+            if(!sameResults(r1, r2)){
+                cerr<<"max_id "<<max_id<<": results differ from the database"<<endl;
+                errors++;
+            }
+        }
+
+        //restricted to the shards near a position
+        ShardQuery q;
+        q.max_id = nentries - 50;
+        q.use_position = true;
+        q.position = cv::Point2d(300, 0);
+        q.radius = 60;
+        q.max_shards = 20;
+        vector<unsigned int> shards;
+        sdb.selectShards(q, shards);
+        vector<EntryRange> ranges;
+        sdb.selectEntries(q, ranges);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        QueryResults all;
+        db.query(query, all, 0, q.max_id);
+        double t_all = msSince(start);
+
+        start = std::chrono::high_resolution_clock::now();
+        QueryResults near;
+        sdb.query(query, near, 0, q);
+        double t_near = msSince(start);
+        cout<<"all entries: "<<all.size()<<" results in "<<t_all<<" ms, "<<shards.size()<<" shards: "
+            <<near.size()<<" results in "<<t_near<<" ms"<<endl;
+
+        //the results are those of the database in the selected entries
+        QueryResults expected;
+        for(const Result &r: all){
+            for(const EntryRange &range: ranges)
+                if(r.Id >= range.first && r.Id < range.second) expected.push_back(r);
+        }
+        if(!sameResults(expected, near)){
+            cerr<<"restricted results differ from the database"<<endl;
+            errors++;
+        }
+        QueryResults parallel;
+        q.parallel = true;
+        sdb.query(query, parallel, 0, q);
+        if(!sameResults(near, parallel)){
+            cerr<<"parallel results differ"<<endl;
+            errors++;
+        }
+        for(unsigned int i: shards){
+            const Shard &shard = sdb.getShards()[i];
+            for(const EntryRange &range: shard.ranges)
+                for(EntryId id = range.first; id < range.second; id++){
+                    if(shard.located && std::abs(positions[id].x - q.position.x) > q.radius + 50){
+                        cerr<<"entry "<<id<<" is too far"<<endl;
+                        errors++;
+                    }
+                }
+        }
+
+        cout<<(errors==0 ? "OK" : "FAILED")<<endl;
+        return errors==0 ? 0 : 1;
+
+    }catch(std::exception &ex){
+        cerr<<ex.what()<<endl;
+        return 1;
+    }
+}
@@ -0,0 +1,119 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstring>
+
+// DBoW3
+#include "DBoW3.h"
+#include "DescManip.h"
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+using namespace DBoW3;
+using namespace std;
+
+//command line parser
+class CmdLineParser{int argc; char **argv; public: CmdLineParser(int _argc,char **_argv):argc(_argc),argv(_argv){}  bool operator[] ( string param ) {int idx=-1;  for ( int i=0; i<argc && idx==-1; i++ ) if ( string ( argv[i] ) ==param ) idx=i;    return ( idx!=-1 ) ;    } string operator()(string param,string defvalue="-1"){int idx=-1;    for ( int i=0; i<argc && idx==-1; i++ ) if ( string ( argv[i] ) ==param ) idx=i; if ( idx==-1 ) return defvalue;   else  return ( argv[  idx+1] ); }};
+
+// gives access to the tree to compare two trainings
+class TrainedVocabulary: public Vocabulary{
+public:
+    TrainedVocabulary(int k, int L): Vocabulary(k, L, TF_IDF, L1_NORM){}
+
+    bool sameTree(const TrainedVocabulary &other) const{
+        if(m_nodes.size() != other.m_nodes.size()) return false;
+        for(size_t i=0; i<m_nodes.size(); i++){
+            const Node &a = m_nodes[i], &b = other.m_nodes[i];
+            if(a.parent != b.parent || a.children != b.children || a.word_id != b.word_id) return false;
+            if(a.weight != b.weight) return false;
+            if(i > 0 && DescManip::distance(a.descriptor, b.descriptor) != 0) return false;
+        }
+        return true;
+    }
+};
+
+// descriptors around random centres, with a few bits flipped or some noise added
+vector<cv::Mat> clusteredFeatures(int images, int per_image, int type, std::mt19937 &rng){
+    const int cols = type == CV_8U ? 32 : 64;
+    const int ncentres = 2000;
+    cv::Mat centres(ncentres, cols, type);
+    for(int r=0; r<ncentres; r++)
+        for(int c=0; c<cols; c++){
+            if(type==CV_8U) centres.at<uchar>(r,c) = rng() & 0xff;
+            else centres.at<float>(r,c) = (rng() % 10000) / 10000.f;
+        }
+
+    vector<cv::Mat> features(images);
+    for(int i=0; i<images; i++){
+        features[i].create(per_image, cols, type);
+        for(int r=0; r<per_image; r++){
+            memcpy(features[i].ptr<uchar>(r), centres.ptr<uchar>(rng() % ncentres), cols * centres.elemSize());
+            for(int f=0; f<8; f++){
+                int c = rng() % cols;
+                if(type==CV_8U) features[i].at<uchar>(r,c) ^= 1 << (rng() % 8);
+                else features[i].at<float>(r,c) += ((int)(rng() % 200) - 100) / 10000.f;
+            }
+        }
+    }
+    return features;
+}
+
+double train(TrainedVocabulary &voc, const vector<cv::Mat> &features){
+    auto start = std::chrono::high_resolution_clock::now();
+    voc.create(features);
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// ----------------------------------------------------------------------------
+
+int main(int argc,char **argv)
+{
+
+    try{
+        CmdLineParser cml(argc,argv);
+        if (cml["-h"]){
+            cerr<<"Usage:  [-images n] [-features n] [-k k] [-L L] [-float] [-seed s]"<<endl;
+            return -1;
+        }
+        const int images = stoi(cml("-images","200"));
+        const int per_image = stoi(cml("-features","500"));
+        const int k = stoi(cml("-k","10"));
+        const int L = stoi(cml("-L","4"));
+        const uint64_t seed = stoull(cml("-seed","0"));
+        const int type = cml["-float"] ? CV_32F : CV_8U;
+
+        std::mt19937 rng(0);
+        vector<cv::Mat> features = clusteredFeatures(images, per_image, type, rng);
+        cout<<images*per_image<<" features, k="<<k<<" L="<<L<<endl;
+
+        TrainedVocabulary serial(k, L);
+        cout<<"serial training: "<<train(serial, features)<<" ms, "<<serial.size()<<" words"<<endl;
+
+        // the same seed must give the same tree whatever the number of threads
+        const int nthreads = cv::getNumThreads();
+        TrainedVocabulary reference(k, L);
+        int errors = 0;
+        for(int threads: {1, 2, nthreads}){
+            cv::setNumThreads(threads);
+            TrainedVocabulary voc(k, L);
+            voc.setParallelTraining(true, seed);
+            double ms = train(voc, features);
+            cout<<"parallel training, "<<threads<<" threads: "<<ms<<" ms, "<<voc.size()<<" words"<<endl;
+            if(threads == 1) reference = voc;
+            else if(!voc.sameTree(reference)){
+                cerr<<"the tree trained with "<<threads<<" threads differs from the one trained with 1 thread"<<endl;
+                errors++;
+            }
+        }
+        cv::setNumThreads(nthreads);
+
+        cout<<(errors==0 ? "OK" : "FAILED")<<endl;
+        return errors==0 ? 0 : 1;
+
+    }catch(std::exception &ex){
+        cerr<<ex.what()<<endl;
+        return 1;
+    }
+}
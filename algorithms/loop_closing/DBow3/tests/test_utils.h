@@ -0,0 +1,43 @@
+/**
+ * File: test_utils.h
+ * Description: helpers shared by the tests
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_TEST_UTILS__
+#define __D_T_TEST_UTILS__
+
+#include <chrono>
+#include <cmath>
+#include <random>
+
+#include "DBoW3.h"
+
+#include <opencv2/core/core.hpp>
+
+/// Milliseconds elapsed since start
+inline double msSince(std::chrono::high_resolution_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+/// Random descriptors, orb-like by default: random bytes, or floats in [0,1)
+inline cv::Mat randomDescriptors(std::mt19937 &rng, int n, int cols = 32, int type = CV_8U){
+    cv::Mat desc(n, cols, type);
+    for(int r=0; r<n; r++)
+        for(int c=0; c<cols; c++){
+            if(type==CV_8U) desc.at<uchar>(r,c) = rng() & 0xff;
+            else desc.at<float>(r,c) = (rng() % 10000) / 10000.f;
+        }
+    return desc;
+}
+
+/// Same entries in the same order, with scores equal up to tolerance
+inline bool sameResults(const DBoW3::QueryResults &a, const DBoW3::QueryResults &b, double tolerance = 0){
+    if(a.size() != b.size()) return false;
+    for(size_t i=0; i<a.size(); i++)
+        if(a[i].Id != b[i].Id || std::abs(a[i].Score - b[i].Score) > tolerance) return false;
+    return true;
+}
+
+#endif
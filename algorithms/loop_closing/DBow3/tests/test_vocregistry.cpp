@@ -0,0 +1,81 @@
+#include <iostream>
+#include <vector>
+#include <random>
+
+// DBoW3
+#include "DBoW3.h"
+#include "ShardedDatabase.h"
+#include "VocabularyRegistry.h"
+#include "test_utils.h"
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+using namespace DBoW3;
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+int main(int argc,char **argv)
+{
+
+    try{
+        if (argc<2){
+            cerr<<"Usage:  voc.dbow3"<<endl;
+            return -1;
+        }
+        int errors = 0;
+        {
+            //the same file spelled another way: a "./" segment before the file name
+            string path = argv[1];
+            size_t slash = path.find_last_of('/');
+            string other_path = slash == string::npos ? "./" + path : path.substr(0, slash + 1) + "./" + path.substr(slash + 1);
+
+            std::shared_ptr<const Vocabulary> voc1 = VocabularyRegistry::get(path);
+            std::shared_ptr<const Vocabulary> voc2 = VocabularyRegistry::get(other_path);
+            if(voc1 != voc2 || VocabularyRegistry::size() != 1){
+                cerr<<"the vocabulary was loaded twice"<<endl;
+                errors++;
+            }
+
+            //databases of the shared vocabulary point at it
+            std::mt19937 rng(0);
+            Database db(voc1, false, 0);
+            ShardedDatabase sdb(voc2, false, 0, 100, 0);
+            if(db.getVocabulary() != voc1.get() || sdb.getDatabase().getVocabulary() != voc1.get()){
+                cerr<<"the vocabulary was copied"<<endl;
+                errors++;
+            }
+            for(int i=0; i<500; i++){
+                BowVector v;
+                voc1->transform(randomDescriptors(rng, 200), v);
+                db.add(v);
+            }
+
+            //copies keep the entries and share the vocabulary
+            Database copy(db), assigned;
+            assigned = db;
+            BowVector query;
+            voc1->transform(randomDescriptors(rng, 500), query);
+            QueryResults r, r_copy, r_assigned;
+            db.query(query, r, 10);
+            copy.query(query, r_copy, 10);
+            assigned.query(query, r_assigned, 10);
+            if(copy.getVocabulary() != voc1.get() || assigned.getVocabulary() != voc1.get() ||
+               !sameResults(r, r_copy) || !sameResults(r, r_assigned)){
+                cerr<<"copies of the database differ"<<endl;
+                errors++;
+            }
+        }
+        if(VocabularyRegistry::size() != 0){
+            cerr<<"the vocabulary was not released"<<endl;
+            errors++;
+        }
+
+        cout<<(errors==0 ? "OK" : "FAILED")<<endl;
+        return errors==0 ? 0 : 1;
+
+    }catch(std::exception &ex){
+        cerr<<ex.what()<<endl;
+        return 1;
+    }
+}
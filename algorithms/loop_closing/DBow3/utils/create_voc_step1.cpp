@@ -43,8 +43,8 @@ int main(int argc,char **argv)
 
     try{
         CmdLineParser cml(argc,argv);
-        if (cml["-h"] || argc!=3){
-            cerr<<"Usage:  features output_voc.yml[.gz]"<<endl;
+        if (cml["-h"] || argc<3){
+            cerr<<"Usage:  features output_voc.yml[.gz] [-parallel] [-seed s]"<<endl;
             return -1;
         }
 
@@ -56,6 +56,9 @@ int main(int argc,char **argv)
         const WeightingType weight = TF_IDF;
         const ScoringType score = L1_NORM;
         DBoW3::Vocabulary voc (k, L, weight, score);
+        //multithreaded training, reproducible for a given seed
+        if (cml["-parallel"])
+            voc.setParallelTraining(true, stoull(cml("-seed","0")));
 
         cout << "Creating a small " << k << "^" << L << " vocabulary..." << endl;
         voc.create(features);
@@ -3,12 +3,15 @@
 #include <vector>
 #include <iostream>
 #include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
 using namespace std;
 using namespace cv;
 
 #define THRESH_FACTOR 6
 
-// 8 possible rotation and each one is 3 X 3 
+// 8 possible rotation and each one is 3 X 3
 const int mRotationPatterns[8][9] = {
 	1,2,3,
 	4,5,6,
@@ -47,375 +50,372 @@ const int mRotationPatterns[8][9] = {
 const double mScaleRatios[5] = { 1.0, 1.0 / 2, 1.0 / sqrt(2.0), sqrt(2.0), 2.0 };
 
 
-class gms_matcher
+// Grid of a GMS run and the 9 neighbors of its cells (-1 outside the grid)
+struct gms_grid
 {
-public:
-	// OpenCV Keypoints & Correspond Image Size & Nearest Neighbor Matches 
-	gms_matcher(const vector<KeyPoint> &vkp1, const Size size1, const vector<KeyPoint> &vkp2, const Size size2, const vector<DMatch> &vDMatches) 
+	Size size;
+	int number;
+	vector<int> neighbors;
+
+	explicit gms_grid(const Size &GridSize) : size(GridSize), number(GridSize.width * GridSize.height), neighbors(number * 9, -1)
 	{
-		// Input initialize
-		NormalizePoints(vkp1, size1, mvP1);
-		NormalizePoints(vkp2, size2, mvP2);
-		mNumberMatches = vDMatches.size();
-		ConvertMatches(vDMatches, mvMatches);
+		for (int idx = 0; idx < number; idx++)
+		{
+			int idx_x = idx % size.width;
+			int idx_y = idx / size.width;
 
-		// Grid initialize
-		mGridSizeLeft = Size(20, 20);
-		mGridNumberLeft = mGridSizeLeft.width * mGridSizeLeft.height;
+			for (int yi = -1; yi <= 1; yi++)
+			{
+				for (int xi = -1; xi <= 1; xi++)
+				{
+					int idx_xx = idx_x + xi;
+					int idx_yy = idx_y + yi;
 
-		// Initialize the neihbor of left grid 
-		mGridNeighborLeft = Mat::zeros(mGridNumberLeft, 9, CV_32SC1);
-		InitalizeNiehbors(mGridNeighborLeft, mGridSizeLeft);
-	};
-	~gms_matcher() {};
+					if (idx_xx < 0 || idx_xx >= size.width || idx_yy < 0 || idx_yy >= size.height)
+						continue;
 
-private:
+					neighbors[idx * 9 + xi + 4 + yi * 3] = idx_xx + idx_yy * size.width;
+				}
+			}
+		}
+	}
+};
 
-	// Normalized Points
-	vector<Point2f> mvP1, mvP2;
+// Grids of a pair of image sizes: the left grid, the right grid of each scale and the factors from pixels to cells.
+// Built once per image sizes and shared by the matchers of all the threads
+struct gms_grid_setup
+{
+	gms_grid left;
+	vector<gms_grid> right;
+	Point2f left_factor;
+	vector<Point2f> right_factors;
 
-	// Matches
-	vector<pair<int, int> > mvMatches;
+	gms_grid_setup(const Size &size1, const Size &size2) : left(Size(20, 20))
+	{
+		left_factor = Point2f((float)left.size.width / size1.width, (float)left.size.height / size1.height);
+		for (int Scale = 0; Scale < 5; Scale++)
+		{
+			Size GridSizeRight(left.size.width * mScaleRatios[Scale], left.size.height * mScaleRatios[Scale]);
+			right.push_back(gms_grid(GridSizeRight));
+			right_factors.push_back(Point2f((float)GridSizeRight.width / size2.width, (float)GridSizeRight.height / size2.height));
+		}
+	}
 
-	// Number of Matches
-	size_t mNumberMatches;
+	static shared_ptr<const gms_grid_setup> get(const Size &size1, const Size &size2)
+	{
+		static std::mutex setups_mutex;
+		static map<vector<int>, shared_ptr<const gms_grid_setup> > setups;
+
+		std::lock_guard<std::mutex> lock(setups_mutex);
+		shared_ptr<const gms_grid_setup> &setup = setups[vector<int>{size1.width, size1.height, size2.width, size2.height}];
+		if (!setup)
+			setup = make_shared<gms_grid_setup>(size1, size2);
+		return setup;
+	}
+};
 
-	// Grid Size
-	Size mGridSizeLeft, mGridSizeRight;
-	int mGridNumberLeft;
-	int mGridNumberRight;
 
-	// x	  : left grid idx
-	// y      :  right grid idx
-	// value  : how many matches from idx_left to idx_right
-	Mat mMotionStatistics;
+class gms_matcher
+{
+public:
+	// OpenCV Keypoints & Correspond Image Size & Nearest Neighbor Matches
+	gms_matcher(const vector<KeyPoint> &vkp1, const Size size1, const vector<KeyPoint> &vkp2, const Size size2, const vector<DMatch> &vDMatches)
+	{
+		// Grid initialize, shared with the matchers of the same image sizes
+		mGridSetup = gms_grid_setup::get(size1, size2);
 
-	// 
-	vector<int> mNumberPointsInPerCellLeft;
+		// Input initialize, only the matched points
+		mNumberMatches = vDMatches.size();
+		mvP1.resize(mNumberMatches);
+		mvP2.resize(mNumberMatches);
+		for (size_t i = 0; i < mNumberMatches; i++)
+		{
+			mvP1[i] = vkp1[vDMatches[i].queryIdx].pt;
+			mvP2[i] = vkp2[vDMatches[i].trainIdx].pt;
+		}
+	};
+	~gms_matcher() {};
 
-	// Inldex  : grid_idx_left
-	// Value   : grid_idx_right
-	vector<int> mCellPairs;
+private:
 
-	// Every Matches has a cell-pair 
-	// first  : grid_idx_left
-	// second : grid_idx_right
-	vector<pair<int, int> > mvMatchPairs;
+	// Matched points, in pixels
+	vector<Point2f> mvP1, mvP2;
 
-	// Inlier Mask for output
-	vector<bool> mvbInlierMask;
+	// Number of Matches
+	size_t mNumberMatches;
 
-	//
-	Mat mGridNeighborLeft;
-	Mat mGridNeighborRight;
+	shared_ptr<const gms_grid_setup> mGridSetup;
 
 public:
 
 	// Get Inlier Mask
-	// Return number of inliers 
+	// Return number of inliers
+	// The scale and grid type pairs run in parallel, each one builds its motion statistics once and verifies the
+	// cell pairs of all the rotations with them
 	int GetInlierMask(vector<bool> &vbInliers, bool WithScale = false, bool WithRotation = false);
 
 private:
 
-	// Normalize Key Points to Range(0 - 1)
-	void NormalizePoints(const vector<KeyPoint> &kp, const Size &size, vector<Point2f> &npts) {
-		const size_t numP = kp.size();
-		const int width   = size.width;
-		const int height  = size.height;
-		npts.resize(numP);
-
-		for (size_t i = 0; i < numP; i++)
-		{
-			npts[i].x = kp[i].pt.x / width;
-			npts[i].y = kp[i].pt.y / height;
-		}
-	}
+	// Motion statistics of a thread, kept from one run to the next. Only the entries set are cleared
+	struct Scratch
+	{
+		// x	  : left grid idx
+		// y      :  right grid idx
+		// value  : how many matches from idx_left to idx_right
+		vector<int> mMotionStatistics;
+		vector<int> mTouched;
+
+		vector<int> mNumberPointsInPerCellLeft;
+
+		// Inldex  : grid_idx_left
+		// Value   : grid_idx_right, its count, and the rotations verifying the pair (bit RotationType - 1)
+		vector<int> mCellPairs;
+		vector<int> mCellPairCounts;
+		vector<unsigned char> mCellPairRotations;
+		vector<int> mTouchedLeft;
+	};
 
-	// Convert OpenCV DMatch to Match (pair<int, int>)
-	void ConvertMatches(const vector<DMatch> &vDMatches, vector<pair<int, int> > &vMatches) {
-		vMatches.resize(mNumberMatches);
-		for (size_t i = 0; i < mNumberMatches; i++)
-		{
-			vMatches[i] = pair<int, int>(vDMatches[i].queryIdx, vDMatches[i].trainIdx);
-		}
+	static Scratch &ThreadScratch()
+	{
+		static thread_local Scratch scratch;
+		return scratch;
 	}
 
-	int GetGridIndexLeft(const Point2f &pt, int type) {
+	int GetGridIndexLeft(const Point2f &pt, int type) const {
+		const Size &GridSizeLeft = mGridSetup->left.size;
+		const float fx = pt.x * mGridSetup->left_factor.x;
+		const float fy = pt.y * mGridSetup->left_factor.y;
 		int x = 0, y = 0;
 
 		if (type == 1) {
-			x = floor(pt.x * mGridSizeLeft.width);
-			y = floor(pt.y * mGridSizeLeft.height);
+			x = floor(fx);
+			y = floor(fy);
 
-			if (y >= mGridSizeLeft.height || x >= mGridSizeLeft.width){
+			if (y >= GridSizeLeft.height || x >= GridSizeLeft.width){
 				return -1;
 			}
 		}
 
 		if (type == 2) {
-			x = floor(pt.x * mGridSizeLeft.width + 0.5);
-			y = floor(pt.y * mGridSizeLeft.height);
+			x = floor(fx + 0.5);
+			y = floor(fy);
 
-			if (x >= mGridSizeLeft.width || x < 1) {
+			if (x >= GridSizeLeft.width || x < 1) {
 				return -1;
 			}
 		}
 
 		if (type == 3) {
-			x = floor(pt.x * mGridSizeLeft.width);
-			y = floor(pt.y * mGridSizeLeft.height + 0.5);
+			x = floor(fx);
+			y = floor(fy + 0.5);
 
-			if (y >= mGridSizeLeft.height || y < 1) {
+			if (y >= GridSizeLeft.height || y < 1) {
 				return -1;
 			}
 		}
 
 		if (type == 4) {
-			x = floor(pt.x * mGridSizeLeft.width + 0.5);
-			y = floor(pt.y * mGridSizeLeft.height + 0.5);
+			x = floor(fx + 0.5);
+			y = floor(fy + 0.5);
 
-			if (y >= mGridSizeLeft.height || y < 1 || x >= mGridSizeLeft.width || x < 1) {
+			if (y >= GridSizeLeft.height || y < 1 || x >= GridSizeLeft.width || x < 1) {
 				return -1;
 			}
 		}
 
-		return x + y * mGridSizeLeft.width;
-	}
-
-	int GetGridIndexRight(const Point2f &pt) {
-		int x = floor(pt.x * mGridSizeRight.width);
-		int y = floor(pt.y * mGridSizeRight.height);
+		if (x < 0 || y < 0)
+			return -1;
 
-		return x + y * mGridSizeRight.width;
+		return x + y * GridSizeLeft.width;
 	}
 
-	// Assign Matches to Cell Pairs 
-	void AssignMatchPairs(int GridType);
+	int GetGridIndexRight(const Point2f &pt, int Scale) const {
+		const Size &GridSizeRight = mGridSetup->right[Scale].size;
+		int x = floor(pt.x * mGridSetup->right_factors[Scale].x);
+		int y = floor(pt.y * mGridSetup->right_factors[Scale].y);
 
-	// Verify Cell Pairs
-	void VerifyCellPairs(int RotationType);
+		if (x < 0 || y < 0 || x >= GridSizeRight.width || y >= GridSizeRight.height)
+			return -1;
 
-	// Get Neighbor 9
-	vector<int> GetNB9(const int idx, const Size& GridSize) {
-		vector<int> NB9(9, -1);
-
-		int idx_x = idx % GridSize.width;
-		int idx_y = idx / GridSize.width;
-
-		for (int yi = -1; yi <= 1; yi++)
-		{
-			for (int xi = -1; xi <= 1; xi++)
-			{	
-				int idx_xx = idx_x + xi;
-				int idx_yy = idx_y + yi;
+		return x + y * GridSizeRight.width;
+	}
 
-				if (idx_xx < 0 || idx_xx >= GridSize.width || idx_yy < 0 || idx_yy >= GridSize.height)
-					continue;
+	// Inlier bits of the matches (bit RotationType - 1) for a scale and a grid type
+	void run(int Scale, int GridType, int RotationCount, vector<unsigned char> &vInlierRotations) const;
 
-				NB9[xi + 4 + yi * 3] = idx_xx + idx_yy * GridSize.width;
-			}
-		}
-		return NB9;
-	}
+	// runs the tasks of GetInlierMask, task = (Scale, GridType - 1), with parallel_for_
+	class ParallelRuns : public ParallelLoopBody
+	{
+	public:
+		ParallelRuns(const gms_matcher &matcher, int RotationCount, vector<vector<unsigned char> > &vTaskInliers)
+			: matcher(matcher), RotationCount(RotationCount), vTaskInliers(vTaskInliers) {}
 
-	void InitalizeNiehbors(Mat &neighbor, const Size& GridSize) {
-		for (int i = 0; i < neighbor.rows; i++)
+		virtual void operator()(const Range &range) const
 		{
-			vector<int> NB9 = GetNB9(i, GridSize);
-			int *data = neighbor.ptr<int>(i);
-			memcpy(data, &NB9[0], sizeof(int) * 9);
+			for (int task = range.start; task < range.end; task++)
+				matcher.run(task / 4, task % 4 + 1, RotationCount, vTaskInliers[task]);
 		}
-	}
-
-	void SetScale(int Scale) {
-		// Set Scale
-		mGridSizeRight.width = mGridSizeLeft.width  * mScaleRatios[Scale];
-		mGridSizeRight.height = mGridSizeLeft.height * mScaleRatios[Scale];
-		mGridNumberRight = mGridSizeRight.width * mGridSizeRight.height;
-
-		// Initialize the neihbor of right grid 
-		mGridNeighborRight = Mat::zeros(mGridNumberRight, 9, CV_32SC1);
-		InitalizeNiehbors(mGridNeighborRight, mGridSizeRight);
-	}
 
-	// Run 
-	int run(int RotationType);
+	private:
+		const gms_matcher &matcher;
+		int RotationCount;
+		vector<vector<unsigned char> > &vTaskInliers;
+	};
 };
 
-int gms_matcher::GetInlierMask(vector<bool> &vbInliers, bool WithScale, bool WithRotation) {
+inline int gms_matcher::GetInlierMask(vector<bool> &vbInliers, bool WithScale, bool WithRotation) {
 
-	int max_inlier = 0;
+	const int ScaleCount = WithScale ? 5 : 1;
+	const int RotationCount = WithRotation ? 8 : 1;
 
-	if (!WithScale && !WithRotation)
-	{
-		SetScale(0);
-		max_inlier = run(1);
-		vbInliers = mvbInlierMask;
-		return max_inlier;
-	}
+	// one task per scale and grid type
+	vector<vector<unsigned char> > vTaskInliers(ScaleCount * 4);
+	parallel_for_(Range(0, ScaleCount * 4), ParallelRuns(*this, RotationCount, vTaskInliers), ScaleCount * 4);
 
-	if (WithRotation && WithScale)
+	// a match is an inlier of a hypothesis if a grid type verifies its cell pair, the first best hypothesis is kept
+	int max_inlier = 0;
+	int best_scale = -1, best_rotation = -1;
+	vector<unsigned char> vScaleInliers(mNumberMatches);
+	vector<unsigned char> vBestInliers;
+	for (int Scale = 0; Scale < ScaleCount; Scale++)
 	{
-		for (int Scale = 0; Scale < 5; Scale++)
+		int num_inlier[8] = { 0 };
+		for (size_t i = 0; i < mNumberMatches; i++)
 		{
-			SetScale(Scale);
-			for (int RotationType = 1; RotationType <= 8; RotationType++)
-			{
-				int num_inlier = run(RotationType);
-
-				if (num_inlier > max_inlier)
-				{
-					vbInliers = mvbInlierMask;
-					max_inlier = num_inlier;
-				}
-			}
+			unsigned char bits = vTaskInliers[Scale * 4][i] | vTaskInliers[Scale * 4 + 1][i] |
+				vTaskInliers[Scale * 4 + 2][i] | vTaskInliers[Scale * 4 + 3][i];
+			vScaleInliers[i] = bits;
+			for (int r = 0; r < 8; r++)
+				num_inlier[r] += (bits >> r) & 1;
 		}
-		return max_inlier;
-	}
 
-	if (WithRotation && !WithScale)
-	{
-		SetScale(0);
-		for (int RotationType = 1; RotationType <= 8; RotationType++)
+		for (int r = 0; r < RotationCount; r++)
 		{
-			int num_inlier = run(RotationType);
-
-			if (num_inlier > max_inlier)
+			if (num_inlier[r] > max_inlier)
 			{
-				vbInliers = mvbInlierMask;
-				max_inlier = num_inlier;
+				max_inlier = num_inlier[r];
+				best_scale = Scale;
+				best_rotation = r;
 			}
 		}
-		return max_inlier;
+		if (best_scale == Scale)
+			vBestInliers.swap(vScaleInliers);
+		vScaleInliers.resize(mNumberMatches);
 	}
 
-	if (!WithRotation && WithScale)
-	{
-		for (int Scale = 0; Scale < 5; Scale++)
-		{
-			SetScale(Scale);
-
-			int num_inlier = run(1);
-
-			if (num_inlier > max_inlier)
-			{
-				vbInliers = mvbInlierMask;
-				max_inlier = num_inlier;
-			}
-			
-		}
-		return max_inlier;
-	}
+	vbInliers.assign(mNumberMatches, false);
+	if (best_scale < 0)
+		return 0;
 
+	for (size_t i = 0; i < mNumberMatches; i++)
+		vbInliers[i] = (vBestInliers[i] >> best_rotation) & 1;
 	return max_inlier;
 }
 
-void gms_matcher::AssignMatchPairs(int GridType) {
+inline void gms_matcher::run(int Scale, int GridType, int RotationCount, vector<unsigned char> &vInlierRotations) const {
 
-	for (size_t i = 0; i < mNumberMatches; i++)
-	{
-		Point2f &lp = mvP1[mvMatches[i].first];
-		Point2f &rp = mvP2[mvMatches[i].second];
+	const gms_grid &left = mGridSetup->left;
+	const gms_grid &right = mGridSetup->right[Scale];
+	Scratch &s = ThreadScratch();
 
-		int lgidx = mvMatchPairs[i].first = GetGridIndexLeft(lp, GridType);
-		int rgidx = -1;
+	if (s.mMotionStatistics.size() < (size_t)left.number * right.number)
+		s.mMotionStatistics.assign((size_t)left.number * right.number, 0);
+	if (s.mNumberPointsInPerCellLeft.size() < (size_t)left.number)
+	{
+		s.mNumberPointsInPerCellLeft.assign(left.number, 0);
+		s.mCellPairs.assign(left.number, -1);
+		s.mCellPairCounts.assign(left.number, 0);
+		s.mCellPairRotations.assign(left.number, 0);
+	}
 
-		if (GridType == 1)
-		{
-			rgidx = mvMatchPairs[i].second = GetGridIndexRight(rp);
-		}
-		else
-		{
-			rgidx = mvMatchPairs[i].second;
-		}
+	// Assign Matches to Cell Pairs, the best right cell of each left cell is kept on the way (the first one of the
+	// highest count)
+	vector<pair<int, int> > vMatchPairs(mNumberMatches);
+	for (size_t i = 0; i < mNumberMatches; i++)
+	{
+		int lgidx = GetGridIndexLeft(mvP1[i], GridType);
+		int rgidx = GetGridIndexRight(mvP2[i], Scale);
+		vMatchPairs[i] = pair<int, int>(lgidx, rgidx);
 
 		if (lgidx < 0 || rgidx < 0)	continue;
 
-		mMotionStatistics.at<int>(lgidx, rgidx)++;
-		mNumberPointsInPerCellLeft[lgidx]++;
-	}
-
-}
-
-void gms_matcher::VerifyCellPairs(int RotationType) {
+		int &value = s.mMotionStatistics[lgidx * right.number + rgidx];
+		if (value == 0)
+			s.mTouched.push_back(lgidx * right.number + rgidx);
+		value++;
 
-	const int *CurrentRP = mRotationPatterns[RotationType - 1];
+		if (s.mNumberPointsInPerCellLeft[lgidx] == 0)
+			s.mTouchedLeft.push_back(lgidx);
+		s.mNumberPointsInPerCellLeft[lgidx]++;
 
-	for (int i = 0; i < mGridNumberLeft; i++)
-	{
-		if (sum(mMotionStatistics.row(i))[0] == 0)
+		if (value > s.mCellPairCounts[lgidx] || (value == s.mCellPairCounts[lgidx] && rgidx < s.mCellPairs[lgidx]))
 		{
-			mCellPairs[i] = -1;
-			continue;
+			s.mCellPairs[lgidx] = rgidx;
+			s.mCellPairCounts[lgidx] = value;
 		}
+	}
 
-		int max_number = 0;
-		for (int j = 0; j < mGridNumberRight; j++)
+	// Verify Cell Pairs: the counts of the 9 x 9 neighbor cell pairs are gathered once, each rotation sums its 9 of them
+	for (int i: s.mTouchedLeft)
+	{
+		const int *NB9_lt = &left.neighbors[i * 9];
+		const int *NB9_rt = &right.neighbors[s.mCellPairs[i] * 9];
+
+		int counts[9][9];
+		int points[9];
+		for (int j = 0; j < 9; j++)
 		{
-			int *value = mMotionStatistics.ptr<int>(i);
-			if (value[j] > max_number)
-			{
-				mCellPairs[i] = j;
-				max_number = value[j];
-			}
+			int ll = NB9_lt[j];
+			points[j] = ll == -1 ? -1 : s.mNumberPointsInPerCellLeft[ll];
+			const int *row = ll == -1 ? nullptr : &s.mMotionStatistics[ll * right.number];
+			for (int k = 0; k < 9; k++)
+				counts[j][k] = (row == nullptr || NB9_rt[k] == -1) ? -1 : row[NB9_rt[k]];
 		}
 
-		int idx_grid_rt = mCellPairs[i];
+		unsigned char rotations = 0;
+		for (int r = 0; r < RotationCount; r++)
+		{
+			const int *CurrentRP = mRotationPatterns[r];
+			int score = 0;
+			double thresh = 0;
+			int numpair = 0;
 
-		const int *NB9_lt = mGridNeighborLeft.ptr<int>(i);
-		const int *NB9_rt = mGridNeighborRight.ptr<int>(idx_grid_rt); 
+			for (int j = 0; j < 9; j++)
+			{
+				int count = counts[j][CurrentRP[j] - 1];
+				if (count < 0)	continue;
 
-		int score = 0;
-		double thresh = 0;
-		int numpair = 0;
+				score += count;
+				thresh += points[j];
+				numpair++;
+			}
 
-		for (size_t j = 0; j < 9; j++)
-		{
-			int ll = NB9_lt[j];
-			int rr = NB9_rt[CurrentRP[j] - 1];
-			if (ll == -1 || rr == -1)	continue;
+			thresh = THRESH_FACTOR * sqrt(thresh / numpair);
 
-			score += mMotionStatistics.at<int>(ll, rr);
-			thresh += mNumberPointsInPerCellLeft[ll];
-			numpair++;
+			if (score >= thresh)
+				rotations |= 1 << r;
 		}
-
-		thresh = THRESH_FACTOR * sqrt(thresh / numpair);
-
-		if (score < thresh)
-			mCellPairs[i] = -2;
+		s.mCellPairRotations[i] = rotations;
 	}
-}
-
-int gms_matcher::run(int RotationType) {
 
-	mvbInlierMask.assign(mNumberMatches, false);
-
-	// Initialize Motion Statisctics
-	mMotionStatistics = Mat::zeros(mGridNumberLeft, mGridNumberRight, CV_32SC1);
-	mvMatchPairs.assign(mNumberMatches, pair<int, int>(0, 0));
+	// Mark inliers
+	vInlierRotations.assign(mNumberMatches, 0);
+	for (size_t i = 0; i < mNumberMatches; i++)
+	{
+		if (vMatchPairs[i].first >= 0 && vMatchPairs[i].second >= 0 && s.mCellPairs[vMatchPairs[i].first] == vMatchPairs[i].second)
+			vInlierRotations[i] = s.mCellPairRotations[vMatchPairs[i].first];
+	}
 
-	for (int GridType = 1; GridType <= 4; GridType++) 
+	// clear the scratch for the next run
+	for (int idx: s.mTouched)
+		s.mMotionStatistics[idx] = 0;
+	for (int i: s.mTouchedLeft)
 	{
-		// initialize
-		mMotionStatistics.setTo(0);
-		mCellPairs.assign(mGridNumberLeft, -1);
-		mNumberPointsInPerCellLeft.assign(mGridNumberLeft, 0);
-		
-		AssignMatchPairs(GridType);
-		VerifyCellPairs(RotationType);
-
-		// Mark inliers
-		for (size_t i = 0; i < mNumberMatches; i++)
-		{
-			if (mvMatchPairs[i].first >= 0) {
-				if (mCellPairs[mvMatchPairs[i].first] == mvMatchPairs[i].second)
-				{
-					mvbInlierMask[i] = true;
-				}
-			}
-		}
+		s.mNumberPointsInPerCellLeft[i] = 0;
+		s.mCellPairs[i] = -1;
+		s.mCellPairCounts[i] = 0;
+		s.mCellPairRotations[i] = 0;
 	}
-	int num_inlier = sum(mvbInlierMask)[0];
-	return num_inlier;
+	s.mTouched.clear();
+	s.mTouchedLeft.clear();
 }
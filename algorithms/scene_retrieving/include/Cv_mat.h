@@ -117,4 +117,27 @@ namespace boost{
 
 
 
+BOOST_SERIALIZATION_SPLIT_FREE(cv::Point3f)
+namespace boost{
+	namespace serialization {
+
+		template <class Archive>
+		void save (Archive &ar, const cv::Point3f &pt, const unsigned int version)
+		{
+			ar & pt.x;
+			ar & pt.y;
+			ar & pt.z;
+		}
+
+		template <class Archive>
+		void load (Archive &ar, cv::Point3f &pt, const unsigned int version)
+		{
+			ar & pt.x;
+			ar & pt.y;
+			ar & pt.z;
+		}
+	}
+}
+
+
 #endif // _CV_MAT_H_
@@ -27,6 +27,7 @@
 #include <geometry_msgs/Quaternion.h>
 #include <geometry_msgs/PoseStamped.h>
 
+#include "pose_ransac.h"
 
 
 using namespace std;
@@ -56,6 +57,9 @@ public:
 
         cv::eigen2cv(K, Kmat);
 
+        // the session fast path keeps the 4 pixels of the solvePnPRansac it replaced
+        session_pnp_ransac.options.threshold = 4.0;
+
         cout<<"cv_helper K: \n"<<K<<endl;
         cout<<"cv_helper Kmat: \n"<<Kmat<<endl;
         cout<<"cv_helper fx: "<<fx<<endl;
@@ -231,15 +235,8 @@ public:
 
     void image2KpAndDesp(cv::Mat& image, vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors)
     {
-
-        cout<<"image2KpAndDesp 1"<<endl;
         cv::Ptr<cv::ORB> orb = cv::ORB::create(1000);
-        cout<<"image2KpAndDesp 2"<<endl;
-
-        cout<<"image size: "<<image.size()<<endl;
-
         orb->detectAndCompute(image, cv::Mat(), keypoints, descriptors);
-        cout<<"image2KpAndDesp size: "<<keypoints.size()<<", "<<descriptors.size()<<endl;
     }
 
 
@@ -293,26 +290,28 @@ public:
     }
 
 
-    bool StereoImage2CamPoints(cv::Mat& image_left_rect,
-                               cv::Mat& image_right_rect,
-                               vector<cv::KeyPoint>& Keypoints_left,
-                               vector<cv::Point3f>& Camera_pts_left,
-                               cv::Mat& descriptors_left)
+    // features of the left image whose camera frame point is found by LK flow in the right image, the
+    // output keypoints, points and descriptors are aligned (point i belongs to keypoint i)
+    bool StereoFeatures2CamPoints(const cv::Mat& image_left_rect,
+                                  const cv::Mat& image_right_rect,
+                                  const vector<cv::KeyPoint>& Keypoints_in,
+                                  const cv::Mat& descriptors_in,
+                                  vector<cv::KeyPoint>& Keypoints_left,
+                                  vector<cv::Point3f>& Camera_pts_left,
+                                  cv::Mat& descriptors_left)
     {
+        Keypoints_left.clear();
+        Camera_pts_left.clear();
+        descriptors_left = cv::Mat();
 
-        //step 1, detect and compute kps and desp
-        cout<<"StereoImage2CamPoints 1"<<endl;
-        cout<<"image_left_rect size: "<<image_left_rect.size()<<endl;
-        this->image2KpAndDesp(image_left_rect, Keypoints_left, descriptors_left);
-        cout<<"StereoImage2CamPoints 2"<<endl;
-        if(Keypoints_left.size()< 10)
+        if(Keypoints_in.size()< 10)
             return false;
 
-        //step 2, convert kps to pt2f
+        //step 1, convert kps to pt2f
         vector<cv::Point2f> InputKeypoints;
-        cv::KeyPoint::convert(Keypoints_left, InputKeypoints);
-        cout<<"StereoImage2CamPoints 3"<<endl;
-        //step 3, conduct LK flow
+        cv::KeyPoint::convert(Keypoints_in, InputKeypoints);
+
+        //step 2, conduct LK flow
         std::vector<unsigned char> PyrLKResults;
         std::vector<float> err;
         std::vector<cv::Point2f> PyrLKmatched_points;
@@ -325,8 +324,7 @@ public:
                                  err
         );
 
-        cout<<"StereoImage2CamPoints 4"<<endl;
-        //step 4, eliminate good points and only keep matched ones
+        //step 3, only keep the tracked features
         std::vector<cv::Point2f> matched_points;
         std::vector<float> disparity_of_points;
 
@@ -336,15 +334,29 @@ public:
             {
                 matched_points.push_back(InputKeypoints[index]);
                 disparity_of_points.push_back(InputKeypoints[index].x - PyrLKmatched_points[index].x);
+                Keypoints_left.push_back(Keypoints_in[index]);
+                descriptors_left.push_back(descriptors_in.row(index));
             }
         }
 
-
-        //step 5, given pts2f, disps, R and t, compute mps
+        //step 4, given pts2f and disps, compute camera points
         Camera_pts_left = this->image2cam(matched_points, disparity_of_points);
-        cout<<"StereoImage2CamPoints 5"<<endl;
-        cout<<"KeyPoint size: "<<Keypoints_left.size()<<endl;
-        return true;
+        return !Keypoints_left.empty();
+    }
+
+
+    bool StereoImage2CamPoints(cv::Mat& image_left_rect,
+                               cv::Mat& image_right_rect,
+                               vector<cv::KeyPoint>& Keypoints_left,
+                               vector<cv::Point3f>& Camera_pts_left,
+                               cv::Mat& descriptors_left)
+    {
+        vector<cv::KeyPoint> keypoints;
+        cv::Mat descriptors;
+        this->image2KpAndDesp(image_left_rect, keypoints, descriptors);
+
+        return this->StereoFeatures2CamPoints(image_left_rect, image_right_rect, keypoints, descriptors,
+                                              Keypoints_left, Camera_pts_left, descriptors_left);
     }
 
 
@@ -372,14 +384,10 @@ public:
             mark.color.b = 0.0;
         }
 
-        cout<<"publish pose 1"<<endl;
-
         mark.pose.position.x = t.at<double> (0,0);
         mark.pose.position.y = t.at<double> (1,0);
         mark.pose.position.z = t.at<double> (2,0);
 
-        cout<<"publish pose 2"<<endl;
-
 //        mark.pose.orientation.x = quat.x();
 //        mark.pose.orientation.y = quat.y();
 //        mark.pose.orientation.z = quat.z();
@@ -416,8 +424,6 @@ public:
                       vector<cv::DMatch>& result_matches)
     {
 
-        cout<<"match2images 1"<<endl;
-
         //step 1, match raw desps
         std::vector<cv::DMatch> matches;
 
@@ -426,10 +432,6 @@ public:
 
         matcher.match(desps1, desps2, matches);
 
-        cout<<"desps1 shape: "<<desps1.size()<<endl;
-        cout<<"desps2 shape: "<<desps2.size()<<endl;
-        cout<<"match2Images 2: matches.size() "<<matches.size()<<endl;
-
         //step 2, find first bunch of good matches using desp distance
         double max_dist = 0;
         double min_dist = 100;
@@ -460,8 +462,6 @@ public:
             }
         }
 
-        cout<<"match2Images: good_matches.size() "<<good_matches.size()<<endl;
-
         if (good_matches.size()<8)
             return false;
 
@@ -477,16 +477,10 @@ public:
             good_kps_cur.push_back( kps2[good_matches[i].trainIdx].pt );
         }
 
-        cout<<"good_kps_old size: "<<good_kps_old.size()<<endl;
-        cout<<"good_kps_cur size: "<<good_kps_cur.size()<<endl;
-
         //step 3, use H to find second bunch of good matches
         cv::Mat isOutlierMask;
         cv::Mat fundamental_matrix = cv::findFundamentalMat(good_kps_old, good_kps_cur, cv::FM_RANSAC, 2, 0.995, isOutlierMask);
 
-        cout<<"isOutlierMask shape: "<<isOutlierMask.size()<<endl;
-        cout<<"isOutlierMask depth: "<<isOutlierMask.depth()<<endl;
-
         std::vector<cv::DMatch> final_good_matches;
         for(int i = 0; i<good_matches.size(); i++)
         {
@@ -498,8 +492,6 @@ public:
         }
 
 
-        cout<<"final_good_matches size: "<<final_good_matches.size()<<endl;
-
         // for findEssentialMat requirement
         if(final_good_matches.size()<8)
             return false;
@@ -515,6 +507,28 @@ public:
                   cv::Mat& result_R, cv::Mat& result_t)
     {
 
+        if(cur_image_left.empty())
+            return -1;
+
+        this->applyMask(cur_image_left);
+
+        vector<cv::KeyPoint> Keypoints_current_left;
+        cv::Mat descriptors_current_left;
+        this->image2KpAndDesp(cur_image_left, Keypoints_current_left, descriptors_current_left);
+
+        return this->solvePnP(old_image_left, old_image_right,
+                              cur_image_left, Keypoints_current_left, descriptors_current_left,
+                              R, t, result_R, result_t);
+    }
+
+
+    // same as above with the features of the (masked) current image already extracted
+    int solvePnP(cv::Mat old_image_left, cv::Mat old_image_right,
+                  cv::Mat cur_image_left, vector<cv::KeyPoint> Keypoints_current_left, cv::Mat descriptors_current_left,
+                  cv::Mat R, cv::Mat t,
+                  cv::Mat& result_R, cv::Mat& result_t)
+    {
+
         if(old_image_left.empty() || old_image_right.empty() ||
            cur_image_left.empty() ||
            R.empty() || t.empty())
@@ -525,7 +539,6 @@ public:
 
         this->applyMask(old_image_left);
         this->applyMask(old_image_right);
-        this->applyMask(cur_image_left);
 
 
         //step 1, given old stereo images, R and t, get kps, desps and mps of old frame
@@ -533,8 +546,6 @@ public:
         cv::Mat descriptors_old_left;
         vector<cv::Point3f> MapPoints_old;
 
-        cout<<"solve pnp 1: R and t: \n"<<R<<"\n"<<t<<endl;
-
         this->StereoImage2MapPoints(old_image_left,      //input
                                     old_image_right,     //input
                                     R, t,                //input
@@ -543,10 +554,7 @@ public:
                                     MapPoints_old);      //output MapPoints in world frame
 
 
-        //step 2, get kps and desps of current image
-        vector<cv::KeyPoint> Keypoints_current_left;
-        cv::Mat descriptors_current_left;
-        this->image2KpAndDesp(cur_image_left, Keypoints_current_left, descriptors_current_left);
+        //step 2, kps and desps of current image are given
 
 
         //for test , cv::CV_FM_8POINT
@@ -590,9 +598,6 @@ public:
         // --------------------------------------------------------------------------------------------------------------------------
 
 
-        cout<<"Fetched kps_cur_left size: "<<kps_cur_left.size()<<endl;
-        cout<<"Fetched mps_old size: "<<mps_old.size()<<endl;
-
         assert(mps_old.size() == kps_cur_left.size());
 
 
@@ -600,8 +605,6 @@ public:
         vector<cv::Point2f> image_pts_cur;
         cv::KeyPoint::convert(kps_cur_left, image_pts_cur);
 
-        cout<<"converted image_pts_cur size: "<<image_pts_cur.size()<<endl;
-
         cv::Mat rvec, tvec;
         cv::Mat intrinstic;
         cv::eigen2cv(this->K, intrinstic);
@@ -610,26 +613,30 @@ public:
         cv::Mat D = cv::Mat::zeros(4, 1, cv::DataType<double>::type);
 
 
-        cout<<"mps_old size(): "<<mps_old.size()<<endl;
-        cout<<"image_pts_cur size(): "<<image_pts_cur.size()<<endl;
-
         //SOLVEPNP_P3P
         //SOLVEPNP_UPNP
         //SOLVEPNP_AP3P
         //NOTE this could be a good indication of the result
         //http://answers.opencv.org/question/87546/solvepnp-fails-with-perfect-coordinates-and-cvposit-passes/
 
-        cv::Rodrigues(R, rvec);
-        cv::Rodrigues(t, tvec);
-
 //        cv::solvePnPRansac(mps_old, image_pts_cur, this->Kmat, cv::Mat(), rvec, tvec, true, 100, 0.02, 0.99, inliers);
 //        cv::solvePnPRansac(mps_old, image_pts_cur, this->Kmat, cv::Mat(), rvec, tvec, true, 100, 0.02, 0.99, inliers, cv::SOLVEPNP_P3P);
 //        cv::solvePnPRansac(mps_old, image_pts_cur, this->Kmat, cv::Mat(), rvec, tvec, false, 100, 0.02, 0.99, inliers, cv::SOLVEPNP_UPNP);
 //        cv::solvePnPRansac(mps_old, image_pts_cur, this->Kmat, cv::Mat(), rvec, tvec, false, 100, 1, 0.99, inliers, cv::SOLVEPNP_EPNP);
-        cv::solvePnPRansac(mps_old, image_pts_cur, this->Kmat, cv::Mat(), rvec, tvec, true, 100, 2, 0.99, inliers, cv::SOLVEPNP_EPNP);
+//        cv::solvePnPRansac(mps_old, image_pts_cur, this->Kmat, cv::Mat(), rvec, tvec, true, 100, 2, 0.99, inliers, cv::SOLVEPNP_EPNP);
+
+        // PROSAC by match distance, P3P and local optimization, stops as soon as the inlier ratio allows
+        vector<float> match_distances;
+        for(size_t i = 0; i < good_matches.size(); i++)
+            match_distances.push_back(good_matches[i].distance);
+
+        vector<int> inlier_indexes;
+        if(!this->pnp_ransac.estimate(mps_old, image_pts_cur, match_distances, this->Kmat, result_R, result_t, inlier_indexes))
+            return -1;
 
-        cv::Rodrigues (rvec, result_R);
-        result_t = tvec;
+        cv::Rodrigues (result_R, rvec);
+        tvec = result_t;
+        inliers = cv::Mat(inlier_indexes, true);
 
         cv::Mat homographyR = this->getRotationfromEssential(kps_old_left, kps_cur_left);
 
@@ -639,8 +646,6 @@ public:
 
         float distanceR = this->Vec3Distance(homographyRvec, rvec);
 
-        cout<<"distanceR is: "<<distanceR<<endl;
-
         float distanceT = this->Vec3Distance(t, tvec);
 
 
@@ -659,8 +664,6 @@ public:
         //if (distanceR < 10) // too many outliers, good recall.
         //if (distanceR < 4) // fewer outliers than before, good recall
         //if (distanceR < 1.0) // too strict
-        cout<<"(inliers.size()): "<<inliers<<endl;
-        cout<<"(inliers.size()).width and height are: "<<(inliers.size()).width<<", "<<(inliers.size()).height<<endl;
 
         if (distanceR < 4 && (inliers.size()).height > 0 && distanceT < 50)
             return (inliers.size()).height;
@@ -777,8 +780,6 @@ public:
                     +  abs(a.at<double>(1) - b.at<double>(1))
                     +  abs(a.at<double>(2) - b.at<double>(2));
 
-        cout<<"Vec3Distance result is: "<<result<<endl;
-
         return result;
     }
 
@@ -793,11 +794,8 @@ public:
 
         cv::Mat essential_mat = cv::findEssentialMat(pts1f, pts2f, focal_length, principal_point, cv::RANSAC);
 
-        cout<<"Recovered essential mat is: \n"<<essential_mat<<endl;
-
         cv::Mat R, t;
 
-        cout<<"Recover Rotation from essential mat, pts1f and pts2f size: "<<pts1f.size()<<", "<<pts2f.size()<<endl;
         cv::recoverPose(essential_mat, pts1f, pts2f, R, t, focal_length, principal_point);
 
         return R;
@@ -825,6 +823,11 @@ public:
 
     cv::Mat mMask;
 
+    // robust pose estimation, the scratch memory is kept from one retrieval to the next
+    PnPRansac pnp_ransac;     // 2d-3d
+    PnPRansac session_pnp_ransac; // 2d-3d of SceneRetriever::trackSession
+    RigidRansac rigid_ransac; // 3d-3d
+
     //for pose visualization
     size_t PoseId = 0;
 
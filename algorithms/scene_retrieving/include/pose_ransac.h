@@ -0,0 +1,174 @@
+#ifndef POSE_RANSAC_H
+#define POSE_RANSAC_H
+
+#include <random>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <opencv2/core.hpp>
+
+
+// report of the last estimation of a PoseRansac
+struct RansacStats
+{
+    int iterations = 0;
+    int local_optimizations = 0;
+    int inliers = 0;
+    double inlier_ratio = 0;
+};
+
+
+// PROSAC sampling (Chum and Matas 2005): the correspondences are sorted by quality, the samples are drawn from the best
+// ones first and the set they are drawn from grows with the iterations until it covers all of them
+class ProsacSampler
+{
+public:
+
+    void init(int point_count, int sample_size, int max_iterations);
+
+    void sample(std::vector<int>& sample_output, std::mt19937& rng);
+
+private:
+
+    int point_count = 0;
+    int sample_size = 0;
+    int iteration = 0;
+    int subset_size = 0;//the samples are drawn from the subset_size best points
+    double subset_samples = 0;//T_n, expected samples of the subset in uniform RANSAC
+    int subset_iteration = 0;//T'_n, iteration when the subset grows
+};
+
+
+// robust pose estimation sharing the PROSAC loop: hypotheses from minimal samples of the best correspondences first,
+// local optimization of each new best hypothesis on its inliers (LO-RANSAC) and termination once an outlier free sample
+// has been drawn with the confidence given. The scratch memory is kept from one call to the next
+class PoseRansac
+{
+public:
+
+    struct Options
+    {
+        double threshold = 2.0;//inlier error, pixels for PnPRansac and scene units for RigidRansac
+        double confidence = 0.99;
+        int max_iterations = 1000;
+        int local_optimization_steps = 5;//refine and count the inliers again, while they increase
+        int min_inliers = 8;
+    };
+
+    virtual ~PoseRansac() {}
+
+    const RansacStats& stats() const
+    {
+        return this->last_stats;
+    }
+
+    Options options;
+
+protected:
+
+    // runs the loop over point_count sorted correspondences. R and t are set if it succeeds, inliers_output are
+    // indexes of the input (see order)
+    bool run(int point_count, int sample_size, Eigen::Matrix3d& R, Eigen::Vector3d& t, std::vector<int>& inliers_output);
+
+    // correspondences in this->order by increasing match distance, in the order given if match_distances is empty
+    void sortByQuality(int point_count, const std::vector<float>& match_distances);
+
+    // poses of a sample of sorted correspondences
+    virtual void solveMinimal(const std::vector<int>& sample, std::vector<Eigen::Matrix3d>& Rs, std::vector<Eigen::Vector3d>& ts) = 0;
+
+    // pose from all the inliers, R and t are the hypothesis to refine. False if it can not be computed
+    virtual bool solveNonMinimal(const std::vector<int>& inliers, Eigen::Matrix3d& R, Eigen::Vector3d& t) = 0;
+
+    virtual bool isInlier(int index, const Eigen::Matrix3d& R, const Eigen::Vector3d& t) const = 0;
+
+    int countInliers(int point_count, const Eigen::Matrix3d& R, const Eigen::Vector3d& t, std::vector<int>& inliers) const;
+
+    // indexes of the input correspondences, the best first
+    std::vector<int> order;
+
+    RansacStats last_stats;
+
+private:
+
+    ProsacSampler sampler;
+    std::mt19937 rng;
+    std::vector<int> sample;
+    std::vector<int> inliers;
+    std::vector<int> best_inliers;
+    std::vector<Eigen::Matrix3d> hypothesis_R;
+    std::vector<Eigen::Vector3d> hypothesis_t;
+    std::vector<std::pair<float, int> > sort_buffer;
+};
+
+
+// camera pose from scene points and their image points: P3P (Grunert) on 3 points of a sample of 4, the fourth selects
+// the solution. The local optimization is a Gauss-Newton minimization of the reprojection error
+class PnPRansac: public PoseRansac
+{
+public:
+
+    // K: 3x3 camera matrix. R_output and t_output (CV_64F) take the scene points to the camera frame, inliers_output
+    // are indexes of the input
+    bool estimate(const std::vector<cv::Point3f>& points3d, const std::vector<cv::Point2f>& points2d,
+                  const std::vector<float>& match_distances, const cv::Mat& K,
+                  cv::Mat& R_output, cv::Mat& t_output, std::vector<int>& inliers_output);
+
+    // up to 4 poses (scene to camera) from 3 scene points and their unit bearing vectors
+    static int solveP3P(const Eigen::Vector3d* points, const Eigen::Vector3d* bearings,
+                        Eigen::Matrix3d* Rs, Eigen::Vector3d* ts);
+
+protected:
+
+    virtual void solveMinimal(const std::vector<int>& sample, std::vector<Eigen::Matrix3d>& Rs, std::vector<Eigen::Vector3d>& ts);
+
+    virtual bool solveNonMinimal(const std::vector<int>& inliers, Eigen::Matrix3d& R, Eigen::Vector3d& t);
+
+    virtual bool isInlier(int index, const Eigen::Matrix3d& R, const Eigen::Vector3d& t) const;
+
+private:
+
+    double reprojectionError2(int index, const Eigen::Matrix3d& R, const Eigen::Vector3d& t) const;
+
+    // sorted correspondences
+    std::vector<Eigen::Vector3d> points;
+    std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d> > pixels;
+    std::vector<Eigen::Vector3d> bearings;
+    double fx = 1, fy = 1, cx = 0, cy = 0;
+};
+
+
+// rigid transform between two sets of 3d points (e.g. camera points of two stereo frames): Umeyama (without scale) on
+// samples of 3 points, and on all the inliers for the local optimization
+class RigidRansac: public PoseRansac
+{
+public:
+
+    RigidRansac()
+    {
+        this->options.threshold = 0.2;
+    }
+
+    // R_output and t_output (CV_64F) take the source points to the target ones
+    bool estimate(const std::vector<cv::Point3f>& source, const std::vector<cv::Point3f>& target,
+                  const std::vector<float>& match_distances,
+                  cv::Mat& R_output, cv::Mat& t_output, std::vector<int>& inliers_output);
+
+protected:
+
+    virtual void solveMinimal(const std::vector<int>& sample, std::vector<Eigen::Matrix3d>& Rs, std::vector<Eigen::Vector3d>& ts);
+
+    virtual bool solveNonMinimal(const std::vector<int>& inliers, Eigen::Matrix3d& R, Eigen::Vector3d& t);
+
+    virtual bool isInlier(int index, const Eigen::Matrix3d& R, const Eigen::Vector3d& t) const;
+
+private:
+
+    // sorted correspondences
+    std::vector<Eigen::Vector3d> source_points;
+    std::vector<Eigen::Vector3d> target_points;
+    Eigen::Matrix3Xd source_matrix;
+    Eigen::Matrix3Xd target_matrix;
+};
+
+#endif
@@ -5,6 +5,7 @@
 
 #include <boost/serialization/split_member.hpp>
 #include <boost/serialization/serialization.hpp>
+#include <boost/serialization/version.hpp>
 
 #include <boost/serialization/map.hpp>
 #include <boost/serialization/vector.hpp>
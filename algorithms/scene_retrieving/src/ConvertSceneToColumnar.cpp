@@ -0,0 +1,31 @@
+
+#include <iostream>
+#include <cstring>
+
+#include "scene_retrieve.h"
+
+
+using namespace std;
+
+//converts a scene saved by Scene::saveFile to the columnar file that Scene::loadFile maps,
+//so a SceneRetriever reads only the frames it uses.
+int main(int argc,char** argv)
+{
+    if (argc < 3)
+    {
+        cout<<"Usage: ConvertSceneToColumnar input_scene_file output_scene_file [--quantize]"<<endl;
+        cout<<"  --quantize: store the 3d points in int16 instead of float32."<<endl;
+        return -1;
+    }
+    const bool quantize = argc > 3 && strcmp(argv[3], "--quantize") == 0;
+
+    Scene scene;
+    scene.loadFile(argv[1]);
+    if (!scene.saveColumnarFile(argv[2], quantize))
+    {
+        cout<<"Can not write "<<argv[2]<<endl;
+        return -1;
+    }
+    cout<<"Wrote "<<scene.getImageCount()<<" frames to "<<argv[2]<<endl;
+    return 0;
+}
@@ -1,242 +1,508 @@
 
 #include <iostream>
-///#include <io.h>
-#include <math.h>
-#include <Eigen/Core>
-#include <opencv2/core/eigen.hpp>
+#include <fstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <unordered_map>
 #include <opencv2/opencv.hpp>
 
 
-#include <math.h>
-
-
 //add scene retrieving.
-#include "scene_retrieve.h"
-#include "LoopClosingManager.h"
+#include "scene_columns.h"
 #include "nlohmann/json.hpp"
 
 
 using namespace std;
 using namespace nlohmann;
-//Scene Pointer
-//Scene* pScene = NULL;
 
-cv::Ptr<cv::ORB> orb;
-void ExtractFeaturesFromCertainKeyPoints(const cv::Mat& img_in,const vector<cv::Point2f> kps_in,vector<cv::Mat>& desp_output)
+//shots made at once by each thread, see MakeSceneFromPath.
+const int FRAMES_PER_THREAD = 4;
+
+
+//body of cv::parallel_for_ calling f(i) for each index of the range.
+template <class F>
+class ParallelRange: public cv::ParallelLoopBody
+{
+public:
+    explicit ParallelRange(const F& f): f(f) {}
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        for (int i = range.start; i < range.end; i++)
+            f(i);
+    }
+
+private:
+    const F& f;
+};
+
+
+//integer of a whole string, false if it is not one.
+static bool parseId(const string& str, long& id)
 {
-    //reference loop closing manager,extract orb feature of these points.
-    cv::Mat gray;
-    cv::Mat desp;
-    cv::cvtColor(img_in,gray,cv::COLOR_RGB2GRAY);
-    vector<cv::KeyPoint> kp_vec;
-    cv::KeyPoint::convert(kps_in,kp_vec);
-    orb->compute(gray,kp_vec,desp);
-    cout<<"kps_in.size():"<<kps_in.size()<<"\tdesp.rows:"<<desp.rows<<endl;
-    desp_output.resize(desp.rows);
-    for(int r=0;r<desp.rows;r++) desp_output[r]=desp.rowRange(r,r+1).clone();
-    return;
+    char* end = nullptr;
+    id = std::strtol(str.c_str(), &end, 10);
+    return !str.empty() && *end == '\0';
 }
 
 
-std::shared_ptr<Scene> MakeSceneFromPath(const string& path)
+//sax handler passing the numbers of a json file to number(), without building the document.
+//path holds the keys of the open containers ("" for the elements of an array), indices their index in their parent.
+//strings holding a number (the coordinates of the feature files) are numbers too.
+class JsonNumberReader: public json_sax<json>
 {
-    std::shared_ptr<Scene> pScene(new Scene());
-    LoopClosingManager lcm();
-    //step<1> parse json.
-    string jsonpath(path.c_str());
-    jsonpath += "/reconstruction.json";
-    cout<<"Using json path: "<<jsonpath<<endl;
-    
-    std::ifstream ifstr_json( jsonpath);
-    
-//     std::ifstream ifstr_json( jsonpath.c_str() );
-    
-    json reconstruction_j;
-    
-    
-    ifstr_json >> reconstruction_j;
-    
-    
-    auto shots = reconstruction_j[0]["shots"];
-
-    auto img2Rotation = new map<string, cv::Mat>;
-    auto img2Translation = new map<string, cv::Mat>;
-    
-
-    for (json::iterator it = shots.begin(); it != shots.end(); ++it) 
-    {
-        cv::Mat rotation_mat,translation_mat;
-        string img_filename = it.key();
-        cv::Mat rvec(1,3,CV_32F);
-        rvec.at<float>(0,0) = (float)shots[img_filename]["rotation"][0].get<double>();
-        rvec.at<float>(0,1) = (float)shots[img_filename]["rotation"][1].get<double>();
-        rvec.at<float>(0,2) = (float)shots[img_filename]["rotation"][2].get<double>();
-        cv::Rodrigues(rvec,rotation_mat); // get 3x3 rotation mat.
-
-        //cv::Mat cur_image;
-        //cv::imread(path+"images"+img_filename,cur_image);
-        //ptr_frameinfo p = lcm.extractFeature(cur_image);
-        (*img2Rotation)[img_filename] = rotation_mat;
-        (*img2Translation)[img_filename] = translation_mat;
-        //std::cout << it.key() << " : " << it.value() << "\n";
-    }
-    
-    cout<<"??? 6"<<endl;
-    
-    //step<2> build graph,do triangulate via these features.Load "features/xxxnpz and get keypoints info."
-    map<string, vector<cv::Mat> >* pMapdesp = new map<string, vector<cv::Mat> >;
-    map<string, vector<cv::Mat> >& img2kpDesps = *pMapdesp;
-    //map<string, vector<cv::Mat> > img2kpDesps;// = *pMapdesp;    
-    
-    //map<string, vector<cv::KeyPoint> >* pMap2d = new map<string, vector<cv::KeyPoint> >;
-    //map<string, vector<cv::KeyPoint> > &img2Kp2Ds = *pMap2d;
-    map<string, vector<cv::KeyPoint> > img2Kp2Ds;
-    
-    map<string,vector<cv::Point3d> >* pMap3d = new map<string,vector<cv::Point3d> >; 
-    map<string,vector<cv::Point3d>> &img2Kp3ds = *pMap3d;
-    for(json::iterator it = shots.begin();it!=shots.end();++it)
-    {
-        string img_filename = it.key();
-        std::ifstream ifstr_img_keypoints_json((path+"/features/"+img_filename+".npz.json").c_str());
-        json img_kp_json;
-        ifstr_img_keypoints_json>> img_kp_json;
-        vector<cv::Point2f> kps;
-        vector<cv::Mat> current_img_desps;
-        for(json::iterator it2 = img_kp_json.begin();it2!=img_kp_json.end();++it2)
+public:
+
+    virtual ~JsonNumberReader() {}
+
+    bool null() override
+    {
+        this->element();
+        return true;
+    }
+
+    bool boolean(bool) override
+    {
+        this->element();
+        return true;
+    }
+
+    bool number_integer(number_integer_t val) override
+    {
+        this->number(val, this->element());
+        return true;
+    }
+
+    bool number_unsigned(number_unsigned_t val) override
+    {
+        this->number(val, this->element());
+        return true;
+    }
+
+    bool number_float(number_float_t val, const string_t&) override
+    {
+        this->number(val, this->element());
+        return true;
+    }
+
+    bool string(string_t& val) override
+    {
+        int index = this->element();
+        char* end = nullptr;
+        double number = std::strtod(val.c_str(), &end);
+        if (!val.empty() && *end == '\0')
+            this->number(number, index);
+        return true;
+    }
+
+    bool start_object(std::size_t) override
+    {
+        this->open();
+        return true;
+    }
+
+    bool key(string_t& val) override
+    {
+        this->next_key = val;
+        return true;
+    }
+
+    bool end_object() override
+    {
+        this->close();
+        return true;
+    }
+
+    bool start_array(std::size_t) override
+    {
+        this->open();
+        return true;
+    }
+
+    bool end_array() override
+    {
+        this->close();
+        return true;
+    }
+
+    bool parse_error(std::size_t position, const std::string&, const detail::exception& ex) override
+    {
+        cout<<"Json parse error at "<<position<<": "<<ex.what()<<endl;
+        return false;
+    }
+
+protected:
+
+    //a number at index of its array (0 in an object), the containers it is in are in path.
+    virtual void number(double value, int index) = 0;
+
+    std::vector<std::string> path;
+    std::vector<int> indices;
+
+private:
+
+    //index of the next value of the current container.
+    int element()
+    {
+        this->next_key.clear();
+        if (this->counts.empty())
+            return 0;
+        return this->counts.back()++;
+    }
+
+    void open()
+    {
+        std::string key;
+        key.swap(this->next_key);
+        this->indices.push_back(this->element());
+        this->path.push_back(key);
+        this->counts.push_back(0);
+    }
+
+    void close()
+    {
+        this->path.pop_back();
+        this->indices.pop_back();
+        this->counts.pop_back();
+    }
+
+    std::string next_key;
+    std::vector<int> counts;
+};
+
+
+struct ShotPose
+{
+    double rotation[3] = {0, 0, 0};//angle axis, world to camera.
+    double translation[3] = {0, 0, 0};
+};
+
+
+//poses of the shots and coordinates of the points of the first reconstruction of reconstruction.json.
+class ReconstructionReader: public JsonNumberReader
+{
+public:
+
+    map<std::string, ShotPose> shots;//by image name, the frames of the scene follow its order.
+    unordered_map<long, cv::Point3d> points;//by track id.
+
+protected:
+
+    //[ {"shots": {name: {"rotation": [...], "translation": [...]}}, "points": {id: {"coordinates": [...]}}}, ... ]
+    void number(double value, int index) override
+    {
+        if (this->path.size() != 5 || this->indices[1] != 0 || index >= 3)
+            return;
+
+        if (this->path[2] == "shots")
+        {
+            if (this->path[4] == "rotation")
+                this->shots[this->path[3]].rotation[index] = value;
+            else if (this->path[4] == "translation")
+                this->shots[this->path[3]].translation[index] = value;
+        }
+        else if (this->path[2] == "points" && this->path[4] == "coordinates")
         {
-            string point_index = it2.key();//make keypoints.
-            string keypoint_x_str,keypoint_y_str;
-	    /*for(json::iterator it_inner = img_kp_json[point_index].begin();it_inner!=img_kp_json[point_index].end();++it_inner)
-	    {
-	      cout<<"Inner object:"<<*it_inner;
-	    }*/
-            keypoint_x_str = img_kp_json[point_index][0].get<string>();
-            keypoint_y_str = img_kp_json[point_index][1].get<string>();
-	    float kpx,kpy;
-	    kpx = std::stof(keypoint_x_str);
-	    kpy = std::stof(keypoint_y_str);
-	    //cout<<"kpx,kpy:"<<kpx<<" "<<kpy<<endl;
-            kps.push_back(cv::Point2f(kpx,kpy));
+            long track_id;
+            if (!parseId(this->path[3], track_id))
+                return;
+            cv::Point3d& p = this->points[track_id];
+            if (index == 0)
+                p.x = value;
+            else if (index == 1)
+                p.y = value;
+            else
+                p.z = value;
         }
-        cv::Mat curr_img = cv::imread(path+"/images/"+img_filename);
-        ExtractFeaturesFromCertainKeyPoints(curr_img,kps,current_img_desps);
-        img2kpDesps[img_filename] = current_img_desps;
-	/*
-	std::vector<cv::KeyPoint> *kps_ = new vector<cv::KeyPoint>;
-	cv::KeyPoint::convert(kps,*kps_);
-        img2Kp2Ds[img_filename] = *kps_;*/
-	std::vector<cv::KeyPoint> kps_;
-	cv::KeyPoint::convert(kps,kps_);
-        img2Kp2Ds[img_filename] = kps_;
-	
-        img2Kp3ds[img_filename] = vector<cv::Point3d>();
-        img2Kp3ds[img_filename].resize(img2Kp2Ds[img_filename].size());
-    }
-    //step<3>.Get 3d position of these points,and make a frame of scene.
-    //open undistorted_tracks.csv. actually it's a tsv file.
-    ifstream track_ifstr((path+"/undistorted_tracks.csv").c_str());
-    vector<vector <string> >fields;
-    string line;
-    while(getline(track_ifstr,line))
-    {
-        stringstream sep(line);
-        string field;
-        fields.push_back(vector<string>());
-        while(getline(sep,field,'\t'))
+    }
+};
+
+
+//keypoints of a features/xxx.npz.json file: {feature id: [x, y, ...]}.
+class FeatureReader: public JsonNumberReader
+{
+public:
+
+    std::vector<cv::Point2f> keypoints;//by feature id.
+
+protected:
+
+    void number(double value, int index) override
+    {
+        long feature_id;
+        if (this->path.size() != 2 || index >= 2 || !parseId(this->path[1], feature_id) || feature_id < 0)
+            return;
+
+        if ((size_t)feature_id >= this->keypoints.size())
+            this->keypoints.resize(feature_id + 1);
+        if (index == 0)
+            this->keypoints[feature_id].x = value;
+        else
+            this->keypoints[feature_id].y = value;
+    }
+};
+
+
+//a feature of a shot and the reconstructed point of its track.
+struct Observation
+{
+    int feature_id;
+    cv::Point3d point;
+};
+
+
+//streams the track file, a line is "image \t track id \t feature id \t ...". Keeps the observations of the
+//reconstructed points, by shot.
+static bool loadObservations(const string& project_path, const ReconstructionReader& reconstruction,
+                             const vector<string>& shot_names, vector<vector<Observation> >& observations)
+{
+    ifstream track_ifstr((project_path+"/undistorted_tracks.csv").c_str());
+    if (!track_ifstr)
+        track_ifstr.open((project_path+"/tracks.csv").c_str());
+    if (!track_ifstr)
+    {
+        cout<<"Can not open the tracks of "<<project_path<<endl;
+        return false;
+    }
+
+    unordered_map<string, int> shot_index;
+    for (size_t i = 0; i < shot_names.size(); i++)
+        shot_index[shot_names[i]] = i;
+    observations.assign(shot_names.size(), vector<Observation>());
+
+    size_t line_count = 0, observation_count = 0;
+    string line, img_filename;
+    while (getline(track_ifstr, line))
+    {
+        size_t tab = line.find('\t');
+        if (tab == string::npos)
+            continue;//the version line of recent OpenSfM.
+        line_count++;
+
+        img_filename.assign(line, 0, tab);
+        auto shot = shot_index.find(img_filename);
+        if (shot == shot_index.end())
+            continue;//this image is not inside of reconstruction[0].
+
+        const char* fields = line.c_str() + tab + 1;
+        char* end = nullptr;
+        long track_id = std::strtol(fields, &end, 10);
+        if (end == fields || *end != '\t')
+            continue;
+        fields = end + 1;
+        long feature_id = std::strtol(fields, &end, 10);
+        if (end == fields || feature_id < 0)
+            continue;
+
+        auto point = reconstruction.points.find(track_id);
+        if (point == reconstruction.points.end())
+            continue;//is a outlier.
+
+        observations[shot->second].push_back(Observation{(int)feature_id, point->second});
+        observation_count++;
+    }
+    cout<<"Tracks: "<<line_count<<" observations, "<<observation_count<<" of reconstructed points."<<endl;
+    return true;
+}
+
+
+//frame of a shot: ORB descriptors of its observed keypoints, their 3d points and the camera to world pose.
+//false if its keypoints or its image can not be read.
+static bool makeFrame(const string& project_path, const string& img_filename, const ShotPose& pose,
+                      const vector<Observation>& observations, SceneColumns::Frame& frame)
+{
+    FeatureReader features;
+    std::ifstream ifstr_img_keypoints_json((project_path+"/features/"+img_filename+".npz.json").c_str());
+    if (!ifstr_img_keypoints_json || !json::sax_parse(ifstr_img_keypoints_json, &features))
+        return false;
+
+    //the class id is the observation until the descriptors are computed, as ORB drops the keypoints near the border.
+    vector<cv::KeyPoint> keypoints;
+    keypoints.reserve(observations.size());
+    for (size_t i = 0; i < observations.size(); i++)
+    {
+        const int feature_id = observations[i].feature_id;
+        if ((size_t)feature_id < features.keypoints.size())
         {
-            fields.back().push_back(field);
+            const cv::Point2f& pt = features.keypoints[feature_id];
+            keypoints.push_back(cv::KeyPoint(pt.x, pt.y, 1, -1, 0, 0, i));
         }
     }
-    std::map<string,std::vector<int> > map_index_with_3d_pos;
-    const auto &points_obj = reconstruction_j[0]["points"];
-    for(int line_index=0;line_index<fields.size();line_index++) // traverse all tracks to find point 3d coordinate.
-    {
-        vector<string>& curr_line = fields[line_index];
-        string img_filename,track_id_str,feature_id_str;
-        int track_id,feature_id;
-        img_filename = curr_line[0];
-        track_id_str = curr_line[1];
-        feature_id_str = curr_line[2];
-        track_id = std::stoi(track_id_str);
-        feature_id = std::stoi(feature_id_str);
-	//string px,py,pz;
-	cout<<endl;
-	cout<<"curr_line[0]:"<<curr_line[0]<<endl;
-        cout<<"at line_index:"<<line_index<<endl;
-	cout<<"track_id:"<<track_id_str<<endl;
-	cout<<"feature_id:"<<feature_id_str<<endl;
-	//auto z = reconstruction_j[0];
-	//auto a = reconstruction_j[0]["points"];
-	cout <<"bb"<<endl;
-	//auto b = reconstruction_j[0]["points"][track_id_str];
-	cout <<"cc"<<endl;
-	//auto c = reconstruction_j[0]["points"][track_id_str]["coordinates"];
-        cout <<"0"<<endl;
-
-	if(points_obj.find(track_id_str)==points_obj.end() )
-	{
-	  //is a outlier.
-	  cout <<"is a outlier"<<endl;
-	  continue;
-	}
-	else
-	{
-	  cout<<"is a inlier!"<<endl;
-	}
-	double px = reconstruction_j[0]["points"][track_id_str]["coordinates"][0].get<double>();
-	cout<<"1"<<endl;
-	double py = reconstruction_j[0]["points"][track_id_str]["coordinates"][1].get<double>();
-	cout<<"2"<<endl;
-	double pz = reconstruction_j[0]["points"][track_id_str]["coordinates"][2].get<double>();
-	cout<<"3"<<endl;
-	cout <<"img2Kp3ds[img_filename].size:"<<img2Kp3ds[img_filename].size()<<"\timg2Kp2Ds[img_filename].size():"<<img2Kp2Ds[img_filename].size()<<endl;
-	if(img2Kp2Ds[img_filename].size() == 0)
-	{
-	  cout <<"this image is not inside of reconstruction[0],ignored!"<<endl;
-	  continue;
-	}
-        img2Kp3ds[img_filename][feature_id] = cv::Point3d(px,py,pz);
-	
-	cout<<"point added!"<<endl;
-	//map_index_with_3d_pos[img_filename].push_back(feature_id);//Unused now.
-    }
-    cout<<"3d points loaded."<<endl;
-    for (json::iterator it = shots.begin(); it != shots.end(); ++it)
-    {
-        //cv::Mat rotation_mat,translation_mat;
-        string img_filename = it.key();
-        cv::Mat temp_desp_mat(img2kpDesps[img_filename].size(),//rows
-                    32,//cols
-                        0
-        );
-        cout<<"temp_desp_mat:"<<temp_desp_mat.cols<<"|"<<temp_desp_mat.rows<<endl;
-        cout<<"Image:"<<img_filename<<img2kpDesps[img_filename].size()<<";"<<img2kpDesps[img_filename][0].rows<<","<<img2kpDesps[img_filename][0].cols<<endl;
-        
-        for(int index = 0;index< img2kpDesps[img_filename].size();index++)
+
+    cv::Mat gray = cv::imread(project_path+"/images/"+img_filename, cv::IMREAD_GRAYSCALE);
+    if (gray.empty())
+        return false;
+    cv::Ptr<cv::ORB> orb = cv::ORB::create();
+    orb->compute(gray, keypoints, frame.descriptors);
+
+    frame.keypoints = keypoints;
+    frame.points3d.resize(keypoints.size());
+    for (size_t i = 0; i < keypoints.size(); i++)
+    {
+        const Observation& observation = observations[keypoints[i].class_id];
+        frame.points3d[i] = observation.point;
+        frame.keypoints[i].class_id = observation.feature_id;
+    }
+
+    //OpenSfM poses take the world to the camera, the scene frames keep the camera to world rotation and the center.
+    cv::Mat rvec = (cv::Mat_<double>(3,1) << pose.rotation[0], pose.rotation[1], pose.rotation[2]);
+    cv::Mat tvec = (cv::Mat_<double>(3,1) << pose.translation[0], pose.translation[1], pose.translation[2]);
+    cv::Mat rotation_mat;
+    cv::Rodrigues(rvec, rotation_mat);
+    frame.R = rotation_mat.t();
+    frame.t = -frame.R * tvec;
+    return true;
+}
+
+
+//frames made and not written yet, kept in a temporary file so that only a batch of them is in memory.
+class FrameSpill
+{
+public:
+
+    explicit FrameSpill(const string& filename): filename(filename)
+    {
+        this->file.open(filename.c_str(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    }
+
+    ~FrameSpill()
+    {
+        this->file.close();
+        std::remove(this->filename.c_str());
+    }
+
+    bool good() const
+    {
+        return this->file.good();
+    }
+
+    size_t size() const
+    {
+        return this->offsets.size();
+    }
+
+    void append(const SceneColumns::Frame& frame)
+    {
+        this->file.seekp(0, std::ios::end);
+        this->offsets.push_back(this->file.tellp());
+
+        cv::Mat descriptors = frame.descriptors.isContinuous() ? frame.descriptors : frame.descriptors.clone();
+        int32_t counts[4] = {(int32_t)frame.keypoints.size(), descriptors.rows, descriptors.cols, descriptors.type()};
+        this->file.write((const char*)counts, sizeof(counts));
+        this->file.write((const char*)frame.keypoints.data(), frame.keypoints.size() * sizeof(cv::KeyPoint));
+        this->file.write((const char*)frame.points3d.data(), frame.points3d.size() * sizeof(cv::Point3d));
+        this->file.write((const char*)descriptors.data, descriptors.total() * descriptors.elemSize());
+        this->file.write((const char*)frame.R.ptr<double>(), 9 * sizeof(double));
+        this->file.write((const char*)frame.t.ptr<double>(), 3 * sizeof(double));
+    }
+
+    void read(size_t index, SceneColumns::Frame& frame)
+    {
+        this->file.seekg(this->offsets[index]);
+
+        int32_t counts[4] = {0, 0, 0, 0};
+        this->file.read((char*)counts, sizeof(counts));
+        frame.keypoints.resize(counts[0]);
+        frame.points3d.resize(counts[0]);
+        frame.descriptors.create(counts[1], counts[2], counts[3]);
+        frame.R.create(3, 3, CV_64F);
+        frame.t.create(3, 1, CV_64F);
+        this->file.read((char*)frame.keypoints.data(), frame.keypoints.size() * sizeof(cv::KeyPoint));
+        this->file.read((char*)frame.points3d.data(), frame.points3d.size() * sizeof(cv::Point3d));
+        this->file.read((char*)frame.descriptors.data, frame.descriptors.total() * frame.descriptors.elemSize());
+        this->file.read((char*)frame.R.ptr<double>(), 9 * sizeof(double));
+        this->file.read((char*)frame.t.ptr<double>(), 3 * sizeof(double));
+    }
+
+private:
+
+    string filename;
+    std::fstream file;
+    vector<std::streamoff> offsets;
+};
+
+
+//converts an OpenSfM reconstruction to a columnar scene: reconstruction.json and the track file are streamed, the
+//shots are made in parallel batches and written frame by frame.
+static bool MakeSceneFromPath(const string& project_path, const string& output_path, bool quantize)
+{
+    //step<1> poses of the shots and the points, reconstruction[0] only.
+    string jsonpath = project_path + "/reconstruction.json";
+    cout<<"Using json path: "<<jsonpath<<endl;
+    std::ifstream ifstr_json(jsonpath);
+    ReconstructionReader reconstruction;
+    if (!ifstr_json || !json::sax_parse(ifstr_json, &reconstruction))
+    {
+        cout<<"Can not read "<<jsonpath<<endl;
+        return false;
+    }
+    cout<<"Reconstruction: "<<reconstruction.shots.size()<<" shots, "<<reconstruction.points.size()<<" points."<<endl;
+
+    vector<string> shot_names;
+    vector<const ShotPose*> shot_poses;
+    for (const auto& shot: reconstruction.shots)
+    {
+        shot_names.push_back(shot.first);
+        shot_poses.push_back(&shot.second);
+    }
+
+    //step<2> the observed 3d points of each shot.
+    vector<vector<Observation> > observations;
+    if (!loadObservations(project_path, reconstruction, shot_names, observations))
+        return false;
+    reconstruction.points.clear();
+
+    //step<3> frames of the shots, the descriptors are extracted at their keypoints. The frames of a batch are made in
+    //parallel then moved to the spill file, only a batch of them is in memory.
+    FrameSpill spill(output_path + ".frames.tmp");
+    if (!spill.good())
+    {
+        cout<<"Can not open "<<output_path<<".frames.tmp"<<endl;
+        return false;
+    }
+    const int batch_size = std::max(cv::getNumThreads(), 1) * FRAMES_PER_THREAD;
+    for (int batch_start = 0; batch_start < (int)shot_names.size(); batch_start += batch_size)
+    {
+        const int batch_end = std::min(batch_start + batch_size, (int)shot_names.size());
+        vector<SceneColumns::Frame> frames(batch_end - batch_start);
+        vector<char> frame_valid(frames.size(), 0);
+        auto make_frame = [&](int i)
+        {
+            frame_valid[i] = makeFrame(project_path, shot_names[batch_start + i], *shot_poses[batch_start + i],
+                                       observations[batch_start + i], frames[i]);
+            vector<Observation>().swap(observations[batch_start + i]);
+        };
+        cv::parallel_for_(cv::Range(0, (int)frames.size()), ParallelRange<decltype(make_frame)>(make_frame), (double)frames.size());
+
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            if (frame_valid[i])
+                spill.append(frames[i]);
+            else
+                cout<<"Can not read the keypoints or the image of "<<shot_names[batch_start + i]<<", ignored!"<<endl;
+        }
+        if (!spill.good())
         {
-            cout<<"index:"<<index<<endl;
-            cv::Mat& temp = img2kpDesps[img_filename][index];
-            cout<<temp.cols<<"|"<<temp.rows<<endl;
-            //temp_desp_mat.rowRange(index,index+1) = img2kpDesps[img_filename][index].row(0);//img2kpDesps[img_filename][index].rowRange(0,1);//.clone();
-            temp_desp_mat.row(index) = img2kpDesps[img_filename][index].row(0);//img2kpDesps[img_filename][index].rowRange(0,1);//.clone();
+            cout<<"Can not write "<<output_path<<".frames.tmp"<<endl;
+            return false;
         }
-    
-        //NOTE method 1, this will serialize kps, mps and desp;
-        //pScene->addFrame(img2Kp2Ds[img_filename], img2Kp3ds[img_filename], temp_desp_mat.clone());
-        
-        //NOTE method 2, this will serialize kps, mps, desps, R and t
-        cv::Mat R = (cv::Mat_<double>(3,3) << 0, -1.1, 0, -1.2, 5.3, -1.4, 0, -1.5, 0);
-        cv::Mat T = (cv::Mat_<double>(1,3) << 0, -1.5, 0);
-        cout<<"Current R and T are: "<<endl<<R<<endl<<T<<endl;
-        
-        pScene->addFrame(img2Kp2Ds[img_filename], img2Kp3ds[img_filename], temp_desp_mat.clone(), R, T);
-        
-        
-    }
-    //step<4>.See if this scene has scale factor.
-    
+        cout<<"Made "<<batch_end<<"/"<<shot_names.size()<<" shots."<<endl;
+    }
+
+    //step<4> write the scene, the frames are read back one at a time on both passes of the writer.
     //pScene->hasScale = false;// for default.
-    return pScene;
+    bool written = SceneColumns::write(output_path, spill.size(), false, quantize,
+        [&spill](size_t index, SceneColumns::Frame& frame)
+        {
+            spill.read(index, frame);
+        });
+    if (written)
+        cout<<"Wrote "<<spill.size()<<" frames to "<<output_path<<endl;
+    return written;
 }
 
 
@@ -246,15 +512,21 @@ int main(int argc,char** argv)
     cout<<"CAUTION:Do not forget set opensfm config feature_type to 'ORB'."<<endl;
     if(argc<3)
     {
-        cout<<"Usage: MakeSceneFromOpenSfMModel OpenSfM_project_dir voc_path"<<endl;
+        cout<<"Usage: MakeSceneFromOpenSfMModel OpenSfM_project_dir voc_path [output_scene_file] [--quantize]"<<endl;
+        cout<<"  output_scene_file: scene.scene by default, a columnar scene file (see ConvertSceneToColumnar)."<<endl;
+        cout<<"  --quantize: store the 3d points in int16 instead of float32."<<endl;
         return -1;
     }
     string project_path(argv[1]);
     string voc_path(argv[2]);
-    orb = cv::ORB::create();
-    std::shared_ptr<Scene>* pp;
-    pp = new std::shared_ptr<Scene>;
-    *pp= MakeSceneFromPath(project_path);
-    (*pp)->saveFile("scene.scene");
-    return 0;
+    string output_path("scene.scene");
+    bool quantize = false;
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--quantize") == 0)
+            quantize = true;
+        else
+            output_path = argv[i];
+    }
+    return MakeSceneFromPath(project_path, output_path, quantize) ? 0 : -1;
 }
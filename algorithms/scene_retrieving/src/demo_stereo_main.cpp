@@ -66,6 +66,9 @@ int main(int argc,char** argv)
     pSceneRetriever->setImageVecPath(left_image_path, 1);
     pSceneRetriever->setImageVecPath(right_image_path, 0);
 
+    // camera points of the scene frames, computed once and saved in the scene file
+    pSceneRetriever->buildCamPoints(scene_path);
+
 
     // test case for stereo image
     int recalled_result=0;
@@ -0,0 +1,180 @@
+#include "geo_scene_index.h"
+#include "gps_utils.h"
+
+#include <set>
+
+
+static pcl::PointXYZ ecefPoint(double longitude,double latitude)
+{
+    double x,y,z;
+    GPS_Utils::lon_lat_to_ecef(longitude,latitude,x,y,z);
+    pcl::PointXYZ p;
+    p.x = x;
+    p.y = y;
+    p.z = z;
+    return p;
+}
+
+GeoSceneIndex::GeoSceneIndex()
+{
+    this->cloud = boost::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> ( new  pcl::PointCloud<pcl::PointXYZ>() );
+}
+
+void GeoSceneIndex::insert(int id,double longitude,double latitude)
+{
+    std::lock_guard<std::mutex> lock(this->index_mutex);
+    Entry& entry = this->entries[id];
+    entry.longitude = longitude;
+    entry.latitude = latitude;
+    entry.point = ecefPoint(longitude,latitude);
+    this->dirty = true;
+}
+
+bool GeoSceneIndex::remove(int id)
+{
+    std::lock_guard<std::mutex> lock(this->index_mutex);
+    if (this->entries.erase(id) == 0)
+    {
+        return false;
+    }
+    this->dirty = true;
+    return true;
+}
+
+size_t GeoSceneIndex::size()
+{
+    std::lock_guard<std::mutex> lock(this->index_mutex);
+    return this->entries.size();
+}
+
+void GeoSceneIndex::rebuild()
+{
+    if (!this->dirty)
+    {
+        return;
+    }
+
+    //a new cloud, the kdtree of the previous one is not updated in place.
+    this->cloud = boost::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> ( new  pcl::PointCloud<pcl::PointXYZ>() );
+    this->cloud->points.reserve(this->entries.size());
+    this->point_ids.clear();
+    this->point_ids.reserve(this->entries.size());
+    for (const auto& entry:this->entries)
+    {
+        this->cloud->points.push_back(entry.second.point);
+        this->point_ids.push_back(entry.first);
+    }
+    this->cloud->width = this->cloud->points.size();
+    this->cloud->height = 1;
+    if (!this->point_ids.empty())
+    {
+        this->kdtree.setInputCloud(this->cloud);
+    }
+    this->dirty = false;
+}
+
+void GeoSceneIndex::nearestKSearch(double longitude,double latitude,int count,
+                                   std::vector<int> &output_ids,std::vector<double> &output_distances_m)
+{
+    output_ids.clear();
+    output_distances_m.clear();
+
+    std::lock_guard<std::mutex> lock(this->index_mutex);
+    this->rebuild();
+    if (this->point_ids.empty() || count <= 0)
+    {
+        return;
+    }
+
+    std::vector<int> indices;
+    std::vector<float> squared_distances;
+    this->kdtree.nearestKSearch(ecefPoint(longitude,latitude),count,indices,squared_distances);
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        output_ids.push_back(this->point_ids[indices[i]]);
+        output_distances_m.push_back(GPS_Utils::chord_to_distance_m(sqrt(squared_distances[i])));
+    }
+}
+
+void GeoSceneIndex::radiusSearchPoint(const pcl::PointXYZ &point,double radius_m,std::vector<int> &output_ids,
+                                      std::vector<double> &output_distances_m,int max_count)
+{
+    output_ids.clear();
+    output_distances_m.clear();
+    if (this->point_ids.empty() || radius_m <= 0)
+    {
+        return;
+    }
+
+    std::vector<int> indices;
+    std::vector<float> squared_distances;
+    this->kdtree.radiusSearch(point,GPS_Utils::distance_to_chord_m(radius_m),indices,squared_distances,
+                              std::max(0, max_count));
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        output_ids.push_back(this->point_ids[indices[i]]);
+        output_distances_m.push_back(GPS_Utils::chord_to_distance_m(sqrt(squared_distances[i])));
+    }
+}
+
+void GeoSceneIndex::radiusSearch(double longitude,double latitude,double radius_m,
+                                 std::vector<int> &output_ids,std::vector<double> &output_distances_m,int max_count)
+{
+    std::lock_guard<std::mutex> lock(this->index_mutex);
+    this->rebuild();
+    this->radiusSearchPoint(ecefPoint(longitude,latitude),radius_m,output_ids,output_distances_m,max_count);
+}
+
+void GeoSceneIndex::routeSearch(const std::vector<std::pair<double,double> > &route,double radius_m,
+                                std::vector<int> &output_ids,int max_count_per_point)
+{
+    output_ids.clear();
+    if (route.empty() || radius_m <= 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(this->index_mutex);
+    this->rebuild();
+
+    std::set<int> found;
+    std::vector<int> ids;
+    std::vector<double> distances;
+    auto search = [&](const pcl::PointXYZ& point)
+    {
+        this->radiusSearchPoint(point,radius_m,ids,distances,max_count_per_point);
+        for (const int& id:ids)
+        {
+            if (found.insert(id).second)
+            {
+                output_ids.push_back(id);
+            }
+        }
+    };
+
+    search(ecefPoint(route[0].first,route[0].second));
+    for (size_t i = 1; i < route.size(); i++)
+    {
+        //points of the great circle arc between the two route points, interpolated on the sphere.
+        const pcl::PointXYZ p0 = ecefPoint(route[i-1].first,route[i-1].second);
+        const pcl::PointXYZ p1 = ecefPoint(route[i].first,route[i].second);
+        const double length_m = GPS_Utils::distance_m(route[i-1].first,route[i-1].second,route[i].first,route[i].second);
+        const double angle = length_m / (GPS_Utils::earth_radius_km * 1000.0);
+        const int steps = std::max(1, (int)ceil(length_m / radius_m));
+        for (int s = 1; s <= steps; s++)
+        {
+            const double t = (double)s / steps;
+            double w0 = 1 - t, w1 = t;
+            if (angle > 1e-9 && angle < GPS_Utils::pi_ - 1e-9)
+            {
+                w0 = sin((1 - t) * angle) / sin(angle);
+                w1 = sin(t * angle) / sin(angle);
+            }
+            pcl::PointXYZ p;
+            p.x = w0 * p0.x + w1 * p1.x;
+            p.y = w0 * p0.y + w1 * p1.y;
+            p.z = w0 * p0.z + w1 * p1.z;
+            search(p);
+        }
+    }
+}
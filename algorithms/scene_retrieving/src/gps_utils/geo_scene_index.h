@@ -0,0 +1,68 @@
+#ifndef GEO_SCENE_INDEX_H
+#define GEO_SCENE_INDEX_H
+
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <pcl/point_cloud.h>
+#include <pcl/kdtree/kdtree_flann.h>
+
+//Spatial index of the scenes by gps position. The positions are kept as earth centered, earth fixed points of the
+//mean earth sphere in a kdtree, so the distances are great circle distances in metres everywhere on earth, across the
+//antimeridian and near the poles. Points are stored in float, about 1m precision.
+//Inserts and removes are cheap, the kdtree is rebuilt by the first query after them. Thread safe.
+class GeoSceneIndex
+{
+public:
+
+    GeoSceneIndex();
+
+    //an id inserted again is moved.
+    void insert(int id,double longitude,double latitude);
+
+    bool remove(int id);
+
+    size_t size();
+
+    //the count nearest scenes, nearest first.
+    void nearestKSearch(double longitude,double latitude,int count,
+                        std::vector<int> &output_ids,std::vector<double> &output_distances_m);
+
+    //the scenes within radius_m, nearest first. max_count <= 0 means all.
+    void radiusSearch(double longitude,double latitude,double radius_m,
+                      std::vector<int> &output_ids,std::vector<double> &output_distances_m,int max_count = 0);
+
+    //the scenes within radius_m of a route of (longitude,latitude) points, in the order the route reaches them.
+    //the segments of the route are sampled along their great circle, every radius_m.
+    void routeSearch(const std::vector<std::pair<double,double> > &route,double radius_m,
+                     std::vector<int> &output_ids,int max_count_per_point = 0);
+
+private:
+
+    struct Entry
+    {
+        double longitude;
+        double latitude;
+        pcl::PointXYZ point;
+    };
+
+    //with index_mutex locked.
+    void rebuild();
+
+    void radiusSearchPoint(const pcl::PointXYZ &point,double radius_m,std::vector<int> &output_ids,
+                           std::vector<double> &output_distances_m,int max_count);
+
+private:
+
+    std::mutex index_mutex;
+    std::map<int,Entry> entries;
+
+    //kdtree of the entries, valid if !dirty. point_ids[i] is the id of the point i.
+    bool dirty = false;
+    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;
+    std::vector<int> point_ids;
+    pcl::KdTreeFLANN<pcl::PointXYZ> kdtree;
+};
+
+#endif
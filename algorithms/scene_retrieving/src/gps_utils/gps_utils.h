@@ -1,11 +1,12 @@
 #ifndef GPS_UTILS_H
 #define GPS_UTILS_H
+#include <algorithm>
 #include <cmath>
 namespace GPS_Utils
 {
     const double earth_radius_km = 6371.393;
     const double pi_ = 3.1415926535;
-    void get_longitude_range_by_dist(double distance_range_km,double center_lati,double &output_range_longitude,bool &success)
+    inline void get_longitude_range_by_dist(double distance_range_km,double center_lati,double &output_range_longitude,bool &success)
     {
         if(center_lati<90.0 && center_lati>-90.0)
         {
@@ -23,7 +24,60 @@ namespace GPS_Utils
         }
     }
 
+    //earth centered, earth fixed coordinates in metres of a point on the mean earth sphere.
+    inline void lon_lat_to_ecef(double longitude,double latitude,double &x,double &y,double &z)
+    {
+        const double r = earth_radius_km * 1000.0;
+        const double lon = longitude * pi_ / 180.0;
+        const double lat = latitude * pi_ / 180.0;
+        x = r * cos(lat) * cos(lon);
+        y = r * cos(lat) * sin(lon);
+        z = r * sin(lat);
+    }
+
+    inline void ecef_to_lon_lat(double x,double y,double z,double &longitude,double &latitude)
+    {
+        longitude = atan2(y, x) * 180.0 / pi_;
+        latitude = atan2(z, sqrt(x * x + y * y)) * 180.0 / pi_;
+    }
+
+    //great circle distance in metres on the mean earth sphere (haversine formula).
+    inline double distance_m(double lon1,double lat1,double lon2,double lat2)
+    {
+        const double dlat = (lat2 - lat1) * pi_ / 360.0;
+        const double dlon = (lon2 - lon1) * pi_ / 360.0;
+        const double a = sin(dlat) * sin(dlat) +
+                         cos(lat1 * pi_ / 180.0) * cos(lat2 * pi_ / 180.0) * sin(dlon) * sin(dlon);
+        return 2.0 * earth_radius_km * 1000.0 * asin(std::min(1.0, sqrt(a)));
+    }
 
+    //great circle distance in metres between two points of the sphere from the chord joining them, and back.
+    inline double chord_to_distance_m(double chord_m)
+    {
+        const double r = earth_radius_km * 1000.0;
+        return 2.0 * r * asin(std::min(1.0, chord_m / (2.0 * r)));
+    }
+
+    inline double distance_to_chord_m(double distance_m)
+    {
+        const double r = earth_radius_km * 1000.0;
+        return 2.0 * r * sin(std::min(pi_ / 2.0, distance_m / (2.0 * r)));
+    }
+
+    //the point reached from (longitude,latitude) going distance_m along the great circle of heading_deg
+    //(degrees clockwise from north).
+    inline void destination_point(double longitude,double latitude,double heading_deg,double distance_m,
+                                  double &output_longitude,double &output_latitude)
+    {
+        const double angle = distance_m / (earth_radius_km * 1000.0);
+        const double heading = heading_deg * pi_ / 180.0;
+        const double lon = longitude * pi_ / 180.0;
+        const double lat = latitude * pi_ / 180.0;
+        const double lat2 = asin(sin(lat) * cos(angle) + cos(lat) * sin(angle) * cos(heading));
+        const double lon2 = lon + atan2(sin(heading) * sin(angle) * cos(lat), cos(angle) - sin(lat) * sin(lat2));
+        output_latitude = lat2 * 180.0 / pi_;
+        output_longitude = remainder(lon2 * 180.0 / pi_, 360.0);
+    }
 
 }
 
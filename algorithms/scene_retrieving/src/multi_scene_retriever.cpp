@@ -1,10 +1,21 @@
 #include "multi_scene_retriever.h"
+#include "gps_utils/gps_utils.h"
 
 
 MultiSceneRetriever::MultiSceneRetriever()
 {
-    this->gps_KDTree = boost::shared_ptr<pcl::PointCloud<pcl::PointXYZ>> ( new  pcl::PointCloud<pcl::PointXYZ>() );
     scene_index = 0;
+    this->prefetch_thread = std::thread(&MultiSceneRetriever::prefetchLoop, this);
+}
+
+MultiSceneRetriever::~MultiSceneRetriever()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->scenes_mutex);
+        this->stop_prefetch = true;
+    }
+    this->prefetch_requested.notify_all();
+    this->prefetch_thread.join();
 }
 
 void MultiSceneRetriever::generate_visualization_graph()
@@ -12,62 +23,328 @@ void MultiSceneRetriever::generate_visualization_graph()
     //iterate all scene,build graph.draw graph to a image file.
 }
 
-int MultiSceneRetriever::retrieveSceneWithScaleFromMonoImage(cv::Mat image_in_rect,
-        cv::Mat cameraMatrix, cv::Mat& RT_mat_of_mono_cam_output, bool& match_success,
-        double img_lon,double img_lat,bool img_lon_lat_valid)
+// runs f(i) for each i of the range, with cv::parallel_for_
+template<class F>
+class ParallelRange: public cv::ParallelLoopBody
 {
-    //step<1> select scene nearby.
-    if(img_lon_lat_valid == false)
+public:
+    explicit ParallelRange(const F& f): f(f) {}
+
+    virtual void operator()(const cv::Range& range) const
     {
-        cout<<"Fatal Error:Image Longitude,Latitude must be valid!"<<endl;
+        for (int i = range.start; i < range.end; i++)
+            f(i);
+    }
+
+private:
+    const F& f;
+};
+
+
+struct SceneMatch
+{
+    bool success = false;
+    int matched_points_count = -1;
+    cv::Mat RT_mat;
+};
+
+
+// matches one query against the scenes in parallel, retrieve(scene, RT_mat, match_success, cancelled) returns the matched
+// points count of a scene. Once a scene matches with CONFIDENT_MATCHED_POINTS the scenes not started yet are skipped and
+// the running ones stop at their next step. Returns the index in scenes of the best match or -1
+template<class F>
+static int matchScenes(const vector<shared_ptr<SceneRetriever> >& scenes, const F& retrieve, cv::Mat& RT_mat_output, bool& match_success)
+{
+    vector<SceneMatch> matches(scenes.size());
+    std::atomic<bool> confident(false);
+
+    auto match_scene = [&](int i)
+    {
+        if (confident)
+            return;
+
+        SceneMatch& match = matches[i];
+        match.matched_points_count = retrieve(*scenes[i], match.RT_mat, match.success, &confident);
+        if (match.success && match.matched_points_count >= CONFIDENT_MATCHED_POINTS)
+            confident = true;
+    };
+    cv::parallel_for_(cv::Range(0, (int)scenes.size()), ParallelRange<decltype(match_scene)>(match_scene), (double)scenes.size());
+
+    //select and reserve only the best match.
+    int best = -1;
+    for (size_t i = 0; i < matches.size(); i++)
+    {
+        if (matches[i].success && (best < 0 || matches[i].matched_points_count > matches[best].matched_points_count))
+            best = i;
+    }
+
+    match_success = best >= 0 && matches[best].matched_points_count > 5;
+    if (!match_success)
         return -1;
+
+    RT_mat_output = matches[best].RT_mat;
+    return best;
+}
+
+
+size_t MultiSceneRetriever::estimateSceneSize(const string& scene_path)
+{
+    //the scene file and its keyframe database cache, both loaded whole.
+    size_t size = 0;
+    for (const string& path: {scene_path, scene_path + ".kfdb"})
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (file.good())
+        {
+            size += (size_t)file.tellg();
+        }
     }
-    vector<int> scene_index_list;
-    this->findNRelativeSceneByGPS(img_lon,img_lat,scene_index_list);
-    //step<2> do match.
-
-    
-    
-    typedef std::pair<int,int> id_and_matched_points_t;
-    vector<id_and_matched_points_t> match_result_list;
-    
-    for (const int& index:scene_index_list)
-    {
-        bool match_success;
-        //do matching.get multiple results.
-        int matched_points_count = this->idToNodeMap[index]->pSceneRetriever->retrieveSceneWithScaleFromMonoImage(image_in_rect, cameraMatrix, RT_mat_of_mono_cam_output, match_success);
-        if(match_success)
+    return size;
+}
+
+void MultiSceneRetriever::setMemoryBudget(size_t memory_budget_mb)
+{
+    std::lock_guard<std::mutex> lock(this->scenes_mutex);
+    this->memory_budget = memory_budget_mb * 1024 * 1024;
+    this->evictScenes();
+}
+
+size_t MultiSceneRetriever::loadedScenesMemory()
+{
+    std::lock_guard<std::mutex> lock(this->scenes_mutex);
+    this->releaseScenes();
+    return this->loaded_memory;
+}
+
+shared_ptr<SceneRetriever> MultiSceneRetriever::getScene(int index)
+{
+    std::unique_lock<std::mutex> lock(this->scenes_mutex);
+    auto it = this->idToNodeMap.find(index);
+    if (it == this->idToNodeMap.end())
+    {
+        return nullptr;
+    }
+    shared_ptr<MultiSceneNode> node = it->second;
+
+    //a scene being loaded by another thread is waited for, not loaded twice.
+    this->scene_loaded.wait(lock, [&node]{ return !node->loading; });
+
+    if (node->pSceneRetriever)
+    {
+        if (node->canReload())
         {
-            match_result_list.push_back(std::make_pair(index,matched_points_count));
+            this->lru_scenes.splice(this->lru_scenes.begin(), this->lru_scenes, node->lru_position);
         }
+        return node->pSceneRetriever;
+    }
+
+    //an evicted scene still held by a query is used again, its memory is counted already.
+    shared_ptr<SceneRetriever> pReleased = node->released_scene.lock();
+    if (pReleased)
+    {
+        this->released_scenes.remove_if([index](const ReleasedScene& released){ return released.index == index; });
+        node->released_scene.reset();
+        node->pSceneRetriever = pReleased;
+        this->lru_scenes.push_front(index);
+        node->lru_position = this->lru_scenes.begin();
+        this->evictScenes();
+        return pReleased;
+    }
+    if (node->load_failed || !node->canReload())
+    {
+        return nullptr;
     }
-    //step<3> select and reserve only the best match.
-    int best_match_id = -1;
-    int best_match_points_count = -1;
-    for(auto match:match_result_list)
+
+    node->loading = true;
+    lock.unlock();
+
+    shared_ptr<SceneRetriever> pSR;
+    try
     {
-        int curr_index = std::get<0>(match);
-        int curr_count = std::get<1>(match);
-	if(curr_count>best_match_points_count)
-	{
-	    best_match_points_count = curr_count;
-	    best_match_id = curr_index;
-	}
+        pSR = shared_ptr<SceneRetriever>(new SceneRetriever(node->voc_path, node->scene_path));
     }
-    if(best_match_id>=0 && best_match_points_count>5)
+    catch (const std::exception& e)
     {
-        //redo mapping;for the last one is not always the best one.
-        this->idToNodeMap[best_match_id]->pSceneRetriever->retrieveSceneWithScaleFromMonoImage(image_in_rect, cameraMatrix, RT_mat_of_mono_cam_output, match_success);
+        cout<<"Error:can not load scene "<<node->scene_path<<": "<<e.what()<<endl;
     }
-    if(match_success)
+
+    lock.lock();
+    node->loading = false;
+    if (pSR && !node->removed)
     {
-        return best_match_id;
+        node->pSceneRetriever = pSR;
+        this->lru_scenes.push_front(index);
+        node->lru_position = this->lru_scenes.begin();
+        this->loaded_memory += node->size_bytes;
+        this->evictScenes();
     }
-    else
+    else if (!pSR)
     {
+        node->load_failed = true;
+    }
+    this->scene_loaded.notify_all();
+    return pSR;
+}
+
+void MultiSceneRetriever::evictScenes()
+{
+    //the most recently used scene is kept even if it alone is over the budget.
+    this->releaseScenes();
+    while (this->loaded_memory > this->memory_budget && this->lru_scenes.size() > 1)
+    {
+        int index = this->lru_scenes.back();
+        this->lru_scenes.pop_back();
+        auto it = this->idToNodeMap.find(index);
+        if (it == this->idToNodeMap.end())
+        {
+            continue;
+        }
+        this->releaseScene(index, it->second);
+    }
+}
+
+void MultiSceneRetriever::releaseScene(int index, const shared_ptr<MultiSceneNode>& node)
+{
+    //queries matching it keep it until they end, its memory is counted until then.
+    this->released_scenes.push_back(ReleasedScene{index, node->pSceneRetriever, node->size_bytes});
+    node->released_scene = node->pSceneRetriever;
+    node->pSceneRetriever = nullptr;
+    this->releaseScenes();
+}
+
+void MultiSceneRetriever::releaseScenes()
+{
+    for (auto it = this->released_scenes.begin(); it != this->released_scenes.end();)
+    {
+        if (it->scene.expired())
+        {
+            this->loaded_memory -= it->size_bytes;
+            it = this->released_scenes.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void MultiSceneRetriever::getScenes(vector<int>& scene_index_list, vector<shared_ptr<SceneRetriever> >& scenes)
+{
+    scenes.assign(scene_index_list.size(), nullptr);
+    auto get_scene = [&](int i)
+    {
+        scenes[i] = this->getScene(scene_index_list[i]);
+    };
+    cv::parallel_for_(cv::Range(0, (int)scenes.size()), ParallelRange<decltype(get_scene)>(get_scene), (double)scenes.size());
+
+    size_t n = 0;
+    for (size_t i = 0; i < scenes.size(); i++)
+    {
+        if (scenes[i])
+        {
+            scene_index_list[n] = scene_index_list[i];
+            scenes[n++] = scenes[i];
+        }
+    }
+    scene_index_list.resize(n);
+    scenes.resize(n);
+}
+
+void MultiSceneRetriever::prefetchScenes(double gps_longitude,double gps_latitude,double heading_deg,bool heading_valid,
+                                         int count,double range_km)
+{
+    vector<std::pair<double,double> > route;
+    route.push_back(std::make_pair(gps_longitude,gps_latitude));
+    if (heading_valid)
+    {
+        double ahead_lon,ahead_lat;
+        GPS_Utils::destination_point(gps_longitude,gps_latitude,heading_deg,range_km * 1000.0,ahead_lon,ahead_lat);
+        route.push_back(std::make_pair(ahead_lon,ahead_lat));
+    }
+    vector<int> scene_index_list;
+    this->findSceneAlongRoute(route,scene_index_list,count,range_km);
+
+    {
+        std::lock_guard<std::mutex> lock(this->scenes_mutex);
+        this->prefetch_queue.clear();
+        size_t memory = 0;
+        for (const int& index:scene_index_list)
+        {
+            //removed since the search.
+            auto it = this->idToNodeMap.find(index);
+            if (it == this->idToNodeMap.end())
+            {
+                continue;
+            }
+            const shared_ptr<MultiSceneNode>& node = it->second;
+            //the scenes past the budget would evict those just prefetched.
+            memory += node->size_bytes;
+            if (memory > this->memory_budget)
+            {
+                break;
+            }
+            if (!node->pSceneRetriever && !node->loading && !node->load_failed && node->canReload())
+            {
+                this->prefetch_queue.push_back(index);
+            }
+        }
+    }
+    this->prefetch_requested.notify_one();
+}
+
+void MultiSceneRetriever::prefetchLoop()
+{
+    std::unique_lock<std::mutex> lock(this->scenes_mutex);
+    while (true)
+    {
+        this->prefetch_requested.wait(lock, [this]{ return this->stop_prefetch || !this->prefetch_queue.empty(); });
+        if (this->stop_prefetch)
+        {
+            return;
+        }
+        int index = this->prefetch_queue.front();
+        this->prefetch_queue.pop_front();
+
+        lock.unlock();
+        this->getScene(index);
+        lock.lock();
+    }
+}
+
+
+int MultiSceneRetriever::retrieveSceneWithScaleFromMonoImage(cv::Mat image_in_rect,
+        cv::Mat cameraMatrix, cv::Mat& RT_mat_of_mono_cam_output, bool& match_success,
+        double img_lon,double img_lat,bool img_lon_lat_valid)
+{
+    match_success = false;
+
+    //step<1> select scene nearby.
+    if(img_lon_lat_valid == false)
+    {
+        cout<<"Fatal Error:Image Longitude,Latitude must be valid!"<<endl;
         return -1;
     }
+    vector<int> scene_index_list;
+    vector<shared_ptr<SceneRetriever> > scenes;
+    this->findNRelativeSceneByGPS(img_lon,img_lat,scene_index_list);
+    this->getScenes(scene_index_list, scenes);
+    if (scenes.empty() || image_in_rect.empty())
+    {
+        return -1;
+    }
+
+    //step<2> extract the query once, the scenes share the vocabulary and the camera.
+    SceneQuery query;
+    scenes[0]->makeQuery(image_in_rect, cv::Mat(), query);
 
+    //step<3> do match.
+    auto retrieve = [&query](SceneRetriever& scene, cv::Mat& RT_mat, bool& success, const std::atomic<bool>* cancelled)
+    {
+        return scene.retrieveSceneWithScaleFromMonoQuery(query, RT_mat, success, cancelled);
+    };
+    int best = matchScenes(scenes, retrieve, RT_mat_of_mono_cam_output, match_success);
+
+    return best >= 0 ? scene_index_list[best] : -1;
 }
 
 int MultiSceneRetriever::retrieveSceneFromStereoImage(cv::Mat image_left_rect,
@@ -77,114 +354,162 @@ int MultiSceneRetriever::retrieveSceneFromStereoImage(cv::Mat image_left_rect,
                                                       bool& match_success,
                                                       double img_lon,double img_lat,bool img_lon_lat_valid)
 {
+    match_success = false;
   
     //step<1> select scene nearby.
-    if(img_lon_lat_valid)
+    if(!img_lon_lat_valid)
     {
         cout<<"Fatal Error:no gps info in retrieveSceneFromStereoImage().Failed."<<endl;
         return -1;
     }
 
     vector<int> scene_index_list;
+    vector<shared_ptr<SceneRetriever> > scenes;
     this->findNRelativeSceneByGPS(img_lon,img_lat,scene_index_list);
+    this->getScenes(scene_index_list, scenes);
+    if (scenes.empty() || image_left_rect.empty() || image_right_rect.empty())
+    {
+        return -1;
+    }
 
-    //step<2> do match.
-    vector<std::pair<int, int> > match_result_list;
+    //step<2> extract and triangulate the query once, the scenes share the vocabulary and the camera.
+    SceneQuery query;
+    if (!scenes[0]->makeQuery(image_left_rect, image_right_rect, query))
+    {
+        return -1;
+    }
 
-    for (const int& index:scene_index_list)
+    //step<3> do match.
+    auto retrieve = [&query](SceneRetriever& scene, cv::Mat& RT_mat, bool& success, const std::atomic<bool>* cancelled)
     {
-        bool match_success;
-        cv::Mat RT_mat;
+        return scene.retrieveSceneFromStereoQuery(query, RT_mat, success, cancelled);
+    };
+    int best = matchScenes(scenes, retrieve, RT_mat_of_stereo_cam_output, match_success);
 
-        //do matching.get multiple results.
-        //int matched_points_count = this->idToNodeMap[index].pScene->retrieveSceneFromStereoImage(cv::imread(left_image_path[i]), cv::imread(right_image_path[i]), Q_mat, RT_mat, match_success);
-        int matched_points_count = (this->idToNodeMap[index]->pSceneRetriever)->retrieveSceneFromStereoImage(image_left_rect, image_right_rect, Q_mat, RT_mat, match_success);
+    return best >= 0 ? scene_index_list[best] : -1;
+}
 
-        if(match_success)
-        {
-            match_result_list.push_back(std::make_pair(index, matched_points_count));
-        }
+int MultiSceneRetriever::retrieveSceneInSession(cv::Mat image_left_rect, cv::Mat image_right_rect, MappingSession& session,
+                                                cv::Mat& RT_mat_output, bool& match_success,
+                                                double img_lon,double img_lat,bool img_lon_lat_valid)
+{
+    match_success = false;
+    if (image_left_rect.empty())
+    {
+        return -1;
     }
 
-    //step<3> select and reserve only the best match.
-    int best_match_id = -1;
-    int best_match_points_count = -1;
-    for(auto match:match_result_list)
+    //step<1> the scene of the session and the scenes nearby.
+    shared_ptr<SceneRetriever> locked_scene;
+    if (session.isLocked() && session.scene_index >= 0)
     {
-        int curr_index = std::get<0>(match);
-        int curr_count = std::get<1>(match);
-        if(curr_count>best_match_points_count)
-        {
-            best_match_points_count = curr_count;
-            best_match_id = curr_index;
-        }
+        locked_scene = this->getScene(session.scene_index);
     }
-
-    if(best_match_id>=0 && best_match_points_count>5)
+    vector<int> scene_index_list;
+    vector<shared_ptr<SceneRetriever> > scenes;
+    if (img_lon_lat_valid)
+    {
+        this->findNRelativeSceneByGPS(img_lon,img_lat,scene_index_list);
+        this->getScenes(scene_index_list, scenes);
+    }
+    if (!locked_scene && scenes.empty())
     {
-        //redo mapping;for the last one is not always the best one.
-        cv::Mat cameraMatrix, RT_mat_of_mono_cam_output;
-        this->idToNodeMap[best_match_id]->pSceneRetriever->retrieveSceneWithScaleFromMonoImage(image_left_rect, cameraMatrix, RT_mat_of_mono_cam_output, match_success);
+        session.onLost();
+        return -1;
     }
 
-    if(match_success)
+    //step<2> extract the query once. A stereo query with too few points in the right image can still be tracked.
+    SceneQuery query;
+    bool query_valid = (locked_scene ? locked_scene : scenes[0])->makeQuery(image_left_rect, image_right_rect, query);
+
+    //step<3> session fast path.
+    if (locked_scene)
     {
-        return best_match_id;
+        int frame_index = -1;
+        if (locked_scene->trackSession(query, session, RT_mat_output, frame_index) > 0)
+        {
+            session.onTracked(frame_index, RT_mat_output);
+            match_success = true;
+            return session.scene_index;
+        }
     }
 
-    else
+    //step<4> global query of the scenes nearby.
+    int best = -1;
+    if (query_valid && !scenes.empty())
+    {
+        auto retrieve = [&query](SceneRetriever& scene, cv::Mat& RT_mat, bool& success, const std::atomic<bool>* cancelled)
+        {
+            if (query.image_right.empty())
+            {
+                return scene.retrieveSceneWithScaleFromMonoQuery(query, RT_mat, success, cancelled);
+            }
+            return scene.retrieveSceneFromStereoQuery(query, RT_mat, success, cancelled);
+        };
+        best = matchScenes(scenes, retrieve, RT_mat_output, match_success);
+    }
+    if (best < 0)
     {
+        session.onLost();
         return -1;
     }
+
+    session.onGlobalMatch(scene_index_list[best], RT_mat_output);
+    return scene_index_list[best];
 }
 
 void MultiSceneRetriever::insertSceneIntoKDTree(shared_ptr<MultiSceneNode> nodeptr)
 {
+    std::lock_guard<std::mutex> lock(this->scenes_mutex);
     this->idToNodeMap[this->scene_index] = nodeptr;
-    pcl::PointXYZ p;
-    p.x = nodeptr->longitude;
-    p.y = nodeptr->latitude;
-    p.z = 0;
-    this->gps_KDTree->points.push_back(p);
+    this->gps_index.insert(this->scene_index,nodeptr->longitude,nodeptr->latitude);
     this->scene_index++; // so the index shall be synchronized.
 }
+
+bool MultiSceneRetriever::removeScene(int index)
+{
+    std::lock_guard<std::mutex> lock(this->scenes_mutex);
+    auto it = this->idToNodeMap.find(index);
+    if (it == this->idToNodeMap.end())
+    {
+        return false;
+    }
+    shared_ptr<MultiSceneNode> node = it->second;
+    if (node->pSceneRetriever && node->canReload())
+    {
+        this->lru_scenes.erase(node->lru_position);
+        this->releaseScene(index, node);
+    }
+    node->pSceneRetriever = nullptr;
+    node->released_scene.reset();
+    node->removed = true;
+    this->idToNodeMap.erase(it);
+    this->prefetch_queue.erase(std::remove(this->prefetch_queue.begin(),this->prefetch_queue.end(),index),
+                               this->prefetch_queue.end());
+    this->gps_index.remove(index);
+    return true;
+}
+
 void MultiSceneRetriever::findNRelativeSceneByGPS(double gps_longitude,double gps_latitude,
                                 vector<int> &output_scene_index,
                                 int count,double range_km)
 {
-    pcl::KdTreeFLANN<pcl::PointXYZ> kdtree;
-    pcl::PointXYZ searchPoint;
-    searchPoint.x = gps_longitude;
-    searchPoint.y = gps_latitude;
-    searchPoint.z = 0;
-    kdtree.setInputCloud (this->gps_KDTree);
-    auto& cloud = this->gps_KDTree;
-    const int K = count;
-    /*std::vector<int> pointIdxNKNSearch(K);
-    std::vector<float> pointNKNSquaredDistance(K);
-    kdtree.nearestKSearch (searchPoint, K, pointIdxNKNSearch, pointNKNSquaredDistance);
-    if ( kdtree.nearestKSearch (searchPoint, K, pointIdxNKNSearch, pointNKNSquaredDistance) > 0 )
-    {
-        for (size_t i = 0; i < pointIdxNKNSearch.size (); ++i)
-        {
-            std::cout << "    "  <<   cloud->points[ pointIdxNKNSearch[i] ].x 
-                << " " << cloud->points[ pointIdxNKNSearch[i] ].y 
-                << " " << cloud->points[ pointIdxNKNSearch[i] ].z 
-                << " (squared distance: " << pointNKNSquaredDistance[i] << ")" << std::endl;
-        }
-    }*/
-    std::vector<int> pointIdxRadiusSearch;
-    std::vector<float> pointRadiusSquaredDistance;
-    const double radius = range_km/6371.0; // this radius is lon,lat radius in its space.
-    if ( kdtree.radiusSearch (searchPoint, radius, pointIdxRadiusSearch, pointRadiusSquaredDistance) > 0 )
-    {
-        for (size_t i = 0; i < pointIdxRadiusSearch.size ()&&i<count; ++i)
-        {
-            std::cout << "    "  <<   cloud->points[ pointIdxRadiusSearch[i] ].x 
-                << " " << cloud->points[ pointIdxRadiusSearch[i] ].y 
-                << " " << cloud->points[ pointIdxRadiusSearch[i] ].z 
-                << " (squared distance: " << pointRadiusSquaredDistance[i] << ")" << std::endl;
-            output_scene_index.push_back(pointIdxRadiusSearch[i]);
-        }
-    }
+    vector<int> ids;
+    vector<double> distances_m;
+    this->gps_index.radiusSearch(gps_longitude,gps_latitude,range_km * 1000.0,ids,distances_m,count);
+    output_scene_index.insert(output_scene_index.end(),ids.begin(),ids.end());
+}
+
+void MultiSceneRetriever::findNNearestSceneByGPS(double gps_longitude,double gps_latitude,
+                                vector<int> &output_scene_index,int count)
+{
+    vector<double> distances_m;
+    this->gps_index.nearestKSearch(gps_longitude,gps_latitude,count,output_scene_index,distances_m);
+}
+
+void MultiSceneRetriever::findSceneAlongRoute(const vector<std::pair<double,double> > &route,
+                                              vector<int> &output_scene_index,
+                                              int count,double range_km)
+{
+    this->gps_index.routeSearch(route,range_km * 1000.0,output_scene_index,count);
 }
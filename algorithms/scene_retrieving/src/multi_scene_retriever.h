@@ -3,8 +3,13 @@
 
 
 #include "scene_retrieve.h"
-#include <pcl/point_cloud.h>
-#include <pcl/kdtree/kdtree_flann.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include "gps_utils/geo_scene_index.h"
 
 //Build a auto balanced kdtree to do quick retrieve of multi scene.
 //Load multiple scenes in different place(maybe include the whole world) at once,and automaticly check the most related and closed ones.
@@ -13,6 +18,12 @@
 #include "nlohmann/json.hpp"
 using namespace nlohmann;
 
+//a scene matched with this many points is taken at once, the other candidate scenes of the query are not matched any further
+const int CONFIDENT_MATCHED_POINTS = 100;
+
+//memory the loaded scenes may take by default, see MultiSceneRetriever::setMemoryBudget
+const size_t DEFAULT_SCENE_MEMORY_BUDGET_MB = 4096;
+
 class MultiSceneNode
 {
 
@@ -21,10 +32,18 @@ public:
     MultiSceneNode()
     {;}
 
-    MultiSceneNode(bool load_scene = false)
-    { //TODO:lazy download of pScene.
+    //node of the scene catalog, the scene is loaded on first use (see MultiSceneRetriever::getScene).
+    //size_bytes: estimated memory of the loaded scene
+    MultiSceneNode(const string& scene_path,const string& voc_path,double lon,double lat,size_t size_bytes)
+    {
+        this->scene_path = scene_path;
+        this->voc_path = voc_path;
+        this->longitude = lon;
+        this->latitude = lat;
+        this->size_bytes = size_bytes;
     }
 
+    //node of a scene loaded already, it is never evicted.
     MultiSceneNode(shared_ptr<SceneRetriever> pSR,double lon,double lat)
     {
         this->pSceneRetriever=pSR;
@@ -39,11 +58,26 @@ public:
         return this->SfM_Model_path == "NO_PATH";
     }
 
+    bool canReload()
+    {
+        return !this->scene_path.empty();
+    }
+
 public:
-    shared_ptr<SceneRetriever> pSceneRetriever;
+    shared_ptr<SceneRetriever> pSceneRetriever;//nullptr while not loaded.
     double longitude;
     double latitude;
     std::string SfM_Model_path = std::string("NO_PATH");//load scene and visualize.
+
+    //catalog metadata, the fields below are guarded by MultiSceneRetriever::scenes_mutex.
+    std::string scene_path;
+    std::string voc_path;
+    size_t size_bytes = 0;
+    bool loading = false;//by a query or in the background.
+    bool load_failed = false;//not tried again.
+    bool removed = false;//from the catalog, see MultiSceneRetriever::removeScene.
+    std::list<int>::iterator lru_position;//in MultiSceneRetriever::lru_scenes while loaded.
+    std::weak_ptr<SceneRetriever> released_scene;//evicted while queries still match it.
 };
 
 class MultiSceneRetriever//Support gps environment only.To do navigation indoor,just init a single SceneRetriever.
@@ -53,6 +87,10 @@ public:
 
     MultiSceneRetriever();
 
+    ~MultiSceneRetriever();
+
+    //registers the scenes of the list in the catalog, they are loaded on first use or when prefetched.
+    //the optional "scene_size_mb" of a scene is its memory once loaded, by default the size of its files.
     void loadSceneInfoFromLocalFile(const string& scene_file_list_path,const string& voc_path)
     {
       //init this class itself.
@@ -65,11 +103,19 @@ public:
 	{
 	    auto scene_obj = it.value();
 	    std::string scene_file_path(scene_obj["scene_path"].get<string>());   
-	    shared_ptr<SceneRetriever> pSR( new SceneRetriever(voc_path,scene_file_path) );
 	    double lon,lat;
 	    lon = scene_obj["gps_longitude"].get<double>();
 	    lat = scene_obj["gps_latitude"].get<double>();
-	    shared_ptr<MultiSceneNode> pNode(new MultiSceneNode(pSR,lon,lat));
+	    size_t size_bytes;
+	    if (scene_obj.find("scene_size_mb")!=scene_obj.end())
+	    {
+	        size_bytes = scene_obj["scene_size_mb"].get<double>() * 1024 * 1024;
+	    }
+	    else
+	    {
+	        size_bytes = estimateSceneSize(scene_file_path);
+	    }
+	    shared_ptr<MultiSceneNode> pNode(new MultiSceneNode(scene_file_path,voc_path,lon,lat,size_bytes));
 	    this->insertSceneIntoKDTree(pNode);//gps indexed!
 	    if (scene_obj.find("sfm_model_path")!=scene_obj.end())
 	    {
@@ -77,15 +123,42 @@ public:
 	    }
 	}
     }
+    //the count nearest scenes within range_km (great circle distance), nearest first.
     void findNRelativeSceneByGPS(double gps_longitude,double gps_latitude,
                                 vector<int> &output_scene_index,
                                 int count = 10,double range_km = 5.0);
+    //the count nearest scenes at any distance, nearest first.
+    void findNNearestSceneByGPS(double gps_longitude,double gps_latitude,
+                                vector<int> &output_scene_index,int count = 10);
+    //the scenes within range_km of a planned route of (longitude,latitude) points, in the order the route reaches
+    //them. At most count scenes around each point of the route, sampled every range_km.
+    void findSceneAlongRoute(const vector<std::pair<double,double> > &route,
+                             vector<int> &output_scene_index,
+                             int count = 10,double range_km = 5.0);
+    //removes a scene from the catalog and the gps index, queries matching it keep it until they end.
+    bool removeScene(int index);
     void loadRelativeSceneInfoFromInternet(double gps_longitute,double gps_latitude,
                                       int count = 10,double range_km=5.0);
     void generate_visualization_graph();
+
+    //the least recently used scenes are evicted once the loaded ones take more than memory_budget_mb.
+    //the scenes a query is matching stay in memory until it ends, they are counted until then.
+    void setMemoryBudget(size_t memory_budget_mb);
+
+    //the scene of a catalog node, loaded first if needed. nullptr if it cannot be loaded.
+    shared_ptr<SceneRetriever> getScene(int index);
+
+    //loads in the background the scenes around the vehicle and, with a valid heading (degrees clockwise from
+    //north), those along its way up to range_km ahead. The requests of the previous position are dropped.
+    void prefetchScenes(double gps_longitude,double gps_latitude,double heading_deg,bool heading_valid = true,
+                        int count = 10,double range_km = 5.0);
+
+    //estimated memory of the loaded scenes.
+    size_t loadedScenesMemory();
     
     //for these methods,return best matched scene's id.
     //here we assert the return value of scene retriever's methods is matched points count.
+    //the query is extracted once and the nearby scenes are matched in parallel, they must share the vocabulary and camera.
     virtual int retrieveSceneWithScaleFromMonoImage(cv::Mat image_in_rect,
         cv::Mat cameraMatrix, cv::Mat& RT_mat_of_mono_cam_output, bool& match_success,
         double img_lon,double img_lat,bool img_lon_lat_valid = false);
@@ -100,14 +173,58 @@ public:
                                              cv::Mat& Q_mat, cv::Mat& RT_mat_of_stereo_cam_output,
                                              bool& match_success,double img_lon,double img_lat,bool img_lon_lat_valid=false);
 
+    //session aware retrieval of a mono (image_right_rect empty) or stereo query: the session fast path on the scene it
+    //is locked on, then the global query of the scenes nearby if it fails or the session is not locked. The query is
+    //tracked without gps, the global query needs it. Returns the matched scene's id and updates the session.
+    int retrieveSceneInSession(cv::Mat image_left_rect, cv::Mat image_right_rect, MappingSession& session,
+                               cv::Mat& RT_mat_output, bool& match_success,
+                               double img_lon,double img_lat,bool img_lon_lat_valid=false);
+
 private:
     //void insertSceneIntoKDTree(double longi,double lati,shared_ptr<Scene> pScene);
     void insertSceneIntoKDTree(shared_ptr<MultiSceneNode> nodeptr);
 
+    static size_t estimateSceneSize(const string& scene_path);
+
+    //the loadable scenes of the list, loaded in parallel. The indexes of the others are removed.
+    void getScenes(vector<int>& scene_index_list, vector<shared_ptr<SceneRetriever> >& scenes);
+
+    //with scenes_mutex locked.
+    void evictScenes();
+
+    //drops the catalog reference of a loaded scene, with scenes_mutex locked.
+    void releaseScene(int index, const shared_ptr<MultiSceneNode>& node);
+
+    //the memory of the released scenes no query holds any more, with scenes_mutex locked.
+    void releaseScenes();
+
+    void prefetchLoop();
+
 private:
     int scene_index;
     map<int, shared_ptr<MultiSceneNode> > idToNodeMap;
-    pcl::PointCloud<pcl::PointXYZ>::Ptr gps_KDTree; // using pcl pointcloud as kdtree.
+    GeoSceneIndex gps_index; // ecef kdtree of the scene positions.
+
+    //loaded scenes, the most recently used first.
+    std::mutex scenes_mutex;
+    std::condition_variable scene_loaded;
+    std::list<int> lru_scenes;
+    size_t loaded_memory = 0;//the loaded scenes and the released ones still held.
+
+    struct ReleasedScene
+    {
+        int index;
+        std::weak_ptr<SceneRetriever> scene;
+        size_t size_bytes;
+    };
+    std::list<ReleasedScene> released_scenes;
+    size_t memory_budget = DEFAULT_SCENE_MEMORY_BUDGET_MB * 1024 * 1024;
+
+    //scenes to load in the background, in order.
+    std::deque<int> prefetch_queue;
+    std::condition_variable prefetch_requested;
+    bool stop_prefetch = false;
+    std::thread prefetch_thread;
 
 };
 
@@ -0,0 +1,493 @@
+#include "pose_ransac.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#include <Eigen/Cholesky>
+#include <Eigen/Eigenvalues>
+#include <opencv2/core/eigen.hpp>
+
+
+//---------------------------------------class ProsacSampler------------------------------------
+
+void ProsacSampler::init(int point_count, int sample_size, int max_iterations)
+{
+    this->point_count = point_count;
+    this->sample_size = sample_size;
+    this->iteration = 0;
+    this->subset_size = sample_size;
+
+    // T_m: samples of the sample_size best points expected among max_iterations uniform samples
+    this->subset_samples = max_iterations;
+    for(int i = 0; i < sample_size; i++)
+        this->subset_samples *= (double)(sample_size - i) / (point_count - i);
+    this->subset_iteration = 1;
+}
+
+void ProsacSampler::sample(std::vector<int>& sample_output, std::mt19937& rng)
+{
+    this->iteration++;
+
+    // T_n+1 = T_n (n+1) / (n+1-m), T'_n+1 = T'_n + ceil(T_n+1 - T_n)
+    if(this->iteration >= this->subset_iteration && this->subset_size < this->point_count)
+    {
+        double next_samples = this->subset_samples * (this->subset_size + 1) / (this->subset_size + 1 - this->sample_size);
+        this->subset_iteration += (int)ceil(next_samples - this->subset_samples);
+        this->subset_samples = next_samples;
+        this->subset_size++;
+    }
+
+    // until the subset grows again the samples take its last point and sample_size-1 points before it, then they are
+    // drawn from the whole subset
+    bool with_last = this->subset_iteration >= this->iteration;
+    int draw_count = with_last ? this->sample_size - 1 : this->sample_size;
+    int draw_range = with_last ? this->subset_size - 1 : this->subset_size;
+
+    sample_output.clear();
+    std::uniform_int_distribution<int> distribution(0, draw_range - 1);
+    while((int)sample_output.size() < draw_count)
+    {
+        int index = distribution(rng);
+        if(std::find(sample_output.begin(), sample_output.end(), index) == sample_output.end())
+            sample_output.push_back(index);
+    }
+    if(with_last)
+        sample_output.push_back(this->subset_size - 1);
+}
+
+
+//---------------------------------------class PoseRansac------------------------------------
+
+void PoseRansac::sortByQuality(int point_count, const std::vector<float>& match_distances)
+{
+    this->order.resize(point_count);
+    if((int)match_distances.size() != point_count)
+    {
+        std::iota(this->order.begin(), this->order.end(), 0);
+        return;
+    }
+
+    this->sort_buffer.resize(point_count);
+    for(int i = 0; i < point_count; i++)
+        this->sort_buffer[i] = std::make_pair(match_distances[i], i);
+    std::sort(this->sort_buffer.begin(), this->sort_buffer.end());
+    for(int i = 0; i < point_count; i++)
+        this->order[i] = this->sort_buffer[i].second;
+}
+
+int PoseRansac::countInliers(int point_count, const Eigen::Matrix3d& R, const Eigen::Vector3d& t, std::vector<int>& inliers) const
+{
+    inliers.clear();
+    for(int i = 0; i < point_count; i++)
+    {
+        if(this->isInlier(i, R, t))
+            inliers.push_back(i);
+    }
+    return inliers.size();
+}
+
+bool PoseRansac::run(int point_count, int sample_size, Eigen::Matrix3d& R, Eigen::Vector3d& t, std::vector<int>& inliers_output)
+{
+    this->last_stats = RansacStats();
+    inliers_output.clear();
+    if(point_count < std::max(sample_size, this->options.min_inliers))
+        return false;
+
+    this->sampler.init(point_count, sample_size, this->options.max_iterations);
+    this->best_inliers.clear();
+
+    const double log_failure = log(1.0 - this->options.confidence);
+    int max_iterations = this->options.max_iterations;
+    Eigen::Matrix3d best_R = Eigen::Matrix3d::Identity();
+    Eigen::Vector3d best_t = Eigen::Vector3d::Zero();
+
+    int iteration = 0;
+    for(; iteration < max_iterations; iteration++)
+    {
+        this->sampler.sample(this->sample, this->rng);
+        this->hypothesis_R.clear();
+        this->hypothesis_t.clear();
+        this->solveMinimal(this->sample, this->hypothesis_R, this->hypothesis_t);
+
+        for(size_t h = 0; h < this->hypothesis_R.size(); h++)
+        {
+            if(this->countInliers(point_count, this->hypothesis_R[h], this->hypothesis_t[h], this->inliers) <= (int)this->best_inliers.size())
+                continue;
+
+            best_R = this->hypothesis_R[h];
+            best_t = this->hypothesis_t[h];
+            this->best_inliers.swap(this->inliers);
+
+            // local optimization of the new best hypothesis: the pose of all its inliers, while they increase
+            this->last_stats.local_optimizations++;
+            for(int step = 0; step < this->options.local_optimization_steps; step++)
+            {
+                Eigen::Matrix3d refined_R = best_R;
+                Eigen::Vector3d refined_t = best_t;
+                if(!this->solveNonMinimal(this->best_inliers, refined_R, refined_t))
+                    break;
+
+                int previous_count = this->best_inliers.size();
+                if(this->countInliers(point_count, refined_R, refined_t, this->inliers) < previous_count)
+                    break;
+
+                best_R = refined_R;
+                best_t = refined_t;
+                this->best_inliers.swap(this->inliers);
+                if((int)this->best_inliers.size() == previous_count)
+                    break;
+            }
+
+            // adaptive termination: iterations to draw an outlier free sample with the confidence given
+            double outlier_free = pow((double)this->best_inliers.size() / point_count, sample_size);
+            if(outlier_free >= 1.0)
+            {
+                max_iterations = iteration + 1;
+            }
+            else if(outlier_free > 0)
+            {
+                double needed = log_failure / log(1.0 - outlier_free);
+                if(needed < max_iterations)
+                    max_iterations = (int)ceil(needed);
+            }
+        }
+    }
+
+    this->last_stats.iterations = iteration;
+    this->last_stats.inliers = this->best_inliers.size();
+    this->last_stats.inlier_ratio = (double)this->best_inliers.size() / point_count;
+    if((int)this->best_inliers.size() < std::max(sample_size, this->options.min_inliers))
+        return false;
+
+    R = best_R;
+    t = best_t;
+    inliers_output.reserve(this->best_inliers.size());
+    for(int index: this->best_inliers)
+        inliers_output.push_back(this->order[index]);
+    std::sort(inliers_output.begin(), inliers_output.end());
+    return true;
+}
+
+
+static void poseToCv(const Eigen::Matrix3d& R, const Eigen::Vector3d& t, cv::Mat& R_output, cv::Mat& t_output)
+{
+    cv::eigen2cv(R, R_output);
+    cv::eigen2cv(t, t_output);
+}
+
+
+//---------------------------------------class PnPRansac------------------------------------
+
+bool PnPRansac::estimate(const std::vector<cv::Point3f>& points3d, const std::vector<cv::Point2f>& points2d,
+                         const std::vector<float>& match_distances, const cv::Mat& K,
+                         cv::Mat& R_output, cv::Mat& t_output, std::vector<int>& inliers_output)
+{
+    inliers_output.clear();
+    if(points3d.size() != points2d.size() || K.empty())
+        return false;
+
+    cv::Mat K_d;
+    K.convertTo(K_d, CV_64F);
+    this->fx = K_d.at<double>(0, 0);
+    this->fy = K_d.at<double>(1, 1);
+    this->cx = K_d.at<double>(0, 2);
+    this->cy = K_d.at<double>(1, 2);
+
+    int point_count = points3d.size();
+    this->sortByQuality(point_count, match_distances);
+    this->points.resize(point_count);
+    this->pixels.resize(point_count);
+    this->bearings.resize(point_count);
+    for(int i = 0; i < point_count; i++)
+    {
+        const cv::Point3f& p = points3d[this->order[i]];
+        const cv::Point2f& uv = points2d[this->order[i]];
+        this->points[i] = Eigen::Vector3d(p.x, p.y, p.z);
+        this->pixels[i] = Eigen::Vector2d(uv.x, uv.y);
+        this->bearings[i] = Eigen::Vector3d((uv.x - this->cx) / this->fx, (uv.y - this->cy) / this->fy, 1.0).normalized();
+    }
+
+    Eigen::Matrix3d R;
+    Eigen::Vector3d t;
+    if(!this->run(point_count, 4, R, t, inliers_output))
+        return false;
+
+    poseToCv(R, t, R_output, t_output);
+    return true;
+}
+
+double PnPRansac::reprojectionError2(int index, const Eigen::Matrix3d& R, const Eigen::Vector3d& t) const
+{
+    Eigen::Vector3d p = R * this->points[index] + t;
+    if(p.z() <= 0)
+        return std::numeric_limits<double>::infinity();
+
+    double du = this->fx * p.x() / p.z() + this->cx - this->pixels[index].x();
+    double dv = this->fy * p.y() / p.z() + this->cy - this->pixels[index].y();
+    return du * du + dv * dv;
+}
+
+bool PnPRansac::isInlier(int index, const Eigen::Matrix3d& R, const Eigen::Vector3d& t) const
+{
+    return this->reprojectionError2(index, R, t) <= this->options.threshold * this->options.threshold;
+}
+
+void PnPRansac::solveMinimal(const std::vector<int>& sample, std::vector<Eigen::Matrix3d>& Rs, std::vector<Eigen::Vector3d>& ts)
+{
+    Eigen::Vector3d sample_points[3], sample_bearings[3];
+    for(int i = 0; i < 3; i++)
+    {
+        sample_points[i] = this->points[sample[i]];
+        sample_bearings[i] = this->bearings[sample[i]];
+    }
+
+    Eigen::Matrix3d solutions_R[4];
+    Eigen::Vector3d solutions_t[4];
+    int solution_count = solveP3P(sample_points, sample_bearings, solutions_R, solutions_t);
+
+    // the fourth point selects the solution
+    int best = -1;
+    double best_error = this->options.threshold * this->options.threshold;
+    for(int s = 0; s < solution_count; s++)
+    {
+        double error = this->reprojectionError2(sample[3], solutions_R[s], solutions_t[s]);
+        if(error <= best_error)
+        {
+            best_error = error;
+            best = s;
+        }
+    }
+    if(best >= 0)
+    {
+        Rs.push_back(solutions_R[best]);
+        ts.push_back(solutions_t[best]);
+    }
+}
+
+bool PnPRansac::solveNonMinimal(const std::vector<int>& inliers, Eigen::Matrix3d& R, Eigen::Vector3d& t)
+{
+    if(inliers.size() < 4)
+        return false;
+
+    // Gauss-Newton on the reprojection error, the pose is updated by R = exp(w) R, t = exp(w) t + d
+    for(int iteration = 0; iteration < 10; iteration++)
+    {
+        Eigen::Matrix<double, 6, 6> H = Eigen::Matrix<double, 6, 6>::Zero();
+        Eigen::Matrix<double, 6, 1> g = Eigen::Matrix<double, 6, 1>::Zero();
+        for(int index: inliers)
+        {
+            Eigen::Vector3d p = R * this->points[index] + t;
+            if(p.z() <= 1e-9)
+                continue;
+
+            double iz = 1.0 / p.z();
+            Eigen::Vector2d residual(this->fx * p.x() * iz + this->cx - this->pixels[index].x(),
+                                     this->fy * p.y() * iz + this->cy - this->pixels[index].y());
+
+            Eigen::Matrix<double, 2, 3> J_p;
+            J_p << this->fx * iz, 0, -this->fx * p.x() * iz * iz,
+                   0, this->fy * iz, -this->fy * p.y() * iz * iz;
+
+            Eigen::Matrix3d p_hat;
+            p_hat << 0, -p.z(), p.y(),
+                     p.z(), 0, -p.x(),
+                     -p.y(), p.x(), 0;
+
+            Eigen::Matrix<double, 2, 6> J;
+            J.leftCols<3>() = -J_p * p_hat;
+            J.rightCols<3>() = J_p;
+
+            H += J.transpose() * J;
+            g += J.transpose() * residual;
+        }
+
+        Eigen::Matrix<double, 6, 1> dx = H.ldlt().solve(-g);
+        if(!dx.allFinite())
+            return false;
+
+        Eigen::Vector3d w = dx.head<3>();
+        double angle = w.norm();
+        Eigen::Matrix3d dR = angle > 1e-12 ? Eigen::AngleAxisd(angle, w / angle).toRotationMatrix() : Eigen::Matrix3d::Identity();
+        R = dR * R;
+        t = dR * t + dx.tail<3>();
+
+        if(dx.norm() < 1e-10)
+            break;
+    }
+    return true;
+}
+
+int PnPRansac::solveP3P(const Eigen::Vector3d* points, const Eigen::Vector3d* bearings,
+                        Eigen::Matrix3d* Rs, Eigen::Vector3d* ts)
+{
+    // Grunert's solution as reviewed by Haralick et al. 1994: a, b, c are the sides of the scene triangle opposite to
+    // the points 1, 2, 3 and alpha, beta, gamma the angles between the bearings seeing them. With u = s2 / s1 and
+    // v = s3 / s1 the ratios of the distances along the bearings, v is a root of a quartic
+    double a2 = (points[1] - points[2]).squaredNorm();
+    double b2 = (points[0] - points[2]).squaredNorm();
+    double c2 = (points[0] - points[1]).squaredNorm();
+    double scale2 = std::max(a2, std::max(b2, c2));
+    if(scale2 <= 0 || (points[1] - points[0]).cross(points[2] - points[0]).squaredNorm() < 1e-10 * scale2 * scale2)
+        return 0;
+
+    double cos_alpha = bearings[1].dot(bearings[2]);
+    double cos_beta = bearings[0].dot(bearings[2]);
+    double cos_gamma = bearings[0].dot(bearings[1]);
+
+    double q = (a2 - c2) / b2;
+    double r = (a2 + c2) / b2;
+
+    double A[5];
+    A[4] = (q - 1) * (q - 1) - 4 * c2 / b2 * cos_alpha * cos_alpha;
+    A[3] = 4 * (q * (1 - q) * cos_beta - (1 - r) * cos_alpha * cos_gamma + 2 * c2 / b2 * cos_alpha * cos_alpha * cos_beta);
+    A[2] = 2 * (q * q - 1 + 2 * q * q * cos_beta * cos_beta + 2 * (b2 - c2) / b2 * cos_alpha * cos_alpha
+                - 4 * r * cos_alpha * cos_beta * cos_gamma + 2 * (b2 - a2) / b2 * cos_gamma * cos_gamma);
+    A[1] = 4 * (-q * (1 + q) * cos_beta + 2 * a2 / b2 * cos_gamma * cos_gamma * cos_beta - (1 - r) * cos_alpha * cos_gamma);
+    A[0] = (1 + q) * (1 + q) - 4 * a2 / b2 * cos_gamma * cos_gamma;
+
+    double largest = 0;
+    for(int i = 0; i < 5; i++)
+        largest = std::max(largest, std::abs(A[i]));
+    if(std::abs(A[4]) < 1e-12 * largest)
+        return 0;
+
+    // real roots of the quartic, eigenvalues of its companion matrix polished by Newton steps
+    Eigen::Matrix4d companion = Eigen::Matrix4d::Zero();
+    companion.block<3, 3>(1, 0) = Eigen::Matrix3d::Identity();
+    for(int i = 0; i < 4; i++)
+        companion(i, 3) = -A[i] / A[4];
+    Eigen::EigenSolver<Eigen::Matrix4d> solver(companion, false);
+
+    int solution_count = 0;
+    for(int i = 0; i < 4; i++)
+    {
+        std::complex<double> root = solver.eigenvalues()[i];
+        if(std::abs(root.imag()) > 1e-6 * (1 + std::abs(root.real())))
+            continue;
+
+        double v = root.real();
+        for(int newton = 0; newton < 2; newton++)
+        {
+            double f = (((A[4] * v + A[3]) * v + A[2]) * v + A[1]) * v + A[0];
+            double df = ((4 * A[4] * v + 3 * A[3]) * v + 2 * A[2]) * v + A[1];
+            if(std::abs(df) < 1e-15)
+                break;
+            v -= f / df;
+        }
+        if(v <= 0)
+            continue;
+
+        double denominator = 2 * (cos_gamma - v * cos_alpha);
+        if(std::abs(denominator) < 1e-12)
+            continue;
+        double u = ((q - 1) * v * v - 2 * q * cos_beta * v + 1 + q) / denominator;
+        if(u <= 0)
+            continue;
+
+        double s1_2 = b2 / (1 + v * v - 2 * v * cos_beta);
+        if(!(s1_2 > 0))
+            continue;
+        double s1 = sqrt(s1_2);
+
+        // the three points in the camera frame, and the rigid transform taking them there
+        Eigen::Matrix3d scene, camera;
+        for(int k = 0; k < 3; k++)
+            scene.col(k) = points[k];
+        camera.col(0) = s1 * bearings[0];
+        camera.col(1) = u * s1 * bearings[1];
+        camera.col(2) = v * s1 * bearings[2];
+
+        Eigen::Matrix4d T = Eigen::umeyama(scene, camera, false);
+        if(!T.allFinite())
+            continue;
+
+        Rs[solution_count] = T.block<3, 3>(0, 0);
+        ts[solution_count] = T.block<3, 1>(0, 3);
+        solution_count++;
+    }
+    return solution_count;
+}
+
+
+//---------------------------------------class RigidRansac------------------------------------
+
+bool RigidRansac::estimate(const std::vector<cv::Point3f>& source, const std::vector<cv::Point3f>& target,
+                           const std::vector<float>& match_distances,
+                           cv::Mat& R_output, cv::Mat& t_output, std::vector<int>& inliers_output)
+{
+    inliers_output.clear();
+    if(source.size() != target.size())
+        return false;
+
+    int point_count = source.size();
+    this->sortByQuality(point_count, match_distances);
+    this->source_points.resize(point_count);
+    this->target_points.resize(point_count);
+    for(int i = 0; i < point_count; i++)
+    {
+        const cv::Point3f& s = source[this->order[i]];
+        const cv::Point3f& d = target[this->order[i]];
+        this->source_points[i] = Eigen::Vector3d(s.x, s.y, s.z);
+        this->target_points[i] = Eigen::Vector3d(d.x, d.y, d.z);
+    }
+
+    Eigen::Matrix3d R;
+    Eigen::Vector3d t;
+    if(!this->run(point_count, 3, R, t, inliers_output))
+        return false;
+
+    poseToCv(R, t, R_output, t_output);
+    return true;
+}
+
+bool RigidRansac::isInlier(int index, const Eigen::Matrix3d& R, const Eigen::Vector3d& t) const
+{
+    return (R * this->source_points[index] + t - this->target_points[index]).squaredNorm() <=
+           this->options.threshold * this->options.threshold;
+}
+
+void RigidRansac::solveMinimal(const std::vector<int>& sample, std::vector<Eigen::Matrix3d>& Rs, std::vector<Eigen::Vector3d>& ts)
+{
+    const Eigen::Vector3d& p0 = this->source_points[sample[0]];
+    double scale2 = std::max((this->source_points[sample[1]] - p0).squaredNorm(), (this->source_points[sample[2]] - p0).squaredNorm());
+    if(scale2 <= 0 || (this->source_points[sample[1]] - p0).cross(this->source_points[sample[2]] - p0).squaredNorm() < 1e-10 * scale2 * scale2)
+        return;
+
+    Eigen::Matrix3d source, target;
+    for(int k = 0; k < 3; k++)
+    {
+        source.col(k) = this->source_points[sample[k]];
+        target.col(k) = this->target_points[sample[k]];
+    }
+
+    Eigen::Matrix4d T = Eigen::umeyama(source, target, false);
+    if(!T.allFinite())
+        return;
+
+    Rs.push_back(T.block<3, 3>(0, 0));
+    ts.push_back(T.block<3, 1>(0, 3));
+}
+
+bool RigidRansac::solveNonMinimal(const std::vector<int>& inliers, Eigen::Matrix3d& R, Eigen::Vector3d& t)
+{
+    if(inliers.size() < 3)
+        return false;
+
+    this->source_matrix.resize(3, inliers.size());
+    this->target_matrix.resize(3, inliers.size());
+    for(size_t i = 0; i < inliers.size(); i++)
+    {
+        this->source_matrix.col(i) = this->source_points[inliers[i]];
+        this->target_matrix.col(i) = this->target_points[inliers[i]];
+    }
+
+    Eigen::Matrix4d T = Eigen::umeyama(this->source_matrix, this->target_matrix, false);
+    if(!T.allFinite())
+        return false;
+
+    R = T.block<3, 3>(0, 0);
+    t = T.block<3, 1>(0, 3);
+    return true;
+}
@@ -0,0 +1,509 @@
+#include "scene_columns.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "MappedFile.h"
+
+using namespace std;
+
+
+static const char SCENE_COLUMNS_MAGIC[8] = {'G','A','A','S','S','C','N','\0'};
+static const uint32_t SCENE_COLUMNS_VERSION = 1;
+
+static const uint32_t FLAG_HAS_SCALE = 1;
+static const uint32_t FLAG_QUANTIZED_POINTS = 2;
+
+enum
+{
+    COLUMN_KEYPOINTS = 0,
+    COLUMN_POINTS,
+    COLUMN_DESCRIPTORS,
+    COLUMN_POSES,
+    COLUMN_CAM_KEYPOINTS,
+    COLUMN_CAM_POINTS,
+    COLUMN_CAM_DESCRIPTORS,
+    COLUMN_COUNT
+};
+
+struct SceneColumns::Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t frame_count;
+    //type and columns of the descriptors, all the frames have the same
+    int32_t descriptor_type;
+    uint32_t descriptor_cols;
+    int32_t cam_descriptor_type;
+    uint32_t cam_descriptor_cols;
+    //bytes from the start of the file, 8 aligned
+    uint64_t column_offset[COLUMN_COUNT];
+    uint64_t column_size[COLUMN_COUNT];
+    //of the header with checksum 0 and the frame table
+    uint64_t checksum;
+};
+
+//rows of a frame in each column, counted in elements of the column
+struct SceneColumns::FrameEntry
+{
+    uint64_t keypoint_first;
+    uint32_t keypoint_count;
+    uint32_t point_count;
+    uint64_t point_first;
+    uint64_t descriptor_first;
+    uint32_t descriptor_rows;
+    uint32_t has_pose;
+    uint64_t cam_first;
+    uint32_t cam_count;
+    uint32_t cam_descriptor_rows;
+    uint64_t cam_descriptor_first;
+    //quantized points are point_origin + q * point_scale
+    double point_origin[3];
+    float point_scale;
+    uint32_t reserved;
+};
+
+struct StoredKeyPoint
+{
+    float x, y, size, angle, response;
+    int32_t octave, class_id;
+};
+
+static const size_t POSE_SIZE = 12 * sizeof(double);
+
+static size_t align8(size_t n)
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+static size_t descriptorRowSize(int type, uint32_t cols)
+{
+    return cols * CV_ELEM_SIZE(type);
+}
+
+static size_t pointSize(uint32_t flags)
+{
+    return (flags & FLAG_QUANTIZED_POINTS) ? 3 * sizeof(int16_t) : 3 * sizeof(float);
+}
+
+static StoredKeyPoint storeKeyPoint(const cv::KeyPoint& kp)
+{
+    StoredKeyPoint s;
+    s.x = kp.pt.x;
+    s.y = kp.pt.y;
+    s.size = kp.size;
+    s.angle = kp.angle;
+    s.response = kp.response;
+    s.octave = kp.octave;
+    s.class_id = kp.class_id;
+    return s;
+}
+
+static vector<cv::KeyPoint> loadKeyPoints(const uchar* data, size_t count)
+{
+    vector<cv::KeyPoint> kps(count);
+    for(size_t i = 0; i < count; i++)
+    {
+        StoredKeyPoint s;
+        memcpy(&s, data + i * sizeof(StoredKeyPoint), sizeof(s));
+        kps[i] = cv::KeyPoint(s.x, s.y, s.size, s.angle, s.response, s.octave, s.class_id);
+    }
+    return kps;
+}
+
+// checks the descriptors of the frames share type and columns, and returns them
+static bool descriptorFormat(const cv::Mat& desc, int32_t& type, uint32_t& cols)
+{
+    if(desc.empty())
+        return true;
+    if(cols == 0)
+    {
+        type = desc.type();
+        cols = desc.cols;
+    }
+    return desc.type() == type && (uint32_t)desc.cols == cols;
+}
+
+
+bool SceneColumns::write(const string& filename, size_t frame_count, bool has_scale, bool quantize_points,
+                         const std::function<void(size_t, Frame&)>& get_frame)
+{
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCENE_COLUMNS_MAGIC, sizeof(header.magic));
+    header.version = SCENE_COLUMNS_VERSION;
+    header.flags = (has_scale ? FLAG_HAS_SCALE : 0) | (quantize_points ? FLAG_QUANTIZED_POINTS : 0);
+    header.frame_count = frame_count;
+
+    //pass 1: the rows of each frame, the quantization and the size of the columns
+    vector<FrameEntry> frames(frame_count);
+    uint64_t counts[COLUMN_COUNT] = {0};
+    for(size_t i = 0; i < frame_count; i++)
+    {
+        Frame f;
+        get_frame(i, f);
+        FrameEntry& e = frames[i];
+        memset(&e, 0, sizeof(e));
+
+        if(!descriptorFormat(f.descriptors, header.descriptor_type, header.descriptor_cols) ||
+           !descriptorFormat(f.cam_descriptors, header.cam_descriptor_type, header.cam_descriptor_cols))
+        {
+            cout<<"SceneColumns::write: frame "<<i<<" descriptors differ from those of the previous frames"<<endl;
+            return false;
+        }
+
+        e.keypoint_first = counts[COLUMN_KEYPOINTS];
+        e.keypoint_count = f.keypoints.size();
+        e.point_first = counts[COLUMN_POINTS];
+        e.point_count = f.points3d.size();
+        e.descriptor_first = counts[COLUMN_DESCRIPTORS];
+        e.descriptor_rows = f.descriptors.rows;
+        e.has_pose = !f.R.empty() && !f.t.empty();
+        e.cam_first = counts[COLUMN_CAM_KEYPOINTS];
+        e.cam_count = f.cam_keypoints.size();
+        e.cam_descriptor_first = counts[COLUMN_CAM_DESCRIPTORS];
+        e.cam_descriptor_rows = f.cam_descriptors.rows;
+        if(f.cam_points.size() != f.cam_keypoints.size())
+        {
+            cout<<"SceneColumns::write: frame "<<i<<" camera points and keypoints differ"<<endl;
+            return false;
+        }
+
+        if(quantize_points && !f.points3d.empty())
+        {
+            cv::Point3d lo = f.points3d[0], hi = f.points3d[0];
+            for(const cv::Point3d& p: f.points3d)
+            {
+                lo = cv::Point3d(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+                hi = cv::Point3d(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+            }
+            e.point_origin[0] = (lo.x + hi.x) / 2;
+            e.point_origin[1] = (lo.y + hi.y) / 2;
+            e.point_origin[2] = (lo.z + hi.z) / 2;
+            const double extent = std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+            e.point_scale = extent > 0 ? extent / 65534.0 : 1.0f;
+        }
+
+        counts[COLUMN_KEYPOINTS] += e.keypoint_count;
+        counts[COLUMN_POINTS] += e.point_count;
+        counts[COLUMN_DESCRIPTORS] += e.descriptor_rows;
+        counts[COLUMN_POSES] += 1;
+        counts[COLUMN_CAM_KEYPOINTS] += e.cam_count;
+        counts[COLUMN_CAM_POINTS] += e.cam_count;
+        counts[COLUMN_CAM_DESCRIPTORS] += e.cam_descriptor_rows;
+    }
+
+    const size_t element_size[COLUMN_COUNT] = {
+        sizeof(StoredKeyPoint),
+        pointSize(header.flags),
+        descriptorRowSize(header.descriptor_type, header.descriptor_cols),
+        POSE_SIZE,
+        sizeof(StoredKeyPoint),
+        3 * sizeof(float),
+        descriptorRowSize(header.cam_descriptor_type, header.cam_descriptor_cols)
+    };
+    uint64_t offset = align8(sizeof(Header) + frame_count * sizeof(FrameEntry));
+    for(int c = 0; c < COLUMN_COUNT; c++)
+    {
+        header.column_offset[c] = offset;
+        header.column_size[c] = counts[c] * element_size[c];
+        offset = align8(offset + header.column_size[c]);
+    }
+
+    header.checksum = DBoW3::checksum64((const uchar*)&header, sizeof(header));
+    header.checksum ^= DBoW3::checksum64((const uchar*)frames.data(), frames.size() * sizeof(FrameEntry));
+
+    const string tmp_filename = filename + ".tmp";
+    std::ofstream file(tmp_filename, std::ios::binary | std::ios::trunc);
+    if(!file)
+    {
+        cout<<"SceneColumns::write: can not open "<<tmp_filename<<endl;
+        return false;
+    }
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)frames.data(), frames.size() * sizeof(FrameEntry));
+
+    //pass 2: the rows of each frame at the end of their columns
+    uint64_t cursor[COLUMN_COUNT];
+    for(int c = 0; c < COLUMN_COUNT; c++)
+        cursor[c] = header.column_offset[c];
+    auto append = [&](int c, const void* data, size_t bytes)
+    {
+        if(bytes == 0)
+            return;
+        file.seekp(cursor[c]);
+        file.write((const char*)data, bytes);
+        cursor[c] += bytes;
+    };
+    auto append_rows = [&](int c, const cv::Mat& m)
+    {
+        for(int r = 0; r < m.rows; r++)
+            append(c, m.ptr(r), element_size[c]);
+    };
+
+    for(size_t i = 0; i < frame_count && file; i++)
+    {
+        Frame f;
+        get_frame(i, f);
+        const FrameEntry& e = frames[i];
+
+        vector<StoredKeyPoint> kps;
+        for(const cv::KeyPoint& kp: f.keypoints)
+            kps.push_back(storeKeyPoint(kp));
+        append(COLUMN_KEYPOINTS, kps.data(), kps.size() * sizeof(StoredKeyPoint));
+
+        if(quantize_points)
+        {
+            vector<int16_t> q;
+            for(const cv::Point3d& p: f.points3d)
+            {
+                q.push_back((int16_t)std::lround((p.x - e.point_origin[0]) / e.point_scale));
+                q.push_back((int16_t)std::lround((p.y - e.point_origin[1]) / e.point_scale));
+                q.push_back((int16_t)std::lround((p.z - e.point_origin[2]) / e.point_scale));
+            }
+            append(COLUMN_POINTS, q.data(), q.size() * sizeof(int16_t));
+        }
+        else
+        {
+            vector<float> pts;
+            for(const cv::Point3d& p: f.points3d)
+            {
+                pts.push_back(p.x);
+                pts.push_back(p.y);
+                pts.push_back(p.z);
+            }
+            append(COLUMN_POINTS, pts.data(), pts.size() * sizeof(float));
+        }
+
+        append_rows(COLUMN_DESCRIPTORS, f.descriptors);
+
+        double pose[12] = {0};
+        if(e.has_pose)
+        {
+            cv::Mat R, t;
+            f.R.convertTo(R, CV_64F);
+            f.t.convertTo(t, CV_64F);
+            for(int k = 0; k < 9; k++)
+                pose[k] = R.at<double>(k / 3, k % 3);
+            for(int k = 0; k < 3; k++)
+                pose[9 + k] = t.at<double>(k);
+        }
+        append(COLUMN_POSES, pose, POSE_SIZE);
+
+        kps.clear();
+        for(const cv::KeyPoint& kp: f.cam_keypoints)
+            kps.push_back(storeKeyPoint(kp));
+        append(COLUMN_CAM_KEYPOINTS, kps.data(), kps.size() * sizeof(StoredKeyPoint));
+        append(COLUMN_CAM_POINTS, f.cam_points.data(), f.cam_points.size() * 3 * sizeof(float));
+        append_rows(COLUMN_CAM_DESCRIPTORS, f.cam_descriptors);
+    }
+
+    //the file ends 8 aligned like its columns
+    file.seekp(0, std::ios::end);
+    const size_t end = file.tellp();
+    const char zeros[8] = {0};
+    file.write(zeros, align8(std::max<size_t>(end, offset)) - end);
+    file.close();
+    if(!file)
+    {
+        cout<<"SceneColumns::write: can not write "<<tmp_filename<<endl;
+        std::remove(tmp_filename.c_str());
+        return false;
+    }
+    return std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+}
+
+
+bool SceneColumns::isColumnarFile(const string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    char magic[sizeof(SCENE_COLUMNS_MAGIC)];
+    return file.read(magic, sizeof(magic)) && memcmp(magic, SCENE_COLUMNS_MAGIC, sizeof(magic)) == 0;
+}
+
+
+std::shared_ptr<SceneColumns> SceneColumns::open(const string& filename)
+{
+    std::shared_ptr<SceneColumns> columns(new SceneColumns());
+    columns->mapping = DBoW3::mapFile(filename, columns->size);
+    if(!columns->mapping || columns->size < sizeof(Header))
+        return nullptr;
+
+    const uchar* data = columns->mapping.get();
+    const Header* header = (const Header*)data;
+    if(memcmp(header->magic, SCENE_COLUMNS_MAGIC, sizeof(header->magic)) != 0 ||
+       header->version != SCENE_COLUMNS_VERSION ||
+       header->frame_count > (columns->size - sizeof(Header)) / sizeof(FrameEntry))
+    {
+        cout<<"SceneColumns::open: "<<filename<<" is not a columnar scene of version "<<SCENE_COLUMNS_VERSION<<endl;
+        return nullptr;
+    }
+
+    Header unsigned_header = *header;
+    unsigned_header.checksum = 0;
+    const FrameEntry* frames = (const FrameEntry*)(data + sizeof(Header));
+    uint64_t checksum = DBoW3::checksum64((const uchar*)&unsigned_header, sizeof(Header));
+    checksum ^= DBoW3::checksum64((const uchar*)frames, header->frame_count * sizeof(FrameEntry));
+    if(checksum != header->checksum)
+    {
+        cout<<"SceneColumns::open: "<<filename<<" is damaged"<<endl;
+        return nullptr;
+    }
+
+    for(int c = 0; c < COLUMN_COUNT; c++)
+    {
+        if(header->column_offset[c] % 8 != 0 || header->column_offset[c] > columns->size ||
+           header->column_size[c] > columns->size - header->column_offset[c])
+        {
+            cout<<"SceneColumns::open: "<<filename<<" is cut short"<<endl;
+            return nullptr;
+        }
+    }
+
+    //every frame in its columns, then no access needs checking
+    const size_t point_size = pointSize(header->flags);
+    const size_t row_size = descriptorRowSize(header->descriptor_type, header->descriptor_cols);
+    const size_t cam_row_size = descriptorRowSize(header->cam_descriptor_type, header->cam_descriptor_cols);
+    auto inside = [header](int c, uint64_t first, uint64_t count, size_t element_size)
+    {
+        return count == 0 || (element_size > 0 && first <= header->column_size[c] / element_size &&
+                              count <= header->column_size[c] / element_size - first);
+    };
+    for(uint64_t i = 0; i < header->frame_count; i++)
+    {
+        const FrameEntry& e = frames[i];
+        if(!inside(COLUMN_KEYPOINTS, e.keypoint_first, e.keypoint_count, sizeof(StoredKeyPoint)) ||
+           !inside(COLUMN_POINTS, e.point_first, e.point_count, point_size) ||
+           !inside(COLUMN_DESCRIPTORS, e.descriptor_first, e.descriptor_rows, row_size) ||
+           !inside(COLUMN_POSES, i, 1, POSE_SIZE) ||
+           !inside(COLUMN_CAM_KEYPOINTS, e.cam_first, e.cam_count, sizeof(StoredKeyPoint)) ||
+           !inside(COLUMN_CAM_POINTS, e.cam_first, e.cam_count, 3 * sizeof(float)) ||
+           !inside(COLUMN_CAM_DESCRIPTORS, e.cam_descriptor_first, e.cam_descriptor_rows, cam_row_size))
+        {
+            cout<<"SceneColumns::open: "<<filename<<" frame "<<i<<" is out of its columns"<<endl;
+            return nullptr;
+        }
+    }
+
+    columns->header = header;
+    columns->frames = frames;
+    return columns;
+}
+
+
+size_t SceneColumns::frameCount() const
+{
+    return this->header->frame_count;
+}
+
+bool SceneColumns::hasScale() const
+{
+    return (this->header->flags & FLAG_HAS_SCALE) != 0;
+}
+
+bool SceneColumns::quantizedPoints() const
+{
+    return (this->header->flags & FLAG_QUANTIZED_POINTS) != 0;
+}
+
+const SceneColumns::FrameEntry& SceneColumns::frame(size_t index) const
+{
+    CV_Assert(index < this->header->frame_count);
+    return this->frames[index];
+}
+
+const uchar* SceneColumns::column(int column) const
+{
+    return this->mapping.get() + this->header->column_offset[column];
+}
+
+vector<cv::KeyPoint> SceneColumns::keyPoints(size_t index) const
+{
+    const FrameEntry& e = this->frame(index);
+    return loadKeyPoints(this->column(COLUMN_KEYPOINTS) + e.keypoint_first * sizeof(StoredKeyPoint), e.keypoint_count);
+}
+
+vector<cv::Point3d> SceneColumns::points3d(size_t index) const
+{
+    const FrameEntry& e = this->frame(index);
+    vector<cv::Point3d> pts(e.point_count);
+    const uchar* data = this->column(COLUMN_POINTS) + e.point_first * pointSize(this->header->flags);
+    if(this->header->flags & FLAG_QUANTIZED_POINTS)
+    {
+        for(size_t i = 0; i < pts.size(); i++)
+        {
+            int16_t q[3];
+            memcpy(q, data + i * sizeof(q), sizeof(q));
+            pts[i] = cv::Point3d(e.point_origin[0] + q[0] * (double)e.point_scale,
+                                 e.point_origin[1] + q[1] * (double)e.point_scale,
+                                 e.point_origin[2] + q[2] * (double)e.point_scale);
+        }
+    }
+    else
+    {
+        for(size_t i = 0; i < pts.size(); i++)
+        {
+            float p[3];
+            memcpy(p, data + i * sizeof(p), sizeof(p));
+            pts[i] = cv::Point3d(p[0], p[1], p[2]);
+        }
+    }
+    return pts;
+}
+
+cv::Mat SceneColumns::descriptors(size_t index) const
+{
+    const FrameEntry& e = this->frame(index);
+    if(e.descriptor_rows == 0)
+        return cv::Mat();
+    const size_t row_size = descriptorRowSize(this->header->descriptor_type, this->header->descriptor_cols);
+    return cv::Mat(e.descriptor_rows, this->header->descriptor_cols, this->header->descriptor_type,
+                   (void*)(this->column(COLUMN_DESCRIPTORS) + e.descriptor_first * row_size));
+}
+
+cv::Mat SceneColumns::R(size_t index) const
+{
+    if(!this->frame(index).has_pose)
+        return cv::Mat();
+    cv::Mat R(3, 3, CV_64F);
+    memcpy(R.data, this->column(COLUMN_POSES) + index * POSE_SIZE, 9 * sizeof(double));
+    return R;
+}
+
+cv::Mat SceneColumns::t(size_t index) const
+{
+    if(!this->frame(index).has_pose)
+        return cv::Mat();
+    cv::Mat t(3, 1, CV_64F);
+    memcpy(t.data, this->column(COLUMN_POSES) + index * POSE_SIZE + 9 * sizeof(double), 3 * sizeof(double));
+    return t;
+}
+
+bool SceneColumns::hasCamPoints(size_t index) const
+{
+    return index < this->header->frame_count && this->frames[index].cam_count > 0;
+}
+
+void SceneColumns::camPoints(size_t index, vector<cv::KeyPoint>& keypoints, vector<cv::Point3f>& points,
+                             cv::Mat& descriptors) const
+{
+    const FrameEntry& e = this->frame(index);
+    keypoints = loadKeyPoints(this->column(COLUMN_CAM_KEYPOINTS) + e.cam_first * sizeof(StoredKeyPoint), e.cam_count);
+    points.resize(e.cam_count);
+    if(e.cam_count > 0)
+        memcpy(points.data(), this->column(COLUMN_CAM_POINTS) + e.cam_first * 3 * sizeof(float),
+               e.cam_count * 3 * sizeof(float));
+
+    descriptors = cv::Mat();
+    if(e.cam_descriptor_rows > 0)
+    {
+        const size_t row_size = descriptorRowSize(this->header->cam_descriptor_type, this->header->cam_descriptor_cols);
+        descriptors = cv::Mat(e.cam_descriptor_rows, this->header->cam_descriptor_cols, this->header->cam_descriptor_type,
+                              (void*)(this->column(COLUMN_CAM_DESCRIPTORS) + e.cam_descriptor_first * row_size)).clone();
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef SCENE_COLUMNS_H
+#define SCENE_COLUMNS_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+
+//Columnar scene file, used in place through a read only file mapping:
+//
+//  header | frame table | keypoints | 3d points | descriptors | poses | camera keypoints | camera points | camera descriptors
+//
+//The frame table gives for each frame the first element and the count of its rows in every column, so a frame is read
+//without touching the others. Keypoints are packed float32, 3d points float32 or int16 quantized per frame, descriptors
+//are packed rows of the same type, poses are 3x3 R and 3x1 t in double. The header and the frame table are checksummed.
+//Written by Scene::saveColumnarFile, Scene::loadFile maps them.
+class SceneColumns
+{
+public:
+
+    //content of a frame given to write
+    struct Frame
+    {
+        std::vector<cv::KeyPoint> keypoints;
+        std::vector<cv::Point3d> points3d;
+        cv::Mat descriptors;
+        cv::Mat R;
+        cv::Mat t;
+
+        std::vector<cv::KeyPoint> cam_keypoints;
+        std::vector<cv::Point3f> cam_points;
+        cv::Mat cam_descriptors;
+    };
+
+    //writes frame_count frames, given one at a time by get_frame(index, frame). With quantize_points the 3d points
+    //are stored in int16 around the center of their frame, about extent/65534 precision.
+    //the file is written next to filename and renamed, a mapping of the previous file stays valid.
+    static bool write(const std::string& filename, size_t frame_count, bool has_scale, bool quantize_points,
+                      const std::function<void(size_t, Frame&)>& get_frame);
+
+    //true if the file starts as a columnar scene file.
+    static bool isColumnarFile(const std::string& filename);
+
+    //maps a columnar scene file, nullptr if it is not one or it is damaged.
+    static std::shared_ptr<SceneColumns> open(const std::string& filename);
+
+    size_t frameCount() const;
+
+    bool hasScale() const;
+
+    //the 3d points are stored in int16.
+    bool quantizedPoints() const;
+
+    std::vector<cv::KeyPoint> keyPoints(size_t index) const;
+
+    std::vector<cv::Point3d> points3d(size_t index) const;
+
+    //points into the read only mapping, valid while this object lives.
+    cv::Mat descriptors(size_t index) const;
+
+    //empty if the frame has no pose.
+    cv::Mat R(size_t index) const;
+
+    cv::Mat t(size_t index) const;
+
+    bool hasCamPoints(size_t index) const;
+
+    //the descriptors are copied out of the mapping.
+    void camPoints(size_t index, std::vector<cv::KeyPoint>& keypoints, std::vector<cv::Point3f>& points,
+                   cv::Mat& descriptors) const;
+
+private:
+
+    struct Header;
+    struct FrameEntry;
+
+    SceneColumns() {}
+
+    const FrameEntry& frame(size_t index) const;
+
+    const uchar* column(int column) const;
+
+    std::shared_ptr<const uchar> mapping;
+    size_t size = 0;
+    const Header* header = nullptr;
+    const FrameEntry* frames = nullptr;
+};
+
+#endif
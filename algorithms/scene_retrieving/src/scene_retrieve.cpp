@@ -1,4 +1,7 @@
 #include "scene_retrieve.h"
+#include <algorithm>
+#include <climits>
+#include <map>
 
 /*SceneRetriever::SceneRetriever(Scene& original_scene_input)
 {
@@ -14,6 +17,8 @@ Scene::Scene()
 
 int Scene::getImageCount()
 {
+    if (this->columns)
+        return this->columns->frameCount();
     return this->vec_p2d.size();
 }
 
@@ -48,6 +53,13 @@ void Scene::saveVoc()
 
 void Scene::saveFile(const std::string &filename)
 {
+    // a mapped scene has no frames in memory to serialize, it stays columnar
+    if (this->columns)
+    {
+        this->saveColumnarFile(filename, this->columns->quantizedPoints());
+        return;
+    }
+
     std::ofstream ofs(filename);
 
     {
@@ -57,8 +69,62 @@ void Scene::saveFile(const std::string &filename)
 }
 
 
+bool Scene::saveColumnarFile(const std::string &filename, bool quantize_points)
+{
+    return SceneColumns::write(filename, this->getImageCount(), this->hasScale, quantize_points,
+        [this](size_t index, SceneColumns::Frame& frame)
+        {
+            if (this->columns)
+            {
+                frame.keypoints = this->columns->keyPoints(index);
+                frame.points3d = this->columns->points3d(index);
+                frame.descriptors = this->columns->descriptors(index);
+                frame.R = this->columns->R(index);
+                frame.t = this->columns->t(index);
+            }
+            else
+            {
+                // scenes built frame by frame may miss the last elements of some vectors
+                frame.keypoints = this->vec_p2d[index];
+                if (index < this->vec_p3d.size())
+                    frame.points3d = this->vec_p3d[index];
+                if (index < this->point_desps.size())
+                    frame.descriptors = this->point_desps[index];
+                if (index < this->mVecR.size() && index < this->mVecT.size())
+                {
+                    frame.R = this->mVecR[index];
+                    frame.t = this->mVecT[index];
+                }
+            }
+            this->getCamPoints(index, frame.cam_keypoints, frame.cam_points, frame.cam_descriptors);
+        });
+}
+
+
 void Scene::loadFile(const std::string &filename)
 {
+    if (SceneColumns::isColumnarFile(filename))
+    {
+        this->columns = SceneColumns::open(filename);
+        if (!this->columns)
+            throw std::runtime_error("Scene::loadFile: can not map " + filename);
+
+        this->mIndex = this->columns->frameCount();
+        this->hasScale = this->columns->hasScale();
+        this->vec_p2d.clear();
+        this->vec_p3d.clear();
+        this->point_desps.clear();
+        this->mVecR.clear();
+        this->mVecT.clear();
+        this->vec_cam_kps.clear();
+        this->vec_cam_p3d.clear();
+        this->cam_desps.clear();
+        cout << "Mapped columnar scene " << filename << endl;
+        this->test();
+        return;
+    }
+    this->columns = nullptr;
+
     std::ifstream ifs(filename);
 
     {
@@ -105,6 +171,7 @@ void Scene::test(bool savePosition)
     
     cout<<"mIndex: "<<mIndex<<endl;
     cout<<"hasScale: "<<hasScale<<endl;
+    cout<<"mapped: "<<isMapped()<<", frames: "<<getImageCount()<<endl;
     cout<<"vec_p2d size: "<<vec_p2d.size()<<endl;
     cout<<"vec_p3d size: "<<vec_p3d.size()<<endl;
     cout<<"point_desps size: "<<point_desps.size()<<endl;
@@ -122,7 +189,10 @@ void Scene::test(bool savePosition)
 
 std::vector <cv::Point3d> Scene::fetchFrameMapPoints(size_t frame_index)
 {
-    assert(frame_index > 0 && frame_index < this->vec_p3d.size());
+    if (this->columns)
+        return this->columns->points3d(frame_index);
+
+    assert(frame_index < this->vec_p3d.size());
 
     return this->vec_p3d[frame_index];
 }
@@ -204,25 +274,50 @@ SceneRetriever::SceneRetriever(const string& voc,const string& scene_file)
     this->mpCv_helper = shared_ptr<cv_helper>(new cv_helper(360.0652, 363.2195, 406.6650, 256.2053, 39.9554));
     this->mpCv_helper->setMask("mask.png");
 
-    this->_init_retriever();
+    this->_init_retriever(scene_file + ".kfdb");
 
     this->publishPoseHistory();
 }
 
 
-void SceneRetriever::_init_retriever()
+void SceneRetriever::_init_retriever(const string& keyframe_db_path)
 {
-    auto p2d = this->original_scene.getP2D();
-    auto p3d = this->original_scene.getP3D();
-
     cout<<"SceneRetriever::init retriever start: "<<original_scene.getImageCount()<<endl;
 
-    for(int frame_index = 0; frame_index < original_scene.getImageCount(); frame_index++)
+    int first_frame = 0;
+    if(!keyframe_db_path.empty())
+    {
+        // the keyframe database is cached next to the scene file. A cache cut short (e.g. by a crash
+        // while building it) is completed, one written with another vocabulary or scene is rebuilt
+        int cached = this->ploop_closing_manager_of_scene->loadFromDB(keyframe_db_path);
+        bool valid = cached >= 0 && cached <= original_scene.getImageCount();
+        for(int i = 0; valid && i < cached; i++)
+        {
+            const cv::Mat& a = this->ploop_closing_manager_of_scene->getFrameInfoById(i)->descriptors;
+            const cv::Mat b = this->original_scene.getDespByIndex(i);
+            valid = a.rows == b.rows && a.cols == b.cols && a.type() == b.type() &&
+                    (a.empty() || (a.isContinuous() && b.isContinuous() &&
+                                   memcmp(a.data, b.data, a.total() * a.elemSize()) == 0));
+        }
+
+        if(valid)
+        {
+            first_frame = cached;
+            cout<<"SceneRetriever::init retriever loaded "<<cached<<" keyframes from "<<keyframe_db_path<<endl;
+        }
+        else
+        {
+            this->ploop_closing_manager_of_scene->clearKeyFrames();
+            this->ploop_closing_manager_of_scene->saveDB(keyframe_db_path);
+        }
+    }
+
+    for(int frame_index = first_frame; frame_index < original_scene.getImageCount(); frame_index++)
     {
 
         struct FrameInfo* pfr = new struct FrameInfo;
 	    
-        pfr->keypoints = p2d[frame_index];
+        pfr->keypoints = this->original_scene.getKeyPoints(frame_index);
 	    pfr->descriptors = this->original_scene.getDespByIndex(frame_index);
 
 
@@ -237,7 +332,7 @@ void SceneRetriever::_init_retriever()
 
     cout<<"frameinfo_list.size()"<<this->ploop_closing_manager_of_scene->frameinfo_list.size()<<endl;
 
-    cout<<"loaded database information: "<<this->ploop_closing_manager_of_scene->frame_db<<endl;
+    cout<<"loaded database information: "<<this->ploop_closing_manager_of_scene->frame_db.getDatabase()<<endl;
 }
 
 
@@ -274,6 +369,52 @@ cv::Mat SceneRetriever::fetchImage(size_t index, int left)
 }
 
 
+int SceneRetriever::buildCamPoints(const string& scene_file)
+{
+    int computed = 0;
+    for(size_t index = 0; index < this->original_scene.getImageCount(); index++)
+    {
+        if(this->original_scene.hasCamPoints(index))
+            continue;
+
+        vector<cv::KeyPoint> kps;
+        vector<cv::Point3f> cam_pts;
+        cv::Mat desps;
+        if(this->fetchCamPoints(index, kps, cam_pts, desps))
+            computed++;
+    }
+
+    cout<<"SceneRetriever::buildCamPoints computed "<<computed<<" frames"<<endl;
+    if(computed > 0 && !scene_file.empty())
+        this->original_scene.saveFile(scene_file);
+    return computed;
+}
+
+
+bool SceneRetriever::fetchCamPoints(size_t index, vector<cv::KeyPoint>& kps, vector<cv::Point3f>& cam_pts, cv::Mat& desps)
+{
+    if(!this->original_scene.hasCamPoints(index))
+    {
+        // scene without camera points for this frame, compute them once from its images
+        if(index >= this->mVecLeftImagePath.size() || index >= this->mVecRightImagePath.size())
+            return false;
+
+        cv::Mat image_left = cv::imread(this->mVecLeftImagePath[index]);
+        cv::Mat image_right = cv::imread(this->mVecRightImagePath[index]);
+        if(image_left.empty() || image_right.empty())
+            return false;
+
+        if(!this->mpCv_helper->StereoImage2CamPoints(image_left, image_right, kps, cam_pts, desps))
+            return false;
+        this->original_scene.setCamPoints(index, kps, cam_pts, desps);
+        return true;
+    }
+
+    this->original_scene.getCamPoints(index, kps, cam_pts, desps);
+    return true;
+}
+
+
 void SceneRetriever::displayFeatureMatches(cv::Mat curImage, vector<cv::KeyPoint> curKps,
                                            cv::Mat oldImage, vector<cv::KeyPoint> oldKps,
                                            std::vector<cv::DMatch> matches, size_t loop_index) {
@@ -309,86 +450,109 @@ void SceneRetriever::displayFeatureMatches(size_t loop_index, ptr_frameinfo& cur
 }
 
 
-int SceneRetriever::retrieveSceneFromStereoImage(cv::Mat& image_left_rect, cv::Mat& image_right_rect, cv::Mat& Q_mat, cv::Mat& RT_mat_of_stereo_cam_output, bool& match_success)
+bool SceneRetriever::makeQuery(const cv::Mat& image_left_rect, const cv::Mat& image_right_rect, SceneQuery& query)
 {
-    this->LoopClosureDebugIndex ++;
+    // apply mask to input image
+    query.image_left = image_left_rect.clone();
+    mpCv_helper->applyMask(query.image_left);
+
+    query.frameinfo_left = this->ploop_closing_manager_of_scene->extractFeature(query.image_left);
+    this->ploop_closing_manager_of_scene->transform(query.frameinfo_left, query.bow);
+
+    query.cam_kps.clear();
+    query.cam_pts.clear();
+    query.cam_desps = cv::Mat();
+    if(image_right_rect.empty())
+    {
+        query.image_right = cv::Mat();
+        return true;
+    }
 
+    query.image_right = image_right_rect.clone();
+    mpCv_helper->applyMask(query.image_right);
+
+    // current frame camera points and desps, extracted the same way as the cached ones of the scene
+    // (1000 orb features) so that match2Images sees the same feature budget on both sides
+    return mpCv_helper->StereoImage2CamPoints(query.image_left, query.image_right,
+                                              query.cam_kps, query.cam_pts, query.cam_desps);
+}
+
+
+int SceneRetriever::retrieveSceneFromStereoImage(cv::Mat& image_left_rect, cv::Mat& image_right_rect, cv::Mat& Q_mat, cv::Mat& RT_mat_of_stereo_cam_output, bool& match_success)
+{
     //step<1> generate sparse pointcloud of image pair input and scene.
     if (image_left_rect.empty() || image_right_rect.empty())
     {
+        this->LoopClosureDebugIndex ++;
         cout<<"Left or Right image are empty, return."<<endl;
         match_success = false;
         return -1;
     }
 
-    // apply mask to input image
-    mpCv_helper->applyMask(image_right_rect);
-    mpCv_helper->applyMask(image_left_rect);
-    
-//    cv::imshow("left image", image_left_rect);
-//    cv::waitKey(5);
+    SceneQuery query;
+    if(!this->makeQuery(image_left_rect, image_right_rect, query))
+    {
+        this->LoopClosureDebugIndex ++;
+        match_success = false;
+        return -1;
+    }
 
-    this->mCurrentImage = image_left_rect;
+    return this->retrieveSceneFromStereoQuery(query, RT_mat_of_stereo_cam_output, match_success);
+}
 
-    //<1>-(1) match left image with scene.
-    std::vector<cv::DMatch> good_matches_output;
-    ptr_frameinfo frameinfo_left = this->ploop_closing_manager_of_scene->extractFeature(image_left_rect);
 
-    int loop_index= this->ploop_closing_manager_of_scene->detectLoopByKeyFrame(frameinfo_left, good_matches_output, true);
+int SceneRetriever::retrieveSceneFromStereoQuery(const SceneQuery& query, cv::Mat& RT_mat_of_stereo_cam_output, bool& match_success,
+                                                 const std::atomic<bool>* cancelled)
+{
+    this->LoopClosureDebugIndex ++;
+    match_success = false;
 
-    cout<<"Loop Index: "<<loop_index<<endl;
-    if(loop_index<0)
+    if (query.image_right.empty() || query.cam_kps.empty())
     {
-        //frame match failed.
-        match_success = false;
         return -1;
     }
 
-    //NOTE display feature matches between current frame and detected old frame
-    cout << "good_matches_output: " << good_matches_output.size() << endl;
+//    cv::imshow("left image", query.image_left);
+//    cv::waitKey(5);
+
+    this->mCurrentImage = query.image_left;
 
-    //step 1, fetch current frame camera points and desps
+    //<1>-(1) match left image with scene.
+    std::vector<cv::DMatch> good_matches_output;
+    ptr_frameinfo frameinfo_left = query.frameinfo_left;
 
-    cout<<"icp fetch current frame camera points and desps"<<endl;
+    int loop_index= this->ploop_closing_manager_of_scene->detectLoopByKeyFrame(frameinfo_left, query.bow, good_matches_output, true);
 
-    vector<cv::KeyPoint> current_kps_left;
-    vector<cv::Point3f> current_camera_pts;
-    cv::Mat current_frame_desps;
-    if(!mpCv_helper->StereoImage2CamPoints(image_left_rect, image_right_rect, current_kps_left, current_camera_pts, current_frame_desps))
+    if(loop_index<0 || (cancelled && *cancelled))
     {
-        match_success = false;
+        //frame match failed.
         return -1;
     }
 
+    //step 1, current frame camera points and desps, computed once by makeQuery
 
-    cout<<"icp fetch old frame camera points and desps"<<endl;
+    vector<cv::KeyPoint> current_kps_left = query.cam_kps;
+    vector<cv::Point3f> current_camera_pts = query.cam_pts;
+    cv::Mat current_frame_desps = query.cam_desps;
 
-    //step 2, fetch old frame camera points and desps
-    cv::Mat old_image_left = this->fetchImage(loop_index, 1);
-    cv::Mat old_image_right = this->fetchImage(loop_index, 0);
+    //step 2, fetch old frame camera points and desps, precomputed in the scene
     vector<cv::KeyPoint> old_kps_left;
     vector<cv::Point3f> old_camera_pts;
     cv::Mat old_frame_desps;
-    cout<<"old_image_left size: "<<old_image_left.size()<<endl;
-    if(!mpCv_helper->StereoImage2CamPoints(old_image_left, old_image_right, old_kps_left, old_camera_pts, old_frame_desps))
+    if(!this->fetchCamPoints(loop_index, old_kps_left, old_camera_pts, old_frame_desps))
     {
-        match_success = false;
         return -1;
     }
 
-
     //step 3, match current and old features
     vector<cv::DMatch> result_matches;
     mpCv_helper->match2Images(current_kps_left, current_frame_desps,
                               old_kps_left, old_frame_desps,
                               result_matches);
 
-    cout<<"icp match current and old features"<<endl;
-
     //step 4, if few matches, return false
-    if(result_matches.size() < 20)
+    if(result_matches.size() < 20 || (cancelled && *cancelled))
     {
-        match_success = false;
         return -1;
     }
 
@@ -404,43 +568,40 @@ int SceneRetriever::retrieveSceneFromStereoImage(cv::Mat& image_left_rect, cv::M
         matched_old_cam_pts.push_back(old_camera_pts[result_matches[i].trainIdx]);
     }
 
-    cout<<"icp displayFeatureMatches"<<endl;
-
-    //step 6, now that we have matched camera points we can conduct ICP, we can use either PCL method or opencv method
-    this->displayFeatureMatches(image_left_rect, current_kps_left,
-                                old_image_left, old_kps_left,
-                                result_matches, loop_index);
-
-    cout<<"icp GeneralICP and std::to_string(this->LoopClosureDebugIndex): "<<std::to_string(this->LoopClosureDebugIndex)<<endl;
+    //step 6, now that we have matched camera points we can estimate their rigid transform
+    if(this->SaveFeatureMatches)
+        this->displayFeatureMatches(query.image_left, current_kps_left,
+                                    this->fetchImage(loop_index, 1), old_kps_left,
+                                    result_matches, loop_index);
 
-    Eigen::Matrix4f result;
-    int result_size = mpCv_helper->GeneralICP(matched_current_cam_pts, matched_old_cam_pts, result);
+    //rigid transform of the matched camera points: PROSAC by match distance on Umeyama hypotheses, refined on the inliers
+    vector<float> match_distances;
+    for(int i=0; i<result_matches.size(); i++)
+        match_distances.push_back(result_matches[i].distance);
 
-    cout<<"icp given old T and relative loop closure T, get new T"<<endl;
-    cout<<"Calculated transform matrix is: \n"<<result<<endl;
+    cv::Mat result_R, result_t;
+    vector<int> rigid_inliers;
+    if(!mpCv_helper->rigid_ransac.estimate(matched_current_cam_pts, matched_old_cam_pts, match_distances,
+                                           result_R, result_t, rigid_inliers))
+    {
+        return -1;
+    }
+    int result_size = rigid_inliers.size();
 
     //step 7, given old T and relative loop closure T, get new T
-    cv::Mat result_relative_T;
-    cv::eigen2cv(result, result_relative_T);
-    cv::Mat result_R = result_relative_T.colRange(0,3).rowRange(0,3);
-    cv::Mat result_t = result_relative_T.rowRange(0,3).col(3);
-
+    cv::Mat result_relative_T = cv::Mat::eye(4, 4, CV_64F);
+    result_R.copyTo(result_relative_T.rowRange(0,3).colRange(0,3));
+    result_t.copyTo(result_relative_T.rowRange(0,3).col(3));
 
     //step 8, given old left image and current left image, compute relative R vec from rodrigues by essential mat
-    cout<<"icp step 8"<<endl;
     if(current_kps_left.size() < 30 && old_kps_left.size() < 30)
         return -1;
 
-    cout<<"icp step 9"<<endl;
     cv::Mat essentialR = mpCv_helper->getRotationfromEssential(matched_current_kps, matched_old_kps);
-    cout<<"icp step 10"<<endl;
     cv::Mat essentialRvec, RrelativeVec;
     cv::Rodrigues (essentialR, essentialRvec);
     cv::Rodrigues (result_R, RrelativeVec);
 
-    cout<<"essentialRvec: "<<essentialRvec<<endl;
-    cout<<"RrelativeVec: "<<RrelativeVec<<endl;
-
     float distanceR = mpCv_helper->Vec3Distance(essentialRvec, RrelativeVec);
 
     if(distanceR>0.3)
@@ -471,8 +632,6 @@ int SceneRetriever::retrieveSceneFromStereoImage(cv::Mat& image_left_rect, cv::M
 
     old_T.at<double>(3, 3) = 1.0;
 
-    cout<<"old T:\n"<<old_T<<endl;
-
     cv::Mat new_T;
 
     result_relative_T.convertTo(result_relative_T, CV_64F);
@@ -482,10 +641,9 @@ int SceneRetriever::retrieveSceneFromStereoImage(cv::Mat& image_left_rect, cv::M
     cv::Mat new_R = new_T.colRange(0,3).rowRange(0,3);
     cv::Mat new_t = new_T.rowRange(0,3).col(3);
 
-    cout<<"new T:\n"<<new_T<<endl;
-
     this->mpCv_helper->publishPose(new_R, new_t, 0);
     RT_mat_of_stereo_cam_output = new_T;
+    match_success = true;
 
     return result_size;
 }
@@ -500,40 +658,51 @@ int SceneRetriever::retrieveSceneWithScaleFromMonoImage(cv::Mat image_left_rect,
         return -1;
     }
 
-    // NOTE this is the working version of SHR
-    this->LoopClosureDebugIndex ++;
-
     //step<1> generate sparse pointcloud of image pair input and scene.
     if (image_left_rect.empty())
     {
+        this->LoopClosureDebugIndex ++;
         cout<<"Left or Right image is empty, return."<<endl;
         match_success = false;
         return -1;
     }
 
-    // apply mask to input image
-    mpCv_helper->applyMask(image_left_rect);
+    SceneQuery query;
+    this->makeQuery(image_left_rect, cv::Mat(), query);
+
+    return this->retrieveSceneWithScaleFromMonoQuery(query, RT_mat_of_mono_cam_output, match_success);
+}
+
+
+int SceneRetriever::retrieveSceneWithScaleFromMonoQuery(const SceneQuery& query, cv::Mat& RT_mat_of_mono_cam_output, bool& match_success,
+                                                        const std::atomic<bool>* cancelled)
+{
+    match_success = false;
+    if(this->original_scene.hasScale == false)
+    {
+        return -1;
+    }
+
+    // NOTE this is the working version of SHR
+    this->LoopClosureDebugIndex ++;
 
-//    cv::imshow("left image", image_left_rect);
+//    cv::imshow("left image", query.image_left);
 //    cv::waitKey(5);
 
-    this->mCurrentImage = image_left_rect;
+    this->mCurrentImage = query.image_left;
 
     //<1>-(1) match left image with scene.
     std::vector<cv::DMatch> good_matches_output;
-    ptr_frameinfo frameinfo_left = this->ploop_closing_manager_of_scene->extractFeature(image_left_rect);
+    ptr_frameinfo frameinfo_left = query.frameinfo_left;
 
-    int loop_index= this->ploop_closing_manager_of_scene->detectLoopByKeyFrame(frameinfo_left, good_matches_output, true);
+    int loop_index= this->ploop_closing_manager_of_scene->detectLoopByKeyFrame(frameinfo_left, query.bow, good_matches_output, true);
 
-    cout<<"Loop Index: "<<loop_index<<endl;
-    if(loop_index<0)
+    if(loop_index<0 || (cancelled && *cancelled))
     {
-        match_success = false;
         return -1;
     }
 
     //NOTE display feature matches between current frame and detected old frame
-    cout << "good_matches_output: " << good_matches_output.size() << endl;
 
     if (good_matches_output.size() > 10) {
         this->displayFeatureMatches(loop_index, frameinfo_left, good_matches_output);
@@ -553,31 +722,31 @@ int SceneRetriever::retrieveSceneWithScaleFromMonoImage(cv::Mat image_left_rect,
     //conduct pnp
     if (old_image_right.empty() || old_image_left.empty() || R.empty() || t.empty())
     {
-        cout<<"Image empty or Rt empty before solvePnP"<<endl;
         match_success = false;
         return -1;
     }
     else
     {
+        // features of the current image are those of the loop query
         int pnpResult = this->mpCv_helper->solvePnP(old_image_left,
                                                      old_image_right,
-                                                     image_left_rect,
+                                                     query.image_left,
+                                                     frameinfo_left->keypoints,
+                                                     frameinfo_left->descriptors,
                                                      R, t,
                                                      result_R, result_t);
 
-        cout<<"pnpresult: "<<pnpResult<<endl;
-        cout<<"pnpresult: "<<bool(pnpResult)<<endl;
         if(pnpResult>0 && !result_R.empty() && !result_t.empty())
         {
-            cout<<"pnp result are: \n: "<<result_R<<endl<<result_t<<endl;
-            cout<<"solve pnp finished, publishing the result."<<endl;
-
             cv::Mat temp_t =  -result_R.t()*result_t;
 
             //this->mpCv_helper->publishPose(result_R, result_t, 0);
             this->mpCv_helper->publishPose(-result_R.t(), temp_t, 0);
 
-            cout<<"solve pnp finished, publishing the result finished."<<endl;
+            // camera to scene, as the stereo retrieval
+            RT_mat_of_mono_cam_output = cv::Mat::eye(4, 4, CV_64F);
+            cv::Mat(result_R.t()).copyTo(RT_mat_of_mono_cam_output.rowRange(0,3).colRange(0,3));
+            temp_t.copyTo(RT_mat_of_mono_cam_output.rowRange(0,3).col(3));
 
             match_success = true;
             return pnpResult;
@@ -658,14 +827,216 @@ int SceneRetriever::retrieveSceneWithScaleFromMonoImage(cv::Mat image_left_rect,
 }
 
 
+int SceneRetriever::trackSession(const SceneQuery& query, const MappingSession& session, cv::Mat& RT_mat_output, int& frame_index_output)
+{
+    frame_index_output = -1;
+
+    const ptr_frameinfo& frameinfo = query.frameinfo_left;
+    if(!session.isLocked() || session.pose.empty() || !frameinfo || frameinfo->keypoints.empty() || query.image_left.empty())
+        return -1;
+
+    //step 1, last verified pose, camera to scene, and the scene to camera transform used for the projection
+    cv::Mat pose;
+    session.pose.convertTo(pose, CV_64F);
+    cv::Matx33d R_wc(pose.rowRange(0,3).colRange(0,3));
+    cv::Vec3d t_wc(pose.at<double>(0,3), pose.at<double>(1,3), pose.at<double>(2,3));
+    cv::Matx33d R_cw = R_wc.t();
+    cv::Vec3d t_cw = -(R_cw * t_wc);
+
+    cv::Mat K;
+    this->mpCv_helper->Kmat.convertTo(K, CV_64F);
+    const double fx = K.at<double>(0,0), fy = K.at<double>(1,1), cx = K.at<double>(0,2), cy = K.at<double>(1,2);
+
+    //step 2, frames to try: the last verified one, then those with the camera nearest to the pose
+    int frame_count = this->original_scene.getImageCount();
+    vector<std::pair<double, int> > frame_distances;
+    for(int i = 0; i < frame_count; i++)
+    {
+        cv::Mat t = this->original_scene.getT(i);
+        if(i == session.frame_index || t.total() != 3)
+            continue;
+
+        cv::Mat t_d;
+        t.convertTo(t_d, CV_64F);
+        cv::Vec3d center(t_d.at<double>(0), t_d.at<double>(1), t_d.at<double>(2));
+        frame_distances.push_back(std::make_pair(cv::norm(center - t_wc), i));
+    }
+
+    vector<int> frames;
+    if(session.frame_index >= 0 && session.frame_index < frame_count)
+        frames.push_back(session.frame_index);
+
+    size_t nearest_count = std::min(frame_distances.size(), (size_t)std::max(0, session.neighbour_frames - (int)frames.size()));
+    std::partial_sort(frame_distances.begin(), frame_distances.begin() + nearest_count, frame_distances.end());
+    for(size_t i = 0; i < nearest_count; i++)
+        frames.push_back(frame_distances[i].second);
+
+    //step 3, grid of the query keypoints, cells of the search radius
+    const vector<cv::KeyPoint>& query_kps = frameinfo->keypoints;
+    const cv::Mat& query_desps = frameinfo->descriptors;
+    const double radius = session.search_radius_px;
+    const int grid_cols = (int)ceil(query.image_left.cols / radius) + 1;
+    const int grid_rows = (int)ceil(query.image_left.rows / radius) + 1;
+    vector<vector<int> > grid(grid_cols * grid_rows);
+    for(size_t k = 0; k < query_kps.size(); k++)
+    {
+        int col = std::min(std::max((int)(query_kps[k].pt.x / radius), 0), grid_cols - 1);
+        int row = std::min(std::max((int)(query_kps[k].pt.y / radius), 0), grid_rows - 1);
+        grid[row * grid_cols + col].push_back(k);
+    }
+
+    //step 4, projected search: each map point of the frames is matched to the nearest descriptor of the query keypoints
+    //around its projection, a query keypoint keeps its best map point
+    vector<int> best_distance(query_kps.size(), INT_MAX);
+    vector<cv::Point3f> best_point(query_kps.size());
+    vector<int> best_frame(query_kps.size(), -1);
+    for(int frame: frames)
+    {
+        vector<cv::Point3d> map_points = this->original_scene.fetchFrameMapPoints(frame);
+        cv::Mat desps = this->original_scene.getDespByIndex(frame);
+        if(desps.rows != (int)map_points.size() || desps.type() != query_desps.type() || desps.cols != query_desps.cols)
+            continue;
+
+        for(size_t j = 0; j < map_points.size(); j++)
+        {
+            cv::Vec3d p = R_cw * cv::Vec3d(map_points[j].x, map_points[j].y, map_points[j].z) + t_cw;
+            if(p[2] <= 0)
+                continue;
+
+            double u = fx * p[0] / p[2] + cx;
+            double v = fy * p[1] / p[2] + cy;
+            if(u < -radius || v < -radius || u >= query.image_left.cols + radius || v >= query.image_left.rows + radius)
+                continue;
+
+            int best = INT_MAX, second = INT_MAX, best_k = -1;
+            int col_begin = std::max((int)floor((u - radius) / radius), 0), col_end = std::min((int)floor((u + radius) / radius), grid_cols - 1);
+            int row_begin = std::max((int)floor((v - radius) / radius), 0), row_end = std::min((int)floor((v + radius) / radius), grid_rows - 1);
+            for(int row = row_begin; row <= row_end; row++)
+            {
+                for(int col = col_begin; col <= col_end; col++)
+                {
+                    for(int k: grid[row * grid_cols + col])
+                    {
+                        double du = query_kps[k].pt.x - u, dv = query_kps[k].pt.y - v;
+                        if(du * du + dv * dv > radius * radius)
+                            continue;
+
+                        int distance = (int)cv::norm(desps.row(j), query_desps.row(k), cv::NORM_HAMMING);
+                        if(distance < best)
+                        {
+                            second = best;
+                            best = distance;
+                            best_k = k;
+                        }
+                        else if(distance < second)
+                        {
+                            second = distance;
+                        }
+                    }
+                }
+            }
+
+            //distinctive in the window
+            if(best_k < 0 || best > session.max_descriptor_distance || (second != INT_MAX && best > 0.8 * second))
+                continue;
+
+            if(best < best_distance[best_k])
+            {
+                best_distance[best_k] = best;
+                best_point[best_k] = cv::Point3f(map_points[j].x, map_points[j].y, map_points[j].z);
+                best_frame[best_k] = frame;
+            }
+        }
+    }
+
+    vector<cv::Point3f> matched_points;
+    vector<cv::Point2f> matched_image_points;
+    vector<float> matched_distances;
+    std::map<int, int> frame_matches;
+    for(size_t k = 0; k < query_kps.size(); k++)
+    {
+        if(best_frame[k] < 0)
+            continue;
+
+        matched_points.push_back(best_point[k]);
+        matched_image_points.push_back(query_kps[k].pt);
+        matched_distances.push_back(best_distance[k]);
+        frame_matches[best_frame[k]]++;
+    }
+
+    if((int)matched_points.size() < std::max(session.min_tracked_inliers, 4))
+        return -1;
+
+    //step 5, pose by PnP ransac, PROSAC by descriptor distance, 4 pixels threshold
+    cv::Mat result_R, result_t;
+    vector<int> inliers;
+    PnPRansac& pnp_ransac = this->mpCv_helper->session_pnp_ransac;
+    if(!pnp_ransac.estimate(matched_points, matched_image_points, matched_distances, K, result_R, result_t, inliers))
+        return -1;
+
+    if((int)inliers.size() < session.min_tracked_inliers)
+        return -1;
+
+    //step 6, camera to scene pose
+    cv::Mat new_R = result_R.t();
+    cv::Mat new_t = -new_R * result_t;
+
+    RT_mat_output = cv::Mat::eye(4, 4, CV_64F);
+    new_R.copyTo(RT_mat_output.rowRange(0,3).colRange(0,3));
+    new_t.copyTo(RT_mat_output.rowRange(0,3).col(3));
+
+    int most_matches = 0;
+    for(const auto& frame: frame_matches)
+    {
+        if(frame.second > most_matches)
+        {
+            most_matches = frame.second;
+            frame_index_output = frame.first;
+        }
+    }
+
+    this->mpCv_helper->publishPose(new_R, new_t, 0);
+
+    return inliers.size();
+}
+
+
+int SceneRetriever::retrieveSceneInSession(const SceneQuery& query, MappingSession& session, cv::Mat& RT_mat_output, bool& match_success)
+{
+    match_success = false;
+
+    //step 1, session fast path
+    int frame_index = -1;
+    int result = this->trackSession(query, session, RT_mat_output, frame_index);
+    if(result > 0)
+    {
+        session.onTracked(frame_index, RT_mat_output);
+        match_success = true;
+        return result;
+    }
+
+    //step 2, global bow query of the scene
+    if(query.image_right.empty())
+        result = this->retrieveSceneWithScaleFromMonoQuery(query, RT_mat_output, match_success);
+    else
+        result = this->retrieveSceneFromStereoQuery(query, RT_mat_output, match_success);
+
+    if(match_success)
+        session.onGlobalMatch(session.scene_index, RT_mat_output);
+    else
+        session.onLost();
+
+    return result;
+}
+
+
 void SceneRetriever::publishPoseHistory()
 {
     assert(this->mpCv_helper != nullptr);
 
-    vector<cv::Mat> vecT = this->original_scene.mVecT;
-
-    for(auto& t: this->original_scene.mVecT)
+    for(size_t index = 0; index < this->original_scene.getImageCount(); index++)
     {
+        cv::Mat t = this->original_scene.getT(index);
         if(t.empty())
             continue;
 
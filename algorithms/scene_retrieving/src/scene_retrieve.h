@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <vector>
+#include <atomic>
 
 // DBoW2/3
 #include "DBoW3.h" // defines OrbVocabulary and OrbDatabase
@@ -19,6 +20,8 @@
 #include "LoopClosingManager.h"
 #include "scene_frame_properties.h"
 #include "serialization.h"
+#include "scene_columns.h"
+#include "session/temporal_manager.h"
 
 #include <Eigen/Core>
 
@@ -55,13 +58,24 @@ public:
     
     void setVisiblePointCloud(const std::string &pointcloud_filename);
     
-    inline int getImageCount();
+    int getImageCount();
     
-    inline cv::Mat& getDespByIndex(int i)
+    //of a mapped scene, the descriptors point into the read only file mapping.
+    inline cv::Mat getDespByIndex(int i)
     {
+      if (this->columns)
+        return this->columns->descriptors(i);
       return this->point_desps[i];
     }
+
+    inline std::vector<cv::KeyPoint> getKeyPoints(size_t index)
+    {
+      if (this->columns)
+        return this->columns->keyPoints(index);
+      return this->vec_p2d[index];
+    }
     
+    //all the frames at once, not for mapped scenes (see isMapped).
     inline std::vector<std::vector<cv::KeyPoint>>& getP2D()
     {
       return this->vec_p2d;
@@ -99,14 +113,59 @@ public:
         this->hasScale = hasScale_in;
     }
 
+    // camera frame points of a frame, computed once from its stereo pair (see SceneRetriever::buildCamPoints)
+    inline bool hasCamPoints(size_t index) const
+    {
+        return (index < this->vec_cam_p3d.size() && !this->vec_cam_p3d[index].empty()) ||
+               (this->columns && this->columns->hasCamPoints(index));
+    }
+
+    // of a mapped scene, those set since it was loaded are kept in memory
+    inline void getCamPoints(size_t index, std::vector<cv::KeyPoint>& kps, std::vector<cv::Point3f>& cam_pts, cv::Mat& desps) const
+    {
+        if(index < this->vec_cam_p3d.size() && !this->vec_cam_p3d[index].empty())
+        {
+            kps = this->vec_cam_kps[index];
+            cam_pts = this->vec_cam_p3d[index];
+            desps = this->cam_desps[index];
+        }
+        else if(this->columns)
+        {
+            this->columns->camPoints(index, kps, cam_pts, desps);
+        }
+    }
+
+    inline void setCamPoints(size_t index, const std::vector<cv::KeyPoint>& kps, const std::vector<cv::Point3f>& cam_pts, const cv::Mat& desps)
+    {
+        if(index >= this->vec_cam_p3d.size())
+        {
+            this->vec_cam_kps.resize(index + 1);
+            this->vec_cam_p3d.resize(index + 1);
+            this->cam_desps.resize(index + 1);
+        }
+        this->vec_cam_kps[index] = kps;
+        this->vec_cam_p3d[index] = cam_pts;
+        this->cam_desps[index] = desps;
+    }
+
 
 
     
     void saveVoc();
 
     void saveFile(const std::string &filename);
+
+    // columnar file (see SceneColumns), loadFile maps it instead of reading every frame
+    bool saveColumnarFile(const std::string &filename, bool quantize_points = false);
     
+    // reads a scene saved by saveFile, or maps one saved by saveColumnarFile
     void loadFile(const std::string &filename);
+
+    // the frames are read from a columnar file when used, the vectors of the frames are empty
+    inline bool isMapped() const
+    {
+        return this->columns != nullptr;
+    }
     
     void saveDeserializedPoseToCSV();
     
@@ -134,6 +193,10 @@ public:
         
         ar & mVecR;
         ar & mVecT;
+
+        ar & vec_cam_kps;
+        ar & vec_cam_p3d;
+        ar & cam_desps;
         
         //ar & m_RT_Scene_Fix;
         //ar & point_cloud_of_scene;
@@ -153,6 +216,14 @@ public:
         
         ar & mVecR;
         ar & mVecT;
+
+        // scene files of version 0 have no camera points, they are computed again from the images
+        if(version >= 1)
+        {
+            ar & vec_cam_kps;
+            ar & vec_cam_p3d;
+            ar & cam_desps;
+        }
         
         //ar & m_RT_Scene_Fix;
         //ar & point_cloud_of_scene;
@@ -164,11 +235,19 @@ public:
 
     inline cv::Mat getR(size_t index)
     {
+        if (this->columns)
+            return this->columns->R(index);
+        if (index >= this->mVecR.size())
+            return cv::Mat();
         return this->mVecR[index];
     }
 
     inline cv::Mat getT(size_t index)
     {
+        if (this->columns)
+            return this->columns->t(index);
+        if (index >= this->mVecT.size())
+            return cv::Mat();
         return this->mVecT[index];
     }
 
@@ -184,14 +263,23 @@ public:
     
     vector<cv::Mat> mVecR;
     vector<cv::Mat> mVecT;
+
+    // per frame: left image features tracked in the right image, their camera frame points and descriptors
+    std::vector<std::vector<cv::KeyPoint>> vec_cam_kps;
+    std::vector<std::vector<cv::Point3f>> vec_cam_p3d;
+    std::vector<cv::Mat> cam_desps;
     
     std::vector<SceneFrame_Properties> vec_properties;
     
     cv::Mat m_RT_Scene_Fix = cv::Mat::eye(4,4,CV_32F);//fix 3d pose of scene.
 
+    std::shared_ptr<const SceneColumns> columns;//file mapping of a columnar scene
+
     //pcl::PointCloud<pcl::PointXYZRGBA>::Ptr point_cloud_of_scene; //Take care:this cloud is not required, so do not use it in any algorithm.
 };
 
+BOOST_CLASS_VERSION(Scene, 1)
+
 
 
 
@@ -203,10 +291,19 @@ SceneFrame generateSceneFrameFromStereoImage(const cv::Mat &imgl, cv::Mat &imgr,
     std::vector<cv::Point3d> points3d;
     cv::Mat feature;
     
-    LoopClosingManager lcm("./voc/brief_k10L6.bin");
+    // the detectors are kept from one stereo pair to the next and both images are extracted in
+    // parallel, no LoopClosingManager (and so no vocabulary) is loaded per pair
+    static FeatureExtractor stereo_extractor;
+    std::vector<std::vector<cv::KeyPoint> > stereo_keypoints;
+    std::vector<cv::Mat> stereo_descriptors;
+    stereo_extractor.extract(std::vector<cv::Mat>{imgl, imgr}, stereo_keypoints, stereo_descriptors);
 
-    ptr_frameinfo pleft_image_info = lcm.extractFeature(imgl);
-    ptr_frameinfo pright_image_info = lcm.extractFeature(imgr);
+    ptr_frameinfo pleft_image_info(new FrameInfo);
+    ptr_frameinfo pright_image_info(new FrameInfo);
+    pleft_image_info->keypoints.swap(stereo_keypoints[0]);
+    pleft_image_info->descriptors = stereo_descriptors[0];
+    pright_image_info->keypoints.swap(stereo_keypoints[1]);
+    pright_image_info->descriptors = stereo_descriptors[1];
     
     cv::Mat feature_l,feature_r;
     feature_l = pleft_image_info->descriptors;
@@ -343,6 +440,26 @@ SceneFrame generateSceneFrameFromStereoImage(const cv::Mat &imgl, cv::Mat &imgr,
 
 
 
+// features of a query image (or stereo pair), computed once by SceneRetriever::makeQuery and matched against
+// any number of scenes with the same vocabulary and camera
+struct SceneQuery
+{
+    // masked images, image_right is empty for a mono query
+    cv::Mat image_left;
+    cv::Mat image_right;
+
+    // features of the left image and their bow vector
+    ptr_frameinfo frameinfo_left;
+    BowVector bow;
+
+    // stereo query: left features (extracted as for the scene camera points) tracked in the right image
+    // and their camera frame points
+    vector<cv::KeyPoint> cam_kps;
+    vector<cv::Point3f> cam_pts;
+    cv::Mat cam_desps;
+};
+
+
 class SceneRetriever
 {
 public:
@@ -366,6 +483,27 @@ public:
     
     int retrieveSceneFromStereoImage(cv::Mat& image_left_rect, cv::Mat& image_right_rect, cv::Mat& Q_mat, cv::Mat& RT_mat_of_stereo_cam_output, bool& match_success);
 
+    // extracts the features of a query once, image_right_rect may be empty for a mono query. Returns false if a stereo
+    // query has too few features tracked in the right image
+    bool makeQuery(const cv::Mat& image_left_rect, const cv::Mat& image_right_rect, SceneQuery& query);
+
+    // retrievals from a query made by any scene with the same vocabulary and camera. They stop with no match between
+    // two steps once *cancelled is set (e.g. another scene already matched)
+    int retrieveSceneFromStereoQuery(const SceneQuery& query, cv::Mat& RT_mat_of_stereo_cam_output, bool& match_success,
+                                     const std::atomic<bool>* cancelled = nullptr);
+
+    int retrieveSceneWithScaleFromMonoQuery(const SceneQuery& query, cv::Mat& RT_mat_of_mono_cam_output, bool& match_success,
+                                            const std::atomic<bool>* cancelled = nullptr);
+
+    // fast path of a locked session: the map points of its last verified frame and of the frames nearest to its pose
+    // are projected with the pose and matched to the query features around their projection, then the pose is solved
+    // by PnP. Returns the inliers count or -1 and the frame with the most matches, the session is not updated
+    int trackSession(const SceneQuery& query, const MappingSession& session, cv::Mat& RT_mat_output, int& frame_index_output);
+
+    // session aware retrieval: the session fast path, then the global bow query of the scene if it fails. Updates the
+    // session and its hit rate
+    int retrieveSceneInSession(const SceneQuery& query, MappingSession& session, cv::Mat& RT_mat_output, bool& match_success);
+
     void debugVisualize();//visualize pointcloud and cam pose.
 
     void readImage(vector<string>& image_paths);
@@ -374,6 +512,13 @@ public:
 
     cv::Mat fetchImage(size_t index, int left);
 
+    // computes the camera points of the scene frames that have none from their stereo images (see setImageVecPath),
+    // and saves the scene to scene_file if any was computed. Returns the number of frames computed
+    int buildCamPoints(const string& scene_file);
+
+    // camera points of a scene frame, computed from its stereo images the first time if the scene file has none
+    bool fetchCamPoints(size_t index, vector<cv::KeyPoint>& kps, vector<cv::Point3f>& cam_pts, cv::Mat& desps);
+
     void displayFeatureMatches(cv::Mat curImage, vector<cv::KeyPoint> curKps,
                                cv::Mat oldImage, vector<cv::KeyPoint> oldKps,
                                std::vector<cv::DMatch> matches, size_t loop_index);
@@ -384,10 +529,14 @@ public:
 
     size_t LoopClosureDebugIndex = 0;
 
+    // write the feature matches of each stereo retrieval to ./loopclosure_result, reads the scene image from disk
+    bool SaveFeatureMatches = false;
+
 
 private:
 
-    void _init_retriever();
+    //keyframe_db_path: keyframe database cache of the scene (see LoopClosingManager::saveDB), empty to always rebuild
+    void _init_retriever(const string& keyframe_db_path = "");
 
     Scene original_scene;
 
@@ -1,24 +1,103 @@
+#ifndef TEMPORAL_MANAGER_H
+#define TEMPORAL_MANAGER_H
 
-
-class MappingSession();//Avoid scene shifting when do retreving/mapping between multiple scenes.
-void InitMappingSession(MultiSceneRetriever &s,MappingSession& m);
+#include <cstddef>
+#include <opencv2/core.hpp>
 
 
+//Avoid scene shifting when do retreving/mapping between multiple scenes.
+//State of the retrievals of one moving camera: once a query is verified the session is locked on its scene, scene frame
+//and pose. The next queries are first matched by projecting the map points of that frame and of the frames nearest to
+//the pose into the query image (see SceneRetriever::trackSession), the global bow query is done only if that fails.
 class MappingSession // to manage the temporal relation of multi scene.
 {
 public:
-    MappingSession();
-        
+
+    MappingSession() {}
+
+    bool isLocked() const
+    {
+        return this->session_locked;
+    }
+
+    //a query matched by the session fast path in frame_index of the locked scene.
+    void onTracked(int frame_index_in, const cv::Mat& pose_in)
+    {
+        this->query_count++;
+        this->tracked_count++;
+        this->lock(this->scene_index, frame_index_in, pose_in);
+    }
+
+    //a query matched by the global bow query, the scene frame is not known.
+    void onGlobalMatch(int scene_index_in, const cv::Mat& pose_in)
+    {
+        this->query_count++;
+        this->global_match_count++;
+        this->lock(scene_index_in, -1, pose_in);
+    }
+
+    //a query matched by neither. The session is unlocked after max_lost_queries in a row.
+    void onLost()
+    {
+        this->query_count++;
+        this->lost_count++;
+        this->lost_queries++;
+        if (this->lost_queries >= this->max_lost_queries)
+        {
+            this->unlock();
+        }
+    }
+
+    void unlock()
+    {
+        this->session_locked = false;
+        this->scene_index = -1;
+        this->frame_index = -1;
+        this->pose = cv::Mat();
+        this->lost_queries = 0;
+    }
+
+    //part of the queries matched by the fast path, without a global bow query.
+    double hitRate() const
+    {
+        return this->query_count == 0 ? 0.0 : (double)this->tracked_count / this->query_count;
+    }
+
 private:
 
+    void lock(int scene_index_in, int frame_index_in, const cv::Mat& pose_in)
+    {
+        this->session_locked = true;
+        this->scene_index = scene_index_in;
+        this->frame_index = frame_index_in;
+        this->pose = pose_in.clone();
+        this->lost_queries = 0;
+    }
+
+public:
+
 //session state
-    bool session_locked;
-//motion dynamics state
-    quarternion state_estimated;
-    double gps_accurate_longitude;
-    double gps_accurate_latitude;
-    double height_accurate;
-//scene selection state
-    shared_ptr<pScene> selected_scene;
-    double visual_matching_dynamic_threshold;
+    int scene_index = -1;//in MultiSceneRetriever, -1 with a single SceneRetriever.
+    int frame_index = -1;//last verified scene frame, -1 if not known.
+    cv::Mat pose;//last verified pose, 4x4 camera to scene.
+    int lost_queries = 0;
+
+//fast path settings
+    int neighbour_frames = 5;//scene frames tried, the last verified one and the nearest to the pose.
+    double search_radius_px = 20;//around the projection of a map point.
+    int max_descriptor_distance = 50;//hamming.
+    int min_tracked_inliers = 20;//pnp inliers to accept a tracked query.
+    int max_lost_queries = 5;
+
+//hit rate counters
+    size_t query_count = 0;
+    size_t tracked_count = 0;
+    size_t global_match_count = 0;
+    size_t lost_count = 0;
+
+private:
+
+    bool session_locked = false;
 };
+
+#endif
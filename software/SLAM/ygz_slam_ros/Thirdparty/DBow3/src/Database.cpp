@@ -1,13 +1,570 @@
 #include "../src/Database.h"
 
+#include <algorithm>
+
 namespace DBoW3{
 
 // --------------------------------------------------------------------------
 
+/// Partial scores of the entries hit by a query. The scores are stored
+/// densely by entry id and only the entries touched by the previous query
+/// are reset, so a query costs in the number of postings it reads and not
+/// in the size of the database. Each thread has one accumulator per query
+/// of the batch it scores, covering the range of entries being scored
+class ScoreAccumulator
+{
+public:
+
+  /// Partial score of one entry
+  struct Score
+  {
+    double value;
+    double sum_v; // sum of the query weights of the common words
+    double sum_w; // sum of the entry weights of the common words
+    int n_words;  // number of common words, 0 if not touched
+  };
+
+  /**
+   * Returns the first n accumulators of the calling thread, cleared
+   * @param n number of queries of the batch
+   * @param begin first entry id scored
+   * @param end entry id after the last one scored
+   */
+  static ScoreAccumulator* get(size_t n, EntryId begin, EntryId end)
+  {
+    static thread_local std::vector<ScoreAccumulator> accs;
+    if(accs.size() < n) accs.resize(n);
+    for(size_t q = 0; q < n; q++) accs[q].reset(begin, end);
+    return accs.data();
+  }
+
+  ScoreAccumulator(): m_base(0) {}
+
+  /**
+   * Returns the score of an entry and counts one more common word
+   * @param eid entry id, in the range of the accumulator
+   */
+  inline Score& add(EntryId eid)
+  {
+    Score &s = m_scores[eid - m_base];
+    if(s.n_words++ == 0) m_touched.push_back(eid);
+    return s;
+  }
+
+  inline const Score& operator[](EntryId eid) const
+  {
+    return m_scores[eid - m_base];
+  }
+
+  /// Entries with at least one common word, in order of first touch
+  inline const std::vector<EntryId>& touched() const { return m_touched; }
+
+private:
+
+  void reset(EntryId begin, EntryId end)
+  {
+    for(EntryId eid: m_touched) m_scores[eid - m_base] = Score();
+    m_touched.clear();
+    m_base = begin;
+    if(m_scores.size() < end - begin) m_scores.resize(end - begin, Score());
+  }
+
+  std::vector<Score> m_scores;
+  std::vector<EntryId> m_touched;
+  EntryId m_base;
+};
+
+// --------------------------------------------------------------------------
+
+/// Ascending score, ties by ascending entry id
+static inline bool lowerScore(const Result &a, const Result &b)
+{
+  return a.Score < b.Score || (a.Score == b.Score && a.Id < b.Id);
+}
+
+/// Descending score, ties by ascending entry id
+static inline bool higherScore(const Result &a, const Result &b)
+{
+  return a.Score > b.Score || (a.Score == b.Score && a.Id < b.Id);
+}
+
+/// Sorts the first max_results results (all if <= 0) and drops the rest
+template<class Compare>
+static void selectTop(QueryResults &ret, int max_results, Compare comp)
+{
+  if(max_results > 0 && (int)ret.size() > max_results)
+  {
+    std::partial_sort(ret.begin(), ret.begin() + max_results, ret.end(), comp);
+    ret.resize(max_results);
+  }
+  else
+  {
+    std::sort(ret.begin(), ret.end(), comp);
+  }
+}
+
+// --------------------------------------------------------------------------
+// Scoring methods. For a word of the query with value v found in an entry
+// with weight w, update() accumulates the partial score of the entry, with
+// term() computed once per query word. emit() moves the partial score of a
+// touched entry to the results and finish() completes the best ones, given
+// the sum of the terms of the query
+
+typedef ScoreAccumulator::Score PartialScore;
+
+struct L1Accumulation
+{
+  inline double term(WordValue) const { return 0; }
+
+  inline void update(PartialScore &s, WordValue v, double, WordValue w) const
+  {
+    s.value += fabs(v - w) - fabs(v) - fabs(w);
+  }
+
+  inline void emit(EntryId eid, const PartialScore &s, QueryResults &ret) const
+  {
+    ret.push_back(Result(eid, s.value));
+  }
+
+  void finish(double, QueryResults &ret, int max_results) const
+  {
+    // resulting "scores" are now in [-2 best .. 0 worst]
+
+    // keep the best ones in ascending order of score
+    selectTop(ret, max_results, lowerScore);
+    // (ret is inverted now --the lower the better--)
+
+    // complete and scale score to [0 worst .. 1 best]
+    // ||v - w||_{L1} = 2 + Sum(|v_i - w_i| - |v_i| - |w_i|)
+    //		for all i | v_i != 0 and w_i != 0
+    // (Nister, 2006)
+    // scaled_||v - w||_{L1} = 1 - 0.5 * ||v - w||_{L1}
+    QueryResults::iterator qit;
+    for(qit = ret.begin(); qit != ret.end(); qit++)
+      qit->Score = -qit->Score/2.0;
+  }
+};
+
+struct L2Accumulation
+{
+  inline double term(WordValue) const { return 0; }
+
+  inline void update(PartialScore &s, WordValue v, double, WordValue w) const
+  {
+    // minus sign for sorting trick
+    s.value -= v * w;
+  }
+
+  inline void emit(EntryId eid, const PartialScore &s, QueryResults &ret) const
+  {
+    ret.push_back(Result(eid, s.value));
+  }
+
+  void finish(double, QueryResults &ret, int max_results) const
+  {
+    // resulting "scores" are now in [-1 best .. 0 worst]
+
+    // keep the best ones in ascending order of score
+    selectTop(ret, max_results, lowerScore);
+    // (ret is inverted now --the lower the better--)
+
+    // complete and scale score to [0 worst .. 1 best]
+    // ||v - w||_{L2} = sqrt( 2 - 2 * Sum(v_i * w_i)
+    //		for all i | v_i != 0 and w_i != 0 )
+    // (Nister, 2006)
+    QueryResults::iterator qit;
+    for(qit = ret.begin(); qit != ret.end(); qit++)
+    {
+      if(qit->Score <= -1.0) // rounding error
+        qit->Score = 1.0;
+      else
+        qit->Score = 1.0 - sqrt(1.0 + qit->Score); // [0..1]
+        // the + sign is ok, it is due to - sign in
+        // value = - qvalue * dvalue
+    }
+  }
+};
+
+struct ChiSquareAccumulation
+{
+  // In the current implementation, we suppose vec is not normalized
+
+  inline double term(WordValue) const { return 0; }
+
+  inline void update(PartialScore &s, WordValue v, double, WordValue w) const
+  {
+    // (v-w)^2/(v+w) - v - w = -4 vw/(v+w)
+    // we move the 4 out
+    double value = 0;
+    if(v + w != 0.0) // words may have weight zero
+      value = - v * w / (v + w);
+
+    s.value += value;
+    s.sum_v += v;
+    s.sum_w += w;
+  }
+
+  inline void emit(EntryId eid, const PartialScore &s, QueryResults &ret) const
+  {
+    if(s.n_words >= MIN_COMMON_WORDS)
+    {
+      ret.push_back(Result(eid, s.value));
+      ret.back().nWords = s.n_words;
+      ret.back().sumCommonVi = s.sum_v;
+      ret.back().sumCommonWi = s.sum_w;
+      ret.back().expectedChiScore = 2 * s.sum_w / (1 + s.sum_w);
+    }
+  }
+
+  void finish(double, QueryResults &ret, int max_results) const
+  {
+    // resulting "scores" are now in [-2 best .. 0 worst]
+    // we have to add +2 to the scores to obtain the chi square score
+
+    // keep the best ones in ascending order of score
+    selectTop(ret, max_results, lowerScore);
+    // (ret is inverted now --the lower the better--)
+
+    // complete and scale score to [0 worst .. 1 best]
+    QueryResults::iterator qit;
+    for(qit = ret.begin(); qit != ret.end(); qit++)
+    {
+      // this takes the 4 into account
+      qit->Score = - 2. * qit->Score; // [0..1]
+
+      qit->chiScore = qit->Score;
+    }
+  }
+};
+
+struct KLAccumulation
+{
+  // penalty of the query words an entry does not contain:
+  // Sum(v_i * (log(v_i) - LOG_EPS)) over the query words, minus the terms
+  // of the words found in the entry
+  inline double term(WordValue v) const
+  {
+    return v != 0 ? v * (log(v) - GeneralScoring::LOG_EPS) : 0;
+  }
+
+  inline void update(PartialScore &s, WordValue v, double missing_v,
+    WordValue w) const
+  {
+    double value = 0;
+    if(v != 0 && w != 0) value = v * log(v/w);
+
+    s.value += value - missing_v;
+  }
+
+  inline void emit(EntryId eid, const PartialScore &s, QueryResults &ret) const
+  {
+    ret.push_back(Result(eid, s.value));
+  }
+
+  void finish(double missing, QueryResults &ret, int max_results) const
+  {
+    // complete scores
+    for(QueryResults::iterator qit = ret.begin(); qit != ret.end(); ++qit)
+      qit->Score += missing;
+
+    // real scores are now in [0 best .. X worst]
+
+    // keep the best ones in ascending order
+    // (scores are inverted now --the lower the better--)
+    selectTop(ret, max_results, lowerScore);
+
+    // cannot scale scores
+  }
+};
+
+struct BhattacharyyaAccumulation
+{
+  inline double term(WordValue) const { return 0; }
+
+  inline void update(PartialScore &s, WordValue v, double, WordValue w) const
+  {
+    s.value += sqrt(v * w);
+  }
+
+  inline void emit(EntryId eid, const PartialScore &s, QueryResults &ret) const
+  {
+    if(s.n_words >= MIN_COMMON_WORDS)
+    {
+      ret.push_back(Result(eid, s.value));
+      ret.back().nWords = s.n_words;
+      ret.back().bhatScore = s.value;
+    }
+  }
+
+  void finish(double, QueryResults &ret, int max_results) const
+  {
+    // scores are already in [0..1]
+
+    // keep the best ones in descending order
+    selectTop(ret, max_results, higherScore);
+  }
+};
+
+struct DotProductAccumulation
+{
+  explicit DotProductAccumulation(bool binary): m_binary(binary) {}
+
+  inline double term(WordValue) const { return 0; }
+
+  inline void update(PartialScore &s, WordValue v, double, WordValue w) const
+  {
+    s.value += m_binary ? 1 : v * w;
+  }
+
+  inline void emit(EntryId eid, const PartialScore &s, QueryResults &ret) const
+  {
+    ret.push_back(Result(eid, s.value));
+  }
+
+  void finish(double, QueryResults &ret, int max_results) const
+  {
+    // scores are the greater the better
+
+    // keep the best ones in descending order
+    selectTop(ret, max_results, higherScore);
+
+    // these scores cannot be scaled
+  }
+
+  bool m_binary;
+};
+
+// --------------------------------------------------------------------------
+
+/// A word of one of the queries of a batch
+struct QueryWord
+{
+  WordId wid;
+  unsigned int query;
+  WordValue value;
+  double term;
+
+  inline bool operator<(const QueryWord &w) const
+  {
+    return wid < w.wid || (wid == w.wid && query < w.query);
+  }
+};
+
+/// Partial scores accumulated at once by a thread: the entries of a range
+/// are scored in tiles of about this many scores, which fit in the cache
+static const size_t TILE_SCORES = 16384;
+
+/**
+ * Scores the entries of some ranges for all the queries. The posting list
+ * of every word is read once per tile of entries, for all the queries that
+ * contain the word. The touched entries of query q are appended to ret[q]
+ * @param words words of the queries, sorted
+ * @param ranges disjoint ranges of entries in ascending order, in the
+ *   database
+ */
+template<class Scoring, class InvertedFile>
+static void scoreRanges(const InvertedFile &ifile,
+  const std::vector<QueryWord> &words, size_t nqueries,
+  const std::vector<EntryRange> &ranges, unsigned int nentries,
+  const Scoring &scoring, std::vector<QueryResults> &ret)
+{
+  typedef typename InvertedFile::value_type::const_iterator RowIterator;
+
+  // queries sharing a word are words[groups[g], groups[g+1]), and the
+  // posting list of the word is read from cursors[g] on
+  std::vector<size_t> groups;
+  std::vector<RowIterator> cursors;
+  for(size_t i = 0; i < words.size(); i++)
+  {
+    if(i > 0 && words[i].wid == words[i-1].wid) continue;
+    groups.push_back(i);
+    cursors.push_back(ifile[words[i].wid].begin());
+  }
+  groups.push_back(words.size());
+
+  uint64_t total = 0;
+  for(const EntryRange &range: ranges) total += range.second - range.first;
+
+  for(const EntryRange &range: ranges)
+  {
+    // a single query keeps one score per entry and is not split
+    const EntryId tile = nqueries == 1 ? range.second - range.first :
+      std::max<size_t>(1, TILE_SCORES / nqueries);
+
+    for(EntryId tbegin = range.first; tbegin < range.second; )
+    {
+      const EntryId tend = range.second - tbegin > tile ?
+        tbegin + tile : range.second;
+      ScoreAccumulator *accs = ScoreAccumulator::get(nqueries, tbegin, tend);
+
+      for(size_t g = 0; g + 1 < groups.size(); g++)
+      {
+        const size_t i = groups[g], j = groups[g+1];
+        const auto &row = ifile[words[i].wid];
+
+        // IFRows are sorted in ascending entry_id order, the cursor is
+        // already at tbegin unless this is the start of a range
+        RowIterator &rit = cursors[g];
+        if(tbegin == range.first && tbegin > 0)
+          rit = std::lower_bound(rit, row.end(), tbegin);
+        const RowIterator rend = tend == nentries ? row.end() :
+          std::lower_bound(rit, row.end(), tend);
+
+        if(j == i + 1)
+        {
+          // word of a single query
+          ScoreAccumulator &acc = accs[words[i].query];
+          const WordValue value = words[i].value;
+          const double term = words[i].term;
+          for(; rit != rend; ++rit)
+            scoring.update(acc.add(rit->entry_id), value, term,
+              rit->word_weight);
+        }
+        else
+        {
+          for(; rit != rend; ++rit)
+          {
+            for(size_t k = i; k < j; k++)
+              scoring.update(accs[words[k].query].add(rit->entry_id),
+                words[k].value, words[k].term, rit->word_weight);
+          }
+        }
+      }
+
+      // move to vector
+      for(size_t q = 0; q < nqueries; q++)
+      {
+        const ScoreAccumulator &acc = accs[q];
+        // the first tile gives an estimate of the size of all the ranges
+        if(ret[q].empty())
+          ret[q].reserve(acc.touched().size() * total / (tend - tbegin));
+        for(EntryId eid: acc.touched())
+          scoring.emit(eid, acc[eid], ret[q]);
+      }
+
+      tbegin = tend;
+    }
+  }
+}
+
+/// Runs f(stripe) for each stripe of the range
+template<class F>
+class ParallelStripes: public cv::ParallelLoopBody
+{
+public:
+  explicit ParallelStripes(const F &f): m_f(f){}
+  void operator()(const cv::Range &range) const
+  {
+    for(int i = range.start; i < range.end; i++) m_f(i);
+  }
+private:
+  const F &m_f;
+};
+
+/// Entries below which a batch is not split between threads
+static const int MIN_PARALLEL_ENTRIES = 4096;
+
+/// Entries with id < max_id: all of them if max_id is -1, none if < -1
+static inline EntryRange entriesBelow(int max_id, unsigned int nentries)
+{
+  EntryId limit = nentries;
+  if(max_id < -1) limit = 0;
+  else if(max_id >= 0 && (unsigned int)max_id < nentries) limit = max_id;
+  return EntryRange(0, limit);
+}
+
+/**
+ * Scores a batch of queries against the entries of some disjoint ranges.
+ * With parallel, the entries are split in contiguous pieces scored by
+ * different threads: every entry is scored by one thread, adding the words
+ * in the same order, so the results are the same as those of a serial run
+ */
+template<class Scoring, class InvertedFile>
+static void scoreQueries(const InvertedFile &ifile, unsigned int nentries,
+  const BowVector * const *vecs, QueryResults * const *rets, size_t nqueries,
+  int max_results, const EntryRange *ranges, size_t nranges, bool parallel,
+  const Scoring &scoring)
+{
+  std::vector<QueryWord> words;
+  std::vector<double> terms(nqueries, 0);
+  size_t nwords = 0;
+  for(size_t q = 0; q < nqueries; q++) nwords += vecs[q]->size();
+  words.reserve(nwords);
+  for(size_t q = 0; q < nqueries; q++)
+  {
+    for(BowVector::const_iterator vit = vecs[q]->begin(); vit != vecs[q]->end();
+      ++vit)
+    {
+      QueryWord w;
+      w.wid = vit->first;
+      w.query = q;
+      w.value = vit->second;
+      w.term = scoring.term(vit->second);
+      terms[q] += w.term;
+      words.push_back(w);
+    }
+  }
+  if(nqueries > 1) std::sort(words.begin(), words.end());
+
+  // entries scored, ranges are clipped to the database and sorted
+  std::vector<EntryRange> clipped;
+  clipped.reserve(nranges);
+  uint64_t total = 0;
+  for(size_t r = 0; r < nranges; r++)
+  {
+    const EntryId end = std::min(ranges[r].second, (EntryId)nentries);
+    if(ranges[r].first >= end) continue;
+    clipped.push_back(EntryRange(ranges[r].first, end));
+    total += end - ranges[r].first;
+  }
+  std::sort(clipped.begin(), clipped.end());
+
+  int nstripes = 1;
+  if(parallel && total >= 2 * MIN_PARALLEL_ENTRIES)
+    nstripes = std::max(1, std::min(cv::getNumThreads(),
+      (int)(total / MIN_PARALLEL_ENTRIES)));
+
+  std::vector<std::vector<QueryResults> > parts(nstripes,
+    std::vector<QueryResults>(nqueries));
+  auto score = [&](int s){
+    // the stripe takes the entries [from, to) of the concatenated ranges
+    const uint64_t from = total * s / nstripes;
+    const uint64_t to = total * (s + 1) / nstripes;
+    std::vector<EntryRange> pieces;
+    uint64_t pos = 0;
+    for(size_t r = 0; r < clipped.size() && pos < to; r++)
+    {
+      const uint64_t len = clipped[r].second - clipped[r].first;
+      if(pos + len > from)
+        pieces.push_back(EntryRange(
+          clipped[r].first + (from > pos ? from - pos : 0),
+          clipped[r].first + (std::min(to, pos + len) - pos)));
+      pos += len;
+    }
+    scoreRanges(ifile, words, nqueries, pieces, nentries, scoring, parts[s]);
+  };
+  if(nstripes > 1)
+    cv::parallel_for_(cv::Range(0, nstripes),
+      ParallelStripes<decltype(score)>(score), nstripes);
+  else
+    score(0);
+
+  for(size_t q = 0; q < nqueries; q++)
+  {
+    QueryResults &ret = *rets[q];
+    ret.swap(parts[0][q]);
+    for(int s = 1; s < nstripes; s++)
+      ret.insert(ret.end(), parts[s][q].begin(), parts[s][q].end());
+    scoring.finish(terms[q], ret, max_results);
+  }
+}
+
+// --------------------------------------------------------------------------
+
 
 Database::Database
   (bool use_di, int di_levels)
-  : m_voc(NULL), m_use_di(use_di), m_dilevels(di_levels), m_nentries(0)
+  : m_use_di(use_di), m_dilevels(di_levels), m_nentries(0)
 {
 }
 
@@ -15,7 +572,7 @@ Database::Database
 
 Database::Database
   (const Vocabulary &voc, bool use_di, int di_levels)
-  : m_voc(NULL), m_use_di(use_di), m_dilevels(di_levels)
+  : m_use_di(use_di), m_dilevels(di_levels)
 {
   setVocabulary(voc);
   clear();
@@ -23,10 +580,18 @@ Database::Database
 
 // --------------------------------------------------------------------------
 
+Database::Database
+  (const std::shared_ptr<const Vocabulary> &voc, bool use_di, int di_levels)
+  : m_use_di(use_di), m_dilevels(di_levels)
+{
+  setVocabulary(voc);
+}
+
+// --------------------------------------------------------------------------
+
 
 Database::Database
   (const Database &db)
-  : m_voc(NULL)
 {
   *this = db;
 }
@@ -36,7 +601,6 @@ Database::Database
 
 Database::Database
   (const std::string &filename)
-  : m_voc(NULL)
 {
   load(filename);
 }
@@ -46,7 +610,6 @@ Database::Database
 
 Database::Database
   (const char *filename)
-  : m_voc(NULL)
 {
   load(filename);
 }
@@ -56,7 +619,6 @@ Database::Database
 
 Database::~Database(void)
 {
-  delete m_voc;
 }
 
 // --------------------------------------------------------------------------
@@ -72,7 +634,7 @@ Database& Database::operator=
     m_ifile = db.m_ifile;
     m_nentries = db.m_nentries;
     m_use_di = db.m_use_di;
-    if (db.m_voc!=0) setVocabulary(*db.m_voc);
+    if (db.m_voc) m_voc = db.m_voc;
   }
   return *this;
 }
@@ -161,8 +723,7 @@ EntryId Database::add(const BowVector &v,
   void Database::setVocabulary
   (const Vocabulary& voc)
 {
-  delete m_voc;
-  m_voc = new Vocabulary(voc);
+  m_voc = std::make_shared<Vocabulary>(voc);
   clear();
 }
 
@@ -174,8 +735,17 @@ EntryId Database::add(const BowVector &v,
 {
   m_use_di = use_di;
   m_dilevels = di_levels;
-  delete m_voc;
-  m_voc = new Vocabulary(voc);
+  m_voc = std::make_shared<Vocabulary>(voc);
+  clear();
+}
+
+// --------------------------------------------------------------------------
+
+
+  void Database::setVocabulary
+  (const std::shared_ptr<const Vocabulary> &voc)
+{
+  m_voc = voc;
   clear();
 }
 
@@ -185,7 +755,7 @@ EntryId Database::add(const BowVector &v,
  const Vocabulary*
 Database::getVocabulary() const
 {
-  return m_voc;
+  return m_voc.get();
 }
 
 // --------------------------------------------------------------------------
@@ -209,14 +779,7 @@ void Database::allocate(int nd, int ni)
   if(ni > 0)
   {
     for(auto rit = m_ifile.begin(); rit != m_ifile.end(); ++rit)
-    {
-      int n = (int)rit->size();
-      if(ni > n)
-      {
-        rit->resize(ni);
-        rit->resize(n);
-      }
-    }
+      rit->reserve(ni);
   }
 
   if(m_use_di && (int)m_dfile.size() < nd)
@@ -233,10 +796,9 @@ void Database::query(
   const  cv::Mat &features,
   QueryResults &ret, int max_results, int max_id) const
 {
-
-    std::vector<cv::Mat> vf(features.rows);
-    for(int r=0;r<features.rows;r++) vf[r]=features.rowRange(r,r+1);
-    query(vf, ret, max_results, max_id);
+  BowVector vec;
+  m_voc->transform(features, vec);
+  query(vec, ret, max_results, max_id);
 }
 
 
@@ -290,269 +852,130 @@ void Database::query(
 // --------------------------------------------------------------------------
 
 
-void Database::queryL1(const BowVector &vec,
-  QueryResults &ret, int max_results, int max_id) const
+void Database::query(const std::vector<BowVector> &vecs,
+  std::vector<QueryResults> &rets, int max_results, int max_id,
+  bool parallel) const
 {
-  BowVector::const_iterator vit;
-
-  std::map<EntryId, double> pairs;
-  std::map<EntryId, double>::iterator pit;
-
-  for(vit = vec.begin(); vit != vec.end(); ++vit)
-  {
-    const WordId word_id = vit->first;
-    const WordValue& qvalue = vit->second;
+  const EntryRange range = entriesBelow(max_id, m_nentries);
+  query(vecs, rets, max_results, std::vector<EntryRange>(1, range), parallel);
+}
 
-    const IFRow& row = m_ifile[word_id];
+// --------------------------------------------------------------------------
 
-    // IFRows are sorted in ascending entry_id order
 
-    for(auto rit = row.begin(); rit != row.end(); ++rit)
-    {
-      const EntryId entry_id = rit->entry_id;
-      const WordValue& dvalue = rit->word_weight;
+void Database::query(const BowVector &vec, QueryResults &ret,
+  int max_results, const std::vector<EntryRange> &ranges, bool parallel) const
+{
+  const BowVector *pvec = &vec;
+  QueryResults *pret = &ret;
+  ret.resize(0);
+  queryRanges(&pvec, &pret, 1, max_results, ranges, parallel);
+}
 
-      if((int)entry_id < max_id || max_id == -1)
-      {
-        double value = fabs(qvalue - dvalue) - fabs(qvalue) - fabs(dvalue);
+// --------------------------------------------------------------------------
 
-        pit = pairs.lower_bound(entry_id);
-        if(pit != pairs.end() && !(pairs.key_comp()(entry_id, pit->first)))
-        {
-          pit->second += value;
-        }
-        else
-        {
-          pairs.insert(pit,
-            std::map<EntryId, double>::value_type(entry_id, value));
-        }
-      }
 
-    } // for each inverted row
-  } // for each query word
+void Database::query(const std::vector<BowVector> &vecs,
+  std::vector<QueryResults> &rets, int max_results,
+  const std::vector<EntryRange> &ranges, bool parallel) const
+{
+  rets.resize(vecs.size());
+  if(vecs.empty()) return;
 
-  // move to vector
-  ret.reserve(pairs.size());
-  for(pit = pairs.begin(); pit != pairs.end(); ++pit)
+  std::vector<const BowVector*> pvecs(vecs.size());
+  std::vector<QueryResults*> prets(vecs.size());
+  for(size_t q = 0; q < vecs.size(); q++)
   {
-    ret.push_back(Result(pit->first, pit->second));
+    pvecs[q] = &vecs[q];
+    prets[q] = &rets[q];
+    rets[q].resize(0);
   }
-
-  // resulting "scores" are now in [-2 best .. 0 worst]
-
-  // sort vector in ascending order of score
-  std::sort(ret.begin(), ret.end());
-  // (ret is inverted now --the lower the better--)
-
-  // cut vector
-  if(max_results > 0 && (int)ret.size() > max_results)
-    ret.resize(max_results);
-
-  // complete and scale score to [0 worst .. 1 best]
-  // ||v - w||_{L1} = 2 + Sum(|v_i - w_i| - |v_i| - |w_i|)
-  //		for all i | v_i != 0 and w_i != 0
-  // (Nister, 2006)
-  // scaled_||v - w||_{L1} = 1 - 0.5 * ||v - w||_{L1}
-  QueryResults::iterator qit;
-  for(qit = ret.begin(); qit != ret.end(); qit++)
-    qit->Score = -qit->Score/2.0;
+  queryRanges(pvecs.data(), prets.data(), vecs.size(), max_results, ranges,
+    parallel);
 }
 
 // --------------------------------------------------------------------------
 
 
-void Database::queryL2(const BowVector &vec,
-  QueryResults &ret, int max_results, int max_id) const
+void Database::queryRanges(const BowVector * const *vecs,
+  QueryResults * const *rets, size_t n, int max_results,
+  const std::vector<EntryRange> &ranges, bool parallel) const
 {
-  BowVector::const_iterator vit;
-
-  std::map<EntryId, double> pairs;
-  std::map<EntryId, double>::iterator pit;
+  const EntryRange *pranges = ranges.data();
+  const size_t nranges = ranges.size();
 
-  //map<EntryId, int> counters;
-  //map<EntryId, int>::iterator cit;
-
-  for(vit = vec.begin(); vit != vec.end(); ++vit)
+  switch(m_voc->getScoringType())
   {
-    const WordId word_id = vit->first;
-    const WordValue& qvalue = vit->second;
-
-    const IFRow& row = m_ifile[word_id];
-
-    // IFRows are sorted in ascending entry_id order
-
-    for(auto rit = row.begin(); rit != row.end(); ++rit)
-    {
-      const EntryId entry_id = rit->entry_id;
-      const WordValue& dvalue = rit->word_weight;
-
-      if((int)entry_id < max_id || max_id == -1)
-      {
-        double value = - qvalue * dvalue; // minus sign for sorting trick
-
-        pit = pairs.lower_bound(entry_id);
-        //cit = counters.lower_bound(entry_id);
-        if(pit != pairs.end() && !(pairs.key_comp()(entry_id, pit->first)))
-        {
-          pit->second += value;
-          //cit->second += 1;
-        }
-        else
-        {
-          pairs.insert(pit,
-            std::map<EntryId, double>::value_type(entry_id, value));
-
-          //counters.insert(cit,
-          //  map<EntryId, int>::value_type(entry_id, 1));
-        }
-      }
-
-    } // for each inverted row
-  } // for each query word
+    case L1_NORM:
+      scoreQueries(m_ifile, m_nentries, vecs, rets, n, max_results,
+        pranges, nranges, parallel, L1Accumulation());
+      break;
 
-  // move to vector
-  ret.reserve(pairs.size());
-  //cit = counters.begin();
-  for(pit = pairs.begin(); pit != pairs.end(); ++pit)//, ++cit)
-  {
-    ret.push_back(Result(pit->first, pit->second));// / cit->second));
-  }
+    case L2_NORM:
+      scoreQueries(m_ifile, m_nentries, vecs, rets, n, max_results,
+        pranges, nranges, parallel, L2Accumulation());
+      break;
 
-  // resulting "scores" are now in [-1 best .. 0 worst]
+    case CHI_SQUARE:
+      scoreQueries(m_ifile, m_nentries, vecs, rets, n, max_results,
+        pranges, nranges, parallel, ChiSquareAccumulation());
+      break;
 
-  // sort vector in ascending order of score
-  std::sort(ret.begin(), ret.end());
-  // (ret is inverted now --the lower the better--)
+    case KL:
+      scoreQueries(m_ifile, m_nentries, vecs, rets, n, max_results,
+        pranges, nranges, parallel, KLAccumulation());
+      break;
 
-  // cut vector
-  if(max_results > 0 && (int)ret.size() > max_results)
-    ret.resize(max_results);
+    case BHATTACHARYYA:
+      scoreQueries(m_ifile, m_nentries, vecs, rets, n, max_results,
+        pranges, nranges, parallel, BhattacharyyaAccumulation());
+      break;
 
-  // complete and scale score to [0 worst .. 1 best]
-  // ||v - w||_{L2} = sqrt( 2 - 2 * Sum(v_i * w_i)
-    //		for all i | v_i != 0 and w_i != 0 )
-    // (Nister, 2006)
-    QueryResults::iterator qit;
-  for(qit = ret.begin(); qit != ret.end(); qit++)
-  {
-    if(qit->Score <= -1.0) // rounding error
-      qit->Score = 1.0;
-    else
-      qit->Score = 1.0 - sqrt(1.0 + qit->Score); // [0..1]
-      // the + sign is ok, it is due to - sign in
-      // value = - qvalue * dvalue
+    case DOT_PRODUCT:
+      scoreQueries(m_ifile, m_nentries, vecs, rets, n, max_results,
+        pranges, nranges, parallel,
+        DotProductAccumulation(m_voc->getWeightingType() == BINARY));
+      break;
   }
-
 }
 
 // --------------------------------------------------------------------------
 
 
-void Database::queryChiSquare(const BowVector &vec,
+void Database::queryL1(const BowVector &vec,
   QueryResults &ret, int max_results, int max_id) const
 {
-  BowVector::const_iterator vit;
-
-  std::map<EntryId, std::pair<double, int> > pairs;
-  std::map<EntryId, std::pair<double, int> >::iterator pit;
-
-  std::map<EntryId, std::pair<double, double> > sums; // < sum vi, sum wi >
-  std::map<EntryId, std::pair<double, double> >::iterator sit;
-
-  // In the current implementation, we suppose vec is not normalized
-
-  //map<EntryId, double> expected;
-  //map<EntryId, double>::iterator eit;
-
-  for(vit = vec.begin(); vit != vec.end(); ++vit)
-  {
-    const WordId word_id = vit->first;
-    const WordValue& qvalue = vit->second;
-
-    const IFRow& row = m_ifile[word_id];
-
-    // IFRows are sorted in ascending entry_id order
-
-    for(auto rit = row.begin(); rit != row.end(); ++rit)
-    {
-      const EntryId entry_id = rit->entry_id;
-      const WordValue& dvalue = rit->word_weight;
-
-      if((int)entry_id < max_id || max_id == -1)
-      {
-        // (v-w)^2/(v+w) - v - w = -4 vw/(v+w)
-        // we move the 4 out
-        double value = 0;
-        if(qvalue + dvalue != 0.0) // words may have weight zero
-          value = - qvalue * dvalue / (qvalue + dvalue);
-
-        pit = pairs.lower_bound(entry_id);
-        sit = sums.lower_bound(entry_id);
-        //eit = expected.lower_bound(entry_id);
-        if(pit != pairs.end() && !(pairs.key_comp()(entry_id, pit->first)))
-        {
-          pit->second.first += value;
-          pit->second.second += 1;
-          //eit->second += dvalue;
-          sit->second.first += qvalue;
-          sit->second.second += dvalue;
-        }
-        else
-        {
-          pairs.insert(pit,
-            std::map<EntryId, std::pair<double, int> >::value_type(entry_id,
-              std::make_pair(value, 1) ));
-          //expected.insert(eit,
-          //  map<EntryId, double>::value_type(entry_id, dvalue));
-
-          sums.insert(sit,
-            std::map<EntryId, std::pair<double, double> >::value_type(entry_id,
-              std::make_pair(qvalue, dvalue) ));
-        }
-      }
-
-    } // for each inverted row
-  } // for each query word
-
-  // move to vector
-  ret.reserve(pairs.size());
-  sit = sums.begin();
-  for(pit = pairs.begin(); pit != pairs.end(); ++pit, ++sit)
-  {
-    if(pit->second.second >= MIN_COMMON_WORDS)
-    {
-      ret.push_back(Result(pit->first, pit->second.first));
-      ret.back().nWords = pit->second.second;
-      ret.back().sumCommonVi = sit->second.first;
-      ret.back().sumCommonWi = sit->second.second;
-      ret.back().expectedChiScore =
-        2 * sit->second.second / (1 + sit->second.second);
-    }
-
-    //ret.push_back(Result(pit->first, pit->second));
-  }
+  const BowVector *pvec = &vec;
+  QueryResults *pret = &ret;
+  const EntryRange range = entriesBelow(max_id, m_nentries);
+  scoreQueries(m_ifile, m_nentries, &pvec, &pret, 1, max_results, &range, 1,
+    false, L1Accumulation());
+}
 
-  // resulting "scores" are now in [-2 best .. 0 worst]
-  // we have to add +2 to the scores to obtain the chi square score
+// --------------------------------------------------------------------------
 
-  // sort vector in ascending order of score
-  std::sort(ret.begin(), ret.end());
-  // (ret is inverted now --the lower the better--)
 
-  // cut vector
-  if(max_results > 0 && (int)ret.size() > max_results)
-    ret.resize(max_results);
+void Database::queryL2(const BowVector &vec,
+  QueryResults &ret, int max_results, int max_id) const
+{
+  const BowVector *pvec = &vec;
+  QueryResults *pret = &ret;
+  const EntryRange range = entriesBelow(max_id, m_nentries);
+  scoreQueries(m_ifile, m_nentries, &pvec, &pret, 1, max_results, &range, 1,
+    false, L2Accumulation());
+}
 
-  // complete and scale score to [0 worst .. 1 best]
-  QueryResults::iterator qit;
-  for(qit = ret.begin(); qit != ret.end(); qit++)
-  {
-    // this takes the 4 into account
-    qit->Score = - 2. * qit->Score; // [0..1]
+// --------------------------------------------------------------------------
 
-    qit->chiScore = qit->Score;
-  }
 
+void Database::queryChiSquare(const BowVector &vec,
+  QueryResults &ret, int max_results, int max_id) const
+{
+  const BowVector *pvec = &vec;
+  QueryResults *pret = &ret;
+  const EntryRange range = entriesBelow(max_id, m_nentries);
+  scoreQueries(m_ifile, m_nentries, &pvec, &pret, 1, max_results, &range, 1,
+    false, ChiSquareAccumulation());
 }
 
 // --------------------------------------------------------------------------
@@ -561,88 +984,11 @@ void Database::queryChiSquare(const BowVector &vec,
 void Database::queryKL(const BowVector &vec,
   QueryResults &ret, int max_results, int max_id) const
 {
-  BowVector::const_iterator vit;
-
-  std::map<EntryId, double> pairs;
-  std::map<EntryId, double>::iterator pit;
-
-  for(vit = vec.begin(); vit != vec.end(); ++vit)
-  {
-    const WordId word_id = vit->first;
-    const WordValue& vi = vit->second;
-
-    const IFRow& row = m_ifile[word_id];
-
-    // IFRows are sorted in ascending entry_id order
-
-    for(auto rit = row.begin(); rit != row.end(); ++rit)
-    {
-      const EntryId entry_id = rit->entry_id;
-      const WordValue& wi = rit->word_weight;
-
-      if((int)entry_id < max_id || max_id == -1)
-      {
-        double value = 0;
-        if(vi != 0 && wi != 0) value = vi * log(vi/wi);
-
-        pit = pairs.lower_bound(entry_id);
-        if(pit != pairs.end() && !(pairs.key_comp()(entry_id, pit->first)))
-        {
-          pit->second += value;
-        }
-        else
-        {
-          pairs.insert(pit,
-            std::map<EntryId, double>::value_type(entry_id, value));
-        }
-      }
-
-    } // for each inverted row
-  } // for each query word
-
-  // resulting "scores" are now in [-X worst .. 0 best .. X worst]
-  // but we cannot make sure which ones are better without calculating
-  // the complete score
-
-  // complete scores and move to vector
-  ret.reserve(pairs.size());
-  for(pit = pairs.begin(); pit != pairs.end(); ++pit)
-  {
-    EntryId eid = pit->first;
-    double value = 0.0;
-
-    for(vit = vec.begin(); vit != vec.end(); ++vit)
-    {
-      const WordValue &vi = vit->second;
-      const IFRow& row = m_ifile[vit->first];
-
-      if(vi != 0)
-      {
-        if(row.end() == find(row.begin(), row.end(), eid ))
-        {
-          value += vi * (log(vi) - GeneralScoring::LOG_EPS);
-        }
-      }
-    }
-
-    pit->second += value;
-
-    // to vector
-    ret.push_back(Result(pit->first, pit->second));
-  }
-
-  // real scores are now in [0 best .. X worst]
-
-  // sort vector in ascending order
-  // (scores are inverted now --the lower the better--)
-  std::sort(ret.begin(), ret.end());
-
-  // cut vector
-  if(max_results > 0 && (int)ret.size() > max_results)
-    ret.resize(max_results);
-
-  // cannot scale scores
-
+  const BowVector *pvec = &vec;
+  QueryResults *pret = &ret;
+  const EntryRange range = entriesBelow(max_id, m_nentries);
+  scoreQueries(m_ifile, m_nentries, &pvec, &pret, 1, max_results, &range, 1,
+    false, KLAccumulation());
 }
 
 // --------------------------------------------------------------------------
@@ -651,70 +997,11 @@ void Database::queryKL(const BowVector &vec,
 void Database::queryBhattacharyya(
   const BowVector &vec, QueryResults &ret, int max_results, int max_id) const
 {
-  BowVector::const_iterator vit;
-
-  //map<EntryId, double> pairs;
-  //map<EntryId, double>::iterator pit;
-
-  std::map<EntryId, std::pair<double, int> > pairs; // <eid, <score, counter> >
-  std::map<EntryId, std::pair<double, int> >::iterator pit;
-
-  for(vit = vec.begin(); vit != vec.end(); ++vit)
-  {
-    const WordId word_id = vit->first;
-    const WordValue& qvalue = vit->second;
-
-    const IFRow& row = m_ifile[word_id];
-
-    // IFRows are sorted in ascending entry_id order
-
-    for(auto rit = row.begin(); rit != row.end(); ++rit)
-    {
-      const EntryId entry_id = rit->entry_id;
-      const WordValue& dvalue = rit->word_weight;
-
-      if((int)entry_id < max_id || max_id == -1)
-      {
-        double value = sqrt(qvalue * dvalue);
-
-        pit = pairs.lower_bound(entry_id);
-        if(pit != pairs.end() && !(pairs.key_comp()(entry_id, pit->first)))
-        {
-          pit->second.first += value;
-          pit->second.second += 1;
-        }
-        else
-        {
-          pairs.insert(pit,
-            std::map<EntryId, std::pair<double, int> >::value_type(entry_id,
-              std::make_pair(value, 1)));
-        }
-      }
-
-    } // for each inverted row
-  } // for each query word
-
-  // move to vector
-  ret.reserve(pairs.size());
-  for(pit = pairs.begin(); pit != pairs.end(); ++pit)
-  {
-    if(pit->second.second >= MIN_COMMON_WORDS)
-    {
-      ret.push_back(Result(pit->first, pit->second.first));
-      ret.back().nWords = pit->second.second;
-      ret.back().bhatScore = pit->second.first;
-    }
-  }
-
-  // scores are already in [0..1]
-
-  // sort vector in descending order
-  std::sort(ret.begin(), ret.end(), Result::gt);
-
-  // cut vector
-  if(max_results > 0 && (int)ret.size() > max_results)
-    ret.resize(max_results);
-
+  const BowVector *pvec = &vec;
+  QueryResults *pret = &ret;
+  const EntryRange range = entriesBelow(max_id, m_nentries);
+  scoreQueries(m_ifile, m_nentries, &pvec, &pret, 1, max_results, &range, 1,
+    false, BhattacharyyaAccumulation());
 }
 
 // ---------------------------------------------------------------------------
@@ -723,65 +1010,11 @@ void Database::queryBhattacharyya(
 void Database::queryDotProduct(
   const BowVector &vec, QueryResults &ret, int max_results, int max_id) const
 {
-  BowVector::const_iterator vit;
-
-  std::map<EntryId, double> pairs;
-  std::map<EntryId, double>::iterator pit;
-
-  for(vit = vec.begin(); vit != vec.end(); ++vit)
-  {
-    const WordId word_id = vit->first;
-    const WordValue& qvalue = vit->second;
-
-    const IFRow& row = m_ifile[word_id];
-
-    // IFRows are sorted in ascending entry_id order
-
-    for(auto rit = row.begin(); rit != row.end(); ++rit)
-    {
-      const EntryId entry_id = rit->entry_id;
-      const WordValue& dvalue = rit->word_weight;
-
-      if((int)entry_id < max_id || max_id == -1)
-      {
-        double value;
-        if(this->m_voc->getWeightingType() == BINARY)
-          value = 1;
-        else
-          value = qvalue * dvalue;
-
-        pit = pairs.lower_bound(entry_id);
-        if(pit != pairs.end() && !(pairs.key_comp()(entry_id, pit->first)))
-        {
-          pit->second += value;
-        }
-        else
-        {
-          pairs.insert(pit,
-            std::map<EntryId, double>::value_type(entry_id, value));
-        }
-      }
-
-    } // for each inverted row
-  } // for each query word
-
-  // move to vector
-  ret.reserve(pairs.size());
-  for(pit = pairs.begin(); pit != pairs.end(); ++pit)
-  {
-    ret.push_back(Result(pit->first, pit->second));
-  }
-
-  // scores are the greater the better
-
-  // sort vector in descending order
-  std::sort(ret.begin(), ret.end(), Result::gt);
-
-  // cut vector
-  if(max_results > 0 && (int)ret.size() > max_results)
-    ret.resize(max_results);
-
-  // these scores cannot be scaled
+  const BowVector *pvec = &vec;
+  QueryResults *pret = &ret;
+  const EntryRange range = entriesBelow(max_id, m_nentries);
+  scoreQueries(m_ifile, m_nentries, &pvec, &pret, 1, max_results, &range, 1,
+    false, DotProductAccumulation(m_voc->getWeightingType() == BINARY));
 }
 
 // ---------------------------------------------------------------------------
@@ -916,10 +1149,10 @@ void Database::load(const cv::FileStorage &fs,
   const std::string &name)
 {
   // load voc first
-  // subclasses must instantiate m_voc before calling this ::load
-  if(!m_voc) m_voc = new Vocabulary;
-
-  m_voc->load(fs);
+  // the vocabulary of the file replaces the one in use, which may be shared
+  std::shared_ptr<Vocabulary> voc = std::make_shared<Vocabulary>();
+  voc->load(fs);
+  m_voc = voc;
 
   // load database now
   clear(); // resizes inverted file
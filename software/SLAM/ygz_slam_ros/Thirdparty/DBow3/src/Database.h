@@ -12,6 +12,8 @@
 #define __D_T_DATABASE__
 
 #include <vector>
+#include <utility>
+#include <memory>
 #include <numeric>
 #include <fstream>
 #include <string>
@@ -30,6 +32,9 @@ namespace DBoW3 {
 // For query functions
 static int MIN_COMMON_WORDS = 5;
 
+/// Entry ids in [first, second)
+typedef std::pair<EntryId, EntryId> EntryRange;
+
  ///   Database
 class DBOW_API Database
 {
@@ -56,7 +61,18 @@ public:
     int di_levels = 0);
 
   /**
-   * Copy constructor. Copies the vocabulary too
+   * Creates a database that uses the given vocabulary without copying it
+   * (e.g. one of VocabularyRegistry)
+   * @param voc vocabulary
+   * @param use_di a direct index is used to store feature indexes
+   * @param di_levels levels to go up the vocabulary tree to select the 
+   *   node id to store in the direct index when adding images
+   */
+  explicit Database(const std::shared_ptr<const Vocabulary> &voc,
+    bool use_di = true, int di_levels = 0);
+
+  /**
+   * Copy constructor. The vocabulary, immutable, is shared
    * @param db object to copy
    */
   Database(const Database &db);
@@ -79,7 +95,7 @@ public:
   virtual ~Database(void);
 
   /**
-   * Copies the given database and its vocabulary
+   * Copies the given database, sharing its vocabulary
    * @param db database to copy
    */
   Database& operator=(
@@ -90,7 +106,7 @@ public:
    * @param T class inherited from Vocabulary
    * @param voc vocabulary to copy
    */
-  inline void setVocabulary(const Vocabulary &voc);
+  void setVocabulary(const Vocabulary &voc);
   
   /**
    * Sets the vocabulary to use and the direct index parameters, and clears
@@ -103,12 +119,19 @@ public:
    */
 
   void setVocabulary(const Vocabulary& voc, bool use_di, int di_levels = 0);
+
+  /**
+   * Sets the vocabulary to use without copying it, and clears the content
+   * of the database
+   * @param voc vocabulary to share
+   */
+  void setVocabulary(const std::shared_ptr<const Vocabulary> &voc);
   
   /**
    * Returns a pointer to the vocabulary used
    * @return vocabulary
    */
-  inline const Vocabulary* getVocabulary() const;
+  const Vocabulary* getVocabulary() const;
 
   /** 
    * Allocates some memory for the direct and inverted indexes
@@ -150,7 +173,7 @@ public:
   /**
    * Empties the database
    */
-  inline void clear();
+  void clear();
 
   /**
    * Returns the number of entries in the database 
@@ -200,9 +223,48 @@ public:
    * @param max_id only entries with id <= max_id are returned in ret. 
    *   < 0 means all
    */
-  void query(const BowVector &vec, QueryResults &ret, 
+  void query(const BowVector &vec, QueryResults &ret,
     int max_results = 1, int max_id = -1) const;
 
+  /**
+   * Queries the database with several vectors at once. The posting list of
+   * each word is read once for all the vectors that contain it. The results
+   * are the same as those of querying each vector alone
+   * @param vecs bow vectors already normalized
+   * @param rets results of each vector
+   * @param max_results number of results to return per vector. <= 0 means all
+   * @param max_id only entries with id < max_id are returned. -1 means all
+   * @param parallel score ranges of entries in different threads
+   */
+  void query(const std::vector<BowVector> &vecs,
+    std::vector<QueryResults> &rets, int max_results = 1, int max_id = -1,
+    bool parallel = false) const;
+
+  /**
+   * Queries the database with a vector, scoring only the entries of some
+   * ranges. The cost depends on the postings of those entries
+   * @param vec bow vector already normalized
+   * @param ret results
+   * @param max_results number of results to return. <= 0 means all
+   * @param ranges disjoint ranges of entry ids
+   * @param parallel score pieces of the ranges in different threads
+   */
+  void query(const BowVector &vec, QueryResults &ret, int max_results,
+    const std::vector<EntryRange> &ranges, bool parallel = false) const;
+
+  /**
+   * Queries the database with several vectors at once, scoring only the
+   * entries of some ranges
+   * @param vecs bow vectors already normalized
+   * @param rets results of each vector
+   * @param max_results number of results to return per vector. <= 0 means all
+   * @param ranges disjoint ranges of entry ids
+   * @param parallel score pieces of the ranges in different threads
+   */
+  void query(const std::vector<BowVector> &vecs,
+    std::vector<QueryResults> &rets, int max_results,
+    const std::vector<EntryRange> &ranges, bool parallel = false) const;
+
   /**
    * Returns the a feature vector associated with a database entry
    * @param id entry id (must be < size())
@@ -277,6 +339,11 @@ protected:
   void queryDotProduct(const BowVector &vec, QueryResults &ret, 
     int max_results, int max_id) const;
 
+  /// Query with the scoring of the vocabulary, on some ranges of entries
+  void queryRanges(const BowVector * const *vecs, QueryResults * const *rets,
+    size_t n, int max_results, const std::vector<EntryRange> &ranges,
+    bool parallel) const;
+
 protected:
 
   /* Inverted file declaration */
@@ -308,10 +375,17 @@ protected:
      * @return true iff this entry id is the same as eid
      */
     inline bool operator==(EntryId eid) const { return entry_id == eid; }
+
+    /**
+     * Compares the entry ids, used to binary search the rows
+     * @param eid
+     * @return true iff this entry id is lower than eid
+     */
+    inline bool operator<(EntryId eid) const { return entry_id < eid; }
   };
   
-  /// Row of InvertedFile
-  typedef std::list<IFPair> IFRow;
+  /// Row of InvertedFile, contiguous and append-only
+  typedef std::vector<IFPair> IFRow;
   // IFRows are sorted in ascending entry_id order
   
   /// Inverted index
@@ -326,8 +400,8 @@ protected:
 
 protected:
 
-  /// Associated vocabulary
-  Vocabulary *m_voc;
+  /// Associated vocabulary, immutable and possibly shared with other databases
+  std::shared_ptr<const Vocabulary> m_voc;
   
   /// Flag to use direct index
   bool m_use_di;
@@ -0,0 +1,123 @@
+/**
+ * File: FeatureExtractor.cpp
+ * Description: ORB extraction with reusable detectors
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include "../src/FeatureExtractor.h"
+
+namespace DBoW3 {
+
+// --------------------------------------------------------------------------
+
+/// Extracts a range of images, borrowing a single detector for all of them
+class FeatureExtractor::ExtractRange: public cv::ParallelLoopBody
+{
+public:
+  ExtractRange(const FeatureExtractor &extractor,
+    const std::vector<cv::Mat> &images,
+    std::vector<std::vector<cv::KeyPoint> > &keypoints,
+    std::vector<cv::Mat> &descriptors):
+    m_extractor(extractor), m_images(images), m_keypoints(keypoints),
+    m_descriptors(descriptors) {}
+
+  virtual void operator()(const cv::Range &range) const
+  {
+    cv::Ptr<cv::ORB> orb = m_extractor.acquire();
+    for(int i = range.start; i < range.end; i++)
+      orb->detectAndCompute(m_images[i], cv::noArray(), m_keypoints[i],
+        m_descriptors[i]);
+    m_extractor.release(orb);
+  }
+
+private:
+  const FeatureExtractor &m_extractor;
+  const std::vector<cv::Mat> &m_images;
+  std::vector<std::vector<cv::KeyPoint> > &m_keypoints;
+  std::vector<cv::Mat> &m_descriptors;
+};
+
+// --------------------------------------------------------------------------
+
+
+FeatureExtractor::FeatureExtractor(int nfeatures, float scale_factor,
+  int nlevels, int edge_threshold, int first_level, int wta_k, int score_type,
+  int patch_size, int fast_threshold):
+  m_nfeatures(nfeatures), m_scale_factor(scale_factor), m_nlevels(nlevels),
+  m_edge_threshold(edge_threshold), m_first_level(first_level),
+  m_wta_k(wta_k), m_score_type(score_type), m_patch_size(patch_size),
+  m_fast_threshold(fast_threshold), m_created(0)
+{
+}
+
+// --------------------------------------------------------------------------
+
+
+void FeatureExtractor::extract(const cv::Mat &image,
+  std::vector<cv::KeyPoint> &keypoints, cv::Mat &descriptors,
+  const cv::Mat &mask) const
+{
+  cv::Ptr<cv::ORB> orb = acquire();
+  orb->detectAndCompute(image, mask, keypoints, descriptors);
+  release(orb);
+}
+
+// --------------------------------------------------------------------------
+
+
+void FeatureExtractor::extract(const std::vector<cv::Mat> &images,
+  std::vector<std::vector<cv::KeyPoint> > &keypoints,
+  std::vector<cv::Mat> &descriptors) const
+{
+  keypoints.resize(images.size());
+  descriptors.resize(images.size());
+  if(images.empty()) return;
+
+  // each call of the body borrows one detector for its whole range
+  cv::parallel_for_(cv::Range(0, (int)images.size()),
+    ExtractRange(*this, images, keypoints, descriptors));
+}
+
+// --------------------------------------------------------------------------
+
+
+size_t FeatureExtractor::detectors() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_created;
+}
+
+// --------------------------------------------------------------------------
+
+
+cv::Ptr<cv::ORB> FeatureExtractor::acquire() const
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(!m_pool.empty())
+    {
+      cv::Ptr<cv::ORB> orb = m_pool.back();
+      m_pool.pop_back();
+      return orb;
+    }
+    m_created++;
+  }
+
+  return cv::ORB::create(m_nfeatures, m_scale_factor, m_nlevels,
+    m_edge_threshold, m_first_level, m_wta_k, m_score_type, m_patch_size,
+    m_fast_threshold);
+}
+
+// --------------------------------------------------------------------------
+
+
+void FeatureExtractor::release(const cv::Ptr<cv::ORB> &orb) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_pool.push_back(orb);
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW3
@@ -1,6 +1,7 @@
 #include "../src/LoopClosingManager.h"
+#include <atomic>
 
-bool match_2_images_flann(ptr_frameinfo current_frame,int index2,int &save_index,double score,const std::vector<ptr_frameinfo>& frameinfo_list,std::vector<DMatch>& good_matches_output);
+bool match_2_images_flann(const ptr_frameinfo& current_frame,const ptr_frameinfo& old_frame,cv::flann::Index& old_frame_index,std::vector<DMatch>& good_matches_output);
 void saveImagePair(int id1,int id2,int &save_index,std::vector<DMatch>& good_matches,double score, const std::vector<ptr_frameinfo> frameinfo_list);
 
 
@@ -10,7 +11,7 @@ LoopClosingManager::LoopClosingManager(const std::string &voc_path)
     this->loop_id = 0;
     //this->orb = cv::ORB::create();
     this->loadVoc(voc_path);
-    this->frame_db = Database(this->voc,false,0);
+    this->frame_db = ShardedDatabase(this->voc,false,0,KEYFRAME_WINDOW_SIZE,KEYFRAME_CELL_SIZE);
 }
 LoopClosingManager::LoopClosingManager(const std::string &voc_path,const std::string &frame_db_path)
 {
@@ -18,12 +19,30 @@ LoopClosingManager::LoopClosingManager(const std::string &voc_path,const std::st
     this->loop_id = 0;
     //this->orb = cv::ORB::create();
     this->loadVoc(voc_path);
-    this->frame_db = Database(frame_db_path.c_str());
+    //a database saved whole has no positions, its keyframes are only sharded by time
+    this->frame_db = ShardedDatabase(KEYFRAME_WINDOW_SIZE,KEYFRAME_CELL_SIZE);
+    this->frame_db.load(frame_db_path);
 }
 
 void LoopClosingManager::addKeyFrame(ptr_frameinfo info)
 {
-    frame_db.add(info->descriptors);
+    BowVector bow;
+    FeatureVector fv;
+    if (frame_db.usingDirectIndex())
+        voc->transform(info->descriptors, bow, fv, frame_db.getDirectIndexLevels());
+    else
+        voc->transform(info->descriptors, bow);
+
+    if (info->has_position)
+        frame_db.add(bow, fv, info->position);
+    else
+        frame_db.add(bow, fv);
+
+    if (frame_store.isOpen() && !frame_store.append(bow, fv, info->keypoints, info->descriptors))
+    {
+        cout<<"LoopClosingManager: could not append keyframe to "<<frame_store.getFilename()<<endl;
+        frame_store.close();
+    }
     frameinfo_list.push_back(info);
     this->frame_index++;
 }
@@ -34,35 +53,75 @@ void LoopClosingManager::addKeyFrame(const cv::Mat& image)
     this->addKeyFrame(info);
 }
 
+void LoopClosingManager::transform(const ptr_frameinfo& info, BowVector& bow) const
+{
+    voc->transform(info->descriptors,bow);
+}
+
 QueryResults LoopClosingManager::queryKeyFrames(ptr_frameinfo info)
+{
+    BowVector bow;
+    this->transform(info,bow);
+    return this->queryKeyFrames(info,bow);
+}
+
+QueryResults LoopClosingManager::queryKeyFrames(ptr_frameinfo info, const BowVector& bow)
 {
     QueryResults results;
-    this->frame_db.query(info->descriptors,results,RET_QUERY_LEN,this->frame_index - TOO_CLOSE_THRES);
+    this->frame_db.query(bow,results,RET_QUERY_LEN,this->loopQuery(info,this->frame_index - TOO_CLOSE_THRES));
     return results;
 }
+
+std::vector<QueryResults> LoopClosingManager::queryKeyFrames(const std::vector<ptr_frameinfo>& infos)
+{
+    //same limits as a single query, the posting lists are read once for all the frames
+    std::vector<BowVector> bow_vecs(infos.size());
+    for (size_t i = 0; i < infos.size(); i++)
+        this->voc->transform(infos[i]->descriptors, bow_vecs[i]);
+
+    //the frames of a rig are taken at the position of the first one
+    ShardQuery query = this->loopQuery(infos.empty() ? ptr_frameinfo() : infos[0], this->frame_index - TOO_CLOSE_THRES);
+    query.parallel = true;
+
+    std::vector<QueryResults> results;
+    this->frame_db.query(bow_vecs, results, RET_QUERY_LEN, query);
+    return results;
+}
+// runs f(i) for each i of the range, with cv::parallel_for_
+template<class F>
+class ParallelRange: public cv::ParallelLoopBody
+{
+public:
+    explicit ParallelRange(const F& f): f(f) {}
+    virtual void operator()(const cv::Range& range) const
+    {
+        for (int i = range.start; i < range.end; i++)
+            f(i);
+    }
+private:
+    const F& f;
+};
+
 int LoopClosingManager::detectLoopByKeyFrame(ptr_frameinfo info,std::vector<DMatch>& good_matches_output,bool current_frame_has_index = true)
 {
-    int ret_index = -1;// Not found!
-    QueryResults results= this->queryKeyFrames(info);
+    BowVector bow;
+    this->transform(info,bow);
+    return this->detectLoopByKeyFrame(info,bow,good_matches_output,current_frame_has_index);
+}
+
+int LoopClosingManager::detectLoopByKeyFrame(ptr_frameinfo info,const BowVector& bow,std::vector<DMatch>& good_matches_output,bool current_frame_has_index)
+{
+    QueryResults results= this->queryKeyFrames(info,bow);
+    //candidates in decreasing score order
+    std::vector<int> candidates;
     for(int wind_index =0;wind_index<results.size();wind_index++)
     {
         if (results[wind_index].Score>DB_QUERY_SCORE_THRES)
         {
-	  if (current_frame_has_index)
-	  
-          if ((current_frame_has_index && results[wind_index].Id<this->frame_index-TOO_CLOSE_THRES) || (!current_frame_has_index))
+          if (results[wind_index].Id < this->frameinfo_list.size() &&
+              ((current_frame_has_index && results[wind_index].Id<this->frame_index-TOO_CLOSE_THRES) || (!current_frame_has_index)))
           {
-            // check if this loop candidate satisfies Epipolar Geometry constrain.
-	    std::vector<DMatch> matches_out;
-            if (match_2_images_flann(info,results[wind_index].Id,this->loop_id,results[wind_index].Score,this->frameinfo_list,matches_out))
-            {
-	      if (current_frame_has_index)
-	      {
-                  cout<<"Loop between ["<<this->frame_index<<"\t"<<results[wind_index].Id<<"]"<<endl;
-	      }
-	      ret_index = results[wind_index].Id;
-              break; // match one frame only once.
-            }
+            candidates.push_back(results[wind_index].Id);
           }
         }
         else
@@ -70,36 +129,171 @@ int LoopClosingManager::detectLoopByKeyFrame(ptr_frameinfo info,std::vector<DMat
           break;
         }
     }
+    // check if these loop candidates satisfy Epipolar Geometry constrain, one frame is matched only once.
+    int ret_index = this->verifyCandidates(info, candidates, good_matches_output);
+    if (ret_index >= 0 && current_frame_has_index)
+    {
+        cout<<"Loop between ["<<this->frame_index<<"\t"<<ret_index<<"]"<<endl;
+    }
     return ret_index;
 }
 
-int LoopClosingManager::saveDB()
+int LoopClosingManager::verifyCandidates(const ptr_frameinfo& info, const std::vector<int>& candidates, std::vector<DMatch>& good_matches_output)
 {
-    // Reserve:
-    
-    // Database frame_db;
-    // int frame_index;
-    // std::vector<ptr_frameinfo> frameinfo_list;
+    good_matches_output.clear();
+    if (candidates.empty())
+        return -1;
+
+    std::vector<std::vector<DMatch> > candidate_matches(candidates.size());
+    std::vector<char> verified(candidates.size(), 0);
+    //rank of the best scored confident candidate found so far, the ones after it are skipped.
+    //whichever tasks run first, the candidate chosen below is the same.
+    std::atomic<int> first_confident((int)candidates.size());
+
+    auto verify = [&](int rank)
+    {
+        if (rank > first_confident.load())
+            return;
+
+        ptr_lshindex lsh = this->getLshIndex(candidates[rank]);
+        if (!lsh || !match_2_images_flann(info, this->frameinfo_list[candidates[rank]], lsh->index, candidate_matches[rank]))
+            return;
+
+        verified[rank] = 1;
+        if (candidate_matches[rank].size() >= CONFIDENT_KP_NUM)
+        {
+            int current = first_confident.load();
+            while (rank < current && !first_confident.compare_exchange_weak(current, rank));
+        }
+    };
+    cv::parallel_for_(cv::Range(0, (int)candidates.size()), ParallelRange<decltype(verify)>(verify), (double)candidates.size());
+
+    //the best scored confident candidate, or else the verified one with the most inliers (the best scored on ties)
+    int best = -1;
+    if (first_confident.load() < (int)candidates.size())
+    {
+        best = first_confident.load();
+    }
+    else
+    {
+        for (int rank = 0; rank < (int)candidates.size(); rank++)
+        {
+            if (verified[rank] && (best < 0 || candidate_matches[rank].size() > candidate_matches[best].size()))
+                best = rank;
+        }
+    }
+
+    if (best < 0)
+        return -1;
+    good_matches_output.swap(candidate_matches[best]);
+    return candidates[best];
+}
+
+ptr_lshindex LoopClosingManager::getLshIndex(int frame_id)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->lsh_index_mutex);
+        if (frame_id < (int)this->lsh_index_list.size() && this->lsh_index_list[frame_id])
+            return this->lsh_index_list[frame_id];
+    }
+
+    const cv::Mat& descriptors = this->frameinfo_list[frame_id]->descriptors;
+    if (descriptors.empty())
+        return ptr_lshindex();
+
+    //built outside the lock, so that candidates build their index in parallel
+    ptr_lshindex lsh(new FrameLshIndex);
+    lsh->descriptors = descriptors;
+    lsh->index.build(lsh->descriptors, flann::LshIndexParams(12,20,2), cvflann::FLANN_DIST_HAMMING);
+
+    std::lock_guard<std::mutex> lock(this->lsh_index_mutex);
+    if (frame_id >= (int)this->lsh_index_list.size())
+        this->lsh_index_list.resize(frame_id + 1);
+    if (!this->lsh_index_list[frame_id])
+        this->lsh_index_list[frame_id] = lsh;
+    return this->lsh_index_list[frame_id];
 }
-void LoopClosingManager::loadFromDB()
+
+ShardQuery LoopClosingManager::loopQuery(const ptr_frameinfo& info, int max_id) const
 {
-    
+    ShardQuery query;
+    query.max_id = max_id;
+    //without a position every shard is scored, so that no loop is missed
+    if (info && info->has_position)
+    {
+        query.use_position = true;
+        query.position = info->position;
+        query.max_shards = MAX_QUERY_SHARDS;
+    }
+    return query;
 }
 
-int LoopClosingManager::loadVoc(const std::string &voc_path)
+int LoopClosingManager::saveDB(const std::string& db_path)
+{
+    if (!this->frame_store.create(db_path, *this->voc))
+        return -1;
+
+    // the database keeps no bow vectors, compute them again
+    const int di_levels = this->frame_db.getDirectIndexLevels();
+    for (const ptr_frameinfo& info : this->frameinfo_list)
+    {
+        BowVector bow;
+        FeatureVector fv;
+        if (this->frame_db.usingDirectIndex())
+            this->voc->transform(info->descriptors, bow, fv, di_levels);
+        else
+            this->voc->transform(info->descriptors, bow);
+
+        if (!this->frame_store.append(bow, fv, info->keypoints, info->descriptors))
+        {
+            this->frame_store.close();
+            return -1;
+        }
+    }
+    return 0;
+}
+int LoopClosingManager::loadFromDB(const std::string& db_path)
 {
+    this->clearKeyFrames();
 
+    int n = this->frame_store.open(db_path, *this->voc, [this](KeyFrameStore::StoredFrame& frame)
+    {
+        this->frame_db.add(frame.bow, frame.fv);
+
+        ptr_frameinfo info(new FrameInfo);
+        info->keypoints.swap(frame.keypoints);
+        info->descriptors = frame.descriptors.clone();
+        this->frameinfo_list.push_back(info);
+        this->frame_index++;
+    });
+
+    if (n < 0)
+        this->clearKeyFrames();
+    return n;
+}
+void LoopClosingManager::clearKeyFrames()
+{
+    this->frame_store.close();
+    this->frame_db.clear();
+    this->frameinfo_list.clear();
+    this->frame_index = 0;
+
+    std::lock_guard<std::mutex> lock(this->lsh_index_mutex);
+    this->lsh_index_list.clear();
+}
+
+int LoopClosingManager::loadVoc(const std::string &voc_path)
+{
+    //loaded once per process and shared by all the managers and their frame_db. Files converted
+    //with convert_voc_mapped are besides mapped and used in place
+    this->voc = VocabularyRegistry::get(voc_path);
+    return this->voc->empty() ? -1 : 0;
 }
 
-ptr_frameinfo LoopClosingManager::extractFeature(const cv::Mat& image)
+ptr_frameinfo LoopClosingManager::extractFeature(const cv::Mat& image) const
 {
-    cv::Mat mask;
     auto pframeinfo = shared_ptr<FrameInfo>(new FrameInfo);
-    //ptr_frameinfo->keypoints
-    //vector<cv::KeyPoint> keypoints;
-    cv::Ptr<cv::ORB> orb;
-    orb = cv::ORB::create();
-    orb->detectAndCompute(image, mask, pframeinfo->keypoints,pframeinfo->descriptors);
+    this->extractor.extract(image, pframeinfo->keypoints, pframeinfo->descriptors);
     //orb->detect(image,keypoints);
     //brief->compute(image,keypoints,descriptors);
     //surf->detectAndCompute(image,mask,keypoints,descriptors);
@@ -110,6 +304,22 @@ ptr_frameinfo LoopClosingManager::extractFeature(const cv::Mat& image)
     return pframeinfo;
 }
 
+std::vector<ptr_frameinfo> LoopClosingManager::extractFeatures(const std::vector<cv::Mat>& images) const
+{
+    std::vector<std::vector<cv::KeyPoint> > keypoints;
+    std::vector<cv::Mat> descriptors;
+    this->extractor.extract(images, keypoints, descriptors);
+
+    std::vector<ptr_frameinfo> frames(images.size());
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        frames[i] = shared_ptr<FrameInfo>(new FrameInfo);
+        frames[i]->keypoints.swap(keypoints[i]);
+        frames[i]->descriptors = descriptors[i];
+    }
+    return frames;
+}
+
 void saveImagePair(int id1,int id2,int &save_index,std::vector<DMatch>& good_matches,double score, const std::vector<ptr_frameinfo> frameinfo_list)
 {
     stringstream ss;
@@ -129,15 +339,23 @@ void saveImagePair(int id1,int id2,int &save_index,std::vector<DMatch>& good_mat
     save_index++;
 }
 
-bool match_2_images_flann(ptr_frameinfo current_frame,int index2,int &save_index,double score,const std::vector<ptr_frameinfo>& frameinfo_list,std::vector<DMatch>& good_matches_output)
+bool match_2_images_flann(const ptr_frameinfo& current_frame,const ptr_frameinfo& old_frame,cv::flann::Index& old_frame_index,std::vector<DMatch>& good_matches_output)
 {
     //TODO:refer VINS KeyFrame::findConnection().
 
-    FlannBasedMatcher matcher = FlannBasedMatcher(makePtr<flann::LshIndexParams>(12,20,2));
-    //FlannBasedMatcher matcher = FlannBasedMatcher();
+    //the index of the old frame is built once and kept by LoopClosingManager, candidates are matched
+    //in parallel so nothing is printed here.
     std::vector< DMatch > matches;
-    //matcher.match( kdesp_list[index1], kdesp_list[index2], matches );
-    matcher.match(current_frame->descriptors, frameinfo_list[index2]->descriptors, matches);
+    if (!current_frame->descriptors.empty())
+    {
+        Mat indices, dists;
+        old_frame_index.knnSearch(current_frame->descriptors, indices, dists, 1, flann::SearchParams());
+        for (int i = 0; i < indices.rows; i++)
+        {
+            if (indices.at<int>(i, 0) >= 0)
+                matches.push_back(DMatch(i, indices.at<int>(i, 0), (float)dists.at<int>(i, 0)));
+        }
+    }
 
     double max_dist = 0; double min_dist = 100;
     for( int i = 0; i < matches.size(); i++ )
@@ -146,7 +364,6 @@ bool match_2_images_flann(ptr_frameinfo current_frame,int index2,int &save_index
         if( dist < min_dist ) min_dist = dist;
         if( dist > max_dist ) max_dist = dist;
     }
-    cout<<"min_dist:"<<min_dist<<endl;
     std::vector< DMatch > good_matches;
 
     for( int i = 0; i < matches.size(); i++ )
@@ -160,10 +377,9 @@ bool match_2_images_flann(ptr_frameinfo current_frame,int index2,int &save_index
     std::vector<cv::Point2f> match_points2;
 
 
-    cout<<"Good matches count:"<<good_matches.size()<<"."<<endl;
     if(good_matches.size()<STEP1_KP_NUM) // 8 -> 12
     {
-        cout<<"Good matches count:"<<good_matches.size()<<"< 8,MATCH FAILED."<<endl;
+        good_matches_output.clear();
         return false;
     }
     for( size_t i = 0; i < good_matches.size(); i++ )
@@ -171,16 +387,16 @@ bool match_2_images_flann(ptr_frameinfo current_frame,int index2,int &save_index
         //kp_list[index1][ good_matches[i].queryIdx ].pt );
         match_points1.push_back( current_frame->keypoints[good_matches[i].queryIdx].pt);
         //kp_list[index2][ good_matches[i].trainIdx ].pt );
-        match_points2.push_back( frameinfo_list[index2]->keypoints[good_matches[i].trainIdx].pt);
+        match_points2.push_back( old_frame->keypoints[good_matches[i].trainIdx].pt);
     }
 
     Mat isOutlierMask;
     Mat fundamental_matrix = findFundamentalMat(match_points1, match_points2, FM_RANSAC, 3, 0.99,isOutlierMask);
     int final_good_matches_count = 0;
     std::vector<DMatch> final_good_matches;
-    for(int i = 0;i<good_matches.size();i++)
+    for(int i = 0;i<(int)isOutlierMask.total();i++) // empty if no fundamental matrix was found
     {
-        if (isOutlierMask.at<int>(i)!=0)
+        if (isOutlierMask.at<uchar>(i)!=0)
         {
             final_good_matches.push_back(good_matches[i]);
             final_good_matches_count++;
@@ -190,7 +406,6 @@ bool match_2_images_flann(ptr_frameinfo current_frame,int index2,int &save_index
     if(final_good_matches_count>STEP2_KP_NUM)
     {
         //saveImagePair(index1,index2,save_index,final_good_matches,score, frameinfo_list);  //for debug only.
-        cout<<"MATCH SUCCESS."<<endl;
 	good_matches_output = final_good_matches;
         return true;
     }
@@ -6,6 +6,10 @@
 
 // DBoW2/3
 #include "../src/DBoW3.h" // defines OrbVocabulary and OrbDatabase
+#include "../src/KeyFrameStore.h"
+#include "../src/FeatureExtractor.h"
+#include "../src/ShardedDatabase.h"
+#include "../src/VocabularyRegistry.h"
 //#include "src/DBoW3.h"
 
 // OpenCV
@@ -15,7 +19,9 @@
 #include <opencv2/xfeatures2d.hpp>
 #include <opencv2/features2d/features2d.hpp>
 #include "opencv2/calib3d.hpp"
+#include <opencv2/flann.hpp>
 #include <memory>
+#include <mutex>
 //#include<boost/smart_ptr.hp0p>
 //#include "opencv2/xfeatures2d.hpp"
 
@@ -53,9 +59,17 @@ const int TOO_CLOSE_THRES = 400;
 const float DB_QUERY_SCORE_THRES = 0.0075;//0.015;//0.5;//0.65;
 const int STEP1_KP_NUM = 8;//12;
 const int STEP2_KP_NUM = 5;//8;
+//a loop candidate with this many epipolar inliers is taken without verifying the lower scored ones
+const int CONFIDENT_KP_NUM = 30;
 
 const double ORB_TH_HIGH = 20;//pretty good.//10; pretty good//5;
 
+//keyframes of a time window of the database, and side in meters of its cells of positions
+const unsigned int KEYFRAME_WINDOW_SIZE = 100;
+const double KEYFRAME_CELL_SIZE = 20.0;
+//a loop query of a frame with a position scores the keyframes of this many shards at most, the nearest ones
+const int MAX_QUERY_SHARDS = 16;
+
 
 struct FrameInfo
 {
@@ -63,12 +77,24 @@ struct FrameInfo
     //cv::Mat descriptors;
     //vector<cv::Mat > descriptors;
     cv::Mat descriptors;
+    //position (e.g. from GPS), loops are looked for among the keyframes nearby
+    bool has_position = false;
+    cv::Point2d position;
     //SE3
     //IMU_INFO
 };
 
 typedef std::shared_ptr<FrameInfo> ptr_frameinfo;
 
+//LSH index over the descriptors of a keyframe, built the first time the keyframe is a loop candidate
+struct FrameLshIndex
+{
+    cv::Mat descriptors;//the index does not copy them
+    cv::flann::Index index;
+};
+
+typedef std::shared_ptr<FrameLshIndex> ptr_lshindex;
+
 class LoopClosingManager
 {
 public:
@@ -77,21 +103,51 @@ public:
     void addKeyFrame(const cv::Mat& image);
     void addKeyFrame(ptr_frameinfo info);
     QueryResults queryKeyFrames(ptr_frameinfo info);
+    //same with the bow vector of info already computed (see transform), e.g. once for several managers with the same vocabulary
+    QueryResults queryKeyFrames(ptr_frameinfo info, const BowVector& bow);
+    //queries with several frames at once (e.g. the cameras of a rig), results in the order of the frames
+    std::vector<QueryResults> queryKeyFrames(const std::vector<ptr_frameinfo>& infos);
     int detectLoopByKeyFrame(ptr_frameinfo info,std::vector<DMatch>& good_matches_output,bool current_frame_has_index);
+    int detectLoopByKeyFrame(ptr_frameinfo info,const BowVector& bow,std::vector<DMatch>& good_matches_output,bool current_frame_has_index);
+    //bow vector of the features of info with the vocabulary of the manager
+    void transform(const ptr_frameinfo& info, BowVector& bow) const;
     int loadVoc(const std::string& voc_path);
-    int saveDB();
-    void loadFromDB();
-    static ptr_frameinfo extractFeature(const cv::Mat& image);
+    //keyframe database file (KeyFrameStore), written incrementally: after saveDB or loadFromDB
+    //every keyframe added is appended to it.
+    //saveDB writes the current keyframes (their bow vectors are computed once more) and returns 0 or -1
+    int saveDB(const std::string& db_path);
+    //replaces the keyframes with the ones in the file without transforming any descriptor,
+    //returns their number or -1 (missing file, other vocabulary) leaving no keyframe
+    int loadFromDB(const std::string& db_path);
+    void clearKeyFrames();
+    //features are extracted with the detectors of the manager, reused between calls and threads
+    ptr_frameinfo extractFeature(const cv::Mat& image) const;
+    //extracts the images in parallel, the result is in the order of the images
+    std::vector<ptr_frameinfo> extractFeatures(const std::vector<cv::Mat>& images) const;
+    inline const FeatureExtractor& getExtractor() const
+    {
+        return extractor;
+    }
     inline ptr_frameinfo& getFrameInfoById(int i)
     {
       return frameinfo_list[i];
     }
 private:
     
-    Vocabulary voc;
+    //shared with the other managers of the same vocabulary file (VocabularyRegistry)
+    std::shared_ptr<const Vocabulary> voc;
     
 private:
-    Database frame_db;
+    ShardedDatabase frame_db;
+    KeyFrameStore frame_store;
+    FeatureExtractor extractor;
+    //verifies the candidates in parallel, returns the id of the chosen one or -1
+    int verifyCandidates(const ptr_frameinfo& info, const std::vector<int>& candidates, std::vector<DMatch>& good_matches_output);
+    ptr_lshindex getLshIndex(int frame_id);
+    //shards of frame_db scored by a loop query of info
+    ShardQuery loopQuery(const ptr_frameinfo& info, int max_id) const;
+    std::vector<ptr_lshindex> lsh_index_list;
+    std::mutex lsh_index_mutex;
     int frame_index;
     std::vector<ptr_frameinfo> frameinfo_list;
     int loop_id;//just for visualize.
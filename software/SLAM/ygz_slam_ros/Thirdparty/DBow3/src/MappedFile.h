@@ -0,0 +1,39 @@
+/**
+ * File: MappedFile.h
+ * Description: read only file mappings and checksums of the binary
+ *   formats that are used in place (mapped vocabulary, keyframe store)
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_MAPPED_FILE__
+#define __D_T_MAPPED_FILE__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <opencv2/core/core.hpp>
+#include "../src/exports.h"
+
+namespace DBoW3 {
+
+/**
+ * Maps a whole file read only, or reads it to memory where mmap is not
+ * available
+ * @param filename
+ * @param size (out) size of the file
+ * @return mapping, released with the last copy. Empty on failure
+ */
+DBOW_API std::shared_ptr<const uchar> mapFile(const std::string &filename,
+  size_t &size);
+
+/**
+ * 64 bit FNV-1a, one 8 byte word per step
+ * @param data
+ * @param size bytes
+ */
+DBOW_API uint64_t checksum64(const uchar *data, size_t size);
+
+} // namespace DBoW3
+
+#endif
@@ -1,9 +1,575 @@
 #include "../src/Vocabulary.h"
 #include "../src/DescManip.h"
 #include "../src/quicklz.h"
+#include "../src/MappedFile.h"
 #include <sstream>
+#include <cstring>
+#include <functional>
+#include <random>
 #include "timers.h"
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#endif
 namespace DBoW3{
+
+// --------------------------------------------------------------------------
+// Distance kernels of the flat tree. The query and the packed node rows are
+// zero padded to a multiple of 32 bytes, so the padding adds nothing to the
+// distances and the kernels never need a tail loop
+
+static inline uint32_t popcount64(uint64_t v)
+{
+#if defined(__GNUC__) && defined(__POPCNT__)
+  return __builtin_popcountll(v);
+#else
+  v = v - ((v >> 1) & (uint64_t)~(uint64_t)0/3);
+  v = (v & (uint64_t)~(uint64_t)0/15*3) + ((v >> 2) & (uint64_t)~(uint64_t)0/15*3);
+  v = (v + (v >> 4)) & (uint64_t)~(uint64_t)0/255*15;
+  return (uint32_t)((uint64_t)(v * ((uint64_t)~(uint64_t)0/255)) >> (sizeof(uint64_t) - 1) * CHAR_BIT);
+#endif
+}
+
+/// Hamming distances between a query and n consecutive rows of a block
+static void hammingBlock(const uchar *q, const uchar *block, size_t step,
+  uint32_t n, uint32_t *out)
+{
+#if defined(__AVX2__)
+  const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                       0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  for(uint32_t i = 0; i < n; i++)
+  {
+    const uchar *row = block + i * step;
+    __m256i acc = _mm256_setzero_si256();
+    for(size_t b = 0; b < step; b += 32)
+    {
+      __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(q + b)),
+                                   _mm256_loadu_si256((const __m256i*)(row + b)));
+      __m256i cnt = _mm256_add_epi8(
+        _mm256_shuffle_epi8(lut, _mm256_and_si256(x, low)),
+        _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+      acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+    }
+    __m128i s = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    out[i] = (uint32_t)(_mm_cvtsi128_si64(s) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(s, s)));
+  }
+#elif defined(__SSSE3__)
+  const __m128i lut = _mm_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+  const __m128i low = _mm_set1_epi8(0x0f);
+  for(uint32_t i = 0; i < n; i++)
+  {
+    const uchar *row = block + i * step;
+    __m128i acc = _mm_setzero_si128();
+    for(size_t b = 0; b < step; b += 16)
+    {
+      __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(q + b)),
+                                _mm_loadu_si128((const __m128i*)(row + b)));
+      __m128i cnt = _mm_add_epi8(
+        _mm_shuffle_epi8(lut, _mm_and_si128(x, low)),
+        _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(x, 4), low)));
+      acc = _mm_add_epi64(acc, _mm_sad_epu8(cnt, _mm_setzero_si128()));
+    }
+    out[i] = (uint32_t)(_mm_cvtsi128_si64(acc) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc)));
+  }
+#else
+  const uint64_t *pq = (const uint64_t*)q;
+  const size_t n64 = step / sizeof(uint64_t);
+  for(uint32_t i = 0; i < n; i++)
+  {
+    const uint64_t *pr = (const uint64_t*)(block + i * step);
+    uint32_t d = 0;
+    for(size_t w = 0; w < n64; w++)
+      d += popcount64(pq[w] ^ pr[w]);
+    out[i] = d;
+  }
+#endif
+}
+
+/// Squared L2 distances between a float query and n consecutive rows,
+/// summed in double as DescManip::distance does
+static void l2Block(const uchar *q, const uchar *block, size_t step,
+  uint32_t n, double *out)
+{
+  const float *pq = (const float*)q;
+  const size_t nf = step / sizeof(float);
+  for(uint32_t i = 0; i < n; i++)
+  {
+    const float *pr = (const float*)(block + i * step);
+    double d = 0;
+    for(size_t c = 0; c < nf; c++)
+      d += (pq[c] - pr[c]) * (pq[c] - pr[c]);
+    out[i] = d;
+  }
+}
+
+/// Runs Vocabulary::quantizeFlat over a range of rows
+class ParallelQuantizer: public cv::ParallelLoopBody
+{
+public:
+  ParallelQuantizer(const Vocabulary &voc, const uchar * const *rows,
+    WordId *words, NodeId *nids, int levelsup)
+    : m_voc(voc), m_rows(rows), m_words(words), m_nids(nids), m_levelsup(levelsup){}
+
+  void operator()(const cv::Range &range) const
+  {
+    m_voc.quantizeFlat(m_rows + range.start, range.end - range.start,
+      m_words + range.start, m_nids ? m_nids + range.start : NULL, m_levelsup);
+  }
+
+private:
+  const Vocabulary &m_voc;
+  const uchar * const *m_rows;
+  WordId *m_words;
+  NodeId *m_nids;
+  int m_levelsup;
+};
+
+/// Adds quantized features to the bow and feature vectors with the
+/// weighting rules of Vocabulary::transform
+static void addToBowVector(WeightingType weighting, bool must, LNorm norm,
+  const std::vector<WordId> &words, const std::vector<WordValue> &weights,
+  const std::vector<NodeId> *nids, BowVector &v, FeatureVector *fv)
+{
+  if(weighting == TF || weighting == TF_IDF)
+  {
+    for(unsigned int i = 0; i < words.size(); i++)
+    {
+      // w is the idf value if TF_IDF, 1 if TF
+      if(weights[i] > 0) // not stopped
+      {
+        v.addWeight(words[i], weights[i]);
+        if(fv) fv->addFeature((*nids)[i], i);
+      }
+    }
+
+    if(!v.empty() && !must)
+    {
+      // unnecessary when normalizing
+      const double nd = v.size();
+      for(BowVector::iterator vit = v.begin(); vit != v.end(); vit++)
+        vit->second /= nd;
+    }
+  }
+  else // IDF || BINARY
+  {
+    for(unsigned int i = 0; i < words.size(); i++)
+    {
+      // w is idf if IDF, or 1 if BINARY
+      if(weights[i] > 0) // not stopped
+      {
+        v.addIfNotExist(words[i], weights[i]);
+        if(fv) fv->addFeature((*nids)[i], i);
+      }
+    }
+  } // if m_weighting == ...
+
+  if(must) v.normalize(norm);
+}
+
+// --------------------------------------------------------------------------
+// Mapped vocabulary files (Vocabulary::saveMapped / loadMapped)
+
+static const char kMappedMagic[8] = {'D','B','O','W','3','M','A','P'};
+static const uint32_t kMappedVersion = 1;
+static const uint64_t kMappedAlignment = 64;
+
+/// Header of a mapped vocabulary file. The sections follow it in this
+/// order, each one aligned to kMappedAlignment bytes
+struct MappedVocHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  int32_t k, L, scoring, weighting;
+  int32_t desc_type, desc_cols;
+  uint32_t desc_step;     // bytes of a padded descriptor row
+  uint32_t max_children;
+  uint32_t n_nodes;       // nodes of the flat tree
+  uint32_t n_words;
+  uint32_t n_node_ids;    // entries of the node id -> flat position table
+  uint32_t reserved;
+  uint64_t nodes_offset;
+  uint64_t weights_offset;
+  uint64_t word_pos_offset;
+  uint64_t node_pos_offset;
+  uint64_t descriptors_offset;
+  uint64_t file_size;
+  uint64_t checksum;      // FNV-1a of all the bytes after the header
+};
+
+static inline uint64_t alignMapped(uint64_t offset)
+{
+  return (offset + kMappedAlignment - 1) / kMappedAlignment * kMappedAlignment;
+}
+
+static inline bool inMappedRange(uint64_t offset, uint64_t bytes, uint64_t size)
+{
+  return offset % sizeof(uint64_t) == 0 && offset <= size && bytes <= size - offset;
+}
+
+// --------------------------------------------------------------------------
+// Parallel vocabulary training, see Vocabulary::setParallelTraining
+
+/// Runs f(begin, end) over [0, n), split over several threads if parallel
+template<class F>
+class ParallelRange: public cv::ParallelLoopBody
+{
+public:
+  explicit ParallelRange(const F &f): m_f(f){}
+  void operator()(const cv::Range &range) const { m_f(range.start, range.end); }
+private:
+  const F &m_f;
+};
+
+template<class F>
+static void parallelRange(int n, bool parallel, const F &f)
+{
+  if(parallel && n > 1)
+    cv::parallel_for_(cv::Range(0, n), ParallelRange<F>(f));
+  else if(n > 0)
+    f(0, n);
+}
+
+/// splitmix64 finalizer, derives the seed of every cluster of the tree
+static inline uint64_t mixSeed(uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/// Per bit majority of n binary rows of a padded matrix, as in
+/// DescManip::meanValue. The bits are counted with 8 bit lanes, which are
+/// flushed to the 32 bit totals every 255 rows
+static void bitMajority(const uchar *data, size_t step, const uint32_t *rows,
+  size_t n, uchar *out)
+{
+  // sum[j*8 + b] = rows with bit b of byte j set
+  std::vector<uint32_t> sum(step * 8, 0);
+#if defined(__AVX2__)
+  const __m256i one = _mm256_set1_epi8(1);
+  uchar lanes[32];
+  for(size_t j0 = 0; j0 < step; j0 += 32)
+  {
+    for(size_t r0 = 0; r0 < n; r0 += 255)
+    {
+      const size_t r1 = std::min(n, r0 + 255);
+      __m256i cnt[8];
+      for(int b = 0; b < 8; b++) cnt[b] = _mm256_setzero_si256();
+      for(size_t r = r0; r < r1; r++)
+      {
+        const __m256i v = _mm256_loadu_si256(
+          (const __m256i*)(data + rows[r] * step + j0));
+        for(int b = 0; b < 8; b++)
+          cnt[b] = _mm256_add_epi8(cnt[b],
+            _mm256_and_si256(_mm256_srli_epi16(v, b), one));
+      }
+      for(int b = 0; b < 8; b++)
+      {
+        _mm256_storeu_si256((__m256i*)lanes, cnt[b]);
+        for(int j = 0; j < 32; j++) sum[(j0 + j) * 8 + b] += lanes[j];
+      }
+    }
+  }
+#elif defined(__SSSE3__)
+  const __m128i one = _mm_set1_epi8(1);
+  uchar lanes[16];
+  for(size_t j0 = 0; j0 < step; j0 += 16)
+  {
+    for(size_t r0 = 0; r0 < n; r0 += 255)
+    {
+      const size_t r1 = std::min(n, r0 + 255);
+      __m128i cnt[8];
+      for(int b = 0; b < 8; b++) cnt[b] = _mm_setzero_si128();
+      for(size_t r = r0; r < r1; r++)
+      {
+        const __m128i v = _mm_loadu_si128(
+          (const __m128i*)(data + rows[r] * step + j0));
+        for(int b = 0; b < 8; b++)
+          cnt[b] = _mm_add_epi8(cnt[b],
+            _mm_and_si128(_mm_srli_epi16(v, b), one));
+      }
+      for(int b = 0; b < 8; b++)
+      {
+        _mm_storeu_si128((__m128i*)lanes, cnt[b]);
+        for(int j = 0; j < 16; j++) sum[(j0 + j) * 8 + b] += lanes[j];
+      }
+    }
+  }
+#else
+  for(size_t r = 0; r < n; r++)
+  {
+    const uchar *p = data + rows[r] * step;
+    for(size_t j = 0; j < step; j++)
+      for(int b = 0; b < 8; b++)
+        sum[j * 8 + b] += (p[j] >> b) & 1;
+  }
+#endif
+
+  const uint32_t n2 = (uint32_t)(n / 2 + n % 2);
+  for(size_t j = 0; j < step; j++)
+  {
+    uchar m = 0;
+    for(int b = 0; b < 8; b++)
+      if(sum[j * 8 + b] >= n2) m |= (uchar)(1 << b);
+    out[j] = m;
+  }
+}
+
+/// Mean of n float rows of a padded matrix
+static void floatMean(const uchar *data, size_t step, const uint32_t *rows,
+  size_t n, uchar *out)
+{
+  const size_t nf = step / sizeof(float);
+  std::vector<double> acc(nf, 0.);
+  for(size_t r = 0; r < n; r++)
+  {
+    const float *p = (const float*)(data + rows[r] * step);
+    for(size_t c = 0; c < nf; c++) acc[c] += p[c];
+  }
+  float *m = (float*)out;
+  for(size_t c = 0; c < nf; c++) m[c] = (float)(acc[c] / n);
+}
+
+/// Hierarchical k-means++ over the rows of a zero padded matrix (the layout
+/// of the flat tree, so the distance kernels of the transforms are used).
+/// A cluster only depends on its rows and its seed, so clusters can be split
+/// in any order and on any thread
+class HKMeansTrainer
+{
+public:
+  struct Cluster
+  {
+    /// Centre, one padded row
+    std::vector<uchar> centre;
+    /// Rows of the matrix in this cluster, in ascending order
+    std::vector<uint32_t> rows;
+    /// Sub clusters, in the order of the k-means centres
+    std::vector<Cluster> children;
+    /// Seed of the k-means++ initialization of this cluster
+    uint64_t seed = 0;
+    /// Tree level of the children
+    int level = 1;
+  };
+
+  HKMeansTrainer(const cv::Mat &data, bool binary, int k, int L)
+    : m_data(data.data), m_step(data.cols), m_binary(binary), m_k(k), m_L(L){}
+
+  /// Splits the root and all its descendants
+  void train(Cluster &root) const
+  {
+    // split the top levels one cluster at a time, each with all the
+    // threads, until there are enough subtrees to keep the threads busy
+    std::vector<Cluster*> frontier(1, &root);
+    const size_t min_tasks = 4 * (size_t)std::max(1, cv::getNumThreads());
+    while(!frontier.empty() && frontier.size() < min_tasks)
+    {
+      std::vector<Cluster*> next;
+      for(size_t i = 0; i < frontier.size(); i++)
+      {
+        split(*frontier[i], true);
+        pushSplittable(*frontier[i], next);
+      }
+      frontier.swap(next);
+    }
+
+    // then whole subtrees as tasks, largest first
+    std::stable_sort(frontier.begin(), frontier.end(),
+      [](const Cluster *a, const Cluster *b){ return a->rows.size() > b->rows.size(); });
+    parallelRange((int)frontier.size(), true, [&](int begin, int end){
+      for(int i = begin; i < end; i++) splitTree(*frontier[i]);
+    });
+  }
+
+private:
+
+  const uchar *row(uint32_t r) const { return m_data + (size_t)r * m_step; }
+
+  void pushSplittable(Cluster &c, std::vector<Cluster*> &out) const
+  {
+    if(c.level >= m_L) return;
+    for(size_t i = 0; i < c.children.size(); i++)
+      if(c.children[i].rows.size() > 1) out.push_back(&c.children[i]);
+  }
+
+  void splitTree(Cluster &c) const
+  {
+    split(c, false);
+    std::vector<Cluster*> children;
+    pushSplittable(c, children);
+    for(size_t i = 0; i < children.size(); i++) splitTree(*children[i]);
+  }
+
+  /// Distances of one descriptor to n consecutive centres
+  void distances(const uchar *q, const uchar *centres, uint32_t n,
+    double *out) const
+  {
+    if(m_binary)
+    {
+      uint32_t d[64];
+      for(uint32_t i = 0; i < n; i += 64)
+      {
+        const uint32_t m = std::min<uint32_t>(64, n - i);
+        hammingBlock(q, centres + i * m_step, m_step, m, d);
+        for(uint32_t j = 0; j < m; j++) out[i + j] = d[j];
+      }
+    }
+    else
+      l2Block(q, centres, m_step, n, out);
+  }
+
+  /// Index of the closest centre of each row, the first one on ties
+  void assign(const std::vector<uint32_t> &rows, const std::vector<uchar> &centres,
+    uint32_t nc, std::vector<uint32_t> &assoc, bool parallel) const
+  {
+    parallelRange((int)rows.size(), parallel, [&](int begin, int end){
+      std::vector<double> d(nc);
+      for(int i = begin; i < end; i++)
+      {
+        distances(row(rows[i]), centres.data(), nc, d.data());
+        assoc[i] = (uint32_t)(std::min_element(d.begin(), d.end()) - d.begin());
+      }
+    });
+  }
+
+  /// Lowers the distance of each row to its closest centre with a new centre
+  void updateMinDist(const std::vector<uint32_t> &rows, const uchar *centre,
+    std::vector<double> &min_dists, bool parallel) const
+  {
+    parallelRange((int)rows.size(), parallel, [&](int begin, int end){
+      for(int i = begin; i < end; i++)
+      {
+        if(min_dists[i] > 0)
+        {
+          double d;
+          distances(row(rows[i]), centre, 1, &d);
+          if(d < min_dists[i]) min_dists[i] = d;
+        }
+      }
+    });
+  }
+
+  /// kmeans++ seeding, see Vocabulary::initiateClustersKMpp. The generator
+  /// is fully specified by the standard, so are the seeds it draws
+  uint32_t seedCentres(const Cluster &c, std::vector<uchar> &centres,
+    bool parallel) const
+  {
+    const std::vector<uint32_t> &rows = c.rows;
+    std::mt19937_64 rng(c.seed);
+    centres.assign((size_t)m_k * m_step, 0);
+    std::vector<double> min_dists(rows.size(), std::numeric_limits<double>::max());
+
+    uint32_t nc = 0;
+    size_t ifeature = rng() % rows.size();
+    while(true)
+    {
+      uchar *centre = centres.data() + (size_t)nc * m_step;
+      memcpy(centre, row(rows[ifeature]), m_step);
+      nc++;
+      if((int)nc == m_k) break;
+
+      updateMinDist(rows, centre, min_dists, parallel);
+      const double dist_sum = std::accumulate(min_dists.begin(), min_dists.end(), 0.0);
+      if(!(dist_sum > 0)) break;
+
+      double cut_d;
+      do
+      {
+        cut_d = (double)(rng() >> 11) * (1.0 / 9007199254740992.0) * dist_sum;
+      } while(cut_d == 0.0);
+
+      double d_up_now = 0;
+      for(ifeature = 0; ifeature < rows.size(); ifeature++)
+      {
+        d_up_now += min_dists[ifeature];
+        if(d_up_now >= cut_d) break;
+      }
+      if(ifeature == rows.size()) ifeature = rows.size() - 1;
+    }
+    return nc;
+  }
+
+  /// Groups the rows of a cluster by centre, keeping their order
+  static void group(const std::vector<uint32_t> &rows,
+    const std::vector<uint32_t> &assoc, uint32_t nc,
+    std::vector<std::vector<uint32_t> > &groups)
+  {
+    groups.assign(nc, std::vector<uint32_t>());
+    for(size_t i = 0; i < rows.size(); i++) groups[assoc[i]].push_back(rows[i]);
+  }
+
+  /// Runs k-means on the rows of a cluster and creates its children
+  void split(Cluster &c, bool parallel) const
+  {
+    const size_t n = c.rows.size();
+    if(n == 0) return;
+
+    std::vector<uchar> centres;
+    std::vector<std::vector<uint32_t> > groups;
+    uint32_t nc;
+
+    if(n <= (size_t)m_k)
+    {
+      // trivial case: one cluster per feature
+      nc = (uint32_t)n;
+      centres.resize(n * m_step);
+      groups.resize(n);
+      for(size_t i = 0; i < n; i++)
+      {
+        memcpy(centres.data() + i * m_step, row(c.rows[i]), m_step);
+        groups[i].push_back(c.rows[i]);
+      }
+    }
+    else
+    {
+      nc = seedCentres(c, centres, parallel);
+
+      std::vector<uint32_t> assoc(n), last_assoc;
+      assign(c.rows, centres, nc, assoc, parallel);
+      while(true)
+      {
+        group(c.rows, assoc, nc, groups);
+
+        // empty clusters keep their centre
+        for(uint32_t i = 0; i < nc; i++)
+        {
+          if(groups[i].empty()) continue;
+          uchar *centre = centres.data() + (size_t)i * m_step;
+          if(m_binary)
+            bitMajority(m_data, m_step, groups[i].data(), groups[i].size(), centre);
+          else
+            floatMean(m_data, m_step, groups[i].data(), groups[i].size(), centre);
+        }
+
+        last_assoc.swap(assoc);
+        assoc.resize(n);
+        assign(c.rows, centres, nc, assoc, parallel);
+        if(assoc == last_assoc) break;
+      }
+      group(c.rows, assoc, nc, groups);
+    }
+
+    c.children.resize(nc);
+    for(uint32_t i = 0; i < nc; i++)
+    {
+      Cluster &child = c.children[i];
+      child.centre.assign(centres.begin() + (size_t)i * m_step,
+        centres.begin() + (size_t)(i + 1) * m_step);
+      child.rows.swap(groups[i]);
+      child.seed = mixSeed(c.seed ^ mixSeed(i + 1));
+      child.level = c.level + 1;
+    }
+    std::vector<uint32_t>().swap(c.rows);
+  }
+
+  const uchar *m_data;
+  size_t m_step;
+  bool m_binary;
+  int m_k;
+  int m_L;
+};
+
 // --------------------------------------------------------------------------
 
 
@@ -128,6 +694,33 @@ Vocabulary::operator=
 
   this->createScoringObject();
 
+  this->m_parallel_transform = voc.m_parallel_transform;
+  this->m_parallel_min_rows = voc.m_parallel_min_rows;
+  this->m_parallel_training = voc.m_parallel_training;
+  this->m_training_seed = voc.m_training_seed;
+
+  if(voc.m_mapping)
+  {
+    // share the mapped file, nothing is copied
+    this->m_nodes.clear();
+    this->m_words.clear();
+    this->m_flat_storage.clear();
+
+    this->m_mapping = voc.m_mapping;
+    this->m_flat_nodes = voc.m_flat_nodes;
+    this->m_flat_size = voc.m_flat_size;
+    this->m_flat_descriptors = voc.m_flat_descriptors;
+    this->m_flat_type = voc.m_flat_type;
+    this->m_flat_cols = voc.m_flat_cols;
+    this->m_flat_max_children = voc.m_flat_max_children;
+    this->m_flat_nwords = voc.m_flat_nwords;
+    this->m_flat_weights = voc.m_flat_weights;
+    this->m_flat_word_pos = voc.m_flat_word_pos;
+    this->m_flat_node_pos = voc.m_flat_node_pos;
+    this->m_flat_nnode_ids = voc.m_flat_nnode_ids;
+    return *this;
+  }
+
   this->m_nodes.clear();
   this->m_words.clear();
 
@@ -173,7 +766,10 @@ void Vocabulary::create(
   m_nodes.push_back(Node(0)); // root
 
   // create the tree
-  HKmeansStep(0, features, 1);
+  if(m_parallel_training)
+    HKmeansParallel(features);
+  else
+    HKmeansStep(0, features, 1);
 
   // create the words
   createWords();
@@ -491,6 +1087,57 @@ void Vocabulary::initiateClustersKMpp(
 // --------------------------------------------------------------------------
 
 
+void Vocabulary::HKmeansParallel(const std::vector<cv::Mat> &descriptors)
+{
+  if(descriptors.empty()) return;
+
+  const cv::Mat &first = descriptors[0];
+  if(first.rows != 1 || (first.type() != CV_8U && first.type() != CV_32F))
+  {
+    HKmeansStep(0, descriptors, 1);
+    return;
+  }
+
+  // pack the descriptors in one zero padded matrix
+  const size_t bytes = first.cols * first.elemSize();
+  const size_t padded = (bytes + 31) / 32 * 32;
+  cv::Mat data = cv::Mat::zeros(descriptors.size(), padded, CV_8U);
+  for(size_t i = 0; i < descriptors.size(); i++)
+    memcpy(data.ptr<uchar>(i), descriptors[i].ptr<uchar>(), bytes);
+
+  HKMeansTrainer::Cluster root;
+  root.rows.resize(descriptors.size());
+  std::iota(root.rows.begin(), root.rows.end(), 0);
+  root.seed = mixSeed(m_training_seed);
+  root.level = 1;
+
+  HKMeansTrainer(data, first.type() == CV_8U, m_k, m_L).train(root);
+
+  // create the nodes with the ids HKmeansStep gives them: the children of
+  // a node are consecutive, then come the subtrees of each child
+  std::function<void(NodeId, const HKMeansTrainer::Cluster&)> createNodes =
+    [&](NodeId parent_id, const HKMeansTrainer::Cluster &c)
+  {
+    const NodeId first_id = m_nodes.size();
+    for(size_t i = 0; i < c.children.size(); i++)
+    {
+      NodeId id = m_nodes.size();
+      m_nodes.push_back(Node(id));
+      m_nodes.back().descriptor.create(1, first.cols, first.type());
+      memcpy(m_nodes.back().descriptor.data, c.children[i].centre.data(), bytes);
+      m_nodes.back().parent = parent_id;
+      m_nodes[parent_id].children.push_back(id);
+    }
+    for(size_t i = 0; i < c.children.size(); i++)
+      if(!c.children[i].children.empty())
+        createNodes(first_id + i, c.children[i]);
+  };
+  createNodes(0, root);
+}
+
+// --------------------------------------------------------------------------
+
+
 void Vocabulary::createWords()
 {
   m_words.resize(0);
@@ -510,6 +1157,88 @@ void Vocabulary::createWords()
       }
     }
   }
+
+  buildFlatTree();
+}
+
+// --------------------------------------------------------------------------
+
+
+void Vocabulary::buildFlatTree()
+{
+  // the flat tree now comes from m_nodes, drop any mapped file
+  m_mapping.reset();
+  m_flat_nwords = 0;
+  m_flat_weights = NULL;
+  m_flat_word_pos = NULL;
+  m_flat_node_pos = NULL;
+  m_flat_nnode_ids = 0;
+
+  m_flat_storage.clear();
+  m_flat_nodes = NULL;
+  m_flat_size = 0;
+  m_flat_descriptors.release();
+  m_flat_type = -1;
+  m_flat_cols = 0;
+  m_flat_max_children = 0;
+
+  if(m_nodes.size() < 2 || m_nodes[0].children.empty()) return;
+
+  // all the descriptors must share the type and size of the first one,
+  // otherwise the transforms keep using m_nodes
+  const cv::Mat &first = m_nodes[m_nodes[0].children.front()].descriptor;
+  if(first.rows != 1 || (first.type() != CV_8U && first.type() != CV_32F)) return;
+  const int type = first.type();
+  const int cols = first.cols;
+  const size_t bytes = cols * first.elemSize();
+  const size_t padded = (bytes + 31) / 32 * 32;
+
+  std::vector<FlatNode> flat;
+  flat.reserve(m_nodes.size());
+  cv::Mat descriptors = cv::Mat::zeros(m_nodes.size(), padded, CV_8U);
+  uint32_t max_children = 0;
+
+  FlatNode root;
+  root.first_child = 0;
+  root.n_children = 0;
+  root.parent = 0;
+  root.node_id = 0;
+  root.word_id = 0;
+  flat.push_back(root);
+
+  // breadth-first, the children of each node end up next to each other
+  for(size_t pos = 0; pos < flat.size(); pos++)
+  {
+    const Node &node = m_nodes[flat[pos].node_id];
+    flat[pos].first_child = flat.size();
+    flat[pos].n_children = node.children.size();
+    max_children = std::max(max_children, (uint32_t)node.children.size());
+
+    for(NodeId cid: node.children)
+    {
+      const Node &child = m_nodes[cid];
+      if(flat.size() >= m_nodes.size() || child.descriptor.type() != type ||
+         child.descriptor.cols != cols || child.descriptor.rows != 1)
+        return;
+
+      FlatNode f;
+      f.first_child = 0;
+      f.n_children = 0;
+      f.parent = pos;
+      f.node_id = cid;
+      f.word_id = child.isLeaf() ? child.word_id : 0;
+      memcpy(descriptors.ptr<uchar>(flat.size()), child.descriptor.ptr<uchar>(), bytes);
+      flat.push_back(f);
+    }
+  }
+
+  m_flat_storage.swap(flat);
+  m_flat_nodes = m_flat_storage.data();
+  m_flat_size = m_flat_storage.size();
+  m_flat_descriptors = descriptors;
+  m_flat_type = type;
+  m_flat_cols = cols;
+  m_flat_max_children = max_children;
 }
 
 // --------------------------------------------------------------------------
@@ -535,22 +1264,44 @@ void Vocabulary::setNodeWeights
     // The complete tf-idf score is calculated in ::transform
 
     std::vector<unsigned int> Ni(NWords, 0);
-    std::vector<bool> counted(NWords, false);
 
-
-    for(auto mit = training_features.begin(); mit != training_features.end(); ++mit)
+    if(m_parallel_training)
     {
-      fill(counted.begin(), counted.end(), false);
+      // distinct words of each document, looked up in parallel
+      std::vector<std::vector<WordId> > doc_words(NDocs);
+      parallelRange((int)NDocs, true, [&](int begin, int end){
+        for(int d = begin; d < end; d++)
+        {
+          std::vector<WordId> &words = doc_words[d];
+          words.resize(training_features[d].size());
+          for(size_t i = 0; i < words.size(); i++)
+            transform(training_features[d][i], words[i]);
+          std::sort(words.begin(), words.end());
+          words.erase(std::unique(words.begin(), words.end()), words.end());
+        }
+      });
+      for(unsigned int d = 0; d < NDocs; d++)
+        for(size_t i = 0; i < doc_words[d].size(); i++)
+          Ni[doc_words[d][i]]++;
+    }
+    else
+    {
+      std::vector<bool> counted(NWords, false);
 
-      for(auto fit = mit->begin(); fit < mit->end(); ++fit)
+      for(auto mit = training_features.begin(); mit != training_features.end(); ++mit)
       {
-        WordId word_id;
-        transform(*fit, word_id);
+        fill(counted.begin(), counted.end(), false);
 
-        if(!counted[word_id])
+        for(auto fit = mit->begin(); fit < mit->end(); ++fit)
         {
-          Ni[word_id]++;
-          counted[word_id] = true;
+          WordId word_id;
+          transform(*fit, word_id);
+
+          if(!counted[word_id])
+          {
+            Ni[word_id]++;
+            counted[word_id] = true;
+          }
         }
       }
     }
@@ -581,6 +1332,14 @@ void Vocabulary::setNodeWeights
 float Vocabulary::getEffectiveLevels() const
 {
   long sum = 0;
+  if(m_mapping)
+  {
+    for(uint32_t wid = 0; wid < m_flat_nwords; ++wid)
+      for(uint32_t pos = m_flat_word_pos[wid]; pos != 0; sum++)
+        pos = m_flat_nodes[pos].parent;
+    return (float)((double)sum / (double)m_flat_nwords);
+  }
+
    for(auto wit = m_words.begin(); wit != m_words.end(); ++wit)
   {
     const Node *p = *wit;
@@ -596,6 +1355,10 @@ float Vocabulary::getEffectiveLevels() const
 
 cv::Mat Vocabulary::getWord(WordId wid) const
 {
+  // the mapped pages are read only, return a copy
+  if(m_mapping)
+    return cv::Mat(1, m_flat_cols, m_flat_type,
+      (void*)m_flat_descriptors.ptr<uchar>(m_flat_word_pos[wid])).clone();
   return m_words[wid]->descriptor;
 }
 
@@ -604,7 +1367,7 @@ cv::Mat Vocabulary::getWord(WordId wid) const
 
 WordValue Vocabulary::getWordWeight(WordId wid) const
 {
-  return m_words[wid]->weight;
+  return wordWeight(wid);
 }
 
 // --------------------------------------------------------------------------
@@ -628,73 +1391,77 @@ WordId Vocabulary::transform
 void Vocabulary::transform(
         const cv::Mat& features, BowVector &v) const
 {
-    //    std::vector<cv::Mat> vf(features.rows);
-    //    for(int r=0;r<features.rows;r++) vf[r]=features.rowRange(r,r+1);
-    //    transform(vf,v);
-
-
+  v.clear();
 
-    v.clear();
+  if(empty())
+  {
+    return;
+  }
 
-    if(empty())
-    {
-        return;
-    }
+  // normalize
+  LNorm norm;
+  bool must = m_scoring_object->mustNormalize(norm);
 
-    // normalize
-    LNorm norm;
-    bool must = m_scoring_object->mustNormalize(norm);
+  std::vector<WordId> words;
+  std::vector<WordValue> weights;
+  quantize(features, words, weights);
+  addToBowVector(m_weighting, must, norm, words, weights, NULL, v, NULL);
+}
 
+// --------------------------------------------------------------------------
 
-    if(m_weighting == TF || m_weighting == TF_IDF)
-    {
-        for(int r=0;r<features.rows;r++)
-        {
-            WordId id;
-            WordValue w;
-            // w is the idf value if TF_IDF, 1 if TF
-            transform(features.row(r), id, w);
-            // not stopped
-            if(w > 0)  v.addWeight(id, w);
-        }
 
-        if(!v.empty() && !must)
-        {
-            // unnecessary when normalizing
-            const double nd = v.size();
-            for(BowVector::iterator vit = v.begin(); vit != v.end(); vit++)
-                vit->second /= nd;
-        }
+void Vocabulary::transform(
+  const std::vector<cv::Mat>& features, BowVector &v) const
+{
+  v.clear();
 
-    }
-    else // IDF || BINARY
-    {
-        for(int r=0;r<features.rows;r++)
-        {
-            WordId id;
-            WordValue w;
-            // w is idf if IDF, or 1 if BINARY
+  if(empty())
+  {
+    return;
+  }
 
-            transform(features.row(r), id, w);
+  // normalize
+  LNorm norm;
+  bool must = m_scoring_object->mustNormalize(norm);
 
-            // not stopped
-            if(w > 0) v.addIfNotExist(id, w);
+  std::vector<WordId> words(features.size());
+  std::vector<WordValue> weights(features.size());
 
-        } // if add_features
-    } // if m_weighting == ...
+  bool flat = true;
+  std::vector<const uchar*> rows(features.size());
+  for(size_t i = 0; i < features.size() && flat; i++)
+  {
+    flat = flatCompatible(features[i]);
+    rows[i] = features[i].data;
+  }
 
-    if(must) v.normalize(norm);
+  if(flat)
+  {
+    if(!rows.empty()) quantizeFlat(rows.data(), rows.size(), words.data(), NULL, 0);
+    for(size_t i = 0; i < words.size(); i++)
+      weights[i] = wordWeight(words[i]);
+  }
+  else
+  {
+    for(size_t i = 0; i < features.size(); i++)
+      transform(features[i], words[i], weights[i]);
+  }
 
+  addToBowVector(m_weighting, must, norm, words, weights, NULL, v, NULL);
 }
 
+// --------------------------------------------------------------------------
 
 
 void Vocabulary::transform(
-  const std::vector<cv::Mat>& features, BowVector &v) const
+  const std::vector<cv::Mat>& features,
+  BowVector &v, FeatureVector &fv, int levelsup) const
 {
   v.clear();
+  fv.clear();
 
-  if(empty())
+  if(empty()) // safe for subclasses
   {
     return;
   }
@@ -703,54 +1470,38 @@ void Vocabulary::transform(
   LNorm norm;
   bool must = m_scoring_object->mustNormalize(norm);
 
+  std::vector<WordId> words(features.size());
+  std::vector<WordValue> weights(features.size());
+  std::vector<NodeId> nids(features.size());
 
-  if(m_weighting == TF || m_weighting == TF_IDF)
+  bool flat = true;
+  std::vector<const uchar*> rows(features.size());
+  for(size_t i = 0; i < features.size() && flat; i++)
   {
-    for(auto fit = features.begin(); fit < features.end(); ++fit)
-    {
-      WordId id;
-      WordValue w;
-      // w is the idf value if TF_IDF, 1 if TF
-
-      transform(*fit, id, w);
-
-      // not stopped
-      if(w > 0) v.addWeight(id, w);
-    }
-
-    if(!v.empty() && !must)
-    {
-      // unnecessary when normalizing
-      const double nd = v.size();
-      for(BowVector::iterator vit = v.begin(); vit != v.end(); vit++)
-        vit->second /= nd;
-    }
+    flat = flatCompatible(features[i]);
+    rows[i] = features[i].data;
+  }
 
+  if(flat)
+  {
+    if(!rows.empty()) quantizeFlat(rows.data(), rows.size(), words.data(), nids.data(), levelsup);
+    for(size_t i = 0; i < words.size(); i++)
+      weights[i] = wordWeight(words[i]);
   }
-  else // IDF || BINARY
+  else
   {
-    for(auto fit = features.begin(); fit < features.end(); ++fit)
-    {
-      WordId id;
-      WordValue w;
-      // w is idf if IDF, or 1 if BINARY
-
-      transform(*fit, id, w);
-
-      // not stopped
-      if(w > 0) v.addIfNotExist(id, w);
-
-    } // if add_features
-  } // if m_weighting == ...
+    for(size_t i = 0; i < features.size(); i++)
+      transform(features[i], words[i], weights[i], &nids[i], levelsup);
+  }
 
-  if(must) v.normalize(norm);
+  addToBowVector(m_weighting, must, norm, words, weights, &nids, v, &fv);
 }
 
 // --------------------------------------------------------------------------
 
 
 void Vocabulary::transform(
-  const std::vector<cv::Mat>& features,
+  const cv::Mat& features,
   BowVector &v, FeatureVector &fv, int levelsup) const
 {
   v.clear();
@@ -765,56 +1516,112 @@ void Vocabulary::transform(
   LNorm norm;
   bool must = m_scoring_object->mustNormalize(norm);
 
+  std::vector<WordId> words;
+  std::vector<WordValue> weights;
+  std::vector<NodeId> nids;
+  quantize(features, words, weights, &nids, levelsup);
+  addToBowVector(m_weighting, must, norm, words, weights, &nids, v, &fv);
+}
 
-  if(m_weighting == TF || m_weighting == TF_IDF)
-  {
-    unsigned int i_feature = 0;
-    for(auto fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
-    {
-      WordId id;
-      NodeId nid;
-      WordValue w;
-      // w is the idf value if TF_IDF, 1 if TF
+// --------------------------------------------------------------------------
 
-      transform(*fit, id, w, &nid, levelsup);
 
-      if(w > 0) // not stopped
-      {
-        v.addWeight(id, w);
-        fv.addFeature(nid, i_feature);
-      }
-    }
+void Vocabulary::quantize(const cv::Mat &features, std::vector<WordId> &words,
+  std::vector<WordValue> &weights, std::vector<NodeId> *nids, int levelsup) const
+{
+  const int n = features.rows;
+  words.resize(n);
+  weights.resize(n);
+  if(nids) nids->resize(n);
+  if(n == 0 || empty()) return;
 
-    if(!v.empty() && !must)
+  if(m_flat_size == 0 || features.type() != m_flat_type || features.cols != m_flat_cols)
+  {
+    // descriptors the flat tree does not know, one row at a time
+    for(int r = 0; r < n; r++)
     {
-      // unnecessary when normalizing
-      const double nd = v.size();
-      for(BowVector::iterator vit = v.begin(); vit != v.end(); vit++)
-        vit->second /= nd;
+      if(nids)
+        transform(features.row(r), words[r], weights[r], &(*nids)[r], levelsup);
+      else
+        transform(features.row(r), words[r], weights[r]);
     }
-
+    return;
   }
-  else // IDF || BINARY
+
+  std::vector<const uchar*> rows(n);
+  for(int r = 0; r < n; r++) rows[r] = features.ptr<uchar>(r);
+
+  NodeId *pnids = nids ? nids->data() : NULL;
+  if(m_parallel_transform && n >= m_parallel_min_rows)
+    cv::parallel_for_(cv::Range(0, n),
+      ParallelQuantizer(*this, rows.data(), words.data(), pnids, levelsup));
+  else
+    quantizeFlat(rows.data(), n, words.data(), pnids, levelsup);
+
+  for(int r = 0; r < n; r++)
+    weights[r] = wordWeight(words[r]);
+}
+
+// --------------------------------------------------------------------------
+
+
+void Vocabulary::quantizeFlat(const uchar * const *rows, int n,
+  WordId *words, NodeId *nids, int levelsup) const
+{
+  // level at which the node must be stored in nids, if given
+  const int nid_level = m_L - levelsup;
+  const bool binary = m_flat_type == CV_8U;
+  const size_t step = m_flat_descriptors.step;
+  const size_t bytes = m_flat_cols * CV_ELEM_SIZE(m_flat_type);
+  const uchar *base = m_flat_descriptors.data;
+
+  // zero padded copy of the query, 8 byte aligned for the scalar kernel
+  std::vector<uint64_t> query(step / sizeof(uint64_t), 0);
+  uchar *q = (uchar*)query.data();
+  std::vector<uint32_t> dist_u(m_flat_max_children);
+  std::vector<double> dist_f(m_flat_max_children);
+
+  for(int r = 0; r < n; r++)
   {
-    unsigned int i_feature = 0;
-    for(auto fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
+    memcpy(q, rows[r], bytes);
+
+    uint32_t pos = 0; // root
+    int current_level = 0;
+    NodeId nid = 0;
+    bool nid_set = nid_level <= 0;
+
+    while(m_flat_nodes[pos].n_children > 0)
     {
-      WordId id;
-      NodeId nid;
-      WordValue w;
-      // w is idf if IDF, or 1 if BINARY
+      const FlatNode &node = m_flat_nodes[pos];
+      const uchar *block = base + node.first_child * step;
+      ++current_level;
 
-      transform(*fit, id, w, &nid, levelsup);
+      // the first child wins ties, as in the per-node transform
+      uint32_t best = 0;
+      if(binary)
+      {
+        hammingBlock(q, block, step, node.n_children, dist_u.data());
+        for(uint32_t i = 1; i < node.n_children; i++)
+          if(dist_u[i] < dist_u[best]) best = i;
+      }
+      else
+      {
+        l2Block(q, block, step, node.n_children, dist_f.data());
+        for(uint32_t i = 1; i < node.n_children; i++)
+          if(dist_f[i] < dist_f[best]) best = i;
+      }
+      pos = node.first_child + best;
 
-      if(w > 0) // not stopped
+      if(!nid_set && current_level == nid_level)
       {
-        v.addIfNotExist(id, w);
-        fv.addFeature(nid, i_feature);
+        nid = m_flat_nodes[pos].node_id;
+        nid_set = true;
       }
     }
-  } // if m_weighting == ...
 
-  if(must) v.normalize(norm);
+    words[r] = m_flat_nodes[pos].word_id;
+    if(nids) nids[r] = nid_set ? nid : m_flat_nodes[pos].node_id;
+  }
 }
 
 // --------------------------------------------------------------------------
@@ -836,6 +1643,15 @@ void Vocabulary::transform
 void Vocabulary::transform(const cv::Mat &feature,
   WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
 {
+  if(flatCompatible(feature))
+  {
+    const uchar *row = feature.data;
+    quantizeFlat(&row, 1, &word_id, nid, levelsup);
+    weight = wordWeight(word_id);
+    return;
+  }
+  checkMappedFeature(feature);
+
   // propagate the feature down the tree
 
 
@@ -878,6 +1694,15 @@ void Vocabulary::transform(const cv::Mat &feature,
 void Vocabulary::transform(const cv::Mat &feature,
   WordId &word_id, WordValue &weight ) const
 {
+  if(flatCompatible(feature))
+  {
+    const uchar *row = feature.data;
+    quantizeFlat(&row, 1, &word_id, NULL, 0);
+    weight = wordWeight(word_id);
+    return;
+  }
+  checkMappedFeature(feature);
+
   // propagate the feature down the tree
 
 
@@ -991,6 +1816,17 @@ void Vocabulary::transform(const cv::Mat &feature,
 NodeId Vocabulary::getParentNode
   (WordId wid, int levelsup) const
 {
+  if(m_mapping)
+  {
+    uint32_t pos = m_flat_word_pos[wid];
+    while(levelsup > 0 && pos != 0) // pos == 0 --> root
+    {
+      --levelsup;
+      pos = m_flat_nodes[pos].parent;
+    }
+    return m_flat_nodes[pos].node_id;
+  }
+
   NodeId ret = m_words[wid]->id; // node id
   while(levelsup > 0 && ret != 0) // ret == 0 --> root
   {
@@ -1008,6 +1844,30 @@ void Vocabulary::getWordsFromNode
 {
   words.clear();
 
+  if(m_mapping)
+  {
+    // the words under a node, in the same order as the m_nodes traversal
+    std::vector<uint32_t> parents(1, m_flat_node_pos[nid]);
+    if(m_flat_nodes[parents[0]].n_children == 0)
+    {
+      words.push_back(m_flat_nodes[parents[0]].word_id);
+      return;
+    }
+    while(!parents.empty())
+    {
+      const FlatNode &parent = m_flat_nodes[parents.back()];
+      parents.pop_back();
+      for(uint32_t c = parent.first_child; c < parent.first_child + parent.n_children; ++c)
+      {
+        if(m_flat_nodes[c].n_children == 0)
+          words.push_back(m_flat_nodes[c].word_id);
+        else
+          parents.push_back(c);
+      }
+    }
+    return;
+  }
+
   if(m_nodes[nid].isLeaf())
   {
     words.push_back(m_nodes[nid].word_id);
@@ -1046,6 +1906,8 @@ void Vocabulary::getWordsFromNode
 
 int Vocabulary::stopWords(double minWeight)
 {
+  if(m_mapping) unmap();
+
   int c = 0;
    for(auto wit = m_words.begin(); wit != m_words.end(); ++wit)
   {
@@ -1084,6 +1946,16 @@ void Vocabulary::load(const std::string &filename)
     //check first if it is a binary file
     std::ifstream ifile(filename,std::ios::binary);
     if (!ifile) throw std::runtime_error("Vocabulary::load Could not open file :"+filename+" for reading");
+    //files written by saveMapped are used in place
+    char magic[sizeof(kMappedMagic)]={0};
+    ifile.read(magic,sizeof(magic));
+    if (ifile && memcmp(magic,kMappedMagic,sizeof(magic))==0){
+        ifile.close();
+        loadMapped(filename);
+        return;
+    }
+    ifile.clear();
+    ifile.seekg(0,std::ios::beg);
     if(!load(ifile)) {
         if ( filename.find(".txt")!=std::string::npos) {
 	    load_fromtxt(filename);
@@ -1108,10 +1980,192 @@ bool Vocabulary::load(std::istream &ifile)
     return true;
 }
 
+// --------------------------------------------------------------------------
+
+
+void Vocabulary::saveMapped(const std::string &filename) const
+{
+  if(m_flat_size == 0)
+    throw std::runtime_error("Vocabulary::saveMapped the vocabulary is empty or its descriptors are not CV_8U/CV_32F rows");
+
+  // tables only mapped vocabularies keep
+  const uint32_t n_words = size();
+  uint32_t n_node_ids = 0;
+  for(uint32_t p = 0; p < m_flat_size; ++p)
+    n_node_ids = std::max(n_node_ids, (uint32_t)m_flat_nodes[p].node_id + 1);
+
+  std::vector<WordValue> weights(n_words);
+  std::vector<uint32_t> word_pos(n_words, 0);
+  std::vector<uint32_t> node_pos(n_node_ids, std::numeric_limits<uint32_t>::max());
+  for(uint32_t p = 0; p < m_flat_size; ++p)
+  {
+    const FlatNode &f = m_flat_nodes[p];
+    node_pos[f.node_id] = p;
+    if(p > 0 && f.n_children == 0) word_pos[f.word_id] = p;
+  }
+  for(uint32_t wid = 0; wid < n_words; ++wid)
+    weights[wid] = wordWeight(wid);
+
+  MappedVocHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, kMappedMagic, sizeof(h.magic));
+  h.version = kMappedVersion;
+  h.header_size = sizeof(MappedVocHeader);
+  h.k = m_k;
+  h.L = m_L;
+  h.scoring = m_scoring;
+  h.weighting = m_weighting;
+  h.desc_type = m_flat_type;
+  h.desc_cols = m_flat_cols;
+  h.desc_step = m_flat_descriptors.step;
+  h.max_children = m_flat_max_children;
+  h.n_nodes = m_flat_size;
+  h.n_words = n_words;
+  h.n_node_ids = n_node_ids;
+  h.nodes_offset = alignMapped(sizeof(MappedVocHeader));
+  h.weights_offset = alignMapped(h.nodes_offset + m_flat_size * sizeof(FlatNode));
+  h.word_pos_offset = alignMapped(h.weights_offset + n_words * sizeof(WordValue));
+  h.node_pos_offset = alignMapped(h.word_pos_offset + n_words * sizeof(uint32_t));
+  h.descriptors_offset = alignMapped(h.node_pos_offset + n_node_ids * sizeof(uint32_t));
+  h.file_size = h.descriptors_offset + (uint64_t)m_flat_size * h.desc_step;
+
+  std::vector<uchar> file(h.file_size, 0);
+  memcpy(&file[h.nodes_offset], m_flat_nodes, m_flat_size * sizeof(FlatNode));
+  memcpy(&file[h.weights_offset], weights.data(), n_words * sizeof(WordValue));
+  memcpy(&file[h.word_pos_offset], word_pos.data(), n_words * sizeof(uint32_t));
+  memcpy(&file[h.node_pos_offset], node_pos.data(), n_node_ids * sizeof(uint32_t));
+  for(uint32_t p = 0; p < m_flat_size; ++p)
+    memcpy(&file[h.descriptors_offset + (uint64_t)p * h.desc_step],
+      m_flat_descriptors.ptr<uchar>(p), h.desc_step);
+
+  h.checksum = checksum64(&file[sizeof(MappedVocHeader)],
+    file.size() - sizeof(MappedVocHeader));
+  memcpy(&file[0], &h, sizeof(h));
+
+  std::ofstream file_out(filename, std::ios::binary);
+  if (!file_out) throw std::runtime_error("Vocabulary::saveMapped Could not open file :"+filename+" for writing");
+  file_out.write((const char*)file.data(), file.size());
+  if (!file_out) throw std::runtime_error("Vocabulary::saveMapped Could not write file :"+filename);
+}
+
+// --------------------------------------------------------------------------
+
+
+void Vocabulary::loadMapped(const std::string &filename, bool verify_checksum)
+{
+  size_t size = 0;
+  std::shared_ptr<const uchar> mapping = mapFile(filename, size);
+  if(!mapping)
+    throw std::runtime_error("Vocabulary::loadMapped Could not map file :"+filename);
+
+  MappedVocHeader h;
+  memset(&h, 0, sizeof(h));
+  if(size >= sizeof(h)) memcpy(&h, mapping.get(), sizeof(h));
+  if(memcmp(h.magic, kMappedMagic, sizeof(h.magic)) != 0 ||
+     h.version != kMappedVersion || h.header_size != sizeof(MappedVocHeader))
+    throw std::runtime_error("Vocabulary::loadMapped "+filename+" is not a mapped vocabulary of version "+std::to_string(kMappedVersion));
+
+  const size_t elem = h.desc_type == CV_8U ? 1 : sizeof(float);
+  bool valid = h.file_size == size && h.n_nodes > 1 &&
+    (h.desc_type == CV_8U || h.desc_type == CV_32F) && h.desc_cols > 0 &&
+    h.desc_step % 32 == 0 && h.desc_step >= h.desc_cols * elem &&
+    inMappedRange(h.nodes_offset, (uint64_t)h.n_nodes * sizeof(FlatNode), size) &&
+    inMappedRange(h.weights_offset, (uint64_t)h.n_words * sizeof(WordValue), size) &&
+    inMappedRange(h.word_pos_offset, (uint64_t)h.n_words * sizeof(uint32_t), size) &&
+    inMappedRange(h.node_pos_offset, (uint64_t)h.n_node_ids * sizeof(uint32_t), size) &&
+    inMappedRange(h.descriptors_offset, (uint64_t)h.n_nodes * h.desc_step, size);
+  if(valid && verify_checksum)
+    valid = checksum64(mapping.get() + sizeof(h), size - sizeof(h)) == h.checksum;
+  if(!valid)
+    throw std::runtime_error("Vocabulary::loadMapped "+filename+" is truncated or corrupted");
+
+  // drops m_nodes and any previous mapping
+  m_nodes.clear();
+  m_words.clear();
+  buildFlatTree();
+
+  m_k = h.k;
+  m_L = h.L;
+  m_scoring = (ScoringType)h.scoring;
+  m_weighting = (WeightingType)h.weighting;
+  createScoringObject();
+
+  const uchar *base = mapping.get();
+  m_flat_nodes = (const FlatNode*)(base + h.nodes_offset);
+  m_flat_size = h.n_nodes;
+  m_flat_descriptors = cv::Mat(h.n_nodes, h.desc_step, CV_8U,
+    (void*)(base + h.descriptors_offset), h.desc_step);
+  m_flat_type = h.desc_type;
+  m_flat_cols = h.desc_cols;
+  m_flat_max_children = h.max_children;
+  m_flat_nwords = h.n_words;
+  m_flat_weights = (const WordValue*)(base + h.weights_offset);
+  m_flat_word_pos = (const uint32_t*)(base + h.word_pos_offset);
+  m_flat_node_pos = (const uint32_t*)(base + h.node_pos_offset);
+  m_flat_nnode_ids = h.n_node_ids;
+  m_mapping = mapping;
+}
+
+// --------------------------------------------------------------------------
+
+
+void Vocabulary::unmap()
+{
+  if(!m_mapping) return;
+
+  m_nodes.clear();
+  m_nodes.resize(m_flat_nnode_ids);
+  for(size_t i = 0; i < m_nodes.size(); ++i) m_nodes[i].id = i;
+
+  const size_t bytes = m_flat_cols * CV_ELEM_SIZE(m_flat_type);
+  for(uint32_t p = 0; p < m_flat_size; ++p)
+  {
+    const FlatNode &f = m_flat_nodes[p];
+    Node &node = m_nodes[f.node_id];
+    node.parent = m_flat_nodes[f.parent].node_id;
+    node.children.reserve(f.n_children);
+    for(uint32_t c = f.first_child; c < f.first_child + f.n_children; ++c)
+      node.children.push_back(m_flat_nodes[c].node_id);
+    if(p == 0) continue; // the root has no descriptor
+
+    node.descriptor.create(1, m_flat_cols, m_flat_type);
+    memcpy(node.descriptor.data, m_flat_descriptors.ptr<uchar>(p), bytes);
+    if(f.n_children == 0)
+    {
+      node.word_id = f.word_id;
+      node.weight = m_flat_weights[f.word_id];
+    }
+  }
+
+  m_words.resize(m_flat_nwords);
+  for(uint32_t wid = 0; wid < m_flat_nwords; ++wid)
+    m_words[wid] = &m_nodes[m_flat_nodes[m_flat_word_pos[wid]].node_id];
+
+  // rebuilt from m_nodes, releases the mapping
+  buildFlatTree();
+}
+
+// --------------------------------------------------------------------------
+
+
+void Vocabulary::checkMappedFeature(const cv::Mat &feature) const
+{
+  if(m_mapping && !flatCompatible(feature))
+    throw std::runtime_error("Vocabulary: a mapped vocabulary only transforms descriptors of its own type and size");
+}
+
+
 
 void Vocabulary::save(cv::FileStorage &f,
   const std::string &name) const
 {
+  if(m_mapping)
+  {
+    Vocabulary copy(*this);
+    copy.unmap();
+    copy.save(f, name);
+    return;
+  }
 
   f << name << "{";
 
@@ -1179,6 +2233,13 @@ void Vocabulary::save(cv::FileStorage &f,
 
 void Vocabulary::toStream(  std::ostream &out_str, bool compressed) const throw(std::exception){
 
+    if (m_mapping){
+        Vocabulary copy(*this);
+        copy.unmap();
+        copy.toStream(out_str, compressed);
+        return;
+    }
+
     uint64_t sig=88877711233;//magic number describing the file
     out_str.write((char*)&sig,sizeof(sig));
     out_str.write((char*)&compressed,sizeof(compressed));
@@ -1331,6 +2392,7 @@ void Vocabulary:: load_fromtxt(const std::string &filename)throw(std::runtime_er
                m_nodes[nid].children.reserve(m_k);
            }
        }
+       buildFlatTree();
 }
 void Vocabulary::fromStream(  std::istream &str )   throw(std::exception){
 
@@ -1403,6 +2465,7 @@ void Vocabulary::fromStream(  std::istream &str )   throw(std::exception){
         m_nodes[nid].word_id = wid;
         m_words[wid] = &m_nodes[nid];
     }
+    buildFlatTree();
 }
 // --------------------------------------------------------------------------
 
@@ -1457,6 +2520,7 @@ void Vocabulary::load(const cv::FileStorage &fs,
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+  buildFlatTree();
 }
 
 // --------------------------------------------------------------------------
@@ -1505,15 +2569,17 @@ void Vocabulary::clear(){
     m_scoring_object=0;
     m_nodes.clear();
     m_words.clear();
-
+    buildFlatTree();
 }
 int Vocabulary::getDescritorSize()const
 {
+    if (m_mapping) return m_flat_cols;
     if (m_words.size()==0)return -1;
     else return m_words[0]->descriptor.cols;
 }
 int Vocabulary::getDescritorType()const{
 
+    if (m_mapping) return m_flat_type;
     if (m_words.size()==0)return -1;
     else return m_words[0]->descriptor.type();
 }
@@ -21,6 +21,8 @@ namespace ygz {
     // forward declare
     class Tracker;
 
+    class Viewer;
+
     class BackendSlidingWindowG2O : public BackendInterface {
 
     public:
@@ -33,6 +35,11 @@ namespace ygz {
         // the main loop thread
         void MainLoop();
 
+        // 局部BA之后向Viewer发布关键帧和地图点
+        void SetViewer(shared_ptr<Viewer> viewer) {
+            mpViewer = viewer;
+        }
+
         // 插入新关键帧
         virtual int InsertKeyFrame(shared_ptr<Frame> newKF) override;
 
@@ -203,6 +210,7 @@ namespace ygz {
 
     private:
         shared_ptr<Tracker> mpTracker = nullptr; // Tracker指针，需要向Tracker通报一些状态
+        shared_ptr<Viewer> mpViewer = nullptr;      // 可为空
         shared_ptr<Frame> mpCurrent = nullptr;      // 当前正处理的帧
 
         bool mbFirstCall = true;
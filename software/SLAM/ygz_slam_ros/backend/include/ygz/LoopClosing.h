@@ -11,6 +11,7 @@
 #include <ygz/Frame.h>
 //#include <ygz/CeresHelper.h>
 #include <ygz/utility.h>
+#include <ygz/PoseGraph4DoF.h>
 
 //#include <DBoW2/BowVector.h>
 //#include <DBoW2/FeatureVector.h>
@@ -51,8 +52,11 @@ namespace ygz{
     void addKeyFrame(shared_ptr<Frame> pFrame, bool flag_detect_loop);
 
     shared_ptr<Frame> getFrame(size_t index);
+
+    shared_ptr<Frame> getFrameByIndex(size_t index);
     
-//     void optimized4DoF();
+    // pose graph thread: solves the part of the graph touched by new loops and moves the frames
+    void optimized4DoF();
     
 //     shared_ptr<Frame> mpCurrentKF = nullptr;
 //     
@@ -76,6 +80,12 @@ namespace ygz{
     
     list<shared_ptr<Frame> > mFrameList;
     
+    // frames by index, so the pose graph result is applied without walking mFrameList
+    vector<shared_ptr<Frame> > mFramesByIndex;
+    
+    // 4-DoF pose graph, nodes are indexed like Frame::index
+    PoseGraph4DoF mPoseGraph;
+    
     std::mutex m_optimize_buf;
     std::mutex m_framelist;
     
@@ -0,0 +1,153 @@
+#ifndef YGZ_POSE_GRAPH_4DOF_H
+#define YGZ_POSE_GRAPH_4DOF_H
+
+#include <Eigen/Core>
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+#include <Eigen/Sparse>
+
+#include <vector>
+#include <mutex>
+
+/**
+ * Incremental 4-DoF (x, y, z, yaw) pose graph for loop closing.
+ *
+ * Pitch and roll are observable from the IMU, so they are kept at their VIO values and only
+ * translation and yaw are optimized, the same model as VINS-Mono's FourDOFError.
+ * Angles are in degrees, like Utility::R2ypr / Utility::ypr2R.
+ *
+ * Nodes and sequential edges are appended as keyframes arrive and loop edges when a loop is
+ * verified. Optimize() only re-solves the window between the oldest frame of the pending loops
+ * and the newest looped frame. Everything older than the window stays fixed and only enters
+ * through the edges that cross the boundary, so the cost of a loop event depends on the loop
+ * length and not on the trajectory length. Frames newer than the window are moved by a single
+ * yaw/translation drift, and only the touched nodes are reported back through TakeChanged().
+ *
+ * All public methods are thread safe; the linear solve runs without holding the lock so the
+ * tracker can keep adding nodes while a loop is being optimized.
+ */
+
+namespace ygz {
+
+    class PoseGraph4DoF {
+
+    public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+
+        struct Options {
+            int sequentialEdges = 4;        // each new node is connected to this many previous nodes
+            int maxIterations = 5;          // gauss-newton iterations per solve
+            double huberDelta = 0.1;        // robust kernel on loop edges
+            double loopYawScale = 0.1;      // yaw residual scale of loop edges (FourDOFWeightError)
+            bool incremental = true;        // false: re-solve from the earliest loop ever seen
+        };
+
+        struct SolveStats {
+            size_t windowStart = 0;         // first (fixed) node of the solved window
+            size_t windowSize = 0;          // nodes in the window, including the fixed one
+            size_t numEdges = 0;            // residual blocks in the problem
+            size_t numChanged = 0;          // nodes whose pose was rewritten
+            int iterations = 0;
+            double initialCost = 0;
+            double finalCost = 0;
+        };
+
+        PoseGraph4DoF();
+
+        explicit PoseGraph4DoF(const Options &options);
+
+        /**
+         * add a keyframe with its VIO pose
+         * @param Rwb VIO rotation
+         * @param twb VIO translation
+         * @param sequence frames of different sequences are not connected by sequential edges
+         * @return index of the node, indices are consecutive from 0
+         */
+        size_t AddNode(const Eigen::Matrix3d &Rwb, const Eigen::Vector3d &twb, int sequence = 1);
+
+        /**
+         * add a verified loop between two nodes
+         * @param oldIndex the older node
+         * @param curIndex the newer node
+         * @param relativeT translation of cur expressed in old (Frame::getLoopRelativeT)
+         * @param relativeYaw yaw of cur relative to old, degrees (Frame::getLoopRelativeYaw)
+         */
+        void AddLoopEdge(size_t oldIndex, size_t curIndex, const Eigen::Vector3d &relativeT, double relativeYaw);
+
+        // true if loop edges were added since the last Optimize()
+        bool HasPendingLoop();
+
+        // solve the window affected by the pending loops, return false if there is nothing to do
+        bool Optimize(SolveStats *stats = nullptr);
+
+        // corrected pose of a node
+        void GetPose(size_t index, Eigen::Matrix3d &Rwb, Eigen::Vector3d &twb);
+
+        // nodes whose corrected pose changed since the last call, in increasing order
+        std::vector<size_t> TakeChanged();
+
+        // current yaw (degrees) / translation drift between VIO and the corrected frame
+        void GetDrift(double &yaw, Eigen::Vector3d &t);
+
+        size_t Size();
+
+    private:
+        struct Node {
+            EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+            Eigen::Vector3d t;              // corrected translation
+            double yaw = 0;                 // corrected yaw
+            double pitch = 0, roll = 0;     // fixed, from VIO
+            Eigen::Vector3d vioT;           // VIO translation
+            double vioYaw = 0;              // VIO yaw
+            int sequence = 1;
+            bool changed = false;
+            std::vector<size_t> edges;      // sequential and loop edges where this node is the newer one
+        };
+
+        struct Edge {
+            EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+            size_t from = 0;                // older node
+            size_t to = 0;                  // newer node
+            Eigen::Vector3d t;              // translation of 'to' in the frame of 'from'
+            double yaw = 0;                 // relative yaw
+            bool loop = false;
+        };
+
+        // problem state of one node inside the window
+        struct WindowNode {
+            EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+            Eigen::Vector3d t;
+            double yaw, pitch, roll;
+            int var;                        // column block in the linear system, -1 if fixed
+        };
+
+        // gather the problem under the lock, solve it without and write it back
+        void SolveWindow(size_t start, size_t end, SolveStats &stats);
+
+        // accumulate one edge into the normal equations and return its (robust) cost
+        double LinearizeEdge(const Edge &e, const WindowNode &from, const WindowNode &to,
+                             std::vector<Eigen::Triplet<double>> *triplets, Eigen::VectorXd *b) const;
+
+        void MarkChanged(size_t index);
+
+        Options mOptions;
+
+        std::mutex mMutex;
+        std::vector<Node, Eigen::aligned_allocator<Node>> mNodes;
+        std::vector<Edge, Eigen::aligned_allocator<Edge>> mEdges;
+
+        bool mHasLoop = false;
+        size_t mEarliestLoop = 0;       // oldest node ever referenced by a loop
+        size_t mPendingStart = 0;       // oldest node of the loops waiting for a solve
+        size_t mPendingEnd = 0;         // newest node of the loops waiting for a solve
+        bool mPending = false;
+
+        size_t mLastSolvedEnd = 0;      // nodes after this one follow the drift
+        double mDriftYaw = 0;
+        Eigen::Vector3d mDriftT = Eigen::Vector3d::Zero();
+
+        std::vector<size_t> mChanged;
+    };
+}
+
+#endif
@@ -3,8 +3,10 @@
 #include "ygz/Frame.h"
 #include "ygz/BackendSlidingWindowG2O.h"
 #include "ygz/Tracker.h"
+#include "ygz/Viewer.h"
 #include "ygz/ORBMatcher.h"
 #include "ygz/Camera.h"
+#include "ygz/Trace.h"
 
 // g2o related
 #include "ygz/G2OTypes.h"
@@ -23,6 +25,7 @@ namespace ygz {
 
     void BackendSlidingWindowG2O::MainLoop() {
 
+        trace::SetThreadName("Backend");
         mbFinished = false;
         while (1) {
 
@@ -60,6 +63,7 @@ namespace ygz {
     }
 
     void BackendSlidingWindowG2O::ProcessNewKeyFrame() {
+        YGZ_TRACE_ZONE("Backend::ProcessNewKeyFrame");
         {
             unique_lock<mutex> lock(mMutexNewKFs);
             mpCurrent = mpNewKFs.front();
@@ -133,6 +137,8 @@ namespace ygz {
         LOG(INFO) << "new good points: " << cntSetGood << " in total immature points: " << cntImmature << endl;
         if (mpKFs.size() == 1) {
             // don't need BA
+            if (mpViewer)
+                mpViewer->PublishMap();
             return;
         }
 
@@ -163,6 +169,9 @@ namespace ygz {
         // 清理不好的地图点
         CleanMapPoint();
         LOG(INFO) << "Backend KF: " << mpKFs.size() << ", map points: " << mpPoints.size() << endl;
+
+        if (mpViewer)
+            mpViewer->PublishMap();
     }
 
     // 外部插新KF的接口
@@ -429,6 +438,7 @@ namespace ygz {
     }
 
     void BackendSlidingWindowG2O::LocalBAXYZWithoutIMU(bool verbose) {
+        YGZ_TRACE_ZONE("Backend::LocalBAXYZWithoutIMU");
 
         LOG(INFO) << "Calling Local BA XYZ without IMU" << endl;
 
@@ -645,6 +655,7 @@ namespace ygz {
     }
 
     void BackendSlidingWindowG2O::LocalBAWithoutIMU(bool verbose) {
+        YGZ_TRACE_ZONE("Backend::LocalBAWithoutIMU");
         // Bundle adjustment without IMU
         // TODO 考虑优化对于地图点的影响，包括把哪些setbad，对margin掉的点怎么做之类
         LOG(INFO) << "Calling Local BA without IMU" << endl;
@@ -934,6 +945,7 @@ namespace ygz {
     }
 
     void BackendSlidingWindowG2O::LocalBAWithIMU(bool verbose) {
+        YGZ_TRACE_ZONE("Backend::LocalBAWithIMU");
         // Bundle adjustment with IMU
         LOG(INFO) << "Call local ba with imu" << endl;
 
@@ -1363,6 +1375,7 @@ namespace ygz {
     }
 
     void BackendSlidingWindowG2O::LocalBAXYZWithIMU(bool verbose) {
+        YGZ_TRACE_ZONE("Backend::LocalBAXYZWithIMU");
 
         // Bundle adjustment with IMU
         LOG(INFO) << "Call local ba XYZ with imu" << endl;
@@ -1,4 +1,5 @@
 #include <ygz/LoopClosing.h>
+#include <ygz/Trace.h>
 
 
 namespace ygz {
@@ -141,197 +142,62 @@ namespace ygz {
     }
     
     
-    /*
+    //given frame index, retrieve correspoding frame in O(1)
+    shared_ptr<Frame> LoopClosing::getFrameByIndex(size_t index)
+    {
+        unique_lock<mutex> lock(m_framelist);
+        if (index < mFramesByIndex.size())
+            return mFramesByIndex[index];
+        return NULL;
+    }
+    
+    
     void LoopClosing::optimized4DoF()
     {
         cout<<"Loop Clsoing:: optimize 4dof initialized!"<<endl;
+        trace::SetThreadName("LoopClosing");
         
         while(true)
         {
             int cur_index = -1;
-            int first_looped_index = -1;
             m_optimize_buf.lock();
             while(!optimize_buf.empty())
             {
-                //frame index in the buf
+                //frame index in the buf, the pose graph keeps track of the affected range itself
                 cur_index = optimize_buf.front();
-                first_looped_index = earliest_loop_index;
                 optimize_buf.pop();
             }
             m_optimize_buf.unlock();
             
-            //if current_idx remain the same
             if(cur_index != -1)
             {
-                cout<<"optimize pose graph"<<endl;
-                m_framelist.lock();
-                shared_ptr<Frame> curFrame = getFrame(cur_index);
-                
-                // we have the current index of the frame
-                int max_length = cur_index + 1;
-                
-                //initialize translation array
-                double t_array[max_length][3];
-                
-                //initialize Quaternion array
-                Quaterniond q_array[max_length];
-                
-                //initialize euler array
-                double euler_array[max_length];
-                
-                //initialize sequence array
-                double sequence_array[max_length];
-                
-                //------------------------ceres---------------------------
-                ceres::Problem problem;
-                ceres::Solver::Options options;
-                options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
-                //options.minimizer_progress_to_stdout = true;
-                //options.max_solver_time_in_seconds = SOLVER_TIME * 3;
-                options.max_num_iterations = 5;
-                ceres::Solver::Summary summary;
-                ceres::LossFunction *loss_function;
-                loss_function = new ceres::HuberLoss(0.1);
-                //loss_function = new ceres::CauchyLoss(1.0);
-                ceres::LocalParameterization* angle_local_parameterization = AngleLocalParameterization::Create();
-                
-                list<shared_ptr<Frame> >::iterator it;
-                int i = 0;
-                for (it = mFrameList.begin(); it != mFrameList.end(); it++)
+                YGZ_TRACE_ZONE("LoopClosing::Optimize4DoF");
+                // only the frames between the oldest pending loop frame and the newest looped frame are solved,
+                // the frames added meanwhile follow the new drift
+                PoseGraph4DoF::SolveStats stats;
+                if (mPoseGraph.Optimize(&stats))
                 {
-                    if ((*it)->index < first_looped_index)
-                        continue;
-                    (*it)->local_index = i;
-                    
-                    Quaterniond tmp_q;
-                    Matrix3d tmp_r;
-                    Vector3d tmp_t;
-                    
-                    tmp_t = (*it)->Rwb();
-                    tmp_r = (*it)->Twb();
-                    tmp_q = tmp_r;
-                    
-                    t_array[i][0] = tmp_t(0);
-                    t_array[i][1] = tmp_t(1);
-                    t_array[i][2] = tmp_t(2);
-                    q_array[i] = tmp_q;
-                    
-                    Vector3d euler_angle = Utility::R2ypr(tmp_q.toRotationMatrix());
-                    euler_array[i][0] = euler_angle.x();
-                    euler_array[i][1] = euler_angle.y();
-                    euler_array[i][2] = euler_angle.z();
-                    
-                    sequence_array[i] = (*it)->sequence;
-                    
-                    problem.AddParameterBlock(euler_array[i], 1, angle_local_parameterization);
-                    problem.AddParameterBlock(t_array[i], 3);
-                    
-                    if ((*it)->index == first_looped_index || (*it)->sequence == 0)
-                    {
-                        problem.SetParameterBlockConstant(euler_array[i]);
-                        problem.SetParameterBlockConstant(t_array[i]);
-                    }
-                     
-                     
-                    //Dont know what it is
-                    for (int j = 1; j < 5; j++)
-                    {
-                        if (i - j >= 0 && sequence_array[i] == sequence_array[i-j])
-                        {
-                            Vector3d euler_conncected = Utility::R2ypr(q_array[i-j].toRotationMatrix());
-                            Vector3d relative_t(t_array[i][0] - t_array[i-j][0], t_array[i][1] - t_array[i-j][1], t_array[i][2] - t_array[i-j][2]);
-                            relative_t = q_array[i-j].inverse() * relative_t;
-                            double relative_yaw = euler_array[i][0] - euler_array[i-j][0];
-                            ceres::CostFunction* cost_function = FourDOFError::Create( relative_t.x(), relative_t.y(), relative_t.z(),
-                                                        relative_yaw, euler_conncected.y(), euler_conncected.z());
-                            problem.AddResidualBlock(cost_function, NULL, euler_array[i-j], 
-                                                    t_array[i-j], 
-                                                    euler_array[i], 
-                                                    t_array[i]);
-                        }
-                    }
-                    
-                    //add loop edge
-                    if((*it)->has_loop)
-                    {
-                        assert((*it)->loop_index >= first_looped_index);
-                        int connected_index = getFrame((*it)->loop_index)->local_index;
-                        Vector3d euler_conncected = Utility::R2ypr(q_array[connected_index].toRotationMatrix());
-                        Vector3d relative_t;
-                        relative_t = (*it)->getLoopRelativeT();
-                        double relative_yaw = (*it)->getLoopRelativeYaw();
-                        
-                        ceres::CostFunction* cost_function = FourDOFWeightError::Create( relative_t.x(), relative_t.y(), relative_t.z(),
-                                                                                relative_yaw, euler_conncected.y(), euler_conncected.z());
-                        problem.AddResidualBlock(cost_function, loss_function, euler_array[connected_index], 
-                                                                    t_array[connected_index], 
-                                                                    euler_array[i], 
-                                                                    t_array[i]);
-                        
-                    }
-                    
-                    if ((*it)->index == cur_index)
-                        break;
-                    i++;
+                    cout<<"optimize pose graph, window "<<stats.windowStart<<" + "<<stats.windowSize
+                        <<", edges "<<stats.numEdges<<", cost "<<stats.initialCost<<" -> "<<stats.finalCost<<endl;
                 }
-                m_keyframelist.unlock();
-                
-                ceres::Solve(options, &problem, &summary);
-                std::cout << summary.BriefReport() << "\n";
                 
-                m_keyframelist.lock();
-                i = 0;
-                for (it = mFrameList.begin(); it != mFrameList.end(); it++)
+                // apply the correction only to the frames that actually moved
+                for (size_t index : mPoseGraph.TakeChanged())
                 {
-                    if ((*it)->index < first_looped_index)
+                    shared_ptr<Frame> frame = getFrameByIndex(index);
+                    if (frame == NULL)
                         continue;
-                    Quaterniond tmp_q;
-                    tmp_q = Utility::ypr2R(Vector3d(euler_array[i][0], euler_array[i][1], euler_array[i][2]));
-                    Vector3d tmp_t = Vector3d(t_array[i][0], t_array[i][1], t_array[i][2]);
-                    Matrix3d tmp_r = tmp_q.toRotationMatrix();
-                    (*it)-> SetPose(tmp_t, tmp_r);
-
-                    if ((*it)->index == cur_index)
-                        break;
-                    i++;
+                    Matrix3d R;
+                    Vector3d t;
+                    mPoseGraph.GetPose(index, R, t);
+                    frame->SetPose(R, t);
                 }
-                
-                Vector3d cur_t, vio_t;
-                Matrix3d cur_r, vio_r;
-                
-                cur_t = curFrame->Twb;
-                cur_r = curFrame->Rwb;
-                
-                //vio_T_w_i here is the relative translation between two consecutive frames in the window
-                //and once loopclosure is finished it should change the these values in the window
-//                 m_drift.lock();
-//                 yaw_drift = Utility::R2ypr(cur_r).x() - Utility::R2ypr(vio_r).x();
-//                 r_drift = Utility::ypr2R(Vector3d(yaw_drift, 0, 0));
-//                 t_drift = cur_t - r_drift * vio_t;
-//                 m_drift.unlock();
-//                 //cout << "t_drift " << t_drift.transpose() << endl;
-//                 //cout << "r_drift " << Utility::R2ypr(r_drift).transpose() << endl;
-//                 //cout << "yaw drift " << yaw_drift << endl;
-// 
-//                 it++;
-//                 for (; it != keyframelist.end(); it++)
-//                 {
-//                     Vector3d P;
-//                     Matrix3d R;
-//                     (*it)->getVioPose(P, R);
-//                     P = r_drift * P + t_drift;
-//                     R = r_drift * R;
-//                     (*it)->updatePose(P, R);
-//                 }
-//                 m_keyframelist.unlock();
-//                 updatePath();
-            
             }
             
+            std::chrono::milliseconds dura(2000);
+            std::this_thread::sleep_for(dura);
         }
-        
-        
-    }*/
+    }
     
     
     
@@ -343,10 +209,14 @@ namespace ygz {
         pFrame->index = global_index;
         global_index ++;
         
+        // node index == frame index
+        mPoseGraph.AddNode(R_cur, P_cur);
+        
         int loop_index = -1;
         
         if (detect_loop)
         {   
+            YGZ_TRACE_ZONE("LoopClosing::DetectLoop");
             loop_index = DetectLoop(pFrame, pFrame->index);
         }
         else
@@ -364,8 +234,19 @@ namespace ygz {
             shared_ptr<Frame> old_kf = getFrame(loop_index);
             
             // WHAT THE FUCK THAT'S A LOT OF WORK TO DO
-            if (pFrame->findConnection(old_kf))
+            bool connected;
+            {
+                YGZ_TRACE_ZONE("LoopClosing::FindConnection");
+                connected = pFrame->findConnection(old_kf);
+            }
+            if (connected)
             {
+                mPoseGraph.AddLoopEdge(loop_index, pFrame->index, pFrame->getLoopRelativeT(), pFrame->getLoopRelativeYaw());
+                
+                m_optimize_buf.lock();
+                optimize_buf.push(pFrame->index);
+                m_optimize_buf.unlock();
+                
 //                 if (earliest_loop_index > loop_index || earliest_loop_index == -1)
 //                 {
 //                     earliest_loop_index = loop_index;
@@ -451,7 +332,10 @@ namespace ygz {
             
         }
         
+        m_framelist.lock();
         mFrameList.push_back(pFrame);
+        mFramesByIndex.push_back(pFrame);
+        m_framelist.unlock();
     }
      
      
@@ -0,0 +1,339 @@
+#include "ygz/PoseGraph4DoF.h"
+#include "ygz/utility.h"
+
+#include <Eigen/SparseCholesky>
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+using namespace std;
+using namespace Eigen;
+
+namespace ygz {
+
+    namespace {
+
+        // rotation of a pure yaw, degrees
+        inline Matrix3d YawRotation(double yaw) {
+            return Utility::ypr2R(Vector3d(yaw, 0, 0));
+        }
+
+        // derivative of Rz(yaw)^T with respect to yaw in degrees
+        inline Matrix3d YawRotationTransposeDerivative(double yaw) {
+            const double k = M_PI / 180.0;
+            const double c = cos(yaw * k), s = sin(yaw * k);
+            Matrix3d d;
+            d << -s, c, 0,
+                -c, -s, 0,
+                0, 0, 0;
+            return d * k;
+        }
+    }
+
+    PoseGraph4DoF::PoseGraph4DoF() : mOptions() {}
+
+    PoseGraph4DoF::PoseGraph4DoF(const Options &options) : mOptions(options) {}
+
+    size_t PoseGraph4DoF::AddNode(const Matrix3d &Rwb, const Vector3d &twb, int sequence) {
+        unique_lock<mutex> lock(mMutex);
+
+        Vector3d ypr = Utility::R2ypr(Rwb);
+        Node node;
+        node.vioT = twb;
+        node.vioYaw = ypr[0];
+        node.pitch = ypr[1];
+        node.roll = ypr[2];
+        node.sequence = sequence;
+
+        // new nodes follow the latest drift estimate
+        node.yaw = Utility::normalizeAngle(node.vioYaw + mDriftYaw);
+        node.t = YawRotation(mDriftYaw) * twb + mDriftT;
+
+        size_t index = mNodes.size();
+
+        // sequential edges come from the VIO poses, they are invariant to the drift correction
+        Matrix3d Rcur = Utility::ypr2R(ypr);
+        for (int k = 1; k <= mOptions.sequentialEdges && (size_t) k <= index; k++) {
+            const Node &prev = mNodes[index - k];
+            if (prev.sequence != sequence)
+                continue;
+            Matrix3d Rprev = Utility::ypr2R(Vector3d(prev.vioYaw, prev.pitch, prev.roll));
+            Edge e;
+            e.from = index - k;
+            e.to = index;
+            e.t = Rprev.transpose() * (twb - prev.vioT);
+            e.yaw = Utility::normalizeAngle(Utility::R2ypr(Rcur)[0] - prev.vioYaw);
+            e.loop = false;
+            node.edges.push_back(mEdges.size());
+            mEdges.push_back(e);
+        }
+
+        mNodes.push_back(node);
+        MarkChanged(index);
+        return index;
+    }
+
+    void PoseGraph4DoF::AddLoopEdge(size_t oldIndex, size_t curIndex, const Vector3d &relativeT, double relativeYaw) {
+        unique_lock<mutex> lock(mMutex);
+        assert(oldIndex < curIndex && curIndex < mNodes.size());
+
+        Edge e;
+        e.from = oldIndex;
+        e.to = curIndex;
+        e.t = relativeT;
+        e.yaw = relativeYaw;
+        e.loop = true;
+        mNodes[curIndex].edges.push_back(mEdges.size());
+        mEdges.push_back(e);
+
+        if (!mHasLoop || oldIndex < mEarliestLoop)
+            mEarliestLoop = oldIndex;
+        mHasLoop = true;
+
+        if (!mPending) {
+            mPendingStart = oldIndex;
+            mPendingEnd = curIndex;
+            mPending = true;
+        } else {
+            mPendingStart = min(mPendingStart, oldIndex);
+            mPendingEnd = max(mPendingEnd, curIndex);
+        }
+    }
+
+    bool PoseGraph4DoF::HasPendingLoop() {
+        unique_lock<mutex> lock(mMutex);
+        return mPending;
+    }
+
+    bool PoseGraph4DoF::Optimize(SolveStats *stats) {
+        size_t start, end;
+        {
+            unique_lock<mutex> lock(mMutex);
+            if (!mPending)
+                return false;
+            start = mOptions.incremental ? mPendingStart : mEarliestLoop;
+            end = mPendingEnd;
+            mPending = false;
+        }
+
+        SolveStats s;
+        SolveWindow(start, end, s);
+        if (stats)
+            *stats = s;
+        return true;
+    }
+
+    double PoseGraph4DoF::LinearizeEdge(const Edge &e, const WindowNode &from, const WindowNode &to,
+                                        vector<Triplet<double>> *triplets, VectorXd *b) const {
+        // residual of 'to' seen from 'from', pitch and roll of 'from' are fixed
+        Matrix3d Rpr = Utility::ypr2R(Vector3d(0, from.pitch, from.roll));
+        Matrix3d RzT = YawRotation(from.yaw).transpose();
+        Vector3d d = to.t - from.t;
+        double yawScale = e.loop ? mOptions.loopYawScale : 1.0;
+
+        Matrix<double, 4, 1> r;
+        r.head<3>() = Rpr.transpose() * RzT * d - e.t;
+        r[3] = Utility::normalizeAngle(to.yaw - from.yaw - e.yaw) * yawScale;
+
+        // robust kernel on loop edges only, sequential edges are trusted
+        double e2 = r.squaredNorm();
+        double w = 1.0, cost = e2;
+        if (e.loop) {
+            double en = sqrt(e2);
+            if (en > mOptions.huberDelta) {
+                w = mOptions.huberDelta / en;
+                cost = 2 * mOptions.huberDelta * en - mOptions.huberDelta * mOptions.huberDelta;
+            }
+        }
+
+        if (triplets == nullptr)
+            return cost;
+
+        Matrix4d Jfrom = Matrix4d::Zero(), Jto = Matrix4d::Zero();
+        Matrix3d A = Rpr.transpose() * RzT;
+        Jto.block<3, 3>(0, 0) = A;
+        Jto(3, 3) = yawScale;
+        Jfrom.block<3, 3>(0, 0) = -A;
+        Jfrom.block<3, 1>(0, 3) = Rpr.transpose() * YawRotationTransposeDerivative(from.yaw) * d;
+        Jfrom(3, 3) = -yawScale;
+
+        const Matrix4d *J[2] = {&Jfrom, &Jto};
+        int var[2] = {from.var, to.var};
+        for (int a = 0; a < 2; a++) {
+            if (var[a] < 0)
+                continue;
+            b->segment<4>(4 * var[a]) += w * J[a]->transpose() * r;
+            for (int c = 0; c < 2; c++) {
+                if (var[c] < 0)
+                    continue;
+                Matrix4d H = w * J[a]->transpose() * (*J[c]);
+                for (int i = 0; i < 4; i++)
+                    for (int j = 0; j < 4; j++)
+                        triplets->emplace_back(4 * var[a] + i, 4 * var[c] + j, H(i, j));
+            }
+        }
+        return cost;
+    }
+
+    void PoseGraph4DoF::SolveWindow(size_t start, size_t end, SolveStats &stats) {
+        vector<WindowNode, aligned_allocator<WindowNode>> window;
+        unordered_map<size_t, WindowNode> boundary;     // fixed nodes older than the window
+        vector<Edge, aligned_allocator<Edge>> edges;
+        int numVars = 0;
+
+        // 1. copy the affected part of the graph
+        {
+            unique_lock<mutex> lock(mMutex);
+            window.resize(end - start + 1);
+            for (size_t i = start; i <= end; i++) {
+                const Node &n = mNodes[i];
+                WindowNode &w = window[i - start];
+                w.t = n.t;
+                w.yaw = n.yaw;
+                w.pitch = n.pitch;
+                w.roll = n.roll;
+                // the oldest node anchors the window, sequence 0 is a prior map
+                w.var = (i == start || n.sequence == 0) ? -1 : numVars++;
+
+                if (i == start)
+                    continue;
+                for (size_t ei: n.edges) {
+                    const Edge &e = mEdges[ei];
+                    if (e.from < start && boundary.count(e.from) == 0) {
+                        const Node &o = mNodes[e.from];
+                        WindowNode &bw = boundary[e.from];
+                        bw.t = o.t;
+                        bw.yaw = o.yaw;
+                        bw.pitch = o.pitch;
+                        bw.roll = o.roll;
+                        bw.var = -1;
+                    }
+                    edges.push_back(e);
+                }
+            }
+        }
+
+        stats.windowStart = start;
+        stats.windowSize = window.size();
+        stats.numEdges = edges.size();
+
+        auto nodeOf = [&](size_t index) -> WindowNode & {
+            return index < start ? boundary[index] : window[index - start];
+        };
+
+        // 2. gauss-newton on the window
+        if (numVars > 0) {
+            SparseMatrix<double> H(4 * numVars, 4 * numVars);
+            VectorXd b(4 * numVars);
+            vector<Triplet<double>> triplets;
+            triplets.reserve(edges.size() * 64 + 4 * numVars);
+            SimplicialLDLT<SparseMatrix<double>> solver;
+            bool analyzed = false;
+
+            for (int iter = 0; iter < mOptions.maxIterations; iter++) {
+                triplets.clear();
+                b.setZero();
+                double cost = 0;
+                for (const Edge &e: edges)
+                    cost += LinearizeEdge(e, nodeOf(e.from), nodeOf(e.to), &triplets, &b);
+                if (iter == 0)
+                    stats.initialCost = cost;
+
+                // tiny damping keeps nodes without any edge from making the system singular
+                for (int i = 0; i < 4 * numVars; i++)
+                    triplets.emplace_back(i, i, 1e-9);
+                H.setFromTriplets(triplets.begin(), triplets.end());
+
+                // the sparsity pattern does not change between iterations
+                if (!analyzed) {
+                    solver.analyzePattern(H);
+                    analyzed = true;
+                }
+                solver.factorize(H);
+                if (solver.info() != Success)
+                    break;
+                VectorXd dx = solver.solve(-b);
+                stats.iterations = iter + 1;
+
+                for (WindowNode &w: window) {
+                    if (w.var < 0)
+                        continue;
+                    w.t += dx.segment<3>(4 * w.var);
+                    w.yaw = Utility::normalizeAngle(w.yaw + dx[4 * w.var + 3]);
+                }
+                if (dx.lpNorm<Infinity>() < 1e-6)
+                    break;
+            }
+        }
+
+        double cost = 0;
+        for (const Edge &e: edges)
+            cost += LinearizeEdge(e, nodeOf(e.from), nodeOf(e.to), nullptr, nullptr);
+        stats.finalCost = cost;
+
+        // 3. write back the window and move everything newer by the drift of the last node
+        unique_lock<mutex> lock(mMutex);
+        size_t changedBefore = mChanged.size();
+        for (size_t i = start; i <= end; i++) {
+            const WindowNode &w = window[i - start];
+            if (w.var < 0)
+                continue;
+            Node &n = mNodes[i];
+            n.t = w.t;
+            n.yaw = w.yaw;
+            MarkChanged(i);
+        }
+
+        const Node &last = mNodes[end];
+        if (end >= mLastSolvedEnd) {
+            mDriftYaw = Utility::normalizeAngle(last.yaw - last.vioYaw);
+            mDriftT = last.t - YawRotation(mDriftYaw) * last.vioT;
+            mLastSolvedEnd = end;
+            Matrix3d Rdrift = YawRotation(mDriftYaw);
+            for (size_t i = end + 1; i < mNodes.size(); i++) {
+                Node &n = mNodes[i];
+                n.yaw = Utility::normalizeAngle(n.vioYaw + mDriftYaw);
+                n.t = Rdrift * n.vioT + mDriftT;
+                MarkChanged(i);
+            }
+        }
+        stats.numChanged = mChanged.size() - changedBefore;
+    }
+
+    void PoseGraph4DoF::MarkChanged(size_t index) {
+        Node &n = mNodes[index];
+        if (!n.changed) {
+            n.changed = true;
+            mChanged.push_back(index);
+        }
+    }
+
+    void PoseGraph4DoF::GetPose(size_t index, Matrix3d &Rwb, Vector3d &twb) {
+        unique_lock<mutex> lock(mMutex);
+        const Node &n = mNodes[index];
+        Rwb = Utility::ypr2R(Vector3d(n.yaw, n.pitch, n.roll));
+        twb = n.t;
+    }
+
+    vector<size_t> PoseGraph4DoF::TakeChanged() {
+        unique_lock<mutex> lock(mMutex);
+        vector<size_t> changed;
+        changed.swap(mChanged);
+        for (size_t i: changed)
+            mNodes[i].changed = false;
+        sort(changed.begin(), changed.end());
+        return changed;
+    }
+
+    void PoseGraph4DoF::GetDrift(double &yaw, Vector3d &t) {
+        unique_lock<mutex> lock(mMutex);
+        yaw = mDriftYaw;
+        t = mDriftT;
+    }
+
+    size_t PoseGraph4DoF::Size() {
+        unique_lock<mutex> lock(mMutex);
+        return mNodes.size();
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef YGZ_TRACE_H
+#define YGZ_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Scoped timing zones for the hot paths of tracker, backend and loop closing.
+ *
+ *   void Tracker::Track() {
+ *       YGZ_TRACE_ZONE("Track");
+ *       ...
+ *   }
+ *
+ * Every thread writes its zones into its own fixed size ring buffer, no locks are taken while
+ * recording. While tracing is disabled (the default) a zone costs one relaxed atomic load.
+ * Define YGZ_DISABLE_TRACE to compile the zones out completely.
+ *
+ * The recorded events can be written as a Chrome trace (chrome://tracing, Perfetto) and every
+ * zone keeps a latency histogram that is not limited by the ring buffer size.
+ */
+
+namespace ygz {
+
+    namespace trace {
+
+        const int kMaxZones = 128;          // distinct zone names
+        const int kHistogramBins = 24;      // log2 buckets of microseconds, bin i holds [2^(i-1), 2^i) us
+
+        struct ZoneStats {
+            std::string name;
+            uint64_t count = 0;
+            double totalMs = 0;
+            double maxMs = 0;
+            uint64_t histogram[kHistogramBins] = {0};
+
+            double MeanMs() const { return count ? totalMs / count : 0; }
+
+            // approximate percentile (0-1) from the histogram, upper edge of the bin
+            double PercentileMs(double p) const;
+        };
+
+        extern std::atomic<bool> gEnabled;
+
+        inline bool Enabled() {
+            return gEnabled.load(std::memory_order_relaxed);
+        }
+
+        // enable or disable recording, the ring buffers keep their content
+        void Enable(bool enable = true);
+
+        // events kept per thread, older events are overwritten. Takes effect for threads that record their first zone afterwards
+        void SetBufferSize(size_t events);
+
+        // name shown for the calling thread in the trace
+        void SetThreadName(const std::string &name);
+
+        // id of a zone name, called once per zone site by YGZ_TRACE_ZONE
+        int RegisterZone(const char *name);
+
+        inline uint64_t NowNs() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // record a finished zone on the calling thread
+        void Record(int zone, uint64_t beginNs, uint64_t endNs);
+
+        class Zone {
+        public:
+            explicit Zone(int zone) : mZone(Enabled() ? zone : -1) {
+                if (mZone >= 0)
+                    mBegin = NowNs();
+            }
+
+            ~Zone() {
+                if (mZone >= 0)
+                    Record(mZone, mBegin, NowNs());
+            }
+
+            Zone(const Zone &) = delete;
+
+            Zone &operator=(const Zone &) = delete;
+
+        private:
+            int mZone;
+            uint64_t mBegin = 0;
+        };
+
+        // write the events of all threads in Chrome trace event format
+        bool ExportChromeTrace(const std::string &path);
+
+        // statistics of every zone that was recorded at least once, summed over all threads
+        std::vector<ZoneStats> GetStats();
+
+        // one line per zone: count, mean, p50, p90, p99, max
+        void PrintStats(std::ostream &os);
+
+        // drop all events and statistics
+        void Clear();
+    }
+}
+
+#define YGZ_TRACE_CONCAT_IMPL(a, b) a##b
+#define YGZ_TRACE_CONCAT(a, b) YGZ_TRACE_CONCAT_IMPL(a, b)
+
+#ifdef YGZ_DISABLE_TRACE
+#define YGZ_TRACE_ZONE(name)
+#else
+#define YGZ_TRACE_ZONE(name) \
+    static const int YGZ_TRACE_CONCAT(_ygzTraceId, __LINE__) = ygz::trace::RegisterZone(name); \
+    ygz::trace::Zone YGZ_TRACE_CONCAT(_ygzTraceZone, __LINE__)(YGZ_TRACE_CONCAT(_ygzTraceId, __LINE__))
+#endif
+
+#endif
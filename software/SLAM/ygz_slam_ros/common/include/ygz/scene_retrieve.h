@@ -416,7 +416,8 @@ public:
     
     
 private:
-    void _init_retriever();
+    //keyframe_db_path: keyframe database cache of the scene (see LoopClosingManager::saveDB), empty to always rebuild
+    void _init_retriever(const string& keyframe_db_path = "");
     Scene original_scene;
     LoopClosingManager* ploop_closing_manager_of_scene;
 };
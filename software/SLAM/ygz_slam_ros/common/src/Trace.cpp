@@ -0,0 +1,296 @@
+#include "ygz/Trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+
+using namespace std;
+
+namespace ygz {
+
+    namespace trace {
+
+        std::atomic<bool> gEnabled(false);
+
+        namespace {
+
+            // one ring buffer slot, a seqlock lets the exporter skip slots that are being overwritten
+            struct Slot {
+                atomic<uint64_t> seq;       // index + 1 of the event in this slot, 0 while writing
+                atomic<uint64_t> begin;
+                atomic<uint64_t> end;
+                atomic<int> zone;
+            };
+
+            struct ZoneCounters {
+                atomic<uint64_t> count;
+                atomic<uint64_t> totalNs;
+                atomic<uint64_t> maxNs;
+                atomic<uint64_t> histogram[kHistogramBins];
+            };
+
+            // written only by its owner thread, read by the exporter
+            struct ThreadBuffer {
+                explicit ThreadBuffer(size_t capacity, int id) : slots(new Slot[capacity]), capacity(capacity), tid(id) {
+                    for (size_t i = 0; i < capacity; i++)
+                        slots[i].seq.store(0, memory_order_relaxed);
+                    ClearCounters();
+                }
+
+                void ClearCounters() {
+                    head.store(0, memory_order_relaxed);
+                    for (int z = 0; z < kMaxZones; z++) {
+                        zones[z].count.store(0, memory_order_relaxed);
+                        zones[z].totalNs.store(0, memory_order_relaxed);
+                        zones[z].maxNs.store(0, memory_order_relaxed);
+                        for (int b = 0; b < kHistogramBins; b++)
+                            zones[z].histogram[b].store(0, memory_order_relaxed);
+                    }
+                }
+
+                unique_ptr<Slot[]> slots;
+                size_t capacity;
+                atomic<uint64_t> head;      // number of events ever written
+                ZoneCounters zones[kMaxZones];
+                int tid;
+                string name;                // guarded by the registry mutex
+            };
+
+            struct Registry {
+                mutex mtx;
+                vector<shared_ptr<ThreadBuffer>> buffers;
+                vector<string> zoneNames;
+                size_t bufferSize = 1 << 16;
+            };
+
+            Registry &GetRegistry() {
+                static Registry registry;
+                return registry;
+            }
+
+            ThreadBuffer &LocalBuffer() {
+                thread_local shared_ptr<ThreadBuffer> buffer;
+                if (buffer == nullptr) {
+                    Registry &reg = GetRegistry();
+                    unique_lock<mutex> lock(reg.mtx);
+                    buffer = make_shared<ThreadBuffer>(reg.bufferSize, (int) reg.buffers.size());
+                    reg.buffers.push_back(buffer);
+                }
+                return *buffer;
+            }
+
+            inline int HistogramBin(uint64_t ns) {
+                uint64_t us = ns / 1000;
+                int bin = 0;
+                while (us > 0 && bin < kHistogramBins - 1) {
+                    us >>= 1;
+                    bin++;
+                }
+                return bin;
+            }
+
+            string Escape(const string &s) {
+                string out;
+                for (char c: s) {
+                    if (c == '"' || c == '\\')
+                        out += '\\';
+                    if ((unsigned char) c >= 0x20)
+                        out += c;
+                }
+                return out;
+            }
+
+            struct ExportedEvent {
+                uint64_t begin, end;
+                int zone;
+            };
+
+            // consistent copy of the events still in a ring buffer
+            void CopyEvents(const ThreadBuffer &buffer, vector<ExportedEvent> &events) {
+                uint64_t head = buffer.head.load(memory_order_acquire);
+                uint64_t first = head > buffer.capacity ? head - buffer.capacity : 0;
+                for (uint64_t i = first; i < head; i++) {
+                    const Slot &slot = buffer.slots[i % buffer.capacity];
+                    uint64_t s1 = slot.seq.load(memory_order_acquire);
+                    ExportedEvent e;
+                    e.begin = slot.begin.load(memory_order_relaxed);
+                    e.end = slot.end.load(memory_order_relaxed);
+                    e.zone = slot.zone.load(memory_order_relaxed);
+                    atomic_thread_fence(memory_order_acquire);
+                    uint64_t s2 = slot.seq.load(memory_order_relaxed);
+                    if (s1 == i + 1 && s2 == s1)
+                        events.push_back(e);
+                }
+            }
+        }
+
+        double ZoneStats::PercentileMs(double p) const {
+            if (count == 0)
+                return 0;
+            uint64_t target = max<uint64_t>(1, (uint64_t) (p * count + 0.5));
+            uint64_t sum = 0;
+            for (int b = 0; b < kHistogramBins; b++) {
+                sum += histogram[b];
+                if (sum >= target)
+                    return min(maxMs, (double) (1ull << b) / 1000.0);
+            }
+            return maxMs;
+        }
+
+        void Enable(bool enable) {
+            gEnabled.store(enable, memory_order_relaxed);
+        }
+
+        void SetBufferSize(size_t events) {
+            Registry &reg = GetRegistry();
+            unique_lock<mutex> lock(reg.mtx);
+            reg.bufferSize = max<size_t>(16, events);
+        }
+
+        void SetThreadName(const string &name) {
+            ThreadBuffer &buffer = LocalBuffer();
+            Registry &reg = GetRegistry();
+            unique_lock<mutex> lock(reg.mtx);
+            buffer.name = name;
+        }
+
+        int RegisterZone(const char *name) {
+            Registry &reg = GetRegistry();
+            unique_lock<mutex> lock(reg.mtx);
+            for (size_t i = 0; i < reg.zoneNames.size(); i++)
+                if (reg.zoneNames[i] == name)
+                    return (int) i;
+            if (reg.zoneNames.size() >= (size_t) kMaxZones)
+                return -1;      // too many zones, this one is never recorded
+            reg.zoneNames.push_back(name);
+            return (int) reg.zoneNames.size() - 1;
+        }
+
+        void Record(int zone, uint64_t beginNs, uint64_t endNs) {
+            if (zone < 0 || zone >= kMaxZones)
+                return;
+            ThreadBuffer &buffer = LocalBuffer();
+
+            uint64_t index = buffer.head.load(memory_order_relaxed);
+            Slot &slot = buffer.slots[index % buffer.capacity];
+            slot.seq.store(0, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+            slot.begin.store(beginNs, memory_order_relaxed);
+            slot.end.store(endNs, memory_order_relaxed);
+            slot.zone.store(zone, memory_order_relaxed);
+            slot.seq.store(index + 1, memory_order_release);
+            buffer.head.store(index + 1, memory_order_release);
+
+            // only this thread writes the counters, no read-modify-write needed
+            uint64_t ns = endNs - beginNs;
+            ZoneCounters &c = buffer.zones[zone];
+            c.count.store(c.count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+            c.totalNs.store(c.totalNs.load(memory_order_relaxed) + ns, memory_order_relaxed);
+            if (ns > c.maxNs.load(memory_order_relaxed))
+                c.maxNs.store(ns, memory_order_relaxed);
+            atomic<uint64_t> &bin = c.histogram[HistogramBin(ns)];
+            bin.store(bin.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        }
+
+        bool ExportChromeTrace(const string &path) {
+            Registry &reg = GetRegistry();
+            vector<shared_ptr<ThreadBuffer>> buffers;
+            vector<string> zoneNames;
+            vector<string> threadNames;
+            {
+                unique_lock<mutex> lock(reg.mtx);
+                buffers = reg.buffers;
+                zoneNames = reg.zoneNames;
+                for (auto &b: buffers)
+                    threadNames.push_back(b->name);
+            }
+
+            vector<vector<ExportedEvent>> events(buffers.size());
+            uint64_t t0 = UINT64_MAX;
+            for (size_t i = 0; i < buffers.size(); i++) {
+                CopyEvents(*buffers[i], events[i]);
+                for (const ExportedEvent &e: events[i])
+                    t0 = min(t0, e.begin);
+            }
+
+            ofstream fout(path);
+            if (!fout) {
+                return false;
+            }
+            fout << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+            bool first = true;
+            fout << fixed << setprecision(3);
+            for (size_t i = 0; i < buffers.size(); i++) {
+                int tid = buffers[i]->tid;
+                string name = threadNames[i].empty() ? "thread " + to_string(tid) : threadNames[i];
+                fout << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+                     << ",\"args\":{\"name\":\"" << Escape(name) << "\"}}";
+                first = false;
+                for (const ExportedEvent &e: events[i]) {
+                    if (e.zone < 0 || (size_t) e.zone >= zoneNames.size())
+                        continue;
+                    fout << ",\n{\"name\":\"" << Escape(zoneNames[e.zone]) << "\",\"cat\":\"ygz\",\"ph\":\"X\",\"pid\":1"
+                         << ",\"tid\":" << tid
+                         << ",\"ts\":" << (e.begin - t0) / 1000.0
+                         << ",\"dur\":" << (e.end - e.begin) / 1000.0 << "}";
+                }
+            }
+            fout << "\n]}\n";
+            return fout.good();
+        }
+
+        vector<ZoneStats> GetStats() {
+            Registry &reg = GetRegistry();
+            vector<shared_ptr<ThreadBuffer>> buffers;
+            vector<string> zoneNames;
+            {
+                unique_lock<mutex> lock(reg.mtx);
+                buffers = reg.buffers;
+                zoneNames = reg.zoneNames;
+            }
+
+            vector<ZoneStats> stats;
+            for (size_t z = 0; z < zoneNames.size(); z++) {
+                ZoneStats s;
+                s.name = zoneNames[z];
+                for (auto &b: buffers) {
+                    const ZoneCounters &c = b->zones[z];
+                    s.count += c.count.load(memory_order_relaxed);
+                    s.totalMs += c.totalNs.load(memory_order_relaxed) * 1e-6;
+                    s.maxMs = max(s.maxMs, c.maxNs.load(memory_order_relaxed) * 1e-6);
+                    for (int bin = 0; bin < kHistogramBins; bin++)
+                        s.histogram[bin] += c.histogram[bin].load(memory_order_relaxed);
+                }
+                if (s.count > 0)
+                    stats.push_back(s);
+            }
+            return stats;
+        }
+
+        void PrintStats(ostream &os) {
+            vector<ZoneStats> stats = GetStats();
+            sort(stats.begin(), stats.end(), [](const ZoneStats &a, const ZoneStats &b) {
+                return a.totalMs > b.totalMs;
+            });
+            os << left << setw(28) << "zone" << right << setw(10) << "count" << setw(12) << "mean ms"
+               << setw(10) << "p50" << setw(10) << "p90" << setw(10) << "p99" << setw(12) << "max ms" << "\n";
+            os << fixed << setprecision(3);
+            for (const ZoneStats &s: stats) {
+                os << left << setw(28) << s.name << right << setw(10) << s.count << setw(12) << s.MeanMs()
+                   << setw(10) << s.PercentileMs(0.5) << setw(10) << s.PercentileMs(0.9)
+                   << setw(10) << s.PercentileMs(0.99) << setw(12) << s.maxMs << "\n";
+            }
+        }
+
+        void Clear() {
+            Registry &reg = GetRegistry();
+            unique_lock<mutex> lock(reg.mtx);
+            for (auto &b: reg.buffers)
+                b->ClearCounters();
+        }
+    }
+}
@@ -130,15 +130,24 @@ SceneFrame Scene::generateSceneFrameFromStereoImage(cv::Mat imgl, cv::Mat imgr,
 
     cout<<"generateSceneFrameFromStereoImage 1"<<endl;
 
-    LoopClosingManager lcm("./voc/brief_k10L6.bin");
-
     std::vector<cv::KeyPoint> key_points2d_candidate;
     std::vector<cv::KeyPoint> key_points2d_final;
     std::vector<cv::Point3d> points3d;
     cv::Mat feature;
 
-    ptr_frameinfo pleft_image_info = lcm.extractFeature(imgl);
-    ptr_frameinfo pright_image_info = lcm.extractFeature(imgr);
+    // the detectors are kept from one stereo pair to the next and both images are extracted in
+    // parallel, no LoopClosingManager (and so no vocabulary) is loaded per pair
+    static FeatureExtractor stereo_extractor;
+    std::vector<std::vector<cv::KeyPoint> > stereo_keypoints;
+    std::vector<cv::Mat> stereo_descriptors;
+    stereo_extractor.extract(std::vector<cv::Mat>{imgl, imgr}, stereo_keypoints, stereo_descriptors);
+
+    ptr_frameinfo pleft_image_info(new FrameInfo);
+    ptr_frameinfo pright_image_info(new FrameInfo);
+    pleft_image_info->keypoints.swap(stereo_keypoints[0]);
+    pleft_image_info->descriptors = stereo_descriptors[0];
+    pright_image_info->keypoints.swap(stereo_keypoints[1]);
+    pright_image_info->descriptors = stereo_descriptors[1];
 
 
     cout<<"pleft_image_info kps size: "<<pleft_image_info->keypoints.size()<<endl;
@@ -307,15 +316,42 @@ SceneRetriever::SceneRetriever(const string& voc,const string& scene_file)
 {
     this->original_scene.loadFile(scene_file);
     this->ploop_closing_manager_of_scene = new LoopClosingManager(voc);
-    this->_init_retriever();
+    this->_init_retriever(scene_file + ".kfdb");
 }
 
-void SceneRetriever::_init_retriever()
+void SceneRetriever::_init_retriever(const string& keyframe_db_path)
 {
     auto p2d = this->original_scene.getP2D();
     auto p3d = this->original_scene.getP3D();
 
-    for(int frame_index = 0; frame_index<original_scene.getImageCount(); frame_index++)
+    int first_frame = 0;
+    if(!keyframe_db_path.empty())
+    {
+        // the keyframe database is cached next to the scene file. A cache cut short (e.g. by a crash
+        // while building it) is completed, one written with another vocabulary or scene is rebuilt
+        int cached = this->ploop_closing_manager_of_scene->loadFromDB(keyframe_db_path);
+        bool valid = cached >= 0 && cached <= original_scene.getImageCount();
+        for(int i = 0; valid && i < cached; i++)
+        {
+            const cv::Mat& a = this->ploop_closing_manager_of_scene->getFrameInfoById(i)->descriptors;
+            const cv::Mat& b = this->original_scene.getDespByIndex(i);
+            valid = a.rows == b.rows && a.cols == b.cols && a.type() == b.type() &&
+                    (a.empty() || (a.isContinuous() && b.isContinuous() &&
+                                   memcmp(a.data, b.data, a.total() * a.elemSize()) == 0));
+        }
+
+        if(valid)
+        {
+            first_frame = cached;
+        }
+        else
+        {
+            this->ploop_closing_manager_of_scene->clearKeyFrames();
+            this->ploop_closing_manager_of_scene->saveDB(keyframe_db_path);
+        }
+    }
+
+    for(int frame_index = first_frame; frame_index<original_scene.getImageCount(); frame_index++)
     {
         ptr_frameinfo pfr = shared_ptr<FrameInfo>(new FrameInfo());
 	    pfr->keypoints = p2d[frame_index];
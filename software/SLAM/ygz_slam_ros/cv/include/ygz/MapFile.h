@@ -0,0 +1,134 @@
+#ifndef YGZ_MAP_FILE_H
+#define YGZ_MAP_FILE_H
+
+#include <opencv2/core/core.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+/**
+ * Flat binary map format, the fast path next to the boost archives of MapSerialization.
+ *
+ * Layout (little endian, every block 16 byte aligned):
+ *   MapFileHeader
+ *   keypoint section    cv::KeyPoint records of all frames, back to back
+ *   point section       cv::Point3d records of all frames
+ *   descriptor section  raw descriptor rows of all frames
+ *   offset table        one MapFileFrameEntry per frame
+ *
+ * The records are the in-memory layout of cv::KeyPoint / cv::Point3d, so a mapped file is used
+ * in place: MappedMapFile hands out pointers and cv::Mat headers into the mapped pages and any
+ * frame can be read without touching the others.
+ *
+ * MapFileWriter streams frames to disk as they arrive. Points and descriptors are spooled into
+ * two side files and appended to the keypoint section when the writer is closed, after which the
+ * offset table and the header are written.
+ */
+
+namespace ygz {
+
+    struct MapFileHeader {
+        char magic[8];                  // "YGZMAP\0\0"
+        uint32_t version;
+        uint32_t headerSize;            // sizeof(MapFileHeader)
+        uint64_t numFrames;
+        uint64_t keypointSection;       // byte offsets of the sections
+        uint64_t pointSection;
+        uint64_t descriptorSection;
+        uint64_t offsetTable;
+        uint64_t fileSize;
+    };
+
+    struct MapFileFrameEntry {
+        uint64_t keypointOffset;        // absolute byte offset of the first keypoint
+        uint64_t pointOffset;
+        uint64_t descriptorOffset;
+        uint32_t numKeypoints;
+        uint32_t numPoints;
+        int32_t descRows;
+        int32_t descCols;
+        int32_t descType;               // cv::Mat type of the descriptors
+        uint32_t reserved;
+    };
+
+    // zero-copy view of one frame inside a mapped file
+    struct MapFileFrame {
+        const cv::KeyPoint *keypoints = nullptr;
+        size_t numKeypoints = 0;
+        const cv::Point3d *points = nullptr;
+        size_t numPoints = 0;
+        cv::Mat descriptors;            // header only, points into the mapping
+    };
+
+    class MapFileWriter {
+    public:
+        static const uint32_t kVersion = 1;
+
+        MapFileWriter() = default;
+
+        ~MapFileWriter();
+
+        // start a new file, false if any of the files cannot be created
+        bool Open(const std::string &path);
+
+        // append one frame, the descriptors must be continuous rows
+        bool AddFrame(const std::vector<cv::KeyPoint> &keypoints, const std::vector<cv::Point3d> &points,
+                      const cv::Mat &descriptors);
+
+        // assemble the sections, write the offset table and the header
+        bool Close();
+
+        size_t NumFrames() const { return mEntries.size(); }
+
+    private:
+        // pad a stream to the block alignment and return its position
+        static uint64_t Align(std::ofstream &ofs);
+
+        // append a spooled side file to the main file
+        bool AppendFile(const std::string &path, uint64_t &sectionOffset);
+
+        std::string mPath;
+        std::ofstream mOfs;             // header + keypoint section
+        std::ofstream mPointOfs;        // spooled point section
+        std::ofstream mDescOfs;         // spooled descriptor section
+        std::vector<MapFileFrameEntry> mEntries;
+        bool mOpen = false;
+    };
+
+    class MappedMapFile {
+    public:
+        MappedMapFile() = default;
+
+        ~MappedMapFile();
+
+        MappedMapFile(const MappedMapFile &) = delete;
+
+        MappedMapFile &operator=(const MappedMapFile &) = delete;
+
+        // map a file and check its header and offset table
+        bool Open(const std::string &path);
+
+        void Close();
+
+        bool IsOpen() const { return mData != nullptr; }
+
+        size_t Size() const { return mHeader ? mHeader->numFrames : 0; }
+
+        // view of a frame, nothing is copied
+        MapFileFrame GetFrame(size_t index) const;
+
+        // deep copy of a frame in the MapSerialization layout
+        std::tuple<std::vector<cv::KeyPoint>, std::vector<cv::Point3d>, cv::Mat> CopyFrame(size_t index) const;
+
+    private:
+        const uint8_t *mData = nullptr;
+        size_t mSize = 0;
+        const MapFileHeader *mHeader = nullptr;
+        const MapFileFrameEntry *mEntries = nullptr;
+    };
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include "ygz/serialization.h"
 #include "ygz/Frame.h"
 #include "ygz/Tracker.h"
+#include "ygz/MapFile.h"
 
 #include "opencv/cv.h"
 
@@ -30,6 +31,12 @@ namespace ygz
         
         MapSerialization deserialize(string& path);
         
+        // flat binary format (see MapFile.h), much faster than the boost archives for large maps
+        bool serializeBinary(const string& path);
+        
+        // load a flat binary map into mVecSceneFrames, use MappedMapFile directly for zero-copy access
+        bool deserializeBinary(const string& path);
+        
         // test deserializatin result by displaying the size of the map vector, size of the first scene and the size of the last scene
         void test();
         
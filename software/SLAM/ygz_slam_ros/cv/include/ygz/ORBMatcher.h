@@ -29,8 +29,14 @@ namespace ygz {
         // 两个描述子之间的距离
         static int DescriptorDistance(const uchar *desc1, const uchar *desc2);
 
+        // 一个描述子与连续存放的n个描述子(每个32字节)之间的距离
+        static void DescriptorDistances(const uchar *desc, const uchar *tile, int n, int *dists);
+
         /**
          * 用词袋检测两个帧间的匹配
+         * Features are only compared inside the same node of the direct index (mFeatVec). The descriptors of frame2
+         * in a node are gathered into one tile and compared with DescriptorDistances; with mbCheckOrientation the
+         * matches outside the three main rotations are removed at the end.
          * @param frame1
          * @param frame2
          * @param matches
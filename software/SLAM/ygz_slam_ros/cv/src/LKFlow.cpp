@@ -2,6 +2,7 @@
 #include "ygz/Align.h"
 #include "ygz/Feature.h"
 #include "ygz/MapPoint.h"
+#include "ygz/Trace.h"
 
 #include <opencv2/video/video.hpp>
 #include <opencv2/calib3d/calib3d.hpp>
@@ -14,6 +15,7 @@ namespace ygz {
             VecVector2f &trackPts,
             bool keepNotConverged
     ) {
+        YGZ_TRACE_ZONE("LKFlow");
 
         if (ref->mPyramidLeft.empty())
             ref->ComputeImagePyramid();
@@ -218,6 +220,7 @@ namespace ygz {
     }
 
     int LKFlow1D(const shared_ptr<Frame> frame) {
+        YGZ_TRACE_ZONE("LKFlow1D");
 
         // 匹配局部地图用的 patch, 默认8x8
         uchar patch[align_patch_area] = {0};
@@ -311,6 +314,7 @@ namespace ygz {
             VecVector2f &refPts,
             VecVector2f &trackedPts
     ) {
+        YGZ_TRACE_ZONE("LKFlowCV");
         if (refPts.size() == 0)
             return 0;
 
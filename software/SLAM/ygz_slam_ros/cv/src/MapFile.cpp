@@ -0,0 +1,238 @@
+#include "ygz/MapFile.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+namespace ygz {
+
+    namespace {
+        const char kMagic[8] = {'Y', 'G', 'Z', 'M', 'A', 'P', 0, 0};
+        const uint64_t kAlignment = 16;
+
+        // the records are written as their in-memory layout
+        static_assert(sizeof(cv::KeyPoint) == 7 * 4, "unexpected cv::KeyPoint layout");
+        static_assert(sizeof(cv::Point3d) == 3 * 8, "unexpected cv::Point3d layout");
+
+        inline bool InRange(uint64_t offset, uint64_t bytes, uint64_t size) {
+            return offset <= size && bytes <= size - offset;
+        }
+    }
+
+    MapFileWriter::~MapFileWriter() {
+        if (mOpen)
+            Close();
+    }
+
+    uint64_t MapFileWriter::Align(ofstream &ofs) {
+        static const char zeros[kAlignment] = {0};
+        uint64_t pos = (uint64_t) ofs.tellp();
+        uint64_t pad = (kAlignment - pos % kAlignment) % kAlignment;
+        ofs.write(zeros, pad);
+        return pos + pad;
+    }
+
+    bool MapFileWriter::Open(const string &path) {
+        if (mOpen)
+            Close();
+
+        mPath = path;
+        mEntries.clear();
+        mOfs.open(path, ios::binary | ios::trunc);
+        mPointOfs.open(path + ".points.tmp", ios::binary | ios::trunc);
+        mDescOfs.open(path + ".desc.tmp", ios::binary | ios::trunc);
+        if (!mOfs || !mPointOfs || !mDescOfs) {
+            cerr << "MapFileWriter: cannot create " << path << endl;
+            mOfs.close();
+            mPointOfs.close();
+            mDescOfs.close();
+            return false;
+        }
+
+        // placeholder, the real header is written by Close()
+        MapFileHeader header;
+        memset(&header, 0, sizeof(header));
+        mOfs.write((const char *) &header, sizeof(header));
+        mOpen = true;
+        return true;
+    }
+
+    bool MapFileWriter::AddFrame(const vector<cv::KeyPoint> &keypoints, const vector<cv::Point3d> &points,
+                                 const cv::Mat &descriptors) {
+        if (!mOpen)
+            return false;
+
+        MapFileFrameEntry entry;
+        memset(&entry, 0, sizeof(entry));
+
+        entry.keypointOffset = Align(mOfs);
+        entry.numKeypoints = keypoints.size();
+        mOfs.write((const char *) keypoints.data(), keypoints.size() * sizeof(cv::KeyPoint));
+
+        // point and descriptor offsets are relative to their side files until Close()
+        entry.pointOffset = Align(mPointOfs);
+        entry.numPoints = points.size();
+        mPointOfs.write((const char *) points.data(), points.size() * sizeof(cv::Point3d));
+
+        entry.descriptorOffset = Align(mDescOfs);
+        if (!descriptors.empty()) {
+            cv::Mat desc = descriptors.isContinuous() ? descriptors : descriptors.clone();
+            entry.descRows = desc.rows;
+            entry.descCols = desc.cols;
+            entry.descType = desc.type();
+            mDescOfs.write((const char *) desc.data, desc.total() * desc.elemSize());
+        }
+
+        mEntries.push_back(entry);
+        return mOfs.good() && mPointOfs.good() && mDescOfs.good();
+    }
+
+    bool MapFileWriter::AppendFile(const string &path, uint64_t &sectionOffset) {
+        sectionOffset = Align(mOfs);
+        ifstream ifs(path, ios::binary);
+        if (!ifs)
+            return false;
+        vector<char> buffer(1 << 20);
+        while (ifs) {
+            ifs.read(buffer.data(), buffer.size());
+            mOfs.write(buffer.data(), ifs.gcount());
+        }
+        return mOfs.good();
+    }
+
+    bool MapFileWriter::Close() {
+        if (!mOpen)
+            return false;
+        mOpen = false;
+
+        mPointOfs.close();
+        mDescOfs.close();
+
+        MapFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kVersion;
+        header.headerSize = sizeof(MapFileHeader);
+        header.numFrames = mEntries.size();
+        header.keypointSection = sizeof(MapFileHeader) + (kAlignment - sizeof(MapFileHeader) % kAlignment) % kAlignment;
+
+        string pointPath = mPath + ".points.tmp", descPath = mPath + ".desc.tmp";
+        bool ok = AppendFile(pointPath, header.pointSection) && AppendFile(descPath, header.descriptorSection);
+        remove(pointPath.c_str());
+        remove(descPath.c_str());
+
+        for (MapFileFrameEntry &entry: mEntries) {
+            entry.pointOffset += header.pointSection;
+            entry.descriptorOffset += header.descriptorSection;
+        }
+        header.offsetTable = Align(mOfs);
+        mOfs.write((const char *) mEntries.data(), mEntries.size() * sizeof(MapFileFrameEntry));
+        header.fileSize = (uint64_t) mOfs.tellp();
+
+        mOfs.seekp(0);
+        mOfs.write((const char *) &header, sizeof(header));
+        ok = ok && mOfs.good();
+        mOfs.close();
+
+        if (!ok)
+            cerr << "MapFileWriter: failed to write " << mPath << endl;
+        else
+            cout << "MapFileWriter: wrote " << mEntries.size() << " frames, " << header.fileSize << " bytes to "
+                 << mPath << endl;
+        return ok;
+    }
+
+    MappedMapFile::~MappedMapFile() {
+        Close();
+    }
+
+    void MappedMapFile::Close() {
+        if (mData)
+            munmap((void *) mData, mSize);
+        mData = nullptr;
+        mSize = 0;
+        mHeader = nullptr;
+        mEntries = nullptr;
+    }
+
+    bool MappedMapFile::Open(const string &path) {
+        Close();
+
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            cerr << "MappedMapFile: cannot open " << path << endl;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(MapFileHeader)) {
+            cerr << "MappedMapFile: " << path << " is not a map file" << endl;
+            close(fd);
+            return false;
+        }
+        void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            cerr << "MappedMapFile: mmap failed for " << path << endl;
+            return false;
+        }
+        mData = (const uint8_t *) data;
+        mSize = st.st_size;
+        mHeader = (const MapFileHeader *) mData;
+
+        const MapFileHeader &h = *mHeader;
+        bool valid = memcmp(h.magic, kMagic, sizeof(kMagic)) == 0 &&
+                     h.version == MapFileWriter::kVersion &&
+                     h.headerSize == sizeof(MapFileHeader) &&
+                     h.fileSize == mSize &&
+                     h.numFrames <= mSize / sizeof(MapFileFrameEntry) &&
+                     InRange(h.offsetTable, h.numFrames * sizeof(MapFileFrameEntry), mSize);
+        if (valid) {
+            mEntries = (const MapFileFrameEntry *) (mData + h.offsetTable);
+            // bounds of every frame are checked once here, GetFrame() trusts them
+            for (size_t i = 0; i < h.numFrames && valid; i++) {
+                const MapFileFrameEntry &e = mEntries[i];
+                uint64_t descBytes = (uint64_t) max(e.descRows, 0) * max(e.descCols, 0) *
+                                     (e.descRows > 0 ? CV_ELEM_SIZE(e.descType) : 0);
+                valid = InRange(e.keypointOffset, (uint64_t) e.numKeypoints * sizeof(cv::KeyPoint), mSize) &&
+                        InRange(e.pointOffset, (uint64_t) e.numPoints * sizeof(cv::Point3d), mSize) &&
+                        InRange(e.descriptorOffset, descBytes, mSize);
+            }
+        }
+        if (!valid) {
+            cerr << "MappedMapFile: " << path << " is corrupted or has an unsupported version" << endl;
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    MapFileFrame MappedMapFile::GetFrame(size_t index) const {
+        MapFileFrame frame;
+        if (mData == nullptr || index >= mHeader->numFrames)
+            return frame;
+
+        const MapFileFrameEntry &e = mEntries[index];
+        frame.keypoints = (const cv::KeyPoint *) (mData + e.keypointOffset);
+        frame.numKeypoints = e.numKeypoints;
+        frame.points = (const cv::Point3d *) (mData + e.pointOffset);
+        frame.numPoints = e.numPoints;
+        if (e.descRows > 0)
+            frame.descriptors = cv::Mat(e.descRows, e.descCols, e.descType, (void *) (mData + e.descriptorOffset));
+        return frame;
+    }
+
+    tuple<vector<cv::KeyPoint>, vector<cv::Point3d>, cv::Mat> MappedMapFile::CopyFrame(size_t index) const {
+        MapFileFrame frame = GetFrame(index);
+        return make_tuple(vector<cv::KeyPoint>(frame.keypoints, frame.keypoints + frame.numKeypoints),
+                          vector<cv::Point3d>(frame.points, frame.points + frame.numPoints),
+                          frame.descriptors.clone());
+    }
+}
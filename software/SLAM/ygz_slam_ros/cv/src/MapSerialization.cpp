@@ -85,4 +85,38 @@ namespace ygz
     }
     
     
+    bool MapSerialization::serializeBinary(const string& path)
+    {
+        MapFileWriter writer;
+        if (!writer.Open(path))
+            return false;
+        
+        for (const SceneFrame& frame : mVecSceneFrames)
+        {
+            if (!writer.AddFrame(std::get<0>(frame), std::get<1>(frame), std::get<2>(frame)))
+                return false;
+        }
+        
+        return writer.Close();
+    }
+    
+    
+    bool MapSerialization::deserializeBinary(const string& path)
+    {
+        MappedMapFile map;
+        if (!map.Open(path))
+            return false;
+        
+        mVecSceneFrames.clear();
+        mVecSceneFrames.reserve(map.Size());
+        for (size_t i = 0; i < map.Size(); i++)
+        {
+            mVecSceneFrames.push_back(map.CopyFrame(i));
+        }
+        
+        cout<<"MapSerialization binary deserialization finished, current SceneFrame vector size: "<<mVecSceneFrames.size()<<endl;
+        return true;
+    }
+    
+    
 }
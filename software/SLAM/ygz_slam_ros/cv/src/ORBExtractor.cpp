@@ -6,6 +6,7 @@
 #include "ygz/Frame.h"
 #include "ygz/Feature.h"
 #include "ygz/ORBExtractor.h"
+#include "ygz/Trace.h"
 
 using namespace cv;
 using namespace std;
@@ -451,6 +452,7 @@ namespace ygz {
     }
 
     void ORBExtractor::Detect(shared_ptr<Frame> frame, bool leftEye, bool computeRotAndDesc) {
+        YGZ_TRACE_ZONE("ORBExtractor::Detect");
         mpFrame = frame;
         mbComputeRotAndDesc = computeRotAndDesc;
 
@@ -3,9 +3,14 @@
 #include "ygz/Frame.h"
 #include "ygz/MapPoint.h"
 #include "ygz/LKFlow.h"
+#include "ygz/Trace.h"
 
 #include <opencv2/video/video.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <cstring>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -29,6 +34,28 @@ namespace ygz {
         return dist;
     }
 
+    void ORBMatcher::DescriptorDistances(const uchar *desc, const uchar *tile, int n, int *dists) {
+#ifdef __AVX2__
+        // a descriptor is one 256 bit register, the bits are counted with a nibble lookup
+        const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                             0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i low = _mm256_set1_epi8(0x0f);
+        const __m256i q = _mm256_loadu_si256((const __m256i *) desc);
+        for (int i = 0; i < n; i++) {
+            const __m256i x = _mm256_xor_si256(q, _mm256_loadu_si256((const __m256i *) (tile + 32 * i)));
+            const __m256i cnt = _mm256_add_epi8(
+                    _mm256_shuffle_epi8(lut, _mm256_and_si256(x, low)),
+                    _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+            const __m256i sad = _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+            const __m128i s = _mm_add_epi64(_mm256_castsi256_si128(sad), _mm256_extracti128_si256(sad, 1));
+            dists[i] = _mm_cvtsi128_si32(s) + _mm_extract_epi32(s, 2);
+        }
+#else
+        for (int i = 0; i < n; i++)
+            dists[i] = DescriptorDistance(desc, tile + 32 * i);
+#endif
+    }
+
     int ORBMatcher::SearchBruteForce(shared_ptr<Frame> frame1, shared_ptr<Frame> frame2, std::vector<Match> &matches) {
         assert (matches.empty());
         matches.reserve(frame1->mFeaturesLeft.size());
@@ -59,23 +86,36 @@ namespace ygz {
                                 bool only3D) {
 
         const DBoW3::FeatureVector &vFeatVecF1 = frame1->mFeatVec;
+        const DBoW3::FeatureVector &vFeatVecF2 = frame2->mFeatVec;
 
-        int nmatches = 0;
+        const size_t firstMatch = matches.size();
 
+        // Rotation Histogram (to check rotation consistency), holds the positions in matches
         vector<int> rotHist[setting::HISTO_LENGTH];
         for (int i = 0; i < setting::HISTO_LENGTH; i++)
             rotHist[i].reserve(500);
+        const float factor = 1.0f / setting::HISTO_LENGTH;
+
+        // 节点中frame2的描述子，连续存放
+        vector<uchar> tile;
+        vector<int> dists;
 
         // We perform the matching over ORB that belong to the same vocabulary node (at a certain level)
         DBoW3::FeatureVector::const_iterator F1it = vFeatVecF1.begin();
-        DBoW3::FeatureVector::const_iterator F2it = frame2->mFeatVec.begin();
+        DBoW3::FeatureVector::const_iterator F2it = vFeatVecF2.begin();
         DBoW3::FeatureVector::const_iterator F1end = vFeatVecF1.end();
-        DBoW3::FeatureVector::const_iterator F2end = frame2->mFeatVec.end();
+        DBoW3::FeatureVector::const_iterator F2end = vFeatVecF2.end();
 
         while (F1it != F1end && F2it != F2end) {
             if (F1it->first == F2it->first) {
-                const vector<unsigned int> vIndicesF1 = F1it->second;
-                const vector<unsigned int> vIndicesF2 = F2it->second;
+                const vector<unsigned int> &vIndicesF1 = F1it->second;
+                const vector<unsigned int> &vIndicesF2 = F2it->second;
+                const int nF2 = vIndicesF2.size();
+
+                tile.resize(32 * nF2);
+                dists.resize(nF2);
+                for (int iF = 0; iF < nF2; iF++)
+                    memcpy(&tile[32 * iF], frame2->mFeaturesLeft[vIndicesF2[iF]]->mDesc, 32);
 
                 for (size_t iKF = 0; iKF < vIndicesF1.size(); iKF++) {
                     const unsigned int realIdxF1 = vIndicesF1[iKF];
@@ -85,24 +125,19 @@ namespace ygz {
                     if (only3D && fea1->mpPoint == nullptr)
                         continue;
 
-                    const uchar *dF1 = fea1->mDesc;
+                    DescriptorDistances(fea1->mDesc, tile.data(), nF2, dists.data());
 
                     int bestDist1 = 256;
                     int bestIdxF = -1;
                     int bestDist2 = 256;
 
-                    for (size_t iF = 0; iF < vIndicesF2.size(); iF++) {
-                        const unsigned int realIdxF2 = vIndicesF2[iF];
-                        auto fea2 = frame2->mFeaturesLeft[realIdxF2];
-
-                        const uchar *dF2 = fea2->mDesc;
-
-                        const int dist = DescriptorDistance(dF1, dF2);
+                    for (int iF = 0; iF < nF2; iF++) {
+                        const int dist = dists[iF];
 
                         if (dist < bestDist1) {
                             bestDist2 = bestDist1;
                             bestDist1 = dist;
-                            bestIdxF = realIdxF2;
+                            bestIdxF = vIndicesF2[iF];
                         } else if (dist < bestDist2) {
                             bestDist2 = dist;
                         }
@@ -110,8 +145,17 @@ namespace ygz {
 
                     if (bestDist1 <= setting::TH_LOW) {
                         if (static_cast<float> ( bestDist1 ) < mfNNratio * static_cast<float> ( bestDist2 )) {
+                            if (mbCheckOrientation) {
+                                float rot = fea1->mAngle - frame2->mFeaturesLeft[bestIdxF]->mAngle;
+                                if (rot < 0.0)
+                                    rot += 360.0f;
+                                int bin = round(rot * factor);
+                                if (bin == setting::HISTO_LENGTH)
+                                    bin = 0;
+                                assert(bin >= 0 && bin < setting::HISTO_LENGTH);
+                                rotHist[bin].push_back(matches.size());
+                            }
                             matches.push_back(Match(realIdxF1, bestIdxF, bestDist1));
-                            nmatches++;
                         }
                     }
 
@@ -121,11 +165,35 @@ namespace ygz {
             } else if (F1it->first < F2it->first) {
                 F1it = vFeatVecF1.lower_bound(F2it->first);
             } else {
-                F2it = frame2->mFeatVec.lower_bound(F1it->first);
+                F2it = vFeatVecF2.lower_bound(F1it->first);
             }
         }
 
-        return nmatches;
+        if (mbCheckOrientation) {
+            int ind1 = -1;
+            int ind2 = -1;
+            int ind3 = -1;
+
+            ComputeThreeMaxima(rotHist, setting::HISTO_LENGTH, ind1, ind2, ind3);
+
+            // 去掉旋转不一致的匹配，保持其余匹配的顺序
+            vector<bool> rejected(matches.size(), false);
+            for (int i = 0; i < setting::HISTO_LENGTH; i++) {
+                if (i == ind1 || i == ind2 || i == ind3)
+                    continue;
+                for (size_t j = 0, jend = rotHist[i].size(); j < jend; j++)
+                    rejected[rotHist[i][j]] = true;
+            }
+
+            size_t kept = firstMatch;
+            for (size_t i = firstMatch; i < matches.size(); i++) {
+                if (!rejected[i])
+                    matches[kept++] = matches[i];
+            }
+            matches.resize(kept);
+        }
+
+        return matches.size() - firstMatch;
     }
 
     int ORBMatcher::SearchByProjection(shared_ptr<Frame> CurrentFrame, shared_ptr<Frame> LastFrame, const float th) {
@@ -347,6 +415,7 @@ namespace ygz {
     }
 
     void ORBMatcher::ComputeStereoMatchesORB(shared_ptr<Frame> f) {
+        YGZ_TRACE_ZONE("ORBMatcher::ComputeStereoMatchesORB");
 
         assert (f->mFeaturesLeft.size() != 0);
         assert (f->mFeaturesRight.size() != 0);
@@ -529,6 +598,7 @@ namespace ygz {
     }
 
     void ORBMatcher::ComputeStereoMatchesOptiFlow(shared_ptr<Frame> f, bool only2Dpoints) {
+        YGZ_TRACE_ZONE("ORBMatcher::ComputeStereoMatchesOptiFlow");
         //assert(!f->mFeaturesLeft.empty());
        	if(f->mFeaturesLeft.empty())
 	    return;	
@@ -561,6 +631,7 @@ namespace ygz {
     }
 
     void ORBMatcher::ComputeStereoMatchesOptiFlowCV(shared_ptr<Frame> f) {
+        YGZ_TRACE_ZONE("ORBMatcher::ComputeStereoMatchesOptiFlowCV");
 
         vector<cv::Point2f> leftPts, rightPts;
         vector<shared_ptr<Feature>> validFeats;
@@ -6,6 +6,7 @@
 #include "ygz/BackendInterface.h"
 #include "ygz/IMUPreIntegration.h"
 #include "ygz/LKFlow.h"
+#include "ygz/Trace.h"
 
 // g2o related
 #include "ygz/G2OTypes.h"
@@ -887,6 +888,7 @@ namespace ygz {
     }
 
     int Tracker::OptimizeCurrentPose() {
+        YGZ_TRACE_ZONE("Tracker::OptimizeCurrentPose");
 
         assert(mState == OK || mState == WEAK || mState == NOT_INITIALIZED);
 
@@ -1657,6 +1659,7 @@ namespace ygz {
 	ros::Publisher obsmap_pub = nh.advertise<octomap_msgs::Octomap>("ygz_obstacle_pub",5);
 	
 	LOG(INFO)<<"Obstacle thread started!"<<endl;
+	trace::SetThreadName("ObstacleBuilder");
 	typedef pcl::PointXYZRGBA PointT;
 	typedef pcl::PointCloud<PointT> PointCloud; 
 	this->pObstacle_tree = shared_ptr<octomap::OcTree>( new octomap::OcTree(0.05 ) );//init it.
@@ -1675,6 +1678,7 @@ namespace ygz {
 	    //do map building.
 	    if(frame_to_be_build_count_cache>30)
 	    {
+	        YGZ_TRACE_ZONE("Tracker::BuildObstacleMap");
 	        frame_to_build_count_mutex.lock();
 		frame_to_build_count = 0;
 		frame_to_build_count_mutex.unlock();
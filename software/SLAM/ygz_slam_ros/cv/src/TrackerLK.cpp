@@ -6,6 +6,7 @@
 #include "ygz/BackendInterface.h"
 #include "ygz/MapPoint.h"
 #include "ygz/Viewer.h"
+#include "ygz/Trace.h"
 
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -64,6 +65,7 @@ namespace ygz {
         bool use_atti,
         double gps_x, double gps_y, double gps_z, bool use_gps, double height, bool use_height)
     {
+        YGZ_TRACE_ZONE("TrackerLK::InsertStereo");
         
         std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
         
@@ -337,6 +339,7 @@ namespace ygz {
     }
 
     bool TrackerLK::TrackLastFrame(bool usePoseInfo) {
+        YGZ_TRACE_ZONE("TrackerLK::TrackLastFrame");
 
         // Track the points in last frame and create new features in current
         std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
@@ -432,6 +435,7 @@ namespace ygz {
     }
 
     bool TrackerLK::TrackLocalMap(int &inliers) {
+        YGZ_TRACE_ZONE("TrackerLK::TrackLocalMap");
 
         std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
 
@@ -7,6 +7,7 @@
 
 #include "ygz/System.h"
 #include "ygz/EurocReader.h"
+#include "ygz/StereoDatasetSource.h"
 
 using namespace std;
 using namespace ygz;
@@ -68,22 +69,19 @@ int main(int argc, char **argv) {
     if (LoadImages(leftFolder, rightFolder, timeFolder, vstrImageLeft, vstrImageRight, vTimeStamp) == false)
         return 1;
 
-    for (size_t i = 0; i < vstrImageLeft.size(); i++) {
-        cv::Mat imLeft, imRight, imLeftRect, imRightRect;
+    // images are decoded and rectified ahead of the tracker
+    StereoDatasetSource source(vstrImageLeft, vstrImageRight, vTimeStamp, StereoDatasetSource::LoadOptions(fsSettings));
+    source.SetRectification(M1l, M2l, M1r, M2r);
+    source.Start();
 
-        // Read left and right images from file
-        imLeft = cv::imread(vstrImageLeft[i], CV_LOAD_IMAGE_UNCHANGED);
-        imRight = cv::imread(vstrImageRight[i], CV_LOAD_IMAGE_UNCHANGED);
-
-        if (imLeft.empty() || imRight.empty()) {
-            LOG(WARNING) << "Cannot load image " << i << endl;
+    StereoDatasetSource::StereoFrame frame;
+    while (source.Next(frame)) {
+        if (frame.left.empty() || frame.right.empty()) {
+            LOG(WARNING) << "Cannot load image " << frame.index << endl;
             continue;
         }
 
-        cv::remap(imLeft, imLeftRect, M1l, M2l, cv::INTER_LINEAR);
-        cv::remap(imRight, imRightRect, M1r, M2r, cv::INTER_LINEAR);
-
-        system.AddStereo(imLeftRect, imRightRect, vTimeStamp[i]);
+        system.AddStereo(frame.left, frame.right, frame.timestamp);
     }
 
 
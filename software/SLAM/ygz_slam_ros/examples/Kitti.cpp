@@ -6,6 +6,7 @@
 #include <opencv2/opencv.hpp>
 
 #include "ygz/System.h"
+#include "ygz/StereoDatasetSource.h"
 
 using namespace std;
 using namespace ygz;
@@ -58,20 +59,20 @@ int main(int argc, char **argv) {
     setting::TBC = SE3d();
 
 
-    // Main loop
-    cv::Mat imLeft, imRight;
-    for (int ni = 0; ni < nImages; ni++) {
-        // Read left and right images from file
-        imLeft = cv::imread(vstrImageLeft[ni], CV_LOAD_IMAGE_GRAYSCALE);
-        imRight = cv::imread(vstrImageRight[ni], CV_LOAD_IMAGE_GRAYSCALE);
-        double tframe = vTimestamps[ni];
+    // Main loop, images are decoded ahead of the tracker
+    StereoDatasetSource::Options sourceOptions = StereoDatasetSource::LoadOptions(fsSettings);
+    sourceOptions.imreadFlags = CV_LOAD_IMAGE_GRAYSCALE;
+    StereoDatasetSource source(vstrImageLeft, vstrImageRight, vTimestamps, sourceOptions);
+    source.Start();
 
-        if (imLeft.empty() || imRight.empty()) {
-            LOG(INFO) << "Cannot load image " << ni << endl;
+    StereoDatasetSource::StereoFrame frame;
+    while (source.Next(frame)) {
+        if (frame.left.empty() || frame.right.empty()) {
+            LOG(INFO) << "Cannot load image " << frame.index << endl;
         }
 
         // Pass the images to the SLAM system
-        system.AddStereo(imLeft, imRight, tframe);
+        system.AddStereo(frame.left, frame.right, frame.timestamp);
     }
 
     // Stop all threads
@@ -0,0 +1,143 @@
+/**
+ * Benchmark of the 4-DoF loop closing pose graph on a long synthetic trajectory.
+ * The vehicle flies the same circuit over and over, the VIO drifts in yaw and translation,
+ * and every revisit produces loop edges against the previous lap.
+ * Each loop event is solved once with a full re-solve from the earliest loop (the old
+ * optimized4DoF behaviour) and once incrementally, and the time per loop event is reported.
+ *
+ * Usage: PoseGraphBenchmark [num_keyframes] [keyframes_per_lap] [loops_per_lap]
+ * The defaults are a 30 minute mission at 5 keyframes per second.
+*/
+
+#include "ygz/PoseGraph4DoF.h"
+#include "ygz/utility.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+using namespace ygz;
+using namespace Eigen;
+
+struct Trajectory {
+    vector<Matrix3d, aligned_allocator<Matrix3d>> Rgt, Rvio;
+    vector<Vector3d, aligned_allocator<Vector3d>> tgt, tvio;
+};
+
+// a circuit of radius 50m with a little altitude and attitude variation, plus a drifting VIO copy
+Trajectory MakeTrajectory(int N, int perLap) {
+    Trajectory traj;
+    mt19937 rng(42);
+    normal_distribution<double> yawNoise(0, 0.02), tNoise(0, 0.01);
+
+    double driftYaw = 0;
+    Vector3d driftT(0, 0, 0);
+    for (int i = 0; i < N; i++) {
+        double a = 2 * M_PI * i / perLap;
+        Vector3d t(50 * cos(a), 50 * sin(a), 10 + 2 * sin(3 * a));
+        Vector3d ypr(Utility::normalizeAngle(a * 180 / M_PI + 90), 2 * sin(a), 1.5 * cos(2 * a));
+        Matrix3d R = Utility::ypr2R(ypr);
+
+        // VIO: integrate the true motion with a random walk in yaw and translation
+        if (i > 0) {
+            driftYaw += yawNoise(rng);
+            driftT += Vector3d(tNoise(rng), tNoise(rng), tNoise(rng) * 0.2);
+        }
+        Matrix3d Rd = Utility::ypr2R(Vector3d(driftYaw, 0, 0));
+        traj.Rgt.push_back(R);
+        traj.tgt.push_back(t);
+        traj.Rvio.push_back(Rd * R);
+        traj.tvio.push_back(Rd * t + driftT);
+    }
+    return traj;
+}
+
+struct Result {
+    vector<double> msPerLoop;
+    double rmse = 0;
+    size_t maxWindow = 0;
+};
+
+Result Run(const Trajectory &traj, int perLap, int loopsPerLap, bool incremental) {
+    PoseGraph4DoF::Options options;
+    options.incremental = incremental;
+    PoseGraph4DoF graph(options);
+
+    Result result;
+    int N = traj.tgt.size();
+    int loopStride = max(1, perLap / loopsPerLap);
+    for (int i = 0; i < N; i++) {
+        graph.AddNode(traj.Rvio[i], traj.tvio[i]);
+        if (i < perLap || i % loopStride != 0)
+            continue;
+
+        // loop against the same place one lap ago, measured from the ground truth
+        int old = i - perLap;
+        Vector3d relT = traj.Rgt[old].transpose() * (traj.tgt[i] - traj.tgt[old]);
+        double relYaw = Utility::normalizeAngle(
+                Utility::R2ypr(traj.Rgt[i])[0] - Utility::R2ypr(traj.Rgt[old])[0]);
+        graph.AddLoopEdge(old, i, relT, relYaw);
+
+        PoseGraph4DoF::SolveStats stats;
+        auto t1 = chrono::steady_clock::now();
+        graph.Optimize(&stats);
+        auto t2 = chrono::steady_clock::now();
+        result.msPerLoop.push_back(chrono::duration_cast<chrono::duration<double, milli>>(t2 - t1).count());
+        result.maxWindow = max(result.maxWindow, stats.windowSize);
+        graph.TakeChanged();
+    }
+
+    // trajectory error, the first node is anchored so no alignment is needed
+    double se = 0;
+    for (int i = 0; i < N; i++) {
+        Matrix3d R;
+        Vector3d t;
+        graph.GetPose(i, R, t);
+        se += (t - traj.tgt[i]).squaredNorm();
+    }
+    result.rmse = sqrt(se / N);
+    return result;
+}
+
+void Report(const string &name, Result r) {
+    if (r.msPerLoop.empty()) {
+        cout << name << ": no loop events" << endl;
+        return;
+    }
+    double sum = 0;
+    for (double ms: r.msPerLoop)
+        sum += ms;
+    sort(r.msPerLoop.begin(), r.msPerLoop.end());
+    cout << name << ": " << r.msPerLoop.size() << " loop events"
+         << ", mean " << sum / r.msPerLoop.size() << " ms"
+         << ", median " << r.msPerLoop[r.msPerLoop.size() / 2] << " ms"
+         << ", max " << r.msPerLoop.back() << " ms"
+         << ", total " << sum / 1000 << " s"
+         << ", largest window " << r.maxWindow
+         << ", rmse " << r.rmse << " m" << endl;
+}
+
+int main(int argc, char **argv) {
+    int N = argc > 1 ? atoi(argv[1]) : 9000;
+    int perLap = argc > 2 ? atoi(argv[2]) : 600;
+    int loopsPerLap = argc > 3 ? atoi(argv[3]) : 4;
+    if (N <= perLap || perLap <= 0 || loopsPerLap <= 0) {
+        cerr << "Usage: PoseGraphBenchmark [num_keyframes] [keyframes_per_lap] [loops_per_lap]" << endl;
+        return 1;
+    }
+
+    cout << "keyframes: " << N << ", keyframes per lap: " << perLap << ", loops per lap: " << loopsPerLap << endl;
+    Trajectory traj = MakeTrajectory(N, perLap);
+
+    double vioSe = 0;
+    for (int i = 0; i < N; i++)
+        vioSe += (traj.tvio[i] - traj.tgt[i]).squaredNorm();
+    cout << "vio rmse " << sqrt(vioSe / N) << " m" << endl;
+
+    Report("full re-solve", Run(traj, perLap, loopsPerLap, false));
+    Report("incremental  ", Run(traj, perLap, loopsPerLap, true));
+    return 0;
+}
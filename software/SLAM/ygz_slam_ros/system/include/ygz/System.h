@@ -59,6 +59,9 @@ namespace ygz {
         shared_ptr<Viewer> mpViewer = nullptr;
         
         SE3d mCurrentPose;
+
+    private:
+        string mTraceOutput;        // Chrome trace written on Shutdown() when Trace.Enable is set
     };
 
 }
@@ -3,6 +3,7 @@
 #include "ygz/Tracker.h"
 #include "ygz/BackendSlidingWindowG2O.h"
 #include "ygz/LoopClosing.h"
+#include "ygz/Trace.h"
 
 namespace ygz {
 
@@ -33,6 +34,19 @@ namespace ygz {
 
         shared_ptr<CameraParam> camera(new CameraParam(fx, fy, cx, cy, bf));
 
+        // timing zones, see Trace.h
+        if (string(fsSettings["Trace.Enable"]) == "true") {
+            int bufferSize = fsSettings["Trace.BufferSize"];
+            if (bufferSize > 0)
+                trace::SetBufferSize(bufferSize);
+            mTraceOutput = string(fsSettings["Trace.Output"]);
+            if (mTraceOutput.empty())
+                mTraceOutput = "ygz_trace.json";
+            trace::SetThreadName("Tracker");
+            trace::Enable(true);
+            LOG(INFO) << "Tracing enabled, the trace will be written to " << mTraceOutput << endl;
+        }
+
         // create a tracker
         mpTracker = shared_ptr<TrackerLK>(new TrackerLK(configPath));
         mpTracker->SetCamera(camera);
@@ -56,6 +70,7 @@ namespace ygz {
         {
             mpViewer = shared_ptr<Viewer>(new Viewer(true, displayMapPoints));
             mpTracker->SetViewer(mpViewer);
+            mpBackend->SetViewer(mpViewer);
         }
         
         //loopClosing instance related
@@ -96,6 +111,16 @@ namespace ygz {
     void System::Shutdown() {
         LOG(INFO) << "System shutdown" << endl;
         mpBackend->Shutdown();
+        if (trace::Enabled()) {
+            trace::Enable(false);
+            stringstream ss;
+            trace::PrintStats(ss);
+            LOG(INFO) << "Timing zones:\n" << ss.str();
+            if (trace::ExportChromeTrace(mTraceOutput))
+                LOG(INFO) << "Trace written to " << mTraceOutput << endl;
+            else
+                LOG(WARNING) << "Cannot write trace to " << mTraceOutput << endl;
+        }
         if (mpViewer) {
             LOG(INFO) << "Please close the GUI to shutdown all the system" << endl;
             mpViewer->WaitToFinish();
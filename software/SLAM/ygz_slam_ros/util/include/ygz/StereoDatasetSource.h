@@ -0,0 +1,108 @@
+#ifndef YGZ_STEREO_DATASET_SOURCE_H
+#define YGZ_STEREO_DATASET_SOURCE_H
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/persistence.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// 多线程预读取的双目数据集读取器
+// Stereo dataset source with background decoding, used by the EuRoC and KITTI examples
+
+namespace ygz {
+
+    /**
+     * Decodes (and optionally rectifies) the stereo images of a dataset on N worker threads,
+     * ahead of the tracker. Frames are handed out strictly in order through a bounded queue,
+     * so memory stays at queueSize stereo pairs no matter how fast the workers are.
+     *
+     * Usage:
+     *   StereoDatasetSource source(vstrImageLeft, vstrImageRight, vTimeStamp, options);
+     *   source.SetRectification(M1l, M2l, M1r, M2r);   // optional
+     *   source.Start();
+     *   StereoDatasetSource::StereoFrame frame;
+     *   while (source.Next(frame)) { ... }
+     */
+    class StereoDatasetSource {
+
+    public:
+        struct Options {
+            int numThreads = 2;             // decode threads
+            size_t queueSize = 8;           // stereo pairs decoded ahead of the consumer
+            int imreadFlags = -1;           // cv::imread flags, -1 is CV_LOAD_IMAGE_UNCHANGED
+            bool realTime = false;          // replay at the dataset rate instead of as fast as possible
+            double playbackRate = 1.0;      // speed factor when realTime is set
+        };
+
+        struct StereoFrame {
+            size_t index = 0;
+            double timestamp = 0;
+            cv::Mat left, right;            // empty if the image could not be loaded
+        };
+
+        /**
+         * read the options from the config file, missing keys keep their defaults
+         * Dataset.DecodeThreads, Dataset.QueueSize, Dataset.RealTime ("true"/"false"), Dataset.PlaybackRate
+         */
+        static Options LoadOptions(const cv::FileStorage &fsSettings);
+
+        StereoDatasetSource(const vector<string> &imageLeft, const vector<string> &imageRight,
+                            const vector<double> &timestamps, const Options &options);
+
+        ~StereoDatasetSource();
+
+        // rectify the images in the decode threads with cv::remap, call before Start()
+        void SetRectification(const cv::Mat &M1l, const cv::Mat &M2l, const cv::Mat &M1r, const cv::Mat &M2r);
+
+        // start the decode threads
+        void Start();
+
+        // next frame in dataset order, blocks until it is decoded; false at the end of the dataset
+        bool Next(StereoFrame &frame);
+
+        // stop the decode threads, frames not yet handed out are dropped
+        void Stop();
+
+        size_t Size() const { return mTimestamps.size(); }
+
+    private:
+        struct Slot {
+            StereoFrame frame;
+            bool ready = false;
+        };
+
+        void DecodeLoop();
+
+        void Decode(size_t index, StereoFrame &frame);
+
+        vector<string> mImageLeft, mImageRight;
+        vector<double> mTimestamps;
+        Options mOptions;
+
+        bool mRectify = false;
+        cv::Mat mM1l, mM2l, mM1r, mM2r;
+
+        mutex mMutex;
+        condition_variable mCondSpace;      // workers wait for a free slot
+        condition_variable mCondReady;      // consumer waits for the next frame
+        vector<Slot> mSlots;                // ring buffer, frame i lives in slot i % queueSize
+        size_t mNextToDecode = 0;
+        size_t mNextToDeliver = 0;
+        bool mStop = false;
+        vector<thread> mThreads;
+
+        // real-time replay
+        bool mClockStarted = false;
+        chrono::steady_clock::time_point mWallStart;
+        double mDataStart = 0;
+    };
+}
+
+#endif
@@ -14,6 +14,8 @@ using namespace std;
 // 可视化程序
 // 构造后默认调用Run，用AddFrame增加新的帧，用Close关闭
 // 或者，用SetBackend关联到后端，那么就仅画出current和后端所有关键帧、地图点
+// AddFrame/SetCurrentFrame/PublishMap 在SLAM线程里生成渲染快照，渲染线程只读快照，不碰Frame和MapPoint的锁
+// The SLAM threads publish render snapshots, the render thread never takes mMutexPose / mMutexFeature
 
 // NOTE MacOS 在创建GUI线程的时候会出现bug，不知道该如何修复
 
@@ -24,6 +26,50 @@ namespace ygz {
 
     class BackendInterface;
 
+    // 渲染快照，发布后不再修改
+    // A compact, immutable copy of what the viewer draws, swapped atomically by the publishers
+    struct RenderSnapshot {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+
+        struct FrameState {
+            EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+            Matrix4d Twc = Matrix4d::Identity();
+            Vector3d Ow = Vector3d::Zero();
+            Vector3d refOw = Vector3d::Zero();      // origin of the reference keyframe
+            bool hasRef = false;
+            Matrix4d TwbGT = Matrix4d::Identity();  // ground truth pose
+        };
+
+        struct PointState {
+            Vector3d pos;
+            Vector3d refOw;                         // origin of the reference keyframe
+            bool hasRef;
+            uchar gray;
+            bool immature;
+        };
+
+        struct FeatureState {
+            Vector2f pixel;
+            float invDepth;
+            bool immature;
+        };
+
+        typedef std::vector<FrameState, Eigen::aligned_allocator<FrameState>> FrameArray;
+        typedef std::vector<PointState, Eigen::aligned_allocator<PointState>> PointArray;
+
+        long id = 0;                                // increases with every publish
+        bool hasCurrent = false;
+        FrameState current;
+        double timestamp = 0;
+        Vector6d bias = Vector6d::Zero();           // bg, ba
+        cv::Mat image;                              // left image of the current frame, shared not copied
+        std::vector<FeatureState, Eigen::aligned_allocator<FeatureState>> features;
+
+        // keyframes and points are only rebuilt on keyframes, normal frames share them
+        shared_ptr<const FrameArray> keyframes;
+        shared_ptr<const PointArray> points;
+    };
+
     class Viewer {
     public:
         EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
@@ -32,12 +78,15 @@ namespace ygz {
 
         ~Viewer();
 
-        // 增加一个KeyFrame，将显示该帧的pose和关联的地图点，且将当前帧设为该帧
+        // 增加一个KeyFrame，且将当前帧设为该帧。该帧的pose和关联的地图点在下一次PublishMap时显示
         void AddFrame(shared_ptr<Frame> frame, bool setToCurrent = true);
 
         // set a new current frame
         void SetCurrentFrame(shared_ptr<Frame> frame);
 
+        // re-read keyframe and map point positions, e.g. after the backend moved them
+        void PublishMap();
+
         // set tracking status
         void SetTrackStatus(int sta, int trackInliers);
 
@@ -81,18 +130,22 @@ namespace ygz {
         }
 
     private:
-        void DrawFrame(shared_ptr<Frame> frame, const Vector3d &color);
+        // 生成并发布快照，调用时需持有 mMutexNewFrame
+        // build and swap in a new snapshot, called by the SLAM threads with mMutexNewFrame held
+        void Publish(bool rebuildMap);
+
+        void DrawFrame(const RenderSnapshot::FrameState &frame, const Vector3d &color);
 
         void DrawOrigin();
 
-        void DrawPoints(const Vector3d &color);
+        void DrawPoints(const RenderSnapshot &snapshot);
 
         void DrawTrajectory();
 
-        void DrawTrajectoryGT();
+        void DrawTrajectoryGT(const RenderSnapshot &snapshot);
 
         // 以opengl的形式获取当前帧的Twb
-        pangolin::OpenGlMatrix GetCurrentGLPose();
+        pangolin::OpenGlMatrix GetCurrentGLPose(const RenderSnapshot &snapshot);
 
         // bias curve log
         pangolin::DataLog mBiasLog;
@@ -114,10 +167,10 @@ namespace ygz {
 
         bool mbRunning = false;         // 是否正在运行
         std::thread mViewerThread;   // 可视化程序线程
-        std::vector<weak_ptr<Frame>> mKeyFrames; // 需要显示的关键帧
-        std::set<weak_ptr<MapPoint>, std::owner_less<std::weak_ptr<MapPoint>>> mPoints; // 需要显示的地图点
-        shared_ptr<Frame> mCurrentFrame = nullptr; // 当前帧
-        VecVector3d mTrajectory;    // 历史轨迹
+        VecVector3d mTrajectory;    // 历史轨迹, render thread only
+
+        // 当前快照，用 atomic_load/atomic_store 交换
+        shared_ptr<const RenderSnapshot> mSnapshot = nullptr;
 
         map<double, Vector3d, std::less<double>, Eigen::aligned_allocator<Vector3d>> mGTTraj;   // 真实轨迹
 
@@ -125,9 +178,12 @@ namespace ygz {
         int mTrackState = -1;
         int mTrackInliers = -1;
 
+        // publisher side, only touched by the SLAM threads
         std::mutex mMutexNewFrame;       // 新加帧时上锁
-        shared_ptr<Frame> mpNewFrame =nullptr, mpNewCurrent = nullptr;
-        bool mbNewFrameUpdated = false;
+        std::vector<weak_ptr<Frame>> mKeyFrames; // 需要显示的关键帧
+        std::set<weak_ptr<MapPoint>, std::owner_less<std::weak_ptr<MapPoint>>> mPoints; // 需要显示的地图点
+        shared_ptr<Frame> mCurrentFrame = nullptr; // 当前帧
+        long mnSnapshotId = 0;
 
         // 选项
         bool mbShowConnection = false;  // 是否画出所有帧观测的地图点
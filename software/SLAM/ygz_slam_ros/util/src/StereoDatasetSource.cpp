@@ -0,0 +1,140 @@
+#include "ygz/StereoDatasetSource.h"
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+
+using namespace std;
+
+namespace ygz {
+
+    StereoDatasetSource::Options StereoDatasetSource::LoadOptions(const cv::FileStorage &fsSettings) {
+        Options options;
+        int threads = fsSettings["Dataset.DecodeThreads"];
+        int queueSize = fsSettings["Dataset.QueueSize"];
+        double rate = fsSettings["Dataset.PlaybackRate"];
+        if (threads > 0)
+            options.numThreads = threads;
+        if (queueSize > 0)
+            options.queueSize = queueSize;
+        if (rate > 0)
+            options.playbackRate = rate;
+        options.realTime = string(fsSettings["Dataset.RealTime"]) == "true";
+        return options;
+    }
+
+    StereoDatasetSource::StereoDatasetSource(const vector<string> &imageLeft, const vector<string> &imageRight,
+                                             const vector<double> &timestamps, const Options &options)
+            : mImageLeft(imageLeft), mImageRight(imageRight), mTimestamps(timestamps), mOptions(options) {
+        size_t n = min(mTimestamps.size(), min(mImageLeft.size(), mImageRight.size()));
+        mTimestamps.resize(n);
+        mOptions.numThreads = max(1, mOptions.numThreads);
+        mOptions.queueSize = max<size_t>(1, mOptions.queueSize);
+        mSlots.resize(mOptions.queueSize);
+    }
+
+    StereoDatasetSource::~StereoDatasetSource() {
+        Stop();
+    }
+
+    void StereoDatasetSource::SetRectification(const cv::Mat &M1l, const cv::Mat &M2l,
+                                               const cv::Mat &M1r, const cv::Mat &M2r) {
+        mM1l = M1l;
+        mM2l = M2l;
+        mM1r = M1r;
+        mM2r = M2r;
+        mRectify = !M1l.empty() && !M2l.empty() && !M1r.empty() && !M2r.empty();
+    }
+
+    void StereoDatasetSource::Start() {
+        if (!mThreads.empty())
+            return;
+        for (int i = 0; i < mOptions.numThreads; i++)
+            mThreads.push_back(thread(&StereoDatasetSource::DecodeLoop, this));
+    }
+
+    void StereoDatasetSource::Stop() {
+        {
+            unique_lock<mutex> lock(mMutex);
+            mStop = true;
+        }
+        mCondSpace.notify_all();
+        mCondReady.notify_all();
+        for (thread &t: mThreads)
+            t.join();
+        mThreads.clear();
+    }
+
+    void StereoDatasetSource::Decode(size_t index, StereoFrame &frame) {
+        frame.index = index;
+        frame.timestamp = mTimestamps[index];
+        cv::Mat left = cv::imread(mImageLeft[index], mOptions.imreadFlags);
+        cv::Mat right = cv::imread(mImageRight[index], mOptions.imreadFlags);
+        if (mRectify && !left.empty() && !right.empty()) {
+            cv::remap(left, frame.left, mM1l, mM2l, cv::INTER_LINEAR);
+            cv::remap(right, frame.right, mM1r, mM2r, cv::INTER_LINEAR);
+        } else {
+            frame.left = left;
+            frame.right = right;
+        }
+    }
+
+    void StereoDatasetSource::DecodeLoop() {
+        const size_t n = mTimestamps.size();
+        while (true) {
+            size_t index;
+            {
+                // wait until the frame we would decode next has a free slot
+                unique_lock<mutex> lock(mMutex);
+                mCondSpace.wait(lock, [&] {
+                    return mStop || mNextToDecode >= n || mNextToDecode < mNextToDeliver + mOptions.queueSize;
+                });
+                if (mStop || mNextToDecode >= n)
+                    return;
+                index = mNextToDecode++;
+            }
+
+            StereoFrame frame;
+            Decode(index, frame);
+
+            {
+                unique_lock<mutex> lock(mMutex);
+                Slot &slot = mSlots[index % mOptions.queueSize];
+                slot.frame = frame;
+                slot.ready = true;
+            }
+            mCondReady.notify_all();
+        }
+    }
+
+    bool StereoDatasetSource::Next(StereoFrame &frame) {
+        {
+            unique_lock<mutex> lock(mMutex);
+            if (mNextToDeliver >= mTimestamps.size())
+                return false;
+            Slot &slot = mSlots[mNextToDeliver % mOptions.queueSize];
+            mCondReady.wait(lock, [&] { return mStop || slot.ready; });
+            if (mStop)
+                return false;
+            frame = slot.frame;
+            slot.frame = StereoFrame();
+            slot.ready = false;
+            mNextToDeliver++;
+        }
+        mCondSpace.notify_all();
+
+        // pace the consumer by the dataset timestamps
+        if (mOptions.realTime) {
+            if (!mClockStarted) {
+                mWallStart = chrono::steady_clock::now();
+                mDataStart = frame.timestamp;
+                mClockStarted = true;
+            }
+            double elapsed = (frame.timestamp - mDataStart) / mOptions.playbackRate;
+            this_thread::sleep_until(mWallStart + chrono::duration_cast<chrono::steady_clock::duration>(
+                    chrono::duration<double>(elapsed)));
+        }
+        return true;
+    }
+}
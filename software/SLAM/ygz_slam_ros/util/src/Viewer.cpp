@@ -12,6 +12,22 @@
 
 namespace ygz {
 
+    namespace {
+        // 在发布线程上读取帧的状态 (会上 mMutexPose)
+        RenderSnapshot::FrameState CaptureFrame(const shared_ptr<Frame> &frame) {
+            RenderSnapshot::FrameState state;
+            state.Ow = frame->Ow();
+            state.Twc = SE3d(frame->Rwc(), state.Ow).matrix();
+            shared_ptr<Frame> ref = frame->mpReferenceKF.lock();
+            if (ref) {
+                state.refOw = ref->Ow();
+                state.hasRef = true;
+            }
+            state.TwbGT = frame->GetPoseGT().matrix();
+            return state;
+        }
+    }
+
     Viewer::Viewer(bool startViewer, bool displayMapPoints)
     {
 
@@ -103,36 +119,18 @@ namespace ygz {
         pangolin::Var<int> nTrackFeats("ui.TrackInliers", 0);
         pangolin::Var<int> nTrackState("ui.TrackState", 0);
 
-        while (!pangolin::ShouldQuit() && mbRunning) {
-
-            if (mbNewFrameUpdated)
-            {
+        long lastSnapshotId = -1;
+        double preFrameTime = -1;
 
-                {
-                    unique_lock<mutex> lock(mMutexNewFrame);
-                    mCurrentFrame = mpNewCurrent;
-                    mKeyFrames.push_back(mpNewFrame);
-                    mbNewFrameUpdated = false;
-                }
-
-                for (shared_ptr<Feature> feat: mCurrentFrame->mFeaturesLeft)
-                {
-                    if (feat == nullptr)
-                        continue;
-                    
-                    if (mDipalyMapPoints)
-                    {
-                        if (feat->mpPoint && feat->mpPoint->isBad() == false)
-                            mPoints.insert(feat->mpPoint);
-                    }
-
-                }
-
-                if (mbRecordTrajectory)
-                {
-                    mTrajectory.push_back(mCurrentFrame->Ow());
-                }
+        while (!pangolin::ShouldQuit() && mbRunning) {
 
+            // 取最新的快照，之后只读快照
+            shared_ptr<const RenderSnapshot> snapshot = atomic_load(&mSnapshot);
+            bool newSnapshot = snapshot && snapshot->id != lastSnapshotId;
+            if (newSnapshot) {
+                lastSnapshotId = snapshot->id;
+                if (mbRecordTrajectory && snapshot->hasCurrent)
+                    mTrajectory.push_back(snapshot->current.Ow);
             }
 
             // Clear entire screen
@@ -144,70 +142,56 @@ namespace ygz {
 
             DrawOrigin();
 
-            if (mCurrentFrame) {
+            if (snapshot && snapshot->hasCurrent) {
 
                 // make the camera follow current frame
-                auto Twc = GetCurrentGLPose();
+                auto Twc = GetCurrentGLPose(*snapshot);
                 Visualization3D_camera.Follow(Twc);
                 Visualization3D_display.Activate(Visualization3D_camera);
-
-                // draw current frame
-                // 红的是Current
-                DrawFrame(mCurrentFrame, Vector3d(1, 0, 0));
             }
 
             // 否则，显示自己记录的内容
             // other frames
-            if (!mKeyFrames.empty()) {
-                for (weak_ptr<Frame> frame : mKeyFrames) {
-                    if (frame.expired())
-                        continue;
-                    shared_ptr<Frame> f = frame.lock();
-                    if (f == mCurrentFrame)
-                        continue;
+            if (snapshot && snapshot->keyframes) {
+                for (const RenderSnapshot::FrameState &frame: *snapshot->keyframes) {
                     // 蓝的是其他Frame
-                    DrawFrame(f, Vector3d(0, 0, 1));
+                    DrawFrame(frame, Vector3d(0, 0, 1));
                 }
             }
+
+            // draw current frame after the keyframes, it may be one of them
+            // 红的是Current
+            if (snapshot && snapshot->hasCurrent)
+                DrawFrame(snapshot->current, Vector3d(1, 0, 0));
+
             // all points
-            DrawPoints(Vector3d(0, 1, 0));
+            if (snapshot)
+                DrawPoints(*snapshot);
 
             if (mbRecordTrajectory) {
                 DrawTrajectory();
             }
 
-            if (mbShowTrajGT)
-                DrawTrajectoryGT();
+            if (mbShowTrajGT && snapshot)
+                DrawTrajectoryGT(*snapshot);
 
             // show image
-            if (mCurrentFrame && mbShowCurrentImg) {
+            if (snapshot && snapshot->hasCurrent && mbShowCurrentImg && newSnapshot) {
                 cv::Mat im = DrawImage();
-                imshow("image",im);
-                cv::waitKey(1);
-                /*
-                texVideo.Upload(im.data, GL_BGR, GL_UNSIGNED_BYTE);
-                d_video.Activate();
-                glColor3f(1.0f, 1.0f, 1.0f);
-                texVideo.RenderToViewportFlipY();
-                Visualization3D_display.Activate();
-                 */
+                if (!im.empty())
+                    imshow("image",im);
             }
+            if (mbShowCurrentImg)
+                cv::waitKey(1);
 
             // draw bias curve
-            if (mCurrentFrame) {
-                static double preFrameTime = -1;
-                if (mCurrentFrame->mTimeStamp != preFrameTime) {
-                    preFrameTime = mCurrentFrame->mTimeStamp;
-                    plotter_biascurve.Activate();
-                    Vector6d bias;
-                    bias.head<3>() = mCurrentFrame->BiasG();
-                    bias.tail<3>() = mCurrentFrame->BiasA();
-                    mBiasLog.Log(bias);
-                    Visualization3D_display.Activate();
-                }
+            if (newSnapshot && snapshot->hasCurrent && snapshot->timestamp != preFrameTime) {
+                preFrameTime = snapshot->timestamp;
+                plotter_biascurve.Activate();
+                mBiasLog.Log(snapshot->bias);
+                Visualization3D_display.Activate();
             }
 
-
             // show status and track points
             {
                 unique_lock<mutex> lk(mMutexTrackerStatus);
@@ -227,17 +211,102 @@ namespace ygz {
     void Viewer::AddFrame(shared_ptr<Frame> frame, bool setToCurrent) {
 
         unique_lock<mutex> lock(mMutexNewFrame);
-        mpNewFrame = frame;
+        mKeyFrames.push_back(frame);
         if (setToCurrent)
-            mpNewCurrent = frame;
-        mbNewFrameUpdated = true;
-
+            mCurrentFrame = frame;
+        // 只发布当前帧，关键帧和地图点由后端在局部BA之后通过PublishMap发布
+        Publish(false);
     }
 
     void Viewer::SetCurrentFrame(shared_ptr<Frame> frame) {
         unique_lock<mutex> lock(mMutexNewFrame);
-        mpNewCurrent = frame;
-        mbNewFrameUpdated = true;
+        mCurrentFrame = frame;
+        Publish(false);
+    }
+
+    void Viewer::PublishMap() {
+        unique_lock<mutex> lock(mMutexNewFrame);
+        Publish(true);
+    }
+
+    void Viewer::Publish(bool rebuildMap) {
+
+        shared_ptr<const RenderSnapshot> last = atomic_load(&mSnapshot);
+        shared_ptr<RenderSnapshot> snapshot(new RenderSnapshot);
+        snapshot->id = ++mnSnapshotId;
+
+        if (mCurrentFrame) {
+            shared_ptr<Frame> f = mCurrentFrame;
+            snapshot->hasCurrent = true;
+            snapshot->current = CaptureFrame(f);
+            snapshot->timestamp = f->mTimeStamp;
+            snapshot->bias.head<3>() = f->BiasG();
+            snapshot->bias.tail<3>() = f->BiasA();
+            snapshot->image = f->mImLeft;   // 图像创建后不再修改，共享数据即可
+
+            vector<shared_ptr<Feature>> features;
+            {
+                unique_lock<mutex> lockFeat(f->mMutexFeature);
+                features = f->mFeaturesLeft;
+            }
+            snapshot->features.reserve(features.size());
+            for (shared_ptr<Feature> feat: features) {
+                if (feat == nullptr)
+                    continue;
+                if (mDipalyMapPoints && feat->mpPoint && feat->mpPoint->isBad() == false)
+                    mPoints.insert(feat->mpPoint);
+                if (feat->mpPoint == nullptr)
+                    continue;
+                RenderSnapshot::FeatureState state;
+                state.pixel = feat->mPixel;
+                state.invDepth = feat->mfInvDepth;
+                state.immature = feat->mpPoint->Status() == MapPoint::IMMATURE;
+                snapshot->features.push_back(state);
+            }
+        }
+
+        if (rebuildMap || last == nullptr) {
+            // 关键帧和地图点，仅在关键帧到来或后端更新时重新读取
+            shared_ptr<RenderSnapshot::FrameArray> keyframes = make_shared<RenderSnapshot::FrameArray>();
+            keyframes->reserve(mKeyFrames.size());
+            for (auto iter = mKeyFrames.begin(); iter != mKeyFrames.end();) {
+                shared_ptr<Frame> f = iter->lock();
+                if (f == nullptr) {
+                    iter = mKeyFrames.erase(iter);
+                    continue;
+                }
+                keyframes->push_back(CaptureFrame(f));
+                iter++;
+            }
+
+            shared_ptr<RenderSnapshot::PointArray> points = make_shared<RenderSnapshot::PointArray>();
+            points->reserve(mPoints.size());
+            for (auto iter = mPoints.begin(); iter != mPoints.end();) {
+                shared_ptr<MapPoint> mp = iter->lock();
+                if (mp == nullptr) {
+                    iter = mPoints.erase(iter);
+                    continue;
+                }
+                RenderSnapshot::PointState state;
+                state.pos = mp->GetWorldPos();
+                state.gray = mp->mGray;
+                state.immature = mp->Status() == MapPoint::IMMATURE;
+                shared_ptr<Frame> ref = mp->mpRefKF.lock();
+                state.hasRef = ref != nullptr;
+                if (ref)
+                    state.refOw = ref->Ow();
+                points->push_back(state);
+                iter++;
+            }
+
+            snapshot->keyframes = keyframes;
+            snapshot->points = points;
+        } else {
+            snapshot->keyframes = last->keyframes;
+            snapshot->points = last->points;
+        }
+
+        atomic_store(&mSnapshot, shared_ptr<const RenderSnapshot>(snapshot));
     }
 
     void Viewer::DrawOrigin() {
@@ -266,10 +335,9 @@ namespace ygz {
         glEnd();
     }
 
-    void Viewer::DrawFrame(shared_ptr<Frame> frame, const Vector3d &color) {
+    void Viewer::DrawFrame(const RenderSnapshot::FrameState &frame, const Vector3d &color) {
 
-        Sophus::SE3d Twc(frame->mRwc, frame->mOw);
-        Matrix4d m = Twc.matrix();
+        Matrix4d m = frame.Twc;
         float sz = setting::cameraSize;
 
         const float w = 1 * sz;
@@ -303,10 +371,10 @@ namespace ygz {
         glEnd();
         glPopMatrix();
 
-        if (frame->mpReferenceKF.expired() == false) {
+        if (frame.hasRef) {
             // 画出此Frame到它参考帧的连线
-            Vector3d Ow = frame->mOw;
-            Vector3d OwRef = frame->mpReferenceKF.lock()->mOw;
+            const Vector3d &Ow = frame.Ow;
+            const Vector3d &OwRef = frame.refOw;
             glBegin(GL_LINES);
             glVertex3d(Ow[0], Ow[1], Ow[2]);
             glVertex3d(OwRef[0], OwRef[1], OwRef[2]);
@@ -315,7 +383,7 @@ namespace ygz {
 
         if (mbShowKFGT) {
             glPushMatrix();
-            m = frame->GetPoseGT().matrix();
+            m = frame.TwbGT;
             m = m * setting::TBC.matrix();
             m = m.transpose();
             glMultMatrixd((GLdouble *) m.data());
@@ -343,29 +411,22 @@ namespace ygz {
         }
     }
 
-    void Viewer::DrawPoints(const Vector3d &color) {
-
-        glPointSize(4);
-        glColor3d(color[0], color[1], color[2]);
+    void Viewer::DrawPoints(const RenderSnapshot &snapshot) {
 
-        for (auto iter = mPoints.begin(); iter != mPoints.end();) {
+        if (snapshot.points == nullptr)
+            return;
 
-            if (iter->expired()) {
-                iter = mPoints.erase(iter);
-                continue;
-            }
+        glPointSize(4);
 
-            shared_ptr<MapPoint> mp = iter->lock();
-            if (mp == nullptr)
-                continue;
+        for (const RenderSnapshot::PointState &mp: *snapshot.points) {
 
             glBegin(GL_POINTS);
-            Vector3d pos = mp->GetWorldPos();
+            const Vector3d &pos = mp.pos;
 
-            if (mp->Status() == MapPoint::IMMATURE) {
+            if (mp.immature) {
                 glColor3d(1, 0, 0);     // immature 的画红色
             } else {
-                glColor3b(mp->mGray, mp->mGray, mp->mGray);
+                glColor3b(mp.gray, mp.gray, mp.gray);
                 // glColor3d(0, 1, 0);
             }
 
@@ -373,18 +434,15 @@ namespace ygz {
             glEnd();
 
             if (mbShowConnection) {
-                if (mp->mpRefKF.expired())
+                if (mp.hasRef == false)
                     continue;
-                shared_ptr<Frame> f = mp->mpRefKF.lock();
-                Vector3d ow = f->Ow();
+                const Vector3d &ow = mp.refOw;
                 glBegin(GL_LINES);
                 glLineWidth(1);
                 glVertex3d(ow[0], ow[1], ow[2]);
                 glVertex3d(pos[0], pos[1], pos[2]);
                 glEnd();
             }
-
-            iter++;
         }
     }
 
@@ -405,21 +463,16 @@ namespace ygz {
     }
 
     cv::Mat Viewer::DrawImage() {
-        if (mCurrentFrame == nullptr)
+        shared_ptr<const RenderSnapshot> snapshot = atomic_load(&mSnapshot);
+        if (snapshot == nullptr || snapshot->hasCurrent == false || snapshot->image.empty())
             return Mat();
 
-        shared_ptr<Frame> f = mCurrentFrame;
-
         cv::Mat im;
-        cv::cvtColor(f->mImLeft, im, CV_GRAY2BGR);
-
-        for (shared_ptr<Feature> feat: f->mFeaturesLeft) {
-            if (feat == nullptr)
-                continue;
-            if (feat->mpPoint == nullptr)
-                continue;
-            if (feat->mpPoint->Status() == MapPoint::IMMATURE) {
-                cv::Point2f pt(feat->mPixel[0], feat->mPixel[1]);
+        cv::cvtColor(snapshot->image, im, CV_GRAY2BGR);
+
+        for (const RenderSnapshot::FeatureState &feat: snapshot->features) {
+            if (feat.immature) {
+                cv::Point2f pt(feat.pixel[0], feat.pixel[1]);
                 cv::Point2f pt1, pt2;
                 pt1.x = pt.x - 2;
                 pt1.y = pt.y - 2;
@@ -428,8 +481,8 @@ namespace ygz {
                 cv::rectangle(im, pt1, pt2, cv::Scalar(255, 0, 255), -1);
             } else {
                 // 有深度，用彩色表示
-                Vector3f color = MakeRedGreen3B(feat->mfInvDepth);
-                cv::Point2f pt(feat->mPixel[0], feat->mPixel[1]);
+                Vector3f color = MakeRedGreen3B(feat.invDepth);
+                cv::Point2f pt(feat.pixel[0], feat.pixel[1]);
                 cv::Point2f pt1, pt2;
                 pt1.x = pt.x - 2;
                 pt1.y = pt.y - 2;
@@ -442,16 +495,15 @@ namespace ygz {
         return im;
     }
 
-    pangolin::OpenGlMatrix Viewer::GetCurrentGLPose() {
-        if (mCurrentFrame == nullptr) {
+    pangolin::OpenGlMatrix Viewer::GetCurrentGLPose(const RenderSnapshot &snapshot) {
+        if (snapshot.hasCurrent == false) {
             pangolin::OpenGlMatrix m;
             m.SetIdentity();
             return m;
         }
 
-        shared_ptr<Frame> f = mCurrentFrame;
         pangolin::OpenGlMatrix M;
-        Matrix4d Twc = SE3d(f->mRwc, f->mOw).matrix();
+        const Matrix4d &Twc = snapshot.current.Twc;
 
         M.m[0] = Twc(0, 0);
         M.m[1] = Twc(1, 0);
@@ -475,11 +527,11 @@ namespace ygz {
         return M;
     }
 
-    void Viewer::DrawTrajectoryGT() {
+    void Viewer::DrawTrajectoryGT(const RenderSnapshot &snapshot) {
 
         if (mGTTraj.size() < 1)
             return;
-        if (mCurrentFrame == nullptr)
+        if (snapshot.hasCurrent == false)
             return;
 
         glLineWidth(2);
@@ -489,7 +541,7 @@ namespace ygz {
         auto iter = mGTTraj.begin(), iterNext = mGTTraj.begin();
         iterNext++;
         for (; iterNext != mGTTraj.end(); iter++, iterNext++) {
-            if (iter->first < mCurrentFrame->mTimeStamp) {
+            if (iter->first < snapshot.timestamp) {
                 Vector3d t1 = iter->second;
                 Vector3d t2 = iterNext->second;
                 // glVertex3d(-t1[1], -t1[2], t1[0]);